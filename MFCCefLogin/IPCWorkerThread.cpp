@@ -80,7 +80,7 @@ CefRefPtr<CefBrowser> CIPCWorkerThread::getBrowser()
 // this code executes in the CEF Login app browser exe.  Not the renderer exe
 int CIPCWorkerThread::Process()
 {
-    int nSleepInterval = 100;
+    unsigned int nSleepInterval = 600;   // seconds; idle we wake once per interval, a message rings us sooner
 #ifdef _DEBUG
     int nPingCnt = 0;
     int nSendCnt = 0;
@@ -175,13 +175,16 @@ int CIPCWorkerThread::Process()
         }
 #endif
         _TRACE("***start timer");
-        nSleepInterval = 600;
-        boost::posix_time::ptime t1 =
-                boost::posix_time::second_clock::universal_time() + boost::posix_time::seconds(nSleepInterval);
-        bool bResult = getSharedMemManager().getClientMutex()->timed_lock(t1);
+        bool bResult = getSharedMemManager().waitMessage(MYADDRESS, nSleepInterval * 1000);
         _TRACE("*** End Timer bResult=%s", (bResult ? "true" : "false"));
     }
 
+    CShmRing::Stats stats;
+    if (getSharedMemManager().getStats(MYADDRESS, stats))
+        _TRACE("IPC %s: %u sent, %u received, %u dropped, %u stale, latency avg %llu us max %llu us", MYADDRESS,
+               stats.sent, stats.received, stats.dropped, stats.stale,
+               (unsigned long long)stats.latencyAvgUs, (unsigned long long)stats.latencyMaxUs);
+
     return 0;
 }
 
@@ -214,7 +217,7 @@ bool CIPCWorkerThread::Stop()
 {
     _TRACE("Stopping worker thread");
     setStopFlag(true);
-    getSharedMemManager().getClientMutex()->unlock();
+    getSharedMemManager().notify(MYADDRESS);
     return true;
 }
 
@@ -226,7 +229,7 @@ bool CIPCWorkerThread::End()
 {
     _TRACE("Ending worker thread");
     setStopFlag(true);
-    getSharedMemManager().getClientMutex()->unlock();
+    getSharedMemManager().notify(MYADDRESS);
     m_pThread->join();
 
     return true;
@@ -0,0 +1,186 @@
+/*
+ * Copyright (c) 2013-2021 MFCXY, Inc. <mfcxy@mfcxy.com>
+ * Copyright (c) 2020 The WebRTC project authors. All Rights Reserved.
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "AbrController.h"
+#include "ScaleSteps.h"
+
+#include <algorithm>
+#include <cstring>
+
+// VideoTrackSource's REQUIRED_ALIGNMENT, a sink asking for more only rounds a rung down further
+static const int LADDER_ALIGNMENT = 2;
+
+
+AbrController::AbrController(const Config& cfg)
+    : m_cfg(cfg)
+    , m_fHaveLast(false)
+    , m_last()
+    , m_nLastDecreaseMs(0)
+    , m_nLastRungMs(0)
+    , m_nBaseRttMs(0)
+    , m_dLastLoss(0.0)
+    , m_dLossSum(0.0)
+{
+    m_cfg.nMaxBitrateKbps   = std::max(m_cfg.nMaxBitrateKbps, 1);
+    m_cfg.nMinBitrateKbps   = std::min(std::max(m_cfg.nMinBitrateKbps, 1), m_cfg.nMaxBitrateKbps);
+    m_cfg.nMaxFps           = std::max(m_cfg.nMaxFps, 1);
+    m_cfg.nMinFps           = std::min(std::max(m_cfg.nMinFps, 1), m_cfg.nMaxFps);
+    m_cfg.nIntervalMs       = std::max(m_cfg.nIntervalMs, 100);
+
+    // Resolution steps first, the sizes VideoTrackSource::AdaptResolution produces,
+    // then frame rate steps at the smallest size
+    m_vLadder.push_back({ m_cfg.nMaxWidth, m_cfg.nMaxHeight, m_cfg.nMaxFps });
+    for (int step = 1; step < ScaleSteps::MAX_STEPS; step++)
+    {
+        ScaleSteps::Size size = ScaleSteps::stepSize(m_cfg.nMaxWidth, m_cfg.nMaxHeight, step, LADDER_ALIGNMENT);
+        if (size.nHeight < m_cfg.nMinHeight)
+            break;
+        m_vLadder.push_back({ size.nWidth, size.nHeight, m_cfg.nMaxFps });
+
+        // the source's pixel limit stops here, smaller steps can't be selected
+        if (size.pixels() <= ScaleSteps::MIN_PIXELS)
+            break;
+    }
+
+    Rung rung = m_vLadder.back();
+    while (rung.nFps > m_cfg.nMinFps)
+    {
+        rung.nFps = std::max(rung.nFps * 2 / 3, m_cfg.nMinFps);
+        m_vLadder.push_back(rung);
+    }
+
+    m_target.nBitrateKbps   = m_cfg.nMaxBitrateKbps;
+    m_target.nRung          = 0;
+    m_target.rung           = m_vLadder[0];
+
+    memset(&m_stats, 0, sizeof(m_stats));
+    m_stats.minBitrateKbps = m_target.nBitrateKbps;
+}
+
+
+double AbrController::bppRatio(int nRung, int nBitrateKbps) const
+{
+    const Rung& full = m_vLadder[0];
+    const Rung& rung = m_vLadder[nRung];
+
+    // (bitrate / pixel rate) / (ceiling / full pixel rate)
+    return ((double)nBitrateKbps / m_cfg.nMaxBitrateKbps)
+         * ((double)full.nWidth * full.nHeight * full.nFps)
+         / ((double)rung.nWidth * rung.nHeight * rung.nFps);
+}
+
+
+bool AbrController::update(const Sample& sample)
+{
+    if (!m_fHaveLast)
+    {
+        m_last = sample;
+        m_fHaveLast = true;
+        m_nLastDecreaseMs = m_nLastRungMs = sample.nTimeMs;
+        return false;
+    }
+
+    // Stats come in about once a second with some jitter, don't skip one that's a bit early
+    if (sample.nTimeMs - m_last.nTimeMs < m_cfg.nIntervalMs * 9 / 10)
+        return false;
+
+    const int64_t nNowMs = sample.nTimeMs;
+    const int64_t nSent  = (int64_t)(sample.nPacketsSent - m_last.nPacketsSent);
+    const int64_t nLost  = std::max(sample.nPacketsLost - m_last.nPacketsLost, (int64_t)0);
+    const int64_t nNacks = (int64_t)sample.nNacks - (int64_t)m_last.nNacks;
+
+    double dLoss = 0.0;
+    if (nSent > 0)
+        dLoss = std::min(std::max((double)nLost, (double)std::max(nNacks, (int64_t)0)) / nSent, 1.0);
+
+    if (sample.nRttMs > 0)
+    {
+        // Lowest RTT seen, creeping up 1/64 of the gap per interval
+        if (m_nBaseRttMs == 0 || sample.nRttMs < m_nBaseRttMs)
+            m_nBaseRttMs = sample.nRttMs;
+        else
+            m_nBaseRttMs += (sample.nRttMs - m_nBaseRttMs + 63) / 64;
+    }
+
+    const bool fQueueing  = sample.nRttMs > 0 && sample.nRttMs > m_nBaseRttMs + m_cfg.nRttRiseMs;
+    const bool fCongested = dLoss > m_cfg.dLossHigh || fQueueing;
+    const bool fClear     = dLoss < m_cfg.dLossLow && (sample.nRttMs <= 0 || sample.nRttMs <= m_nBaseRttMs + m_cfg.nRttRiseMs / 2);
+
+    m_stats.intervals++;
+    m_stats.plis += sample.nPlis >= m_last.nPlis ? sample.nPlis - m_last.nPlis : 0;
+    m_dLossSum += dLoss;
+    m_dLastLoss = dLoss;
+    m_last = sample;
+
+    int nBitrate = m_target.nBitrateKbps;
+    if (fCongested)
+    {
+        m_stats.congested++;
+
+        // Down from what actually got through, the target may be well above it
+        int nRef = sample.nSendKbps > 0 ? std::min(nBitrate, (int)(sample.nSendKbps * (1.0 - dLoss))) : nBitrate;
+        int nNew = std::max((int)(nRef * m_cfg.dDecrease), m_cfg.nMinBitrateKbps);
+        if (nNew < nBitrate)
+        {
+            nBitrate = nNew;
+            m_nLastDecreaseMs = nNowMs;
+            m_stats.decreases++;
+        }
+    }
+    else if (fClear && nNowMs - m_nLastDecreaseMs >= m_cfg.nHoldMs && nBitrate < m_cfg.nMaxBitrateKbps)
+    {
+        nBitrate = std::min((int)(nBitrate * m_cfg.dIncrease) + 1, m_cfg.nMaxBitrateKbps);
+        m_stats.increases++;
+    }
+
+    int nRung = m_target.nRung;
+    if (nNowMs - m_nLastRungMs >= m_cfg.nRungHoldMs)
+    {
+        if (nRung + 1 < (int)m_vLadder.size() && bppRatio(nRung, nBitrate) < m_cfg.dBppDown)
+        {
+            nRung++;
+            m_stats.rungDowns++;
+        }
+        else if (nRung > 0 && !fCongested && bppRatio(nRung - 1, nBitrate) >= m_cfg.dBppUp)
+        {
+            nRung--;
+            m_stats.rungUps++;
+        }
+    }
+
+    if (nBitrate == m_target.nBitrateKbps && nRung == m_target.nRung)
+        return false;
+
+    if (nRung != m_target.nRung)
+        m_nLastRungMs = nNowMs;
+
+    m_target.nBitrateKbps   = nBitrate;
+    m_target.nRung          = nRung;
+    m_target.rung           = m_vLadder[nRung];
+
+    m_stats.minBitrateKbps  = std::min(m_stats.minBitrateKbps, nBitrate);
+    m_stats.maxRung         = std::max(m_stats.maxRung, nRung);
+    return true;
+}
+
+
+AbrController::Stats AbrController::getStats(void) const
+{
+    Stats stats = m_stats;
+    stats.lossAvg = m_stats.intervals ? m_dLossSum / m_stats.intervals : 0.0;
+    return stats;
+}
@@ -0,0 +1,145 @@
+/*
+ * Copyright (c) 2013-2021 MFCXY, Inc. <mfcxy@mfcxy.com>
+ * Copyright (c) 2020 The WebRTC project authors. All Rights Reserved.
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#pragma once
+
+#ifndef ABR_CONTROLLER_H_
+#define ABR_CONTROLLER_H_
+
+#include <cstdint>
+#include <vector>
+
+
+// Closed loop bitrate, resolution and frame rate control from the sender's RTCP stats.
+//
+// update() takes the cumulative counters WebRTCStream collects in OnStatsDelivered and
+// acts once per interval (nIntervalMs) on the deltas since the last interval it acted
+// on. Congestion is either loss (the larger of the receiver reported loss and the NACK
+// rate) over dLossHigh, or an RTT more than nRttRiseMs above the baseline (the lowest
+// RTT seen, drifting slowly up so a route change doesn't pin it) which means queues
+// are building. Under congestion the bitrate drops to dDecrease of what got through
+// (the rate sent less the loss). The link is clear when loss is under dLossLow and the RTT is back near the
+// baseline; then, once nHoldMs have passed since the last decrease, the bitrate grows
+// by dIncrease per interval up to the ceiling. In between nothing changes.
+//
+// Resolution and frame rate follow the bitrate on a ladder of rungs: the full size,
+// then the 3/4, 2/3, ... ScaleSteps sizes VideoTrackSource scales to, down to nMinHeight
+// or the smallest step the source will pick, then frame rate steps of 2/3 down to nMinFps. The ladder is stepped on bits per pixel
+// relative to the full rung at the ceiling: down when the current rung is under
+// dBppDown of it, up when the rung above would be at least dBppUp, so a step never
+// lands right back at the other threshold. Rungs change at most every nRungHoldMs,
+// each one restarts the encoder with a keyframe.
+//
+// Not thread safe, WebRTCStream calls it under its stats mutex. Also built into
+// abrsim, which replays network traces through it.
+//
+class AbrController
+{
+public:
+    struct Config
+    {
+        int     nMinBitrateKbps = 300;
+        int     nMaxBitrateKbps = 2500;
+        int     nMaxWidth       = 1280;
+        int     nMaxHeight      = 720;
+        int     nMaxFps         = 30;
+        int     nMinHeight      = 360;
+        int     nMinFps         = 15;
+        int     nIntervalMs     = 1000;     // evaluation cadence
+        int     nHoldMs         = 4000;     // no increase for this long after a decrease
+        int     nRungHoldMs     = 8000;     // minimum time between rung changes
+        int     nRttRiseMs      = 150;      // RTT over the baseline that counts as queueing
+        double  dLossHigh       = 0.08;     // loss fraction that counts as congestion
+        double  dLossLow        = 0.02;     // loss fraction under which the link is clear
+        double  dDecrease       = 0.85;     // of the measured send rate
+        double  dIncrease       = 1.08;     // per clear interval
+        double  dBppDown        = 0.5;      // rung down under this fraction of the full rung's bits per pixel
+        double  dBppUp          = 0.7;      // rung up when the rung above gets at least this
+    };
+
+    // Cumulative counters as reported by the RTCStats, except the rates
+    struct Sample
+    {
+        int64_t     nTimeMs;
+        uint64_t    nPacketsSent;
+        int64_t     nPacketsLost;       // remote inbound, may go down on duplicates
+        uint32_t    nNacks;
+        uint32_t    nPlis;
+        int         nRttMs;             // 0 if not known yet
+        uint32_t    nSendKbps;          // video bitrate sent over the last stats period, 0 if unknown
+    };
+
+    struct Rung
+    {
+        int     nWidth;
+        int     nHeight;
+        int     nFps;
+    };
+
+    struct Target
+    {
+        int     nBitrateKbps;
+        int     nRung;
+        Rung    rung;
+    };
+
+    struct Stats
+    {
+        uint64_t    intervals;
+        uint64_t    congested;          // intervals with loss or queueing
+        uint64_t    decreases;
+        uint64_t    increases;
+        uint64_t    rungDowns;
+        uint64_t    rungUps;
+        uint64_t    plis;
+        int         minBitrateKbps;
+        int         maxRung;            // lowest rung reached, 0 is the full size
+        double      lossAvg;            // over all intervals
+    };
+
+    explicit AbrController(const Config& cfg);
+
+    // Feeds one stats sample, true if the target changed
+    bool update(const Sample& sample);
+
+    const Target& target(void) const { return m_target; }
+    const std::vector< Rung >& ladder(void) const { return m_vLadder; }
+
+    // Last interval's view of the link, for logging and the simulator
+    double lastLoss(void) const { return m_dLastLoss; }
+    int baseRttMs(void) const { return m_nBaseRttMs; }
+
+    Stats getStats(void) const;
+
+private:
+    double bppRatio(int nRung, int nBitrateKbps) const;
+
+    Config              m_cfg;
+    std::vector< Rung > m_vLadder;
+    Target              m_target;
+
+    bool                m_fHaveLast;
+    Sample              m_last;
+    int64_t             m_nLastDecreaseMs;
+    int64_t             m_nLastRungMs;
+    int                 m_nBaseRttMs;       // 0 until the first RTT
+    double              m_dLastLoss;
+
+    Stats               m_stats;
+    double              m_dLossSum;
+};
+
+#endif  // ABR_CONTROLLER_H_
@@ -75,12 +75,17 @@
 // solution
 #include <libfcs/fcs_b64.h>
 #include <libfcs/MfcTimer.h>
+#include <libfcs/MfcTrace.h>
 #include <libPlugins/build_version.h>
+#include <libPlugins/ChatServerSelector.h>
 #include <libPlugins/EdgeChatSock.h>
+#include <libPlugins/Executor.h>
 #include <libPlugins/IPCShared.h>
 #include <libPlugins/MFCConfigConstants.h>
 #include <libPlugins/ObsUtil.h>
+#include <libPlugins/PluginConfigWriter.h>
 #include <libPlugins/Portable.h>
+#include <libPlugins/TimerWheel.h>
 
 // project
 #include "SidekickTypes.h"
@@ -88,6 +93,7 @@
 #include "ObsBroadcast.h"
 #include "ObsCallbackEvent.h"
 #include "SidekickProperties.h"
+#include "X264Calibration.h"
 
 #define _SKLOG(pszFmt, ...) SKLogMarker(__FILE__, __FUNCTION__, __LINE__, pszFmt, ##__VA_ARGS__)
 
@@ -173,6 +179,15 @@ void onSidekickSetup(void* pCtx)
 }
 
 
+// Tools menu: throw the x264 calibration away and measure the configured output again
+void onRecalibrateEncoder(void* pCtx)
+{
+    UNUSED_PARAMETER(pCtx);
+    _MESG("x264 recalibration requested from the tools menu");
+    X264Calibration::instance().recalibrate();
+}
+
+
 // Event handler for browser panel unit test
 #if PANEL_UNIT_TEST
 void openBrowserPanelMenuHandler(void*)
@@ -252,8 +267,9 @@ bool obs_module_load(void)
 {
     Log::Setup( CObsUtil::getLogPath() );
     Log::AddOutputMask(MFC_LOG_LEVEL, MFC_LOG_OUTPUT_MASK);
+    Log::SetAsync(true);
+    Log::OpenBinLog( CObsUtil::AppendPath(CObsUtil::getLogPath(), BROADCAST_FILENAME ".blog") );
 
-    SidekickModelConfig::initializeDefaults();
     g_ctx.clear(false);
 
     _TRACE("%s OBS Plugin has been loaded", __progname);
@@ -263,6 +279,16 @@ bool obs_module_load(void)
     obs_frontend_add_event_callback(OBSFrontendEvent, nullptr);
 #endif
     loadServices();
+
+    // calibrates the last configured output in the background if it has no result yet
+    char* pszCalibration = obs_module_config_path("x264cal.json");
+    X264Calibration::instance().setFile(pszCalibration ? pszCalibration : "");
+    bfree(pszCalibration);
+    obs_frontend_add_tools_menu_item(obs_module_text("Recalibrate x264 Encoder"), onRecalibrateEncoder, nullptr);
+
+    // rank the chat servers in the background, so the first pick has a list to pick from
+    CChatServerSelector::instance().refresh(false);
+
     obs_register_output(&wowza_output_info);
     static SidekickTimer* s_pTimer = new SidekickTimer();
 
@@ -404,7 +430,7 @@ void ui_onUserUpdate(int nChange, uint32_t nCurUid, uint32_t nNewUid, uint32_t n
     std::string sUsername;
     {
         auto lk     = g_ctx.sharedLock();
-        sUsername   = g_ctx.cfg.getString("username");
+        sUsername   = g_ctx.cfg.getString(SkCfg::Username);
         isLoggedIn  = g_ctx.isLoggedIn;
         isWebRTC    = g_ctx.isWebRTC;
         isLinked    = g_ctx.isLinked;
@@ -545,140 +571,167 @@ void ui_onSetWebRtc(int nState)
 #endif
 
 
-void SidekickTimer::onTimerEvent()
+SidekickTimer::SidekickTimer()
+    : m_nProfileTimer(CTimerWheel::INVALID_TIMER)
+    , m_nLatencyTimer(CTimerWheel::INVALID_TIMER)
 {
-    static size_t s_nPulse = 0;
-    if (s_nPulse == 0)
-        setupSidekickUI();
+    CTimerWheel& wheel = CTimerWheel::instance();
 
-    if (CBroadcastCtx::sm_edgeSock)
-        CBroadcastCtx::sm_edgeSock->onTimerEvent(s_nPulse);
+    // UiThread timers are queued to us, the same way wakeUiThread() hops threads
+    wheel.setExecutor(CTimerWheel::UiThread, [this](std::function<void(void)> fn)
+    {
+        QMetaObject::invokeMethod(this, std::move(fn), Qt::QueuedConnection);
+    });
 
-#ifdef SIDEKICK_TIMER_EXAMPLE
-    // example for running an event only after at least 500ms elapsed
-    //
-    static struct timeval tvLastStateUpdate = { 0, 0 };
-    struct timeval tvNow;
-    uint64_t diffMicro;
-    gettimeofday(&tvNow, NULL);
-    if ((diffMicro = MfcTimer::DiffMicro(tvNow, tvLastStateUpdate)) > 500000)
+    // Normally events are delivered as soon as they are queued through the
+    // wakeup, the first pass only picks up anything queued before the wakeup was set.
+    wheel.addOneShot(0, [this]()
     {
-       // execute every 500ms timer/action ...
-       tvLastStateUpdate = tvNow;
-    }
-#endif
+        setupSidekickUI();
+        onUiEvents();
+    }, CTimerWheel::UiThread, "setupSidekickUI");
 
-    // Move any queued UI events out of g_ctx
-    std::deque<SIDEKICK_UI_EV> uiEvents;
+    m_nProfileTimer = wheel.addPeriodic(1500, [this]() { onProfileCheck(); }, CTimerWheel::UiThread, 0, "profileCheck");
+
+    m_nLatencyTimer = wheel.addPeriodic(1000, []()
     {
-        auto lk = g_ctx.eventLock();
-        g_ctx.sm_eventQueue.swap(uiEvents);
-    }
+        if (pMFCDock)
+            pMFCDock->updateLatency();
+    }, CTimerWheel::UiThread, 0, "dockLatency");
 
-    // Queued events are pushed onto the front of the deque, so the latest event will be read
-    // first as we iterate through in the normal forward direction. Any events that are meant to
-    // only be processed once per event cycle, we mark once processing that event and skip any
-    // other events found of the same type later in the iteration of the deque.
-    std::set<SidekickEventType> skipEvents;
-    for (auto iEvent = uiEvents.begin(); iEvent != uiEvents.end(); ++iEvent)
+    // UI events wake us up directly instead of waiting on the next timer tick
+    CBroadcastCtx::sm_events.setWakeup(&SidekickTimer::wakeUiThread, this);
+}
+
+
+SidekickTimer::~SidekickTimer()
+{
+    CBroadcastCtx::sm_events.setWakeup(nullptr, nullptr);
+
+    CTimerWheel::instance().cancel(m_nProfileTimer);
+    CTimerWheel::instance().cancel(m_nLatencyTimer);
+    CTimerWheel::instance().setExecutor(CTimerWheel::UiThread, nullptr);
+}
+
+
+void SidekickTimer::wakeUiThread(void* pCtx)
+{
+    // Called on the producer's thread, so hop to the UI thread with a queued call
+    QMetaObject::invokeMethod(static_cast<SidekickTimer*>(pCtx), "onUiEvents", Qt::QueuedConnection);
+}
+
+
+void SidekickTimer::onUiEvents()
+{
+    // Superseded state events (session, user, model state, etc) have already been
+    // dropped by the queue, so whatever is delivered here is the latest of its type.
+    CBroadcastCtx::sm_events.drain([](const SIDEKICK_UI_EV& ev)
     {
-        if (skipEvents.find(iEvent->ev) == skipEvents.end())
+        switch (ev.ev)
         {
-            switch (iEvent->ev)
-            {
-            case SkSessionId:
-                ui_onSessionUpdate(iEvent->dwArg1, iEvent->dwArg2, iEvent->dwArg3, iEvent->dwArg4);
-                skipEvents.insert(iEvent->ev);
-                break;
-
-            case SkUserId:
-                ui_onUserUpdate(iEvent->dwArg1, iEvent->dwArg2, iEvent->dwArg3, iEvent->dwArg4);
-                skipEvents.insert(iEvent->ev);
-                break;
-
-            case SkLog:
-                _SKLOG(">> %s", iEvent->sArg1.c_str());
-                break;
-
-            case SkModelState:
-                ui_onModelState(iEvent->dwArg1, static_cast<SidekickActiveState>(iEvent->dwArg2), static_cast<SidekickActiveState>(iEvent->dwArg3));
-                skipEvents.insert(iEvent->ev);
-                break;
-
-            case SkStreamKey:
-                //_MESG("WDBG: SkStreamKey caught, args: %s,   %s", iEvent->sArg1.c_str(), iEvent->sArg2.c_str());
-                ui_onStreamkeyUpdate(iEvent->sArg1, iEvent->sArg2);
-                skipEvents.insert(iEvent->ev);
-                break;
-
-            case SkServerUrl:
-                //_MESG("WDBG: SkServerUrl caught, args: %s,   %s", iEvent->sArg1.c_str(), iEvent->sArg2.c_str());
-                ui_onServerUpdate(iEvent->sArg1, iEvent->sArg2);
-                skipEvents.insert(iEvent->ev);
-                break;
-
-            case SkUnlink:
-                ui_onUnlinkEvent();
-                skipEvents.insert(iEvent->ev);
-                break;
-
-            case SkReadProfile:
-                skipEvents.insert(SkUserId);
-                onObsProfileChange(OBS_FRONTEND_EVENT_PROFILE_CHANGED);
-                break;
+        case SkSessionId:
+            ui_onSessionUpdate(ev.dwArg1, ev.dwArg2, ev.dwArg3, ev.dwArg4);
+            break;
+
+        case SkUserId:
+            ui_onUserUpdate(ev.dwArg1, ev.dwArg2, ev.dwArg3, ev.dwArg4);
+            break;
+
+        case SkLog:
+            _SKLOG(">> %s", ev.szArg1);
+            break;
+
+        case SkModelState:
+            ui_onModelState(ev.dwArg1, static_cast<SidekickActiveState>(ev.dwArg2), static_cast<SidekickActiveState>(ev.dwArg3));
+            break;
+
+        case SkStreamKey:
+            //_MESG("WDBG: SkStreamKey caught, args: %s,   %s", ev.szArg1, ev.szArg2);
+            ui_onStreamkeyUpdate(ev.szArg1, ev.szArg2);
+            break;
+
+        case SkServerUrl:
+            //_MESG("WDBG: SkServerUrl caught, args: %s,   %s", ev.szArg1, ev.szArg2);
+            ui_onServerUpdate(ev.szArg1, ev.szArg2);
+            break;
+
+        case SkUnlink:
+            ui_onUnlinkEvent();
+            break;
+
+        case SkReadProfile:
+            onObsProfileChange(OBS_FRONTEND_EVENT_PROFILE_CHANGED);
+            break;
 
 #if SIDEKICK_SET_WEBRTC
-            case SkSetWebRtc:
-                ui_onSetWebRtc(iEvent->dwArg1);
-                break;
+        case SkSetWebRtc:
+            ui_onSetWebRtc(ev.dwArg1);
+            break;
 #endif
-            case SkRoomEv:
-                _MESG("HTTP THREAD [RoomEvent]: %s", iEvent->sArg1.c_str());
-                break;
+        case SkRoomEv:
+            _MESG("HTTP THREAD [RoomEvent]: %s", ev.szArg1);
+            break;
 
-            case SkNull:
-                _MESG("HTTP THREAD [NullEvent]");
-                break;
-            }
+        case SkNull:
+            _MESG("HTTP THREAD [NullEvent]");
+            break;
+
+        default:
+            break;
         }
-    }
+    });
+}
 
+
+void SidekickTimer::onProfileCheck()
+{
     // If we're not a webRTC feed, check if we become one since no event is fired for
-    // profile settings being changed, but only check every 6th iteration (every 1.5 sec)
-    if ((s_nPulse % 6) == 0)
+    // profile settings being changed
+    bool isWebRTC = false, isStreaming = false, isMfc = false;
+    SidekickActiveState curState = SkUninitialized;
     {
-        bool isWebRTC = false, isStreaming = false, isMfc = false;
-        SidekickActiveState curState = SkUninitialized;
-        {
-            auto lk     = g_ctx.sharedLock();
-            curState    = g_ctx.activeState;
-            isStreaming = g_ctx.isStreaming;
-            isWebRTC    = g_ctx.isWebRTC;
-            isMfc       = g_ctx.isMfc;
-        }
+        auto lk     = g_ctx.sharedLock();
+        curState    = g_ctx.activeState;
+        isStreaming = g_ctx.isStreaming;
+        isWebRTC    = g_ctx.isWebRTC;
+        isMfc       = g_ctx.isMfc;
+    }
 
-        obs_service_t* pService = obs_frontend_get_streaming_service();
-        if (pService)
+    obs_service_t* pService = obs_frontend_get_streaming_service();
+    if (pService)
+    {
+        const char* pszType = obs_service_get_output_type(pService);
+        if (pszType)
         {
-            const char* pszType = obs_service_get_output_type(pService);
-            if (pszType)
+            std::string sSvcOutputType(pszType);
+            if ( sSvcOutputType == "mfc_wowza_output")
             {
-                std::string sSvcOutputType(pszType);
-                if ( sSvcOutputType == "mfc_wowza_output")
+                if ( ! isWebRTC )
                 {
-                    if ( ! isWebRTC )
-                    {
-                        // went from non-webrtc to webrtc
-                        onObsProfileChange(OBS_FRONTEND_EVENT_PROFILE_CHANGED);
-                    }
+                    // went from non-webrtc to webrtc
+                    onObsProfileChange(OBS_FRONTEND_EVENT_PROFILE_CHANGED);
                 }
-                else
+            }
+            else
+            {
+                if ( isWebRTC )
+                {
+                    // went from webrtc to non webrtc
+                    _MESG("** WebRTC Service deactivated on profile change **");
+                    g_ctx.isWebRTC = false;
+
+                    if (sidekick_prop)
+                        sidekick_prop->relabelPropertiesText();
+
+                    if (pMFCDock)
+                        pMFCDock->relabelPropertiesText();
+                }
+
+                if ( ! isMfc )
                 {
-                    if ( isWebRTC )
+                    if (curState != SkUnknownProfile)
                     {
-                        // went from webrtc to non webrtc
-                        _MESG("** WebRTC Service deactivated on profile change **");
-                        g_ctx.isWebRTC = false;
+                        g_ctx.activeState = SkUnknownProfile;
 
                         if (sidekick_prop)
                             sidekick_prop->relabelPropertiesText();
@@ -686,25 +739,10 @@ void SidekickTimer::onTimerEvent()
                         if (pMFCDock)
                             pMFCDock->relabelPropertiesText();
                     }
-
-                    if ( ! isMfc )
-                    {
-                        if (curState != SkUnknownProfile)
-                        {
-                            g_ctx.activeState = SkUnknownProfile;
-
-                            if (sidekick_prop)
-                                sidekick_prop->relabelPropertiesText();
-
-                            if (pMFCDock)
-                                pMFCDock->relabelPropertiesText();
-                        }
-                    }
                 }
             }
         }
     }
-    s_nPulse++;
 }
 
 
@@ -761,6 +799,7 @@ void showAccountLinkStatus(void)
 void onObsProfileChange(obs_frontend_event eventType)
 {
     UNREFERENCED_PARAMETER(eventType);
+    MFC_TRACE_SCOPE("ui", "onObsProfileChange");
 
     auto lk = g_ctx.sharedLock();
 
@@ -828,7 +867,7 @@ void onObsProfileChange(obs_frontend_event eventType)
     }
 #endif
     firstProfileCheck = true;
-    g_ctx.cfg.set("serviceType", svcName);
+    g_ctx.cfg.set(SkCfg::ServiceType, svcName);
 
     // read config if we are webRTC, clear config if we are not
     if (isWebRTC)
@@ -925,6 +964,9 @@ void onObsEvent(obs_frontend_event eventType, void* pCtx)
 
     if (eventType == OBS_FRONTEND_EVENT_STREAMING_STARTING)
     {
+        // no encoder calibration competing with the stream for CPU
+        X264Calibration::instance().setStreaming(true);
+
         auto lk = g_ctx.sharedLock();
 
         if ( g_ctx.isMfc )
@@ -972,10 +1014,10 @@ void onObsEvent(obs_frontend_event eventType, void* pCtx)
             else
             {
                 _MESG("DBG: Valid sid[%u]; marking streaming as started on profile:%s to server:%s for %s",
-                      g_ctx.cfg.getInt("sid"),
+                      g_ctx.cfg.getInt(SkCfg::Sid),
                       g_ctx.profileName.c_str(),
                       g_ctx.serverName.c_str(),
-                      g_ctx.cfg.getString("username"));
+                      g_ctx.cfg.getString(SkCfg::Username).c_str());
 
                 // When streaming starts, pause polling agentSvc.php
                 g_ctx.onStartStreaming();
@@ -998,14 +1040,16 @@ void onObsEvent(obs_frontend_event eventType, void* pCtx)
     }
     else if (eventType == OBS_FRONTEND_EVENT_STREAMING_STOPPED)
     {
+        X264Calibration::instance().setStreaming(false);
+
         auto lk = g_ctx.sharedLock();
         if ( g_ctx.isMfc )
         {
             _MESG(  "DBG: Streaming ended, marking stream as stopped for sid[%u] on profile:%s to server:%s for %s",
-                    g_ctx.cfg.getInt("sid"),
+                    g_ctx.cfg.getInt(SkCfg::Sid),
                     g_ctx.profileName.c_str(),
                     g_ctx.serverName.c_str(),
-                    g_ctx.cfg.getString("username"));
+                    g_ctx.cfg.getString(SkCfg::Username).c_str());
 
             // When streaming stops, we resume polling agentSvc.php
             g_ctx.onStopStreaming();
@@ -1104,9 +1148,76 @@ void obs_module_unload()
 {
     _TRACE("obs_module_unload called, stopping thread");
     g_thread.Stop(-1);
+
+    SidekickEventQueue::Stats evStats = CBroadcastCtx::sm_events.getStats();
+    _TRACE("UI events: %llu queued, %llu delivered, %llu coalesced, %llu dropped, %llu truncated; latency avg %lluus max %lluus",
+           (unsigned long long)evStats.queued,
+           (unsigned long long)evStats.delivered,
+           (unsigned long long)evStats.coalesced,
+           (unsigned long long)evStats.dropped,
+           (unsigned long long)evStats.truncated,
+           (unsigned long long)evStats.latencyAvgUs,
+           (unsigned long long)evStats.latencyMaxUs);
+
+    // no timer callbacks past this point, UiThread ones would land on a torn down UI
+    CTimerWheel::Stats timerStats = CTimerWheel::instance().getStats();
+    CTimerWheel::instance().stop();
+    _TRACE("Timers: %llu scheduled, %llu fired, %llu cancelled, %llu coalesced, %llu missed, %llu unrouted, %llu wakeups; lag avg %lldus max %lldus",
+           (unsigned long long)timerStats.scheduled,
+           (unsigned long long)timerStats.fired,
+           (unsigned long long)timerStats.cancelled,
+           (unsigned long long)timerStats.coalesced,
+           (unsigned long long)timerStats.missed,
+           (unsigned long long)timerStats.unrouted,
+           (unsigned long long)timerStats.wakeups,
+           (long long)timerStats.avgLagUs,
+           (long long)timerStats.maxLagUs);
+
+    // don't leave a chat server probe running while we unload
+    CChatServerSelector::instance().stop();
+
+    // nor an encoder calibration
+    X264Calibration::instance().stop();
+
+    // write out any config changes still waiting on the debounce window
+    CPluginConfigWriter::instance().stop();
+
+    // everything above has handed off its last background task by now
+    CExecutor::instance().stop();
+    CExecutor::Stats exStats = CExecutor::instance().getStats();
+    _TRACE("Executor: %llu submitted, %llu executed, %llu cancelled, %llu stolen, %llu inlined, max depth %zu on %zu workers; "
+           "wait latency avg %lldus max %lldus, bulk avg %lldus max %lldus",
+           (unsigned long long)exStats.submitted,
+           (unsigned long long)exStats.executed,
+           (unsigned long long)exStats.cancelled,
+           (unsigned long long)exStats.stolen,
+           (unsigned long long)exStats.inlined,
+           exStats.maxDepth,
+           exStats.workers,
+           (long long)exStats.avgWaitUs[CExecutor::Latency],
+           (long long)exStats.maxWaitUs[CExecutor::Latency],
+           (long long)exStats.avgWaitUs[CExecutor::Bulk],
+           (long long)exStats.maxWaitUs[CExecutor::Bulk]);
+
+    MfcLogWriter::Stats logStats;
+    if (Log::GetAsyncStats(logStats))
+        _TRACE("Log writer: %llu queued, %llu written in %llu batches, %llu dropped, %llu truncated",
+               (unsigned long long)logStats.queued,
+               (unsigned long long)logStats.written,
+               (unsigned long long)logStats.batches,
+               (unsigned long long)logStats.dropped,
+               (unsigned long long)logStats.truncated);
     _TRACE("%s OBS Plugin has been Unloaded", __progname);
 
     CObsUtil::TerminateMFCLogin();
+
+    if (MfcTrace::IsEnabled())
+        SidekickModelConfig::dumpTrace();
+
+    Log::CloseBinLog();
+
+    // write out anything still queued and go back to logging on the caller's thread
+    Log::SetAsync(false);
 }
 
 
@@ -0,0 +1,148 @@
+/*
+ * Copyright (c) 2013-2021 MFCXY, Inc. <mfcxy@mfcxy.com>
+ * Copyright (c) 2020 The WebRTC project authors. All Rights Reserved.
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "EncoderOverload.h"
+
+#include <libfcs/Log.h>
+
+#include <algorithm>
+#include <cstring>
+
+
+EncoderOverload::EncoderOverload()
+{
+    reset();
+}
+
+
+void EncoderOverload::reset(void)
+{
+    m_level         = NORMAL;
+    m_nLevelSinceUs = 0;
+    m_nStateSinceUs = 0;
+    m_fOverloaded   = false;
+    m_dEncodeAvgUs  = 0.0;
+    m_dQueueAvgUs   = 0.0;
+    m_nFrames       = 0;
+    m_nLevelUps     = 0;
+    m_nLevelDowns   = 0;
+    m_nMaxLevel     = NORMAL;
+    m_nEncodeSumUs  = 0;
+    m_nEncodeMaxUs  = 0;
+    m_nQueueSumUs   = 0;
+    m_nQueueMaxUs   = 0;
+    memset(m_nLevelUs, 0, sizeof(m_nLevelUs));
+}
+
+
+// static
+const char* EncoderOverload::levelName(Level level)
+{
+    switch (level)
+    {
+    case NORMAL:        return "normal";
+    case SKIP_FRAMES:   return "skip frames";
+    case FASTER_PRESET: return "faster preset";
+    case REDUCE_FPS:    return "reduce fps";
+    default:            return "?";
+    }
+}
+
+
+bool EncoderOverload::update(int64_t nNowUs, int64_t nEncodeUs, int64_t nQueueUs, int64_t nIntervalUs)
+{
+    nQueueUs = std::max(nQueueUs, (int64_t)0);
+
+    if (m_nFrames++ == 0)
+    {
+        m_nLevelSinceUs = nNowUs;
+        m_dEncodeAvgUs  = (double)nEncodeUs;
+        m_dQueueAvgUs   = (double)nQueueUs;
+    }
+    else
+    {
+        m_dEncodeAvgUs += ((double)nEncodeUs - m_dEncodeAvgUs) / 8.0;
+        m_dQueueAvgUs  += ((double)nQueueUs - m_dQueueAvgUs) / 8.0;
+    }
+
+    m_nEncodeSumUs += nEncodeUs;
+    m_nEncodeMaxUs  = std::max(m_nEncodeMaxUs, nEncodeUs);
+    m_nQueueSumUs  += nQueueUs;
+    m_nQueueMaxUs   = std::max(m_nQueueMaxUs, nQueueUs);
+
+    const double dInterval = (double)std::max(nIntervalUs, (int64_t)1);
+    const bool fOverloaded = m_dEncodeAvgUs > dInterval * OVERLOAD_FRACTION || m_dQueueAvgUs > dInterval * QUEUE_FRAMES;
+    const bool fHeadroom   = m_dEncodeAvgUs < dInterval * RESTORE_FRACTION && m_dQueueAvgUs < dInterval * RESTORE_FRACTION;
+
+    if (!fOverloaded && !fHeadroom)
+    {
+        m_nStateSinceUs = 0;
+        return false;
+    }
+
+    if (m_nStateSinceUs == 0 || m_fOverloaded != fOverloaded)
+    {
+        m_nStateSinceUs = nNowUs;
+        m_fOverloaded = fOverloaded;
+        return false;
+    }
+
+    Level next = m_level;
+    if (fOverloaded && nNowUs - m_nStateSinceUs >= ESCALATE_US && m_level + 1 < NUM_LEVELS)
+        next = (Level)(m_level + 1);
+    else if (fHeadroom && nNowUs - m_nStateSinceUs >= RESTORE_US && m_level > NORMAL)
+        next = (Level)(m_level - 1);
+    else
+        return false;
+
+    m_nLevelUs[m_level] += nNowUs - m_nLevelSinceUs;
+    m_nLevelSinceUs = nNowUs;
+    m_nStateSinceUs = nNowUs;
+
+    if (next > m_level)
+        m_nLevelUps++;
+    else
+        m_nLevelDowns++;
+
+    _MESG("Encoder overload %s -> %s: encode avg %lldus, queue avg %lldus, frame interval %lldus",
+          levelName(m_level), levelName(next), (long long)m_dEncodeAvgUs, (long long)m_dQueueAvgUs, (long long)nIntervalUs);
+
+    m_level = next;
+    m_nMaxLevel = std::max(m_nMaxLevel, (int)m_level);
+    return true;
+}
+
+
+EncoderOverload::Stats EncoderOverload::getStats(int64_t nNowUs) const
+{
+    Stats stats;
+    stats.frames        = m_nFrames;
+    stats.levelUps      = m_nLevelUps;
+    stats.levelDowns    = m_nLevelDowns;
+    stats.level         = m_level;
+    stats.maxLevel      = m_nMaxLevel;
+    stats.encodeAvgUs   = m_nFrames ? m_nEncodeSumUs / (int64_t)m_nFrames : 0;
+    stats.encodeMaxUs   = m_nEncodeMaxUs;
+    stats.queueAvgUs    = m_nFrames ? m_nQueueSumUs / (int64_t)m_nFrames : 0;
+    stats.queueMaxUs    = m_nQueueMaxUs;
+
+    memcpy(stats.levelUs, m_nLevelUs, sizeof(stats.levelUs));
+    if (m_nFrames)
+        stats.levelUs[m_level] += nNowUs - m_nLevelSinceUs;
+
+    return stats;
+}
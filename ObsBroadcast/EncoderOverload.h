@@ -0,0 +1,108 @@
+/*
+ * Copyright (c) 2013-2021 MFCXY, Inc. <mfcxy@mfcxy.com>
+ * Copyright (c) 2020 The WebRTC project authors. All Rights Reserved.
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#pragma once
+
+#ifndef ENCODER_OVERLOAD_H_
+#define ENCODER_OVERLOAD_H_
+
+#include <cstdint>
+
+
+// Detects when the encoder can't keep up and picks how far to back off.
+//
+// update() gets each encoded frame's encode time and how long the frame waited between
+// leaving VideoTrackSource and reaching the encoder, both smoothed over ~8 frames and
+// measured against the nominal frame interval. The encoder is overloaded when encoding
+// takes more than OVERLOAD_FRACTION of the interval, or frames wait more than
+// QUEUE_FRAMES intervals (WebRTC's encoder queue is backing up, which OBS then shows
+// as lag). It has headroom when both are under RESTORE_FRACTION of an interval.
+//
+// Each ESCALATE_US of continuous overload moves one level up, each RESTORE_US of
+// continuous headroom one level down; the clocks restart on every change so a step
+// has time to take effect before the next one. What a level does is up to X264Encoder:
+// SKIP_FRAMES drops a share of the frames before encoding, FASTER_PRESET also moves
+// x264 one preset faster, REDUCE_FPS encodes at half the frame rate.
+//
+// Level changes go to the Sidekick log. Not thread safe, runs on the encoder queue
+// with X264Encoder.
+//
+class EncoderOverload
+{
+public:
+    enum Level
+    {
+        NORMAL = 0,
+        SKIP_FRAMES,
+        FASTER_PRESET,
+        REDUCE_FPS,
+        NUM_LEVELS
+    };
+
+    static constexpr double OVERLOAD_FRACTION   = 0.9;
+    static constexpr double QUEUE_FRAMES        = 2.0;
+    static constexpr double RESTORE_FRACTION    = 0.5;
+    static const int64_t    ESCALATE_US         = 500000;
+    static const int64_t    RESTORE_US          = 5000000;
+
+    struct Stats
+    {
+        uint64_t    frames;
+        uint64_t    levelUps;
+        uint64_t    levelDowns;
+        int         level;
+        int         maxLevel;
+        int64_t     levelUs[NUM_LEVELS];    // time spent at each level
+        int64_t     encodeAvgUs;
+        int64_t     encodeMaxUs;
+        int64_t     queueAvgUs;
+        int64_t     queueMaxUs;
+    };
+
+    EncoderOverload();
+
+    // Back to NORMAL with fresh averages, for a new encoder session
+    void reset(void);
+
+    // One encoded frame, true if the level changed
+    bool update(int64_t nNowUs, int64_t nEncodeUs, int64_t nQueueUs, int64_t nIntervalUs);
+
+    Level level(void) const { return m_level; }
+    static const char* levelName(Level level);
+
+    Stats getStats(int64_t nNowUs) const;
+
+private:
+    Level       m_level;
+    int64_t     m_nLevelSinceUs;    // when the current level started, 0 before the first frame
+    int64_t     m_nStateSinceUs;    // when the current overload or headroom run started, 0 in between
+    bool        m_fOverloaded;      // which of the two the run is
+
+    double      m_dEncodeAvgUs;
+    double      m_dQueueAvgUs;
+
+    uint64_t    m_nFrames;
+    uint64_t    m_nLevelUps;
+    uint64_t    m_nLevelDowns;
+    int         m_nMaxLevel;
+    int64_t     m_nLevelUs[NUM_LEVELS];
+    int64_t     m_nEncodeSumUs;
+    int64_t     m_nEncodeMaxUs;
+    int64_t     m_nQueueSumUs;
+    int64_t     m_nQueueMaxUs;
+};
+
+#endif  // ENCODER_OVERLOAD_H_
@@ -0,0 +1,410 @@
+/*
+ * Copyright (c) 2013-2021 MFCXY, Inc. <mfcxy@mfcxy.com>
+ * Copyright (c) 2020 The WebRTC project authors. All Rights Reserved.
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "FrameBufferPool.h"
+
+#include <libfcs/MfcTimer.h>
+
+#include "rtc_base/checks.h"
+#include "rtc_base/ref_counted_object.h"
+#include "third_party/libyuv/include/libyuv/planar_functions.h"
+#include "third_party/libyuv/include/libyuv/scale.h"
+
+#include <algorithm>
+
+using rtc::RefCountedObject;
+using webrtc::AlignedFreeDeleter;
+using webrtc::Mutex;
+using webrtc::MutexLock;
+
+typedef std::unique_ptr<uint8_t, AlignedFreeDeleter> AlignedBlock;
+
+
+static int AlignUp(int n, int nAlign)
+{
+    return (n + nAlign - 1) & ~(nAlign - 1);
+}
+
+
+// Pooled block for one frame, with the plane layout it was sized for
+struct PoolSlot
+{
+    AlignedBlock    block;
+    int             strideY;
+    int             strideUV;
+    size_t          nBytes;
+};
+
+
+static void AddSample(std::atomic<int64_t>& nSumNs, std::atomic<int64_t>& nMaxNs, int64_t nNs)
+{
+    nSumNs += nNs;
+    int64_t nMax = nMaxNs.load(std::memory_order_relaxed);
+    while (nNs > nMax && !nMaxNs.compare_exchange_weak(nMax, nNs, std::memory_order_relaxed))
+        ;
+}
+
+
+struct NV12BufPool::Shared
+{
+    explicit Shared(size_t nMax)
+        : nMaxBuffers(nMax), width(0), height(0), strideY(0), strideUV(0), nBytes(0), nInUse(0)
+        , nAcquired(0), nScaled(0), nAllocated(0), nExhausted(0), nMaxInUse(0)
+        , nCopySumNs(0), nCopyMaxNs(0), nScaleSumNs(0), nScaleMaxNs(0)
+    {}
+
+    // Free block for a width x height frame, false if every buffer is out
+    bool Acquire(int w, int h, PoolSlot& slot)
+    {
+        MutexLock lock(&mutex);
+
+        if (w != width || h != height)
+        {
+            width       = w;
+            height      = h;
+            strideY     = AlignUp(w, BUFFER_ALIGNMENT);
+            strideUV    = AlignUp(w + (w & 1), BUFFER_ALIGNMENT);
+            nBytes      = (size_t)strideY * h + (size_t)strideUV * ((h + 1) / 2);
+            vFree.clear();
+        }
+
+        if (nInUse >= nMaxBuffers)
+        {
+            nExhausted++;
+            return false;
+        }
+
+        if (!vFree.empty())
+        {
+            slot.block = std::move(vFree.back());
+            vFree.pop_back();
+        }
+        else
+        {
+            slot.block.reset(static_cast<uint8_t*>(webrtc::AlignedMalloc(nBytes, BUFFER_ALIGNMENT)));
+            if (!slot.block)
+                return false;
+            nAllocated++;
+        }
+
+        slot.strideY    = strideY;
+        slot.strideUV   = strideUV;
+        slot.nBytes     = nBytes;
+
+        if (++nInUse > nMaxInUse)
+            nMaxInUse = nInUse;
+        return true;
+    }
+
+    // Called by a pooled buffer when the last frame referencing it goes away
+    void Release(AlignedBlock block, size_t nBlockBytes)
+    {
+        MutexLock lock(&mutex);
+        nInUse--;
+
+        // buffers from before a resolution change are simply freed
+        if (nBlockBytes == nBytes && vFree.size() < nMaxBuffers)
+            vFree.push_back(std::move(block));
+    }
+
+    const size_t                nMaxBuffers;
+
+    Mutex                       mutex;
+    std::vector<AlignedBlock>   vFree       RTC_GUARDED_BY(mutex);
+    int                         width       RTC_GUARDED_BY(mutex);
+    int                         height      RTC_GUARDED_BY(mutex);
+    int                         strideY     RTC_GUARDED_BY(mutex);
+    int                         strideUV    RTC_GUARDED_BY(mutex);
+    size_t                      nBytes      RTC_GUARDED_BY(mutex);
+    size_t                      nInUse      RTC_GUARDED_BY(mutex);
+
+    std::atomic<uint64_t>       nAcquired;
+    std::atomic<uint64_t>       nScaled;
+    std::atomic<uint64_t>       nAllocated;
+    std::atomic<uint64_t>       nExhausted;
+    std::atomic<size_t>         nMaxInUse;
+    std::atomic<int64_t>        nCopySumNs;
+    std::atomic<int64_t>        nCopyMaxNs;
+    std::atomic<int64_t>        nScaleSumNs;
+    std::atomic<int64_t>        nScaleMaxNs;
+};
+
+
+// NV12Buf that owns its pooled memory and hands it back when released
+class PooledNV12Buf : public NV12Buf
+{
+public:
+    PooledNV12Buf(std::shared_ptr<NV12BufPool::Shared> shared, AlignedBlock block, size_t nBytes,
+                  int strideY, int strideUV, int width, int height)
+        : NV12Buf(block.get(), strideY, block.get() + (size_t)strideY * height, strideUV, width, height)
+        , shared_(std::move(shared))
+        , block_(std::move(block))
+        , nBytes_(nBytes)
+    {}
+
+protected:
+    ~PooledNV12Buf() override
+    {
+        shared_->Release(std::move(block_), nBytes_);
+    }
+
+private:
+    std::shared_ptr<NV12BufPool::Shared>    shared_;
+    AlignedBlock                            block_;
+    const size_t                            nBytes_;
+};
+
+
+NV12BufPool::NV12BufPool(size_t nMaxBuffers)
+    : shared_(std::make_shared<Shared>(nMaxBuffers))
+{}
+
+
+NV12BufPool::~NV12BufPool() = default;
+
+
+scoped_refptr<NV12Buf> NV12BufPool::CopyFrom(const uint8_t* dataY, int strideY,
+                                             const uint8_t* dataUV, int strideUV,
+                                             int width, int height)
+{
+    RTC_DCHECK_GT(width, 0);
+    RTC_DCHECK_GT(height, 0);
+
+    PoolSlot slot;
+    if (!shared_->Acquire(width, height, slot))
+        return nullptr;
+
+    // Y is 8 bit per pixel, UV interleaved at half height, so both are byte planes
+    uint8_t* pDst = slot.block.get();
+    int64_t nStartNs = (int64_t)MfcTimer::FastNs();
+    libyuv::CopyPlane(dataY, strideY, pDst, slot.strideY, width, height);
+    libyuv::CopyPlane(dataUV, strideUV, pDst + (size_t)slot.strideY * height, slot.strideUV,
+                      width + (width & 1), (height + 1) / 2);
+    AddSample(shared_->nCopySumNs, shared_->nCopyMaxNs, (int64_t)MfcTimer::FastNs() - nStartNs);
+    shared_->nAcquired++;
+
+    return new RefCountedObject<PooledNV12Buf>(shared_, std::move(slot.block), slot.nBytes, slot.strideY, slot.strideUV, width, height);
+}
+
+
+scoped_refptr<NV12Buf> NV12BufPool::ScaleFrom(const uint8_t* dataY, int strideY,
+                                              const uint8_t* dataUV, int strideUV,
+                                              int width, int height,
+                                              int scaledWidth, int scaledHeight)
+{
+    RTC_DCHECK_GT(scaledWidth, 0);
+    RTC_DCHECK_GT(scaledHeight, 0);
+
+    if (scaledWidth == width && scaledHeight == height)
+        return CopyFrom(dataY, strideY, dataUV, strideUV, width, height);
+
+    PoolSlot slot;
+    if (!shared_->Acquire(scaledWidth, scaledHeight, slot))
+        return nullptr;
+
+    uint8_t* pDst = slot.block.get();
+    int64_t nStartNs = (int64_t)MfcTimer::FastNs();
+    libyuv::NV12Scale(dataY, strideY, dataUV, strideUV, width, height,
+                      pDst, slot.strideY, pDst + (size_t)slot.strideY * scaledHeight, slot.strideUV,
+                      scaledWidth, scaledHeight, libyuv::kFilterBox);
+    AddSample(shared_->nScaleSumNs, shared_->nScaleMaxNs, (int64_t)MfcTimer::FastNs() - nStartNs);
+    shared_->nAcquired++;
+    shared_->nScaled++;
+
+    return new RefCountedObject<PooledNV12Buf>(shared_, std::move(slot.block), slot.nBytes, slot.strideY, slot.strideUV,
+                                               scaledWidth, scaledHeight);
+}
+
+
+NV12BufPool::Stats NV12BufPool::GetStats() const
+{
+    Stats stats;
+    stats.acquired  = shared_->nAcquired.load();
+    stats.scaled    = shared_->nScaled.load();
+    stats.allocated = shared_->nAllocated.load();
+    stats.exhausted = shared_->nExhausted.load();
+    stats.maxInUse  = shared_->nMaxInUse.load();
+
+    uint64_t nCopied = stats.acquired - stats.scaled;
+    stats.copyAvgUs = nCopied ? (shared_->nCopySumNs.load() / (int64_t)nCopied) / 1000 : 0;
+    stats.copyMaxUs = shared_->nCopyMaxNs.load() / 1000;
+    stats.scaleAvgUs = stats.scaled ? (shared_->nScaleSumNs.load() / (int64_t)stats.scaled) / 1000 : 0;
+    stats.scaleMaxUs = shared_->nScaleMaxNs.load() / 1000;
+    {
+        MutexLock lock(&shared_->mutex);
+        stats.inUse = shared_->nInUse;
+    }
+    return stats;
+}
+
+
+I420BufPool& I420BufPool::instance()
+{
+    static I420BufPool s_pool;
+    return s_pool;
+}
+
+
+I420BufPool::I420BufPool(size_t nMaxPerSize)
+    : nMaxPerSize_(nMaxPerSize)
+    , nCreated_(0)
+    , nAllocated_(0)
+    , nExhausted_(0)
+{}
+
+
+scoped_refptr<webrtc::I420Buffer> I420BufPool::Create(int width, int height)
+{
+    MutexLock lock(&mutex_);
+    uint64_t nGen = ++nCreated_;
+
+    SizePool& pool = pools_[ std::make_pair(width, height) ];
+    pool.nLastUsed = nGen;
+
+    // drop sizes nobody has asked for in a while, the new size is current so it stays
+    if (pools_.size() > 1)
+    {
+        for (auto it = pools_.begin(); it != pools_.end(); )
+        {
+            if (nGen - it->second.nLastUsed > IDLE_GENERATIONS)
+                it = pools_.erase(it);
+            else
+                ++it;
+        }
+    }
+
+    for (auto& buffer : pool.vBuffers)
+    {
+        if (buffer->HasOneRef())
+            return buffer;
+    }
+
+    nAllocated_++;
+    scoped_refptr<PooledI420> buffer(new PooledI420(width, height));
+    if (pool.vBuffers.size() < nMaxPerSize_)
+        pool.vBuffers.push_back(buffer);
+    else
+        nExhausted_++;
+
+    return buffer;
+}
+
+
+I420BufPool::Stats I420BufPool::GetStats() const
+{
+    MutexLock lock(&mutex_);
+
+    Stats stats;
+    stats.created   = nCreated_;
+    stats.allocated = nAllocated_;
+    stats.exhausted = nExhausted_;
+    stats.sizes     = pools_.size();
+    stats.buffers   = 0;
+    for (auto& it : pools_)
+        stats.buffers += it.second.vBuffers.size();
+    return stats;
+}
+
+
+class EncodedBufPool::Buffer : public webrtc::EncodedImageBufferInterface
+{
+public:
+    explicit Buffer(size_t nCapacity) { resize(nCapacity); }
+
+    const uint8_t* data() const override    { return m_pData.get(); }
+    uint8_t* data() override                { return m_pData.get(); }
+    size_t size() const override            { return m_nCapacity; }
+
+    void resize(size_t nCapacity)
+    {
+        m_pData.reset(new uint8_t[ nCapacity ]);
+        m_nCapacity = nCapacity;
+    }
+
+private:
+    std::unique_ptr<uint8_t[]>  m_pData;
+    size_t                      m_nCapacity = 0;
+};
+
+
+EncodedBufPool::EncodedBufPool()
+    : m_nPeakBytes(0)
+    , m_nAcquired(0)
+    , m_nAllocated(0)
+    , m_nExhausted(0)
+{}
+
+
+void EncodedBufPool::Reset(size_t nSizeHint)
+{
+    m_vBuffers.clear();
+    m_nPeakBytes = nSizeHint;
+}
+
+
+size_t EncodedBufPool::targetCapacity(size_t nRequired) const
+{
+    size_t nTarget = std::max(nRequired, m_nPeakBytes + m_nPeakBytes / 4);
+    return (nTarget + SIZE_GRANULARITY - 1) / SIZE_GRANULARITY * SIZE_GRANULARITY;
+}
+
+
+scoped_refptr<webrtc::EncodedImageBufferInterface> EncodedBufPool::Acquire(size_t nRequired)
+{
+    m_nAcquired++;
+    m_nPeakBytes = std::max(nRequired, m_nPeakBytes - m_nPeakBytes / PEAK_DECAY);
+
+    const size_t nTarget = targetCapacity(nRequired);
+
+    for (auto& buffer : m_vBuffers)
+    {
+        if (!buffer->HasOneRef())
+            continue;
+
+        // regrow a buffer that's too small, shrink one left over from a much bigger peak
+        if (buffer->size() < nRequired || buffer->size() > 4 * nTarget)
+        {
+            buffer->resize(nTarget);
+            m_nAllocated++;
+        }
+        return buffer;
+    }
+
+    m_nAllocated++;
+    if (m_vBuffers.size() < MAX_BUFFERS)
+    {
+        m_vBuffers.push_back(new PooledBuffer(nTarget));
+        return m_vBuffers.back();
+    }
+
+    m_nExhausted++;
+    return webrtc::EncodedImageBuffer::Create(nRequired);
+}
+
+
+EncodedBufPool::Stats EncodedBufPool::GetStats() const
+{
+    Stats stats;
+    stats.acquired      = m_nAcquired;
+    stats.allocated     = m_nAllocated;
+    stats.exhausted     = m_nExhausted;
+    stats.peakBytes     = m_nPeakBytes;
+    stats.pooledBytes   = 0;
+    for (auto& buffer : m_vBuffers)
+        stats.pooledBytes += buffer->size();
+    return stats;
+}
@@ -0,0 +1,213 @@
+/*
+ * Copyright (c) 2013-2021 MFCXY, Inc. <mfcxy@mfcxy.com>
+ * Copyright (c) 2020 The WebRTC project authors. All Rights Reserved.
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#pragma once
+
+#ifndef FRAME_BUFFER_POOL_H_
+#define FRAME_BUFFER_POOL_H_
+
+#include <atomic>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include "api/scoped_refptr.h"
+#include "api/video/encoded_image.h"
+#include "api/video/i420_buffer.h"
+#include "rtc_base/ref_counted_object.h"
+#include "rtc_base/memory/aligned_malloc.h"
+#include "rtc_base/synchronization/mutex.h"
+
+#include "NV12Buf.h"
+
+using rtc::scoped_refptr;
+
+
+// Recycled NV12 frame buffers for VideoTrackSource.
+//
+// OBS only lends us its video_data planes for the duration of the output callback, so
+// every frame handed to WebRTC (which encodes on its own queue) is copied into a
+// buffer from here first. Buffers are BUFFER_ALIGNMENT aligned with both plane strides
+// rounded up to it, and each plane is copied with one libyuv CopyPlane pass, or when the
+// sinks want a lower resolution scaled with NV12Scale straight into the buffer.
+//
+// A buffer goes back on the free list when WebRTC drops its last reference to the
+// frame, so steady state streaming allocates nothing. At most nMaxBuffers are out at
+// once; past that CopyFrom() fails and the caller drops the frame, which means the
+// encoder has fallen that far behind. A resolution change frees the old buffers as
+// they come back. The pool may be destroyed while frames are still in flight.
+//
+class NV12BufPool
+{
+public:
+    static const int        BUFFER_ALIGNMENT    = 64;
+    static const size_t     DEFAULT_MAX_BUFFERS = 8;
+
+    struct Stats
+    {
+        uint64_t    acquired;       // frames copied or scaled into a pooled buffer
+        uint64_t    scaled;         // of those, ones that were scaled
+        uint64_t    allocated;      // buffers allocated, anything past the first few is churn
+        uint64_t    exhausted;      // CopyFrom() calls that failed with every buffer in flight
+        size_t      inUse;          // buffers referenced by frames right now
+        size_t      maxInUse;
+        int64_t     copyAvgUs;      // plane copy time
+        int64_t     copyMaxUs;
+        int64_t     scaleAvgUs;     // NV12Scale time
+        int64_t     scaleMaxUs;
+    };
+
+    explicit NV12BufPool(size_t nMaxBuffers = DEFAULT_MAX_BUFFERS);
+    ~NV12BufPool();
+
+    NV12BufPool(const NV12BufPool&) = delete;
+    NV12BufPool& operator=(const NV12BufPool&) = delete;
+
+    // Copies the planes into a pooled buffer, nullptr if the pool is exhausted
+    scoped_refptr<NV12Buf> CopyFrom(const uint8_t* dataY, int strideY,
+                                    const uint8_t* dataUV, int strideUV,
+                                    int width, int height);
+
+    // Same, scaled to scaledWidth x scaledHeight in one box filtered pass
+    scoped_refptr<NV12Buf> ScaleFrom(const uint8_t* dataY, int strideY,
+                                     const uint8_t* dataUV, int strideUV,
+                                     int width, int height,
+                                     int scaledWidth, int scaledHeight);
+
+    Stats GetStats() const;
+
+    // State shared with the buffers that are out, so they can come back after we're gone
+    struct Shared;
+
+private:
+    std::shared_ptr<Shared> shared_;
+};
+
+
+// Recycled I420 buffers for NV12Buf::ToI420(), shared by every frame in the process.
+//
+// Buffers are kept per resolution, up to nMaxPerSize of each. A buffer is free again
+// once the pool holds the only reference to it, so callers just drop the frame as
+// usual. Sizes that haven't been asked for in IDLE_GENERATIONS Create() calls of other
+// sizes are released, which covers a stream that changed resolution.
+//
+class I420BufPool
+{
+public:
+    static const size_t     DEFAULT_MAX_PER_SIZE    = 4;
+    static const uint64_t   IDLE_GENERATIONS        = 300;
+
+    struct Stats
+    {
+        uint64_t    created;        // Create() calls
+        uint64_t    allocated;      // of those, ones that needed a new buffer
+        uint64_t    exhausted;      // ones that got an unpooled buffer, every pooled one was in use
+        size_t      sizes;          // resolutions currently pooled
+        size_t      buffers;        // buffers currently pooled, free or not
+    };
+
+    static I420BufPool& instance();
+
+    explicit I420BufPool(size_t nMaxPerSize = DEFAULT_MAX_PER_SIZE);
+
+    I420BufPool(const I420BufPool&) = delete;
+    I420BufPool& operator=(const I420BufPool&) = delete;
+
+    // Free buffer of this size, allocated if needed. Never nullptr.
+    scoped_refptr<webrtc::I420Buffer> Create(int width, int height);
+
+    Stats GetStats() const;
+
+private:
+    typedef rtc::RefCountedObject<webrtc::I420Buffer>   PooledI420;
+
+    struct SizePool
+    {
+        std::vector< scoped_refptr<PooledI420> >    vBuffers;
+        uint64_t                                    nLastUsed = 0;
+    };
+
+    const size_t                                        nMaxPerSize_;
+
+    mutable webrtc::Mutex                               mutex_;
+    std::map< std::pair<int, int>, SizePool >           pools_      RTC_GUARDED_BY(mutex_);
+    uint64_t                                            nCreated_   RTC_GUARDED_BY(mutex_);
+    uint64_t                                            nAllocated_ RTC_GUARDED_BY(mutex_);
+    uint64_t                                            nExhausted_ RTC_GUARDED_BY(mutex_);
+};
+
+
+// Recycled output buffers for X264Encoder, one pool per encoder.
+//
+// The NALs of each encoded frame are copied into a buffer from here instead of a new
+// EncodedImageBuffer. The packetizer copies the payload out during OnEncodedImage, so
+// normally two buffers alternate (image_ holds on to the last one); a buffer is free
+// again once the pool holds the only reference to it.
+//
+// Buffers are sized from recent frames rather than the raw frame size: a decaying peak
+// of the encoded sizes (halving over about PEAK_DECAY frames, so it covers the last
+// keyframe or two) plus a quarter, rounded up to SIZE_GRANULARITY. A buffer that is too
+// small for a frame is regrown, one far bigger than the peak is shrunk.
+//
+// Not thread safe, the encoder only uses it from WebRTC's encoder queue.
+//
+class EncodedBufPool
+{
+public:
+    static const size_t     MAX_BUFFERS         = 4;
+    static const size_t     SIZE_GRANULARITY    = 4096;
+    static const size_t     PEAK_DECAY          = 64;
+
+    struct Stats
+    {
+        uint64_t    acquired;       // frames handed a buffer
+        uint64_t    allocated;      // buffer (re)allocations, pooled or not
+        uint64_t    exhausted;      // frames that got an unpooled buffer
+        size_t      peakBytes;      // current decaying peak frame size
+        size_t      pooledBytes;    // capacity held by the pool
+    };
+
+    EncodedBufPool();
+
+    EncodedBufPool(const EncodedBufPool&) = delete;
+    EncodedBufPool& operator=(const EncodedBufPool&) = delete;
+
+    // Drops the buffers and seeds the size estimate, called from InitEncode()
+    void Reset(size_t nSizeHint);
+
+    // Buffer with at least nRequired bytes, never nullptr
+    scoped_refptr<webrtc::EncodedImageBufferInterface> Acquire(size_t nRequired);
+
+    Stats GetStats() const;
+
+private:
+    class Buffer;
+    typedef rtc::RefCountedObject<Buffer>   PooledBuffer;
+
+    size_t targetCapacity(size_t nRequired) const;
+
+    std::vector< scoped_refptr<PooledBuffer> >  m_vBuffers;
+    size_t                                      m_nPeakBytes;
+
+    uint64_t                                    m_nAcquired;
+    uint64_t                                    m_nAllocated;
+    uint64_t                                    m_nExhausted;
+};
+
+#endif  // FRAME_BUFFER_POOL_H_
@@ -0,0 +1,129 @@
+/*
+ * Copyright (c) 2013-2021 MFCXY, Inc. <mfcxy@mfcxy.com>
+ * Copyright (c) 2020 The WebRTC project authors. All Rights Reserved.
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "FrameDecimator.h"
+
+#include <algorithm>
+#include <cstdlib>
+
+static const int64_t NANOS_PER_SEC = 1000000000;
+
+
+FrameDecimator::FrameDecimator(int nTargetFps)
+    : m_nTargetFps(0)
+    , m_nIntervalNs(0)
+    , m_fSynced(false)
+    , m_nLastInputNs(0)
+    , m_nLastKeptNs(0)
+    , m_nCreditNs(0)
+    , m_nInputAvgNs(0)
+    , m_nNominalInputNs(0)
+    , m_nKept(0)
+    , m_nDropped(0)
+    , m_nResyncs(0)
+    , m_nJitterSamples(0)
+    , m_nJitterSumNs(0)
+    , m_nJitterMaxNs(0)
+{
+    setTargetFps(nTargetFps);
+}
+
+
+void FrameDecimator::setTargetFps(int nFps)
+{
+    nFps = std::max(nFps, 1);
+    if (nFps == m_nTargetFps)
+        return;
+
+    m_nTargetFps = nFps;
+    m_nIntervalNs = NANOS_PER_SEC / nFps;
+
+    // keep the phase, just don't let a lower rate's credit turn into a burst at a higher one
+    m_nCreditNs = std::min(m_nCreditNs, m_nIntervalNs / 2);
+}
+
+
+void FrameDecimator::setInputFps(double dFps)
+{
+    m_nNominalInputNs = dFps > 0 ? (int64_t)(NANOS_PER_SEC / dFps) : 0;
+}
+
+
+bool FrameDecimator::keepFrame(int64_t nFrameTimeNs)
+{
+    int64_t nDeltaNs = nFrameTimeNs - m_nLastInputNs;
+
+    if (!m_fSynced || nDeltaNs <= 0 || nDeltaNs > RESYNC_NS)
+    {
+        if (m_fSynced)
+            m_nResyncs++;
+
+        // first frame or a timestamp step, always send it and start a new cadence
+        m_fSynced       = true;
+        m_nLastInputNs  = nFrameTimeNs;
+        m_nLastKeptNs   = nFrameTimeNs;
+        m_nCreditNs     = 0;
+        m_nInputAvgNs   = 0;
+        m_nKept++;
+        return true;
+    }
+
+    m_nLastInputNs = nFrameTimeNs;
+
+    // Count whole input intervals rather than raw timestamp deltas, so capture jitter
+    // can't move the phase while a frame OBS skipped still counts. Rounded at 3/4 of an
+    // interval, a late frame is a lot more likely than a skipped one.
+    int64_t nInputNs = m_nNominalInputNs ? m_nNominalInputNs : m_nInputAvgNs;
+    int64_t nSteps = nInputNs ? std::max<int64_t>(1, (nDeltaNs + nInputNs / 4) / nInputNs) : 1;
+    m_nInputAvgNs = m_nInputAvgNs ? m_nInputAvgNs + (nDeltaNs / nSteps - m_nInputAvgNs) / 16 : nDeltaNs;
+    if (!nInputNs)
+        nInputNs = m_nInputAvgNs;
+
+    m_nCreditNs += nSteps * nInputNs;
+
+    if (m_nCreditNs < m_nIntervalNs - nInputNs / 2)
+    {
+        m_nDropped++;
+        return false;
+    }
+
+    // in steady state what's left is under half an input interval, more means a stall
+    m_nCreditNs = std::min(m_nCreditNs - m_nIntervalNs, m_nIntervalNs / 2);
+
+    int64_t nExpectedNs = std::max(m_nIntervalNs, m_nInputAvgNs);
+    int64_t nJitterNs = std::abs((nFrameTimeNs - m_nLastKeptNs) - nExpectedNs);
+    m_nLastKeptNs = nFrameTimeNs;
+    m_nJitterSumNs += nJitterNs;
+    m_nJitterMaxNs = std::max(m_nJitterMaxNs, nJitterNs);
+    m_nJitterSamples++;
+
+    m_nKept++;
+    return true;
+}
+
+
+FrameDecimator::Stats FrameDecimator::getStats(void) const
+{
+    Stats stats;
+    stats.kept          = m_nKept;
+    stats.dropped       = m_nDropped;
+    stats.resyncs       = m_nResyncs;
+    stats.targetFps     = m_nTargetFps;
+    stats.jitterAvgUs   = m_nJitterSamples ? (m_nJitterSumNs / (int64_t)m_nJitterSamples) / 1000 : 0;
+    stats.jitterMaxUs   = m_nJitterMaxNs / 1000;
+    return stats;
+}
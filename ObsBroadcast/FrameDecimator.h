@@ -0,0 +1,91 @@
+/*
+ * Copyright (c) 2013-2021 MFCXY, Inc. <mfcxy@mfcxy.com>
+ * Copyright (c) 2020 The WebRTC project authors. All Rights Reserved.
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#pragma once
+
+#ifndef FRAME_DECIMATOR_H_
+#define FRAME_DECIMATOR_H_
+
+#include <cstdint>
+
+
+// Decides which captured frames go on to the encoder to hit a target frame rate.
+//
+// A phase accumulator collects input frame intervals, the nominal one from OBS's video
+// rate (or a smoothed measurement without it) times the number of intervals since the
+// previous frame, so timestamp jitter doesn't move the phase but a skipped frame counts,
+// and a frame is kept once a full output interval has built up, less half an input
+// interval so the decision falls midway between inputs. Keeping a
+// frame takes exactly one interval out of the accumulator rather than resetting it,
+// so 60 -> 48 keeps 4 of every 5 frames in a steady pattern and the average rate never
+// drifts. What's left after a kept frame is capped at half an interval so a stall isn't
+// followed by a burst, and a timestamp that goes backwards or jumps more than RESYNC_NS restarts it.
+//
+// Jitter is how far each kept frame interval is from the expected one, the target
+// interval or the input interval if the input is slower than the target.
+//
+// Not thread safe, VideoTrackSource serializes access.
+//
+class FrameDecimator
+{
+public:
+    static const int64_t    RESYNC_NS   = 1000000000;
+
+    struct Stats
+    {
+        uint64_t    kept;
+        uint64_t    dropped;
+        uint64_t    resyncs;        // accumulator restarts after a gap or a timestamp step
+        int         targetFps;
+        int64_t     jitterAvgUs;    // mean |kept frame interval - expected interval|
+        int64_t     jitterMaxUs;
+    };
+
+    explicit FrameDecimator(int nTargetFps);
+
+    // Target output rate, the rate actually used never exceeds the input rate
+    void setTargetFps(int nFps);
+    int targetFps(void) const { return m_nTargetFps; }
+
+    // Nominal capture rate, 0 to estimate it from the timestamps
+    void setInputFps(double dFps);
+
+    // True if the frame captured at nFrameTimeNs should be sent
+    bool keepFrame(int64_t nFrameTimeNs);
+
+    Stats getStats(void) const;
+
+private:
+    int         m_nTargetFps;
+    int64_t     m_nIntervalNs;
+
+    bool        m_fSynced;
+    int64_t     m_nLastInputNs;
+    int64_t     m_nLastKeptNs;
+    int64_t     m_nCreditNs;        // phase accumulator
+    int64_t     m_nInputAvgNs;      // smoothed input frame interval
+    int64_t     m_nNominalInputNs;  // from setInputFps(), 0 if unknown
+
+    uint64_t    m_nKept;
+    uint64_t    m_nDropped;
+    uint64_t    m_nResyncs;
+    uint64_t    m_nJitterSamples;
+    int64_t     m_nJitterSumNs;
+    int64_t     m_nJitterMaxNs;
+};
+
+#endif  // FRAME_DECIMATOR_H_
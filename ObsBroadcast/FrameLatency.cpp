@@ -0,0 +1,264 @@
+/*
+ * Copyright (c) 2013-2021 MFCXY, Inc. <mfcxy@mfcxy.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "FrameLatency.h"
+
+#include <libfcs/MfcTimer.h>
+
+#include <algorithm>
+#include <cstring>
+
+
+void FrameLatency::Histogram::reset(void)
+{
+    memset(m_nBuckets, 0, sizeof(m_nBuckets));
+    m_nCount    = 0;
+    m_nSumUs    = 0;
+    m_nMaxUs    = 0;
+}
+
+
+void FrameLatency::Histogram::add(int64_t nUs)
+{
+    nUs = std::max< int64_t >(nUs, 0);
+    m_nBuckets[bucket(nUs)]++;
+    m_nCount++;
+    m_nSumUs += nUs;
+    m_nMaxUs = std::max(m_nMaxUs, nUs);
+}
+
+
+int FrameLatency::Histogram::bucket(int64_t nUs)
+{
+    if (nUs < 10000)
+        return (int)(nUs / 100);
+    if (nUs < 200000)
+        return 100 + (int)((nUs - 10000) / 1000);
+    if (nUs < 2000000)
+        return 290 + (int)((nUs - 200000) / 10000);
+    return NUM_BUCKETS - 1;
+}
+
+
+int64_t FrameLatency::Histogram::bucketLowUs(int nBucket)
+{
+    if (nBucket < 100)
+        return nBucket * 100;
+    if (nBucket < 290)
+        return 10000 + (int64_t)(nBucket - 100) * 1000;
+    if (nBucket < NUM_BUCKETS - 1)
+        return 200000 + (int64_t)(nBucket - 290) * 10000;
+    return 2000000;
+}
+
+
+int64_t FrameLatency::Histogram::bucketHighUs(int nBucket)
+{
+    return bucketLowUs(nBucket + 1);
+}
+
+
+int64_t FrameLatency::Histogram::percentileUs(double dPct) const
+{
+    if (!m_nCount)
+        return 0;
+
+    double dRank = std::min(std::max(dPct, 0.0), 100.0) / 100.0 * (double)m_nCount;
+    uint64_t nBelow = 0;
+    for (int i = 0; i < NUM_BUCKETS; i++)
+    {
+        if (!m_nBuckets[i])
+            continue;
+
+        if ((double)(nBelow + m_nBuckets[i]) >= dRank)
+        {
+            // The overflow bucket has no upper edge, the max is the best we know
+            if (i == NUM_BUCKETS - 1)
+                return m_nMaxUs;
+
+            double dFrac = (dRank - (double)nBelow) / (double)m_nBuckets[i];
+            int64_t nLow = bucketLowUs(i);
+            int64_t nUs = nLow + (int64_t)(dFrac * (double)(bucketHighUs(i) - nLow));
+            return std::min(nUs, m_nMaxUs);
+        }
+        nBelow += m_nBuckets[i];
+    }
+    return m_nMaxUs;
+}
+
+
+FrameLatency& FrameLatency::instance(void)
+{
+    static FrameLatency latency;
+    return latency;
+}
+
+
+FrameLatency::FrameLatency()
+{
+    reset();
+}
+
+
+void FrameLatency::reset(void)
+{
+    std::lock_guard< std::mutex > lock(m_mutex);
+
+    memset(m_slots, 0, sizeof(m_slots));
+    for (auto& hist : m_hist)
+        hist.reset();
+    memset(m_nDrops, 0, sizeof(m_nDrops));
+    m_nFrames   = 0;
+    m_nSendUs   = 0;
+    m_dRecentUs = 0.0;
+}
+
+
+void FrameLatency::captured(uint16_t nId, int64_t nObsUs)
+{
+    int64_t nNowUs = nowUs();
+    std::lock_guard< std::mutex > lock(m_mutex);
+
+    Slot& slot = m_slots[nId & (SLOTS - 1)];
+    if (slot.fActive)
+        m_nDrops[DROP_LOST]++;
+
+    memset(&slot, 0, sizeof(slot));
+    slot.nId                = nId;
+    slot.fActive            = true;
+    slot.nObsUs             = std::max< int64_t >(nObsUs, 0);
+    slot.nMarkUs[CAPTURED]  = nNowUs;
+}
+
+
+void FrameLatency::mark(uint16_t nId, Mark mark)
+{
+    int64_t nNowUs = nowUs();
+    std::lock_guard< std::mutex > lock(m_mutex);
+
+    Slot& slot = m_slots[nId & (SLOTS - 1)];
+    if (!slot.fActive || slot.nId != nId)
+        return;
+
+    slot.nMarkUs[mark] = nNowUs;
+    if (mark == PACKETIZED)
+        complete(slot);
+}
+
+
+void FrameLatency::dropped(uint16_t nId, Drop reason)
+{
+    std::lock_guard< std::mutex > lock(m_mutex);
+
+    Slot& slot = m_slots[nId & (SLOTS - 1)];
+    if (!slot.fActive || slot.nId != nId)
+        return;
+
+    slot.fActive = false;
+    m_nDrops[reason]++;
+}
+
+
+void FrameLatency::sendDelay(int64_t nAvgUs)
+{
+    std::lock_guard< std::mutex > lock(m_mutex);
+
+    m_nSendUs = std::max< int64_t >(nAvgUs, 0);
+    m_hist[STAGE_SEND].add(m_nSendUs);
+}
+
+
+void FrameLatency::complete(Slot& slot)
+{
+    const int64_t* pMarks = slot.nMarkUs;
+    slot.fActive = false;
+
+    // A stage is only known if both of its marks were seen
+    auto addStage = [this, pMarks](Stage stage, Mark from, Mark to)
+    {
+        if (pMarks[from] && pMarks[to])
+            m_hist[stage].add(pMarks[to] - pMarks[from]);
+    };
+
+    m_hist[STAGE_OBS].add(slot.nObsUs);
+    addStage(STAGE_COPY,        CAPTURED,       DELIVERED);
+    addStage(STAGE_QUEUE,       DELIVERED,      ENCODE_START);
+    addStage(STAGE_ENCODE,      ENCODE_START,   ENCODE_END);
+    addStage(STAGE_PACKETIZE,   ENCODE_END,     PACKETIZED);
+
+    int64_t nTotalUs = slot.nObsUs + (pMarks[PACKETIZED] - pMarks[CAPTURED]) + m_nSendUs;
+    m_hist[STAGE_TOTAL].add(nTotalUs);
+    m_dRecentUs = m_nFrames ? m_dRecentUs + RECENT_WEIGHT * ((double)nTotalUs - m_dRecentUs) : (double)nTotalUs;
+    m_nFrames++;
+}
+
+
+FrameLatency::Stats FrameLatency::getStats(void) const
+{
+    std::lock_guard< std::mutex > lock(m_mutex);
+
+    Stats stats;
+    stats.frames        = m_nFrames;
+    stats.recentTotalUs = (int64_t)m_dRecentUs;
+    memcpy(stats.drops, m_nDrops, sizeof(stats.drops));
+    for (int i = 0; i < NUM_STAGES; i++)
+    {
+        const Histogram& hist = m_hist[i];
+        StageStats& stage = stats.stages[i];
+        stage.count = hist.count();
+        stage.avgUs = hist.avgUs();
+        stage.p50Us = hist.percentileUs(50);
+        stage.p95Us = hist.percentileUs(95);
+        stage.p99Us = hist.percentileUs(99);
+        stage.maxUs = hist.maxUs();
+    }
+    return stats;
+}
+
+
+const char* FrameLatency::stageName(Stage stage)
+{
+    switch (stage)
+    {
+    case STAGE_OBS:         return "obs";
+    case STAGE_COPY:        return "copy";
+    case STAGE_QUEUE:       return "queue";
+    case STAGE_ENCODE:      return "encode";
+    case STAGE_PACKETIZE:   return "packetize";
+    case STAGE_SEND:        return "send";
+    case STAGE_TOTAL:       return "total";
+    default:                return "?";
+    }
+}
+
+
+const char* FrameLatency::dropName(Drop reason)
+{
+    switch (reason)
+    {
+    case DROP_DECIMATED:    return "decimated";
+    case DROP_SOURCE:       return "source";
+    case DROP_ENCODER:      return "encoder";
+    case DROP_LOST:         return "lost";
+    default:                return "?";
+    }
+}
+
+
+int64_t FrameLatency::nowUs(void)
+{
+    return (int64_t)MfcTimer::MonoUs();
+}
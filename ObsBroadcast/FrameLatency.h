@@ -0,0 +1,175 @@
+/*
+ * Copyright (c) 2013-2021 MFCXY, Inc. <mfcxy@mfcxy.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#pragma once
+
+#ifndef FRAME_LATENCY_H_
+#define FRAME_LATENCY_H_
+
+#include <cstdint>
+#include <mutex>
+
+
+// Capture to wire latency of the video pipeline, per stage.
+//
+// Every frame OBS hands to WebRTCStream gets an id (the same one VideoTrackSource puts
+// on the webrtc::VideoFrame), and each stage marks it as it goes by: CAPTURED when
+// onVideoFrame() gets it, DELIVERED when VideoTrackSource passes it on to WebRTC,
+// ENCODE_START and ENCODE_END around x264, PACKETIZED when OnEncodedImage() returns
+// (WebRTC packetizes synchronously in there and queues the packets in the pacer).
+// The marks live in a ring of SLOTS entries indexed by the low bits of the id, a mark
+// for an id that no longer owns its slot is ignored.
+//
+// PACKETIZED completes the frame and its stage times go into the histograms. How long
+// the frame sat in OBS before CAPTURED comes from OBS's own timestamp, and how long the
+// packets then wait in the pacer isn't visible per frame, so SEND is fed once per stats
+// interval with the average packet send delay from the outbound RTP stats. TOTAL adds
+// the latest SEND average to each frame's OBS to PACKETIZED time.
+//
+// Frames that leave early are counted by reason; a slot that is reused before its
+// frame completed was lost inside WebRTC (its encoder queue dropped it).
+//
+// Process wide, the marks come from the OBS video thread and the encoder queue.
+//
+class FrameLatency
+{
+public:
+    enum Mark
+    {
+        CAPTURED = 0,
+        DELIVERED,
+        ENCODE_START,
+        ENCODE_END,
+        PACKETIZED,
+        NUM_MARKS
+    };
+
+    enum Stage
+    {
+        STAGE_OBS = 0,          // OBS render to onVideoFrame()
+        STAGE_COPY,             // pacer decision, scale and copy in VideoTrackSource
+        STAGE_QUEUE,            // WebRTC's encoder queue
+        STAGE_ENCODE,           // x264
+        STAGE_PACKETIZE,        // RTP packetization into the pacer
+        STAGE_SEND,             // pacer, per stats interval
+        STAGE_TOTAL,
+        NUM_STAGES
+    };
+
+    enum Drop
+    {
+        DROP_DECIMATED = 0,     // frame rate decimator
+        DROP_SOURCE,            // no buffer in VideoTrackSource
+        DROP_ENCODER,           // paused, overload skip or x264 had no output
+        DROP_LOST,              // never completed, dropped inside WebRTC
+        NUM_DROPS
+    };
+
+    static const int        SLOTS           = 256;      // must be a power of 2
+    static constexpr double RECENT_WEIGHT   = 0.05;     // EWMA weight of the recent total
+
+    // Fixed buckets: 100us up to 10ms, 1ms up to 200ms, 10ms up to 2s, then overflow
+    class Histogram
+    {
+    public:
+        static const int NUM_BUCKETS = 100 + 190 + 180 + 1;
+
+        Histogram() { reset(); }
+
+        void reset(void);
+        void add(int64_t nUs);
+
+        uint64_t count(void) const  { return m_nCount; }
+        int64_t avgUs(void) const   { return m_nCount ? m_nSumUs / (int64_t)m_nCount : 0; }
+        int64_t maxUs(void) const   { return m_nMaxUs; }
+
+        // dPct in 0..100, interpolated within the bucket
+        int64_t percentileUs(double dPct) const;
+
+        static int bucket(int64_t nUs);
+        static int64_t bucketLowUs(int nBucket);
+        static int64_t bucketHighUs(int nBucket);
+
+    private:
+        uint32_t    m_nBuckets[NUM_BUCKETS];
+        uint64_t    m_nCount;
+        int64_t     m_nSumUs;
+        int64_t     m_nMaxUs;
+    };
+
+    struct StageStats
+    {
+        uint64_t    count;
+        int64_t     avgUs;
+        int64_t     p50Us;
+        int64_t     p95Us;
+        int64_t     p99Us;
+        int64_t     maxUs;
+    };
+
+    struct Stats
+    {
+        uint64_t    frames;                 // frames that completed
+        uint64_t    drops[NUM_DROPS];
+        int64_t     recentTotalUs;          // EWMA of TOTAL, 0 before the first frame
+        StageStats  stages[NUM_STAGES];
+    };
+
+    static FrameLatency& instance(void);
+
+    // Clears everything, for a new stream
+    void reset(void);
+
+    // New frame from OBS, nObsUs is how long ago OBS rendered it
+    void captured(uint16_t nId, int64_t nObsUs);
+
+    // Later marks, PACKETIZED completes the frame
+    void mark(uint16_t nId, Mark mark);
+
+    void dropped(uint16_t nId, Drop reason);
+
+    // Average pacer delay per packet over the last stats interval
+    void sendDelay(int64_t nAvgUs);
+
+    Stats getStats(void) const;
+
+    static const char* stageName(Stage stage);
+    static const char* dropName(Drop reason);
+
+private:
+    struct Slot
+    {
+        uint16_t    nId;
+        bool        fActive;
+        int64_t     nObsUs;
+        int64_t     nMarkUs[NUM_MARKS];
+    };
+
+    FrameLatency();
+
+    void complete(Slot& slot);
+
+    static int64_t nowUs(void);
+
+    mutable std::mutex  m_mutex;
+    Slot                m_slots[SLOTS];
+    Histogram           m_hist[NUM_STAGES];
+    uint64_t            m_nFrames;
+    uint64_t            m_nDrops[NUM_DROPS];
+    int64_t             m_nSendUs;
+    double              m_dRecentUs;
+};
+
+#endif  // FRAME_LATENCY_H_
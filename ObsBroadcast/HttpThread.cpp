@@ -13,16 +13,15 @@
  * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
  * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
  */
+#include <algorithm>
 #include <ctime>
 #include <list>
 #ifdef _WIN32
 #include <io.h>
 #else
-#include <sys/timeb.h>
 #include <pthread.h>
 #endif
 
-#include <boost/date_time/posix_time/posix_time_types.hpp>
 #include <curl/curl.h>
 
 // obs includes
@@ -32,6 +31,8 @@
 // MFC includes
 #include <libfcs/Log.h>
 #include <libfcs/MfcJson.h>
+#include <libfcs/MfcTimer.h>
+#include <libfcs/MfcTrace.h>
 
 // solution includes
 #include <libPlugins/HttpRequest.h>
@@ -48,25 +49,65 @@
 
 using std::string;
 
-// https://stackoverflow.com/questions/27314485/use-of-deleted-function-error-with-stdatomic-int
-std::atomic< uint32_t >         CHttpThread::sm_dwThreadCmd = { THREADCMD_NONE };
-pthread_mutex_t                 CHttpThread::sm_mutexTimed;
 MFC_Shared_Mem::CMessageManager CHttpThread::sm_mem;
+std::mutex                      CHttpThread::sm_cmdMutex;
+std::deque< CHttpThread::Cmd >  CHttpThread::sm_cmds;
+std::atomic< bool >             CHttpThread::sm_fShutdown = { false };
+std::atomic< uint64_t >         CHttpThread::sm_nWakeups = { 0 };
+std::atomic< uint64_t >         CHttpThread::sm_nTimeouts = { 0 };
+std::atomic< uint64_t >         CHttpThread::sm_nCommands = { 0 };
+std::atomic< uint64_t >         CHttpThread::sm_nHeartbeats = { 0 };
+std::atomic< int64_t >          CHttpThread::sm_nCmdLatencySumNs = { 0 };
+std::atomic< int64_t >          CHttpThread::sm_nCmdLatencyMaxNs = { 0 };
+
+// how long waitMessage() sleeps when no deadline is armed. Anything else that wakes an
+// idle thread is a doorbell ring and shows up in sm_nWakeups - sm_nTimeouts.
+static const int64_t            IDLE_WAIT_MS    = 3600 * 1000;
 
 extern CBroadcastCtx g_ctx; // part of MFCLibPlugins.lib::MfcPluginAPI.obj
 
 //---------------------------------------------------------------------------
-// setStop
+// setCmd
 //
-// access member for stop flag.
+// queue a command for the thread and ring its doorbell.
 void CHttpThread::setCmd(uint32_t dwCmd)
 {
-    sm_dwThreadCmd = dwCmd;
+    if (dwCmd == THREADCMD_NONE)
+        return;
+
+    if (dwCmd == THREADCMD_SHUTDOWN)
+        sm_fShutdown.store(true, std::memory_order_release);
+
+    {
+        std::lock_guard< std::mutex > lk(sm_cmdMutex);
+        sm_cmds.push_back(Cmd{ dwCmd, MfcTimer::MonoNs() });
+    }
+    sm_mem.notify(ADDR_OBS_BROADCAST_Plugin);
 }
 
-uint32_t CHttpThread::getCmd(void)
+
+bool CHttpThread::popCmd(Cmd& cmd)
 {
-    return sm_dwThreadCmd;
+    std::lock_guard< std::mutex > lk(sm_cmdMutex);
+    if (sm_cmds.empty())
+        return false;
+
+    cmd = sm_cmds.front();
+    sm_cmds.pop_front();
+    return true;
+}
+
+
+CHttpThread::Stats CHttpThread::getStats(void)
+{
+    Stats stats;
+    stats.wakeups           = sm_nWakeups.load();
+    stats.timeouts          = sm_nTimeouts.load();
+    stats.commands          = sm_nCommands.load();
+    stats.heartbeats        = sm_nHeartbeats.load();
+    stats.cmdLatencyAvgUs   = stats.commands ? (sm_nCmdLatencySumNs.load() / (int64_t)stats.commands) / 1000 : 0;
+    stats.cmdLatencyMaxUs   = sm_nCmdLatencyMaxNs.load() / 1000;
+    return stats;
 }
 
 
@@ -84,7 +125,7 @@ int stopBroadcasterCallback(void* clientp, curl_off_t dltotal, curl_off_t dlnow,
     UNUSED_PARAMETER(dlnow);
     UNUSED_PARAMETER(ultotal);
     UNUSED_PARAMETER(uLow);
-    if (CHttpThread::getCmd() == THREADCMD_SHUTDOWN)
+    if (CHttpThread::isShuttingDown())
     {
         _TRACE("Terminating http request!");
         return 1;
@@ -98,20 +139,16 @@ int stopBroadcasterCallback(void* clientp, curl_off_t dltotal, curl_off_t dlnow,
 //
 // Http thread.
 CHttpThread::CHttpThread()
-{
-    // create exit timed mutex
-    pthread_mutexattr_t attrTimed;
-    pthread_mutexattr_init(&attrTimed);
-    pthread_mutexattr_settype(&attrTimed, PTHREAD_MUTEX_NORMAL);
-    pthread_mutex_init(&sm_mutexTimed, &attrTimed);
-    setCmd(THREADCMD_NONE);
-}
+    : m_nHeartbeatMs(NO_DEADLINE)
+    , m_nPingMs(NO_DEADLINE)
+    , m_nErrCx(0)
+    , m_nPingCx(0)
+    , m_bStarted(false)
+{}
 
 
 CHttpThread::~CHttpThread()
-{
-    pthread_mutex_destroy(&sm_mutexTimed);
-}
+{}
 
 
 //---------------------------------------------------------------------------
@@ -133,15 +170,10 @@ void* CHttpThread::startProcessThread(void* pCtx)
 //---------------------------------------------------------------------------
 bool CHttpThread::Start()
 {
-    // hold mutex locked unless work is needed
-    pthread_mutex_lock(&sm_mutexTimed);
-
     bool bInitSharedMem = sm_mem.init(true);
     if (bInitSharedMem)
     {
-        assert(sm_mem.getBroadcastPluginMutex());
-        sm_mem.getBroadcastPluginMutex()->lock();
-        setCmd(THREADCMD_NONE);
+        sm_fShutdown = false;
         pthread_create(&m_thread, nullptr, CHttpThread::startProcessThread, this);
         return true;
     }
@@ -158,50 +190,13 @@ bool CHttpThread::Start()
 bool CHttpThread::Stop(int nTimeout)
 {
     UNUSED_PARAMETER(nTimeout);
+    // setting the cmd rings our doorbell and wakes the thread
     setCmd(THREADCMD_SHUTDOWN);
-    // clear the mutex and this will wake the thread
-    sm_mem.getBroadcastPluginMutex()->unlock();
-    // pthread_mutex_unlock(&sm_mutexTimed);
     pthread_join(m_thread, nullptr);
     return true;
 }
 
 
-#ifdef __APPLE__
-// apple doesn't define pthread_mutex_timedlock
-int pthread_mutex_timedlock(pthread_mutex_t *mutex, const struct timespec *timeout)
-{
-    int nResult;
-    struct timeb currsystime;
-    const int64_t nNanoToSec = 1000000;
-    _TRACE("Start pthread_mutex_timedlock");
-    bool bDone = false;
-    do
-    {
-        nResult = pthread_mutex_trylock(mutex);
-        if (EBUSY == nResult)
-        {
-            timespec ts;
-            ts.tv_sec = 0;
-            ts.tv_nsec = nNanoToSec;
-            nanosleep(&ts, &ts);
-            ftime(&currsystime);
-            if (currsystime.time >= timeout->tv_sec)
-                bDone = true;
-        }
-        else
-        {
-            _TRACE("Break");
-            break;
-        }
-    } while (nResult != 0 && !bDone);
-    _TRACE("End pthread_mutex_timedlock");
-
-    return nResult;
-}
-#endif
-
-
 //---------------------------------------------------------------------------
 // Process
 //
@@ -209,162 +204,203 @@ int pthread_mutex_timedlock(pthread_mutex_t *mutex, const struct timespec *timeo
 //---------------------------------------------------------------------------
 void CHttpThread::Process()
 {
-    bool bConnected = false, bDone = false, bStarted = false;
-    boost::posix_time::ptime nWakeTm, nLastPingTm;
     CMFCPluginAPI api(stopBroadcasterCallback);
-    size_t nErrCx = 0, nPingCx = 0;
-    int nErr = 0, nSleepTimer = 0;
     CBroadcastCtx ctx;
-    uint32_t dwCmd = 0u;
+    bool bDone = false;
+    Cmd cmd;
+
+    // to start off, poll right away. The ping is armed once a worker process reports in.
+    m_nHeartbeatMs  = MfcTimer::MonoMs();
+    m_nPingMs       = NO_DEADLINE;
+    m_nErrCx        = 0;
+    m_bStarted      = false;
 
-    // to start off, set sleep timeout to now so it will trigger a polling action right away.
-    // Set initial ping time to now as well.
-    nWakeTm     = boost::posix_time::second_clock::universal_time();
-    nLastPingTm = boost::posix_time::second_clock::local_time() - boost::posix_time::seconds((CHttpThread::PING_MSG_INTERVAL - 5));
+    MfcTrace::SetThreadName("http");
 
     while (!bDone)
     {
         // Collect current ctx data from main thread
         ctx = g_ctx;
 
-        if (boost::posix_time::second_clock::universal_time() >= nWakeTm)
+        int64_t nNowMs = MfcTimer::MonoMs();
+        if (nNowMs >= m_nHeartbeatMs)
         {
-            bConnected = false;
-            if (ctx.agentPolling)
-            {
-                // Only send heartbeat to agentSvc.php when we attached to an mfc WebRTC backend
-                if (ctx.isMfc)
-                {
-                    int nInterval = ctx.isLoggedIn ? 15 : 8;
-                    if ((nErr = api.SendHeartBeat()) == 0)
-                    {
-                        bConnected = true;
-                        ctx = g_ctx;
-                        nSleepTimer = nInterval;
-                        nErrCx = 0;
-                    }
-                    //
-                    // Launch CEF Login window, we need auth credentials before we can login.
-                    //
-                    else if (nErr == ERR_NEED_LOGIN)
-                    {
-                        // Send message to SK log aboput login required, pause until we read a msg
-                        // of MSG_TYPE_DOCREDENTIALS or MSG_TYPE_SET_MSK and we can resume heartbeat calls
-                        if (g_ctx.activeState != SkNoCredentials)
-                        {
-                            g_ctx.activeState = SkNoCredentials;
-                            _MESG("state => SkNoCredentials, stopping agent polling");
-                            g_ctx.stopPolling();
+            int64_t nNextMs = heartbeat(api, ctx);
+            m_nHeartbeatMs = nNextMs == NO_DEADLINE ? NO_DEADLINE : MfcTimer::MonoMs() + nNextMs;
+        }
 
-#if MFC_BROWSER_LOGIN
-                            // TODO: Honor an option/config setting to only load login window when manually
-                            // started by user, otherwise we launch it automatically here.
-                            if (!CObsUtil::ExecMFCLogin())
-                                _MESG("SendHeartbeat() response ERR_NEED_LOGIN, but ExecMFCLogin() FAILED to start process.");
-#endif
-                        }
-                    }
-                    //
-                    // set sleep timer to either normal interval seconds (if we have less than 5 errors) or
-                    // triple the normnal interval if we have 5 or more since the last successful heartbeat
-                    //
-                    else nSleepTimer = (++nErrCx < 5 ? nInterval : (nInterval * 3));
-                }
-                else nSleepTimer = 1;   // set sleep timer to 1 second when we aren't a webRtc stream
+        if (nNowMs >= m_nPingMs)
+        {
+            if (!m_workerPids.empty())
+            {
+                sm_mem.sendMessage(ADDR_FCSLOGIN, ADDR_OBS_BROADCAST_Plugin, MSG_TYPE_PING, "Ping %d obsBroadcast", (int)m_nPingCx++);
+                m_nPingMs = nNowMs + CHttpThread::PING_MSG_INTERVAL * 1000;
             }
-            else nSleepTimer = 1;       // set sleep timer to 1 second when we are paused
-
-            // Set the sleep timer forward by +nSleepTimer seconds before we process another heartbeat api check
-            nWakeTm = boost::posix_time::second_clock::universal_time() + boost::posix_time::seconds( nSleepTimer );
+            else m_nPingMs = NO_DEADLINE;
         }
 
-        boost::posix_time::time_duration diffTm = boost::posix_time::second_clock::local_time() - nLastPingTm;
-        if (diffTm.total_seconds() > CHttpThread::PING_MSG_INTERVAL)
+        // Sleep until the nearest deadline, or until a shared mem message or thread
+        // cmd rings the doorbell. Every return is counted, so the exit stats show
+        // the real idle wakeup rate on each platform.
+        int64_t nDeadlineMs = std::min(m_nHeartbeatMs, m_nPingMs);
+        int64_t nWaitMs = nDeadlineMs == NO_DEADLINE ? IDLE_WAIT_MS
+                        : std::min(std::max< int64_t >(nDeadlineMs - MfcTimer::MonoMs(), 0), IDLE_WAIT_MS);
+
+        if (nWaitMs > 0)
         {
-            if (!m_workerPids.empty())
-                sm_mem.sendMessage(ADDR_FCSLOGIN, ADDR_OBS_BROADCAST_Plugin, MSG_TYPE_PING, "Ping %d obsBroadcast", nPingCx++);
+            if (!sm_mem.waitMessage(ADDR_OBS_BROADCAST_Plugin, (unsigned int)nWaitMs))
+                sm_nTimeouts++;
+            sm_nWakeups++;
+        }
 
-            nLastPingTm = boost::posix_time::second_clock::local_time();
+        // Commands in the order they were queued
+        while (!bDone && popCmd(cmd))
+        {
+            int64_t nLatencyNs = (int64_t)MfcTimer::DiffNs(MfcTimer::MonoNs(), cmd.nQueuedNs);
+            sm_nCmdLatencySumNs += nLatencyNs;
+            int64_t nMax = sm_nCmdLatencyMaxNs.load();
+            while (nLatencyNs > nMax && !sm_nCmdLatencyMaxNs.compare_exchange_weak(nMax, nLatencyNs))
+                ;
+            sm_nCommands++;
+
+            MFC_TRACE_SPAN(cmdSpan, "http", "threadCmd");
+            cmdSpan.SetArg("cmd", cmd.dwCmd);
+            bDone = !handleCmd(cmd.dwCmd);
         }
 
-        // Sleep for at most 1 second (if we aren't woken up by acquisition of lock) before we timeout and
-        // check for threadcmd events and loop starting block over and potentially sending a heartbeat API
-        //
-        boost::posix_time::ptime t1 = boost::posix_time::second_clock::universal_time() + boost::posix_time::seconds( 1 );
-        sm_mem.getBroadcastPluginMutex()->timed_lock( t1 );
+        // Check for any shared mem messages for us before looping
+        if (!bDone)
+            readSharedMsg(ctx);
+    }
 
-        // If we woke up from a thread cmd being set, collect threadCmd and take action,
-        // otherwise return to top of loop and check for heatbeat/ping times before sleeping
-        if ((dwCmd = getCmd()) != THREADCMD_NONE)
+    MFC_Shared_Mem::CShmRing::Stats stats;
+    if (sm_mem.getStats(ADDR_OBS_BROADCAST_Plugin, stats))
+        _TRACE("IPC %s: %u sent, %u received, %u dropped, %u stale, latency avg %llu us max %llu us", ADDR_OBS_BROADCAST_Plugin,
+               stats.sent, stats.received, stats.dropped, stats.stale,
+               (unsigned long long)stats.latencyAvgUs, (unsigned long long)stats.latencyMaxUs);
+
+    Stats threadStats = getStats();
+    _TRACE("HTTP thread: %llu wakeups (%llu on a deadline), %llu heartbeats, %llu commands; command latency avg %lldus max %lldus",
+           (unsigned long long)threadStats.wakeups,
+           (unsigned long long)threadStats.timeouts,
+           (unsigned long long)threadStats.heartbeats,
+           (unsigned long long)threadStats.commands,
+           (long long)threadStats.cmdLatencyAvgUs,
+           (long long)threadStats.cmdLatencyMaxUs);
+}
+
+
+int64_t CHttpThread::heartbeat(CMFCPluginAPI& api, CBroadcastCtx& ctx)
+{
+    // Nothing to poll while paused or on a non MFC profile, THREADCMD_RESUME/PROFILE
+    // or new credentials re-arm the heartbeat
+    if (!ctx.agentPolling || !ctx.isMfc)
+        return NO_DEADLINE;
+
+    MFC_TRACE_SCOPE("http", "heartbeat");
+    sm_nHeartbeats++;
+
+    // Only send heartbeat to agentSvc.php when we attached to an mfc WebRTC backend
+    int64_t nInterval = ctx.isLoggedIn ? 15 : 8;
+    int nErr;
+
+    if ((nErr = api.SendHeartBeat()) == 0)
+    {
+        ctx = g_ctx;
+        m_nErrCx = 0;
+        return nInterval * 1000;
+    }
+    //
+    // Launch CEF Login window, we need auth credentials before we can login.
+    //
+    else if (nErr == ERR_NEED_LOGIN)
+    {
+        // Send message to SK log aboput login required, pause until we read a msg
+        // of MSG_TYPE_DOCREDENTIALS or MSG_TYPE_SET_MSK and we can resume heartbeat calls
+        if (g_ctx.activeState != SkNoCredentials)
         {
-            // Reset the wakeup time in case we are changing something that relies on not being asleep
-            nWakeTm = boost::posix_time::second_clock::universal_time();
+            g_ctx.activeState = SkNoCredentials;
+            _MESG("state => SkNoCredentials, stopping agent polling");
+            g_ctx.stopPolling();
 
-            switch (dwCmd)
-            {
-            case THREADCMD_SHUTDOWN:
-                g_ctx.stopPolling();
-                if ( ! bDone )
-                {
-                    sm_mem.sendMessage(ADDR_FCSLOGIN, ADDR_OBS_BROADCAST_Plugin, MSG_TYPE_SHUTDOWN, "Shutdown!");
-                    bDone = true;
-                }
-                break;
+#if MFC_BROWSER_LOGIN
+            // TODO: Honor an option/config setting to only load login window when manually
+            // started by user, otherwise we launch it automatically here.
+            if (!CObsUtil::ExecMFCLogin())
+                _MESG("SendHeartbeat() response ERR_NEED_LOGIN, but ExecMFCLogin() FAILED to start process.");
+#endif
+        }
 
-            case THREADCMD_PAUSE:
-                if ( g_ctx.agentPolling )
-                {
-                    _TRACE("HttpThread polling PAUSED.");
-                    g_ctx.stopPolling();
-                }
-                break;
+        // polling is stopped now, the next pass sees that and stops rescheduling
+        return nInterval * 1000;
+    }
 
-            case THREADCMD_RESUME:
-                if ( ! g_ctx.agentPolling )
-                {
-                    _TRACE("HttpThread polling UNPAUSED.");
-                    g_ctx.startPolling();
-                }
-                break;
+    //
+    // set sleep timer to either normal interval seconds (if we have less than 5 errors) or
+    // triple the normnal interval if we have 5 or more since the last successful heartbeat
+    //
+    return (++m_nErrCx < 5 ? nInterval : (nInterval * 3)) * 1000;
+}
 
-            case THREADCMD_STREAMSTART:
-                if ( ! bStarted )
-                {
-                    _TRACE("Stream Started, widening poll interval.");
-                    bStarted = true;
-                }
-                break;
 
-            case THREADCMD_STREAMSTOP:
-                if ( bStarted )
-                {
-                    _TRACE("Stream Stopped, narrowing poll interval.");
-                    bStarted = false;
+bool CHttpThread::handleCmd(uint32_t dwCmd)
+{
+    // Poll right away in case we are changing something that relies on not being asleep
+    m_nHeartbeatMs = MfcTimer::MonoMs();
 
-                    // also reset the wake time to be next loop since it could be upto 6 seconds away still
-                    nWakeTm = boost::posix_time::second_clock::universal_time();
-                }
-                break;
-
-            case THREADCMD_PROFILE:
-                // < recursive_mutex > lk = g_ctx.sharedLock();
-                //
-                // Send profile change event to any shared memory segment subscribers
-                // that may be interested in it (along with profile data, server, etc)
-                //
-                g_ctx.startPolling();
-                break;
-
-            default:
-                _TRACE("UNHANDLED ThreadCmd value: %u -- dropping!", dwCmd);
-                break;
-            }
-            setCmd(THREADCMD_NONE);
+    switch (dwCmd)
+    {
+    case THREADCMD_SHUTDOWN:
+        g_ctx.stopPolling();
+        sm_mem.sendMessage(ADDR_FCSLOGIN, ADDR_OBS_BROADCAST_Plugin, MSG_TYPE_SHUTDOWN, "Shutdown!");
+        return false;
+
+    case THREADCMD_PAUSE:
+        if ( g_ctx.agentPolling )
+        {
+            _TRACE("HttpThread polling PAUSED.");
+            g_ctx.stopPolling();
         }
-        // Check for any shared mem messages for us before looping
-        if (!bDone)
-            readSharedMsg(ctx);
+        break;
+
+    case THREADCMD_RESUME:
+        if ( ! g_ctx.agentPolling )
+        {
+            _TRACE("HttpThread polling UNPAUSED.");
+            g_ctx.startPolling();
+        }
+        break;
+
+    case THREADCMD_STREAMSTART:
+        if ( ! m_bStarted )
+        {
+            _TRACE("Stream Started, widening poll interval.");
+            m_bStarted = true;
+        }
+        break;
+
+    case THREADCMD_STREAMSTOP:
+        if ( m_bStarted )
+        {
+            _TRACE("Stream Stopped, narrowing poll interval.");
+            m_bStarted = false;
+        }
+        break;
+
+    case THREADCMD_PROFILE:
+        // < recursive_mutex > lk = g_ctx.sharedLock();
+        //
+        // Send profile change event to any shared memory segment subscribers
+        // that may be interested in it (along with profile data, server, etc)
+        //
+        g_ctx.startPolling();
+        break;
+
+    default:
+        _TRACE("UNHANDLED ThreadCmd value: %u -- dropping!", dwCmd);
+        break;
     }
+    return true;
 }
 
 
@@ -381,7 +417,7 @@ void CHttpThread::readSharedMsg(CBroadcastCtx& ctx)
         switch (msg.getID())
         {
         case MSG_TYPE_PING:
-            _TRACE("MSG_TYPE_PING  To:%s From:%s Type:%d Msg: %s\n", sTo.c_str(), msg.getFrom(), msg.getID(), sMsg.c_str());
+            _BTRACE("MSG_TYPE_PING  To:%s From:%s Type:%d Msg: %s", sTo.c_str(), msg.getFrom(), msg.getID(), sMsg.c_str());
             break;
 
         case MSG_TYPE_LOG:
@@ -394,6 +430,8 @@ void CHttpThread::readSharedMsg(CBroadcastCtx& ctx)
             if (nPid > 0)
             {
                 m_workerPids.insert(nPid);
+                if (m_nPingMs == NO_DEADLINE)
+                    m_nPingMs = MfcTimer::MonoMs() + CHttpThread::PING_MSG_INTERVAL * 1000;
                 // _TRACE("MSG_TYPE_START  To:%s From:%s Type:%d Worker process id %d (%zu total workers running)",
                 //        sTo.c_str(),
                 //        msg.getFrom(),
@@ -430,10 +468,11 @@ void CHttpThread::readSharedMsg(CBroadcastCtx& ctx)
             _TRACE("MSG_TYPE_SET_MSK  To:%s From:%s Type:%d Msg: %s\n", sTo.c_str(), msg.getFrom(), msg.getID(), sMsg.c_str());
             if (sMsg.length() > 0)
             {
-                ctx.cfg.set("ctx", sMsg);
-                ctx.cfg.writePluginConfig();
+                ctx.cfg.set(SkCfg::Ctx, sMsg);
+                ctx.cfg.savePluginConfig();
                 // Send ctx data back to main thread after we updated it
                 g_ctx = ctx;
+                m_nHeartbeatMs = MfcTimer::MonoMs();
             }
             break;
 
@@ -443,11 +482,12 @@ void CHttpThread::readSharedMsg(CBroadcastCtx& ctx)
             {
                 MfcJsonObj js;
                 ctx.cfg.Serialize(js);
-                ctx.cfg.writePluginConfig();
+                ctx.cfg.savePluginConfig();
 
                 // Send ctx data back to main thread after we updated it
                 g_ctx = ctx;
                 g_ctx.agentPolling = true;
+                m_nHeartbeatMs = MfcTimer::MonoMs();
 
             }
             else
@@ -17,6 +17,9 @@
 #pragma once
 
 #include <atomic>
+#include <cstdint>
+#include <deque>
+#include <mutex>
 
 #include <libobs/util/threading.h>
 
@@ -29,12 +32,25 @@
 #define THREADCMD_SHUTDOWN      255     // request to stop any http polling and end thread
 
 class CBroadcastCtx;
+class CMFCPluginAPI;
 
 namespace MFC_Shared_Mem {
 class CMessageManager;
 }
 
 
+// Control loop of the plugin: agentSvc heartbeats, IPC with the login/CEF processes
+// and the THREADCMD_* commands from the UI thread, all handled on one thread.
+//
+// Everything arrives as an event: setCmd() queues a command and rings the IPC
+// doorbell, IPC messages ring it themselves, and the heartbeat and ping each have a
+// deadline on the monotonic clock. The thread sleeps on the doorbell until the
+// nearest deadline, or for IDLE_WAIT_MS when there is none (polling paused, not an
+// MFC profile, no worker processes to ping), and a command is acted on as soon as it
+// is queued. How often an idle thread really wakes depends on the doorbell sleeping
+// in the kernel (CShmDoorbell); Stats::wakeups counts it. Commands are handled in the order
+// they were queued; none are lost when several arrive back to back.
+//
 class CHttpThread
 {
 public:
@@ -42,6 +58,17 @@ public:
     ~CHttpThread();
 
     const static int PING_MSG_INTERVAL = 120; // every 2 minutes we send a ping msg over the shared memory segment
+    const static int64_t NO_DEADLINE = INT64_MAX;
+
+    struct Stats
+    {
+        uint64_t    wakeups;            // times the thread woke up
+        uint64_t    timeouts;           // wakeups for a deadline rather than an event
+        uint64_t    commands;           // THREADCMD_* handled
+        uint64_t    heartbeats;         // heartbeat passes run
+        int64_t     cmdLatencyAvgUs;    // setCmd() to the command being handled
+        int64_t     cmdLatencyMaxUs;
+    };
 
     bool Start();
     bool Stop(int);
@@ -61,22 +88,56 @@ public:
 
     static MFC_Shared_Mem::CMessageManager& getSharedMemManager() { return sm_mem; }
 
-    // thread-safe methods for setting and getting the current thread cmd
-    static uint32_t                         getCmd(void);
+    // thread-safe, queues a THREADCMD_* for the thread and wakes it
     static void                             setCmd(uint32_t dwCmd);
 
+    // true once THREADCMD_SHUTDOWN has been queued, checked by curl to abort requests
+    static bool                             isShuttingDown(void) { return sm_fShutdown.load(std::memory_order_acquire); }
+
     static void*                            startProcessThread(void* pCtx);
 
+    static Stats                            getStats(void);
+
     static MFC_Shared_Mem::CMessageManager  sm_mem;
-    static atomic< uint32_t >               sm_dwThreadCmd;
-    static pthread_mutex_t                  sm_mutexTimed;
 
     std::string                             m_sServicesFilename;
 
 private:
+    struct Cmd
+    {
+        uint32_t    dwCmd;
+        uint64_t    nQueuedNs;          // MfcTimer::MonoNs() at setCmd()
+    };
+
+    static bool                             popCmd(Cmd& cmd);
+
+    // Runs a heartbeat pass if polling, returns how long until the next one (ms) or
+    // NO_DEADLINE if there's nothing to poll for until a command or message says so.
+    int64_t                                 heartbeat(CMFCPluginAPI& api, CBroadcastCtx& ctx);
+
+    // Acts on one command, returns false once the thread should exit
+    bool                                    handleCmd(uint32_t dwCmd);
+
+    static std::mutex                       sm_cmdMutex;    // protects sm_cmds
+    static std::deque< Cmd >                sm_cmds;
+    static std::atomic< bool >              sm_fShutdown;
+
+    static std::atomic< uint64_t >          sm_nWakeups;
+    static std::atomic< uint64_t >          sm_nTimeouts;
+    static std::atomic< uint64_t >          sm_nCommands;
+    static std::atomic< uint64_t >          sm_nHeartbeats;
+    static std::atomic< int64_t >           sm_nCmdLatencySumNs;
+    static std::atomic< int64_t >           sm_nCmdLatencyMaxNs;
+
     set< int >                              m_workerPids;
     pthread_t                               m_thread;
 
+    int64_t                                 m_nHeartbeatMs;     // MfcTimer::MonoMs() deadlines, NO_DEADLINE when not armed
+    int64_t                                 m_nPingMs;
+    size_t                                  m_nErrCx;           // heartbeat failures since the last success
+    size_t                                  m_nPingCx;
+    bool                                    m_bStarted;         // streaming, between STREAMSTART and STREAMSTOP
+
 #ifdef _DEBUG
 public:
     void orig_process(); // original implementation of Process()
@@ -16,6 +16,11 @@
  */
 
 #include "NV12Buf.h"
+#include "FrameBufferPool.h"
+
+#include <libfcs/MfcTimer.h>
+
+#include <atomic>
 
 #include "absl/types/optional.h"
 #include "api/video/i420_buffer.h"
@@ -31,6 +36,11 @@ using namespace webrtc;
 
 static const int kBufferAlignment = 64;
 
+static std::atomic<uint64_t> s_nI420Conversions(0);
+static std::atomic<uint64_t> s_nI420CacheHits(0);
+static std::atomic<int64_t> s_nI420ConvertSumNs(0);
+static std::atomic<int64_t> s_nI420ConvertMaxNs(0);
+
 int NV12DataSize(int height, int stride_y, int stride_uv)
 {
     return stride_y * height + stride_uv * ((height + 1) / 2);
@@ -91,30 +101,76 @@ int NV12Buf::StrideUV() const { return stride_uv_; }
 const uint8_t* NV12Buf::DataY() const { return data_y_; }
 const uint8_t* NV12Buf::DataUV() const { return data_uv_; }
 
-uint8_t* NV12Buf::MutableDataY() { return const_cast<uint8_t*>(DataY()); }
-uint8_t* NV12Buf::MutableDataUV() { return const_cast<uint8_t*>(DataUV()); }
+uint8_t* NV12Buf::MutableDataY()
+{
+    DropI420();
+    return const_cast<uint8_t*>(DataY());
+}
+
+uint8_t* NV12Buf::MutableDataUV()
+{
+    DropI420();
+    return const_cast<uint8_t*>(DataUV());
+}
 
 const I420BufferInterface* NV12Buf::GetI420() const { return nullptr; }
 
 scoped_refptr<I420BufferInterface> NV12Buf::ToI420()
 {
-    auto i420_buffer = I420Buffer::Create(width(), height());
+    MutexLock lock(&i420_mutex_);
+    if (i420_)
+    {
+        s_nI420CacheHits++;
+        return i420_;
+    }
+
+    int64_t nStartNs = (int64_t)MfcTimer::FastNs();
+    auto i420_buffer = I420BufPool::instance().Create(width(), height());
     libyuv::NV12ToI420(DataY(), StrideY(), DataUV(), StrideUV(),
                        i420_buffer->MutableDataY(), i420_buffer->StrideY(),
                        i420_buffer->MutableDataU(), i420_buffer->StrideU(),
                        i420_buffer->MutableDataV(), i420_buffer->StrideV(),
                        width(), height());
-    return i420_buffer;
+    int64_t nConvertNs = (int64_t)MfcTimer::FastNs() - nStartNs;
+
+    s_nI420Conversions++;
+    s_nI420ConvertSumNs += nConvertNs;
+    int64_t nMax = s_nI420ConvertMaxNs.load(std::memory_order_relaxed);
+    while (nConvertNs > nMax && !s_nI420ConvertMaxNs.compare_exchange_weak(nMax, nConvertNs, std::memory_order_relaxed))
+        ;
+
+    i420_ = i420_buffer;
+    return i420_;
+}
+
+
+NV12Buf::I420Stats NV12Buf::GetI420Stats()
+{
+    I420Stats stats;
+    stats.conversions   = s_nI420Conversions.load();
+    stats.cacheHits     = s_nI420CacheHits.load();
+    stats.convertAvgUs  = stats.conversions ? (s_nI420ConvertSumNs.load() / (int64_t)stats.conversions) / 1000 : 0;
+    stats.convertMaxUs  = s_nI420ConvertMaxNs.load() / 1000;
+    return stats;
+}
+
+
+void NV12Buf::DropI420()
+{
+    MutexLock lock(&i420_mutex_);
+    i420_ = nullptr;
 }
 
 
 void NV12Buf::SetBlack(NV12Buf* buffer)
 {
+    // MutableDataY() drops the cached I420 copy
     memset(buffer->MutableDataY(), 0, NV12DataSize(buffer->height(), buffer->StrideY(), buffer->StrideUV()));
 }
 
 void NV12Buf::InitializeData()
 {
+    // MutableDataY() drops the cached I420 copy
     memset(MutableDataY(), 0, NV12DataSize(height_, stride_y_, stride_uv_));
 }
 
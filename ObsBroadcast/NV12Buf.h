@@ -26,6 +26,7 @@
 #include "api/scoped_refptr.h"
 #include "api/video/video_frame_buffer.h"
 #include "rtc_base/ref_counted_object.h"
+#include "rtc_base/synchronization/mutex.h"
 
 using absl::optional;
 using rtc::scoped_refptr;
@@ -33,9 +34,24 @@ using webrtc::I420BufferInterface;
 using webrtc::NV12BufferInterface;
 
 
+// NV12 frame over caller owned planes (or pooled ones, see PooledNV12Buf).
+//
+// ToI420() converts once into a buffer from I420BufPool and keeps the result, so every
+// sink that wants I420 for the same frame shares one conversion. The Mutable*()
+// accessors, SetBlack() and InitializeData() drop the cached copy since the planes
+// may change after them.
+//
 class NV12Buf : public NV12BufferInterface
 {
 public:
+    struct I420Stats
+    {
+        uint64_t    conversions;    // ToI420() calls that ran NV12ToI420
+        uint64_t    cacheHits;      // ToI420() calls answered from the cached copy
+        int64_t     convertAvgUs;
+        int64_t     convertMaxUs;
+    };
+
     static scoped_refptr<NV12Buf> Create(const uint8_t* data_y, int stride_y,
                                          const uint8_t* data_uv, int stride_uv,
                                          int width, int height);
@@ -63,6 +79,8 @@ public:
     static void SetBlack(NV12Buf* buffer);
     void InitializeData();
 
+    static I420Stats GetI420Stats();
+
 protected:
     NV12Buf(const uint8_t* data_y, int stride_y, const uint8_t* data_uv, int stride_uv,
             int width, int height);
@@ -72,6 +90,7 @@ protected:
 
 private:
     size_t UVOffset() const;
+    void DropI420();
 
     const uint8_t* data_y_;
     const uint8_t* data_uv_;
@@ -79,6 +98,9 @@ private:
     const int stride_uv_;
     const int width_;
     const int height_;
+
+    webrtc::Mutex i420_mutex_;
+    scoped_refptr<I420BufferInterface> i420_ RTC_GUARDED_BY(i420_mutex_);
 };
 
 #endif  // NV12_BUF_H_
@@ -71,8 +71,8 @@ CBroadcastCtx& CBroadcastCtx::copyFrom(const CBroadcastCtx& other)
     auto otherLock  = other.sharedLock();
     auto ourLock    = sharedLock();
 
-    uint32_t nCurSid = (uint32_t)cfg.getInt("sid");
-    uint32_t nCurUid = (uint32_t)cfg.getInt("uid");
+    uint32_t nCurSid = (uint32_t)cfg.getInt(SkCfg::Sid);
+    uint32_t nCurUid = (uint32_t)cfg.getInt(SkCfg::Uid);
     string sCurProfileName = profileName;
 
     // Copy the member properties that should be copied regardless
@@ -87,8 +87,8 @@ CBroadcastCtx& CBroadcastCtx::copyFrom(const CBroadcastCtx& other)
     cfg = other.cfg;
     bool profileChanged = (sCurProfileName != profileName);
 
-    onUpdateSid(nCurSid, (uint32_t)other.cfg.getInt("sid"), profileChanged, cfg.isShared());
-    onUpdateUid(nCurUid, (uint32_t)other.cfg.getInt("uid"), profileChanged, cfg.isShared());
+    onUpdateSid(nCurSid, (uint32_t)other.cfg.getInt(SkCfg::Sid), profileChanged, cfg.isShared());
+    onUpdateUid(nCurUid, (uint32_t)other.cfg.getInt(SkCfg::Uid), profileChanged, cfg.isShared());
 
     validateActiveState(cfg.isShared());
 
@@ -133,17 +133,7 @@ void CBroadcastCtx::updateState(SidekickActiveState oldState, SidekickActiveStat
         }
 
         if (nChange != -1 && triggerHooks)
-        {
-            auto lk = eventLock();
-            SIDEKICK_UI_EV ev;
-            gettimeofday(&ev.tvStamp, NULL);
-            ev.ev = SkModelState;
-            ev.dwArg1 = (uint32_t)nChange;
-            ev.dwArg2 = oldState;
-            ev.dwArg3 = newState;
-            ev.dwArg4 = 0;
-            sm_eventQueue.push_front( ev );
-        }
+            sendEvent(SkModelState, (uint32_t)nChange, oldState, newState, 0);
     }
 
     activeState = newState;
@@ -191,18 +181,8 @@ void CBroadcastCtx::onUpdateSid(uint32_t nCurSid, uint32_t nNewSid, bool profile
 
         if (nChange != -1 && triggerHooks)
         {
-            auto lk = eventLock();
-
-            SIDEKICK_UI_EV ev;
-            gettimeofday(&ev.tvStamp, nullptr);
-            ev.ev = SkSessionId;
-            ev.dwArg1 = (uint32_t)nChange;
-            ev.dwArg2 = nCurSid;
-            ev.dwArg3 = nNewSid;
-            ev.dwArg4 = profileChanged ? 1 : 0;
-
-            sm_eventQueue.push_front(ev);
-            //_MESG("updateSid: change(%d); sid %u => %u, event added, queue sz now: %zu", nChange, nCurSid, nNewSid, sm_eventQueue.size());
+            sendEvent(SkSessionId, (uint32_t)nChange, nCurSid, nNewSid, profileChanged ? 1 : 0);
+            //_MESG("updateSid: change(%d); sid %u => %u, event added", nChange, nCurSid, nNewSid);
         }
     }
 }
@@ -246,19 +226,7 @@ void CBroadcastCtx::onUpdateUid(uint32_t nCurUid, uint32_t nNewUid, bool profile
         // This prevents a duplicate event from being issued for showLinkStatus() on
         // startup when the user link status is displayed as part of a profile change.
         if (nChange != -1 && triggerHooks)
-        {
-            auto lk = eventLock();
-
-            SIDEKICK_UI_EV ev;
-            gettimeofday(&ev.tvStamp, nullptr);
-            ev.ev = SkUserId;
-            ev.dwArg1 = (uint32_t)nChange;
-            ev.dwArg2 = nCurUid;
-            ev.dwArg3 = nNewUid;
-            ev.dwArg4 = profileChanged ? 1 : 0;
-
-            sm_eventQueue.push_front(ev);
-        }
+            sendEvent(SkUserId, (uint32_t)nChange, nCurUid, nNewUid, profileChanged ? 1 : 0);
     }
 }
 
@@ -283,19 +251,7 @@ void CBroadcastCtx::onUpdateStreamkey(const string& sCurKey, const string& sNewK
 
             if (nChange != -1 && triggerHooks)
             {
-                auto lk = eventLock();
-
-                SIDEKICK_UI_EV ev;
-                gettimeofday(&ev.tvStamp, nullptr);
-                ev.ev = SkStreamKey;
-                ev.dwArg1 = (uint32_t)nChange;
-                ev.dwArg2 = FCVIDEO_TX_IDLE;
-                ev.dwArg3 = 0;
-                ev.dwArg4 = 0;
-                ev.sArg1 = sCurKey;
-                ev.sArg2 = sNewKey;
-
-                sm_eventQueue.push_front(ev);
+                sendEvent(SkStreamKey, (uint32_t)nChange, FCVIDEO_TX_IDLE, 0, 0, sCurKey.c_str(), sNewKey.c_str());
                 //_MESG("STREAMKEY UPDATED ***** change(%d); %s [%zu] => [%zu] %s", nChange, sCurKey.c_str(), sCurKey.size(), sNewKey.size(), sNewKey.c_str());
             }
         }
@@ -327,19 +283,7 @@ void CBroadcastCtx::onUpdateServerUrl(const string& sCurUrl, const string& sNewU
 
             if (nChange != -1 && triggerHooks)
             {
-                auto lk = eventLock();
-
-                SIDEKICK_UI_EV ev;
-                gettimeofday(&ev.tvStamp, nullptr);
-                ev.ev = SkServerUrl;
-                ev.dwArg1 = (uint32_t)nChange;
-                ev.dwArg2 = 0;
-                ev.dwArg3 = 0;
-                ev.dwArg4 = 0;
-                ev.sArg1 = sCurUrl;
-                ev.sArg2 = sNewUrl;
-
-                sm_eventQueue.push_front(ev);
+                sendEvent(SkServerUrl, (uint32_t)nChange, 0, 0, 0, sCurUrl.c_str(), sNewUrl.c_str());
                 //_MESG("SERVERURL UPDATED **** change(%d); %s => %s", nChange, sCurUrl.c_str(), sNewUrl.c_str());
             }
         }
@@ -354,13 +298,13 @@ bool CBroadcastCtx::DeserializeCfg(MfcJsonObj& js, bool triggerHooks)
     bool retVal = false;
 
     js.objectGetInt("sid", nNewSid);
-    onUpdateSid(cfg.getInt("sid"), nNewSid, false, triggerHooks);
+    onUpdateSid(cfg.getInt(SkCfg::Sid), nNewSid, false, triggerHooks);
 
     js.objectGetInt("uid", nNewUid);
-    if ((nCurUid = (uint32_t)cfg.getInt("uid")) != nNewUid)
+    if ((nCurUid = (uint32_t)cfg.getInt(SkCfg::Uid)) != nNewUid)
         onUpdateUid(nCurUid, nNewUid, false, triggerHooks);
 
-    //sCurKey = cfg.getString("ctx");
+    //sCurKey = cfg.getString(SkCfg::Ctx);
     // read current key value from obs settings data directly (in case it was changed in the UI)
     CObsUtil::getCurrentSetting("key", sCurKey);
     js.objectGetString("streamkey", sData);
@@ -371,7 +315,7 @@ bool CBroadcastCtx::DeserializeCfg(MfcJsonObj& js, bool triggerHooks)
     //if (js.objectGetString("streamurl", sData))
     if (js.objectGetString("videoserver", sData))
     {
-        //sCurUrl = cfg.getString("streamurl");
+        //sCurUrl = cfg.getString(SkCfg::StreamUrl);
         CObsUtil::getCurrentSetting("server", sCurUrl);
 
         if ( ! sCurUrl.empty() || ! sData.empty() )
@@ -425,7 +369,7 @@ void CBroadcastCtx::validateActiveState(bool triggerHooks)
         }
         // if we aren't logged in, but our uid is still valid, set
         // state to Waiting on modelweb session
-        else if (cfg.getInt("uid") > 0)
+        else if (cfg.getInt(SkCfg::Uid) > 0)
         {
             updateState(activeState, SkNoModelwebSession, triggerHooks);
         }
@@ -440,18 +384,18 @@ bool CBroadcastCtx::readPluginConfig(bool triggerHooks)
 {
     bool retVal;
 
-    uint32_t nCurSid = cfg.getInt("sid");
-    uint32_t nCurUid = cfg.getInt("uid");
-    string sCurKey, sCurUrl;    // = cfg.getString("ctx");  cfg.getString("streamurl");
+    uint32_t nCurSid = cfg.getInt(SkCfg::Sid);
+    uint32_t nCurUid = cfg.getInt(SkCfg::Uid);
+    string sCurKey, sCurUrl;    // = cfg.getString(SkCfg::Ctx);  cfg.getString(SkCfg::StreamUrl);
     CObsUtil::getCurrentSetting("key", sCurKey);
     CObsUtil::getCurrentSetting("server", sCurUrl);
     string sCurProfile = profileName;
     retVal = cfg.readPluginConfig();
 
-    uint32_t nNewSid = cfg.getInt("sid");
-    uint32_t nNewUid = cfg.getInt("uid");
-    string sNewKey = cfg.getString("ctx");
-    string sNewUrl = cfg.getString("streamurl");
+    uint32_t nNewSid = cfg.getInt(SkCfg::Sid);
+    uint32_t nNewUid = cfg.getInt(SkCfg::Uid);
+    string sNewKey = cfg.getString(SkCfg::Ctx);
+    string sNewUrl = cfg.getString(SkCfg::StreamUrl);
 
     bool profileChanged = (sCurProfile != profileName);
 
@@ -563,17 +507,17 @@ void CBroadcastCtx::clear(bool triggerHooks)
 
     if (triggerHooks)
     {
-        nCurSid = cfg.getInt("sid");
-        nCurUid = cfg.getInt("uid");
-        //sCurKey = cfg.getString("ctx");
+        nCurSid = cfg.getInt(SkCfg::Sid);
+        nCurUid = cfg.getInt(SkCfg::Uid);
+        //sCurKey = cfg.getString(SkCfg::Ctx);
     }
 
     cfg.clear();
 
     if (triggerHooks)
     {
-        nNewSid = cfg.getInt("sid");
-        nNewUid = cfg.getInt("uid");
+        nNewSid = cfg.getInt(SkCfg::Sid);
+        nNewUid = cfg.getInt(SkCfg::Uid);
     }
 
     // onUpdateSid() will make sure isLoggedIn is the correct value
@@ -589,7 +533,7 @@ void CBroadcastCtx::clear(bool triggerHooks)
 
 string CBroadcastCtx::streamName(void)
 {
-    return string("ext_x_") + std::to_string(cfg.getInt("uid"));
+    return string("ext_x_") + std::to_string(cfg.getInt(SkCfg::Uid));
 }
 
 
@@ -604,26 +548,8 @@ std::unique_lock<std::recursive_mutex> CBroadcastCtx::sharedLock(void) const
 void CBroadcastCtx::sendEvent(SidekickEventType evType, uint32_t dwArg1, uint32_t dwArg2,
                               uint32_t dwArg3, uint32_t dwArg4, const char* pszArg1, const char* pszArg2)
 {
-    SIDEKICK_UI_EV ev;
-    auto lk = eventLock();
-
-    gettimeofday(&ev.tvStamp, NULL);
-    ev.ev = evType;
-    ev.dwArg1 = dwArg1;
-    ev.dwArg2 = dwArg2;
-    ev.dwArg3 = dwArg3;
-    ev.dwArg4 = dwArg4;
-    ev.sArg1 = pszArg1 ? pszArg1 : "";
-    ev.sArg2 = pszArg2 ? pszArg2 : "";
-
-    CBroadcastCtx::sm_eventQueue.push_front( ev );
-}
-
-
-std::unique_lock<std::recursive_mutex> CBroadcastCtx::eventLock(void)
-{
-    std::unique_lock<std::recursive_mutex> lk(sm_eventLock, std::try_to_lock);
-    return lk;
+    if (!sm_events.push(evType, dwArg1, dwArg2, dwArg3, dwArg4, pszArg1, pszArg2))
+        _MESG("UI event queue full, dropped event type %d", (int)evType);
 }
 
 
@@ -660,7 +586,7 @@ bool CBroadcastCtx::startEdgeSock(const string& sUser, uint32_t modelId, const s
 {
     if (sm_edgeSock == nullptr)
     {
-        const string sUrl = string("wss://") + EdgeChatSock::FcsServer() + string(".myfreecams.com/fcsl");
+        const string sUrl = EdgeChatSock::FcsServerUrl( EdgeChatSock::FcsServer() );
         return startEdgeSock(sUser, modelId, sToken, sUrl);
     }
     return false;
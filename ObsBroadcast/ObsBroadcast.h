@@ -29,7 +29,6 @@
 
 #include <atomic>
 #include <cstdint>
-#include <deque>
 #include <mutex>
 #include <string>
 
@@ -38,6 +37,7 @@
 #include <libPlugins/SidekickModelConfig.h>
 #include <libfcs/MfcJson.h>
 
+#include "SidekickEventQueue.h"
 #include "SidekickTypes.h"
 
 
@@ -80,8 +80,6 @@ public:
     // or when updating any of our other member properties if we are g_ctx
     std::unique_lock<std::recursive_mutex> sharedLock(void) const;
 
-    static std::unique_lock<std::recursive_mutex> eventLock(void);
-
     static void sendEvent(SidekickEventType evType, uint32_t dwArg1 = 0, uint32_t dwArg2 = 0, uint32_t dwArg3 = 0,
                           uint32_t dwArg4 = 0, const char* pszArg1 = nullptr, const char* pszArg2 = nullptr);
 
@@ -115,14 +113,12 @@ public:
     // The data in SidekickModelConfig is relative to the currently active profile only.
     SidekickModelConfig cfg;
 
-    static std::deque<SIDEKICK_UI_EV> sm_eventQueue;
+    static SidekickEventQueue sm_events;
     static EdgeChatSock* sm_edgeSock;
 
 private:
     // only set to non-null for g_ctx instance.
     void* m_pConsole;
-
-    static std::recursive_mutex sm_eventLock;
 };
 
 #endif  // OBS_BROADCAST_H_
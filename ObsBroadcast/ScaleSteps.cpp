@@ -0,0 +1,71 @@
+/*
+ * Copyright (c) 2013-2021 MFCXY, Inc. <mfcxy@mfcxy.com>
+ * Copyright (c) 2020 The WebRTC project authors. All Rights Reserved.
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#include "ScaleSteps.h"
+
+#include <algorithm>
+#include <cstdlib>
+
+
+ScaleSteps::Size ScaleSteps::stepSize(int nWidth, int nHeight, int nStep, int nAlignment)
+{
+    if (nStep <= 0)
+        return { nWidth, nHeight };
+
+    int64_t n = 1, d = 1;
+    for (int step = 0; step < nStep; step++)
+    {
+        if (step % 2 == 0)
+        {
+            n *= 3;
+            d *= 4;
+        }
+        else
+        {
+            n *= 2;
+            d *= 3;
+        }
+    }
+
+    nAlignment = std::max(nAlignment, 1);
+    return { std::max((int)(nWidth * n / d) / nAlignment * nAlignment, nAlignment),
+             std::max((int)(nHeight * n / d) / nAlignment * nAlignment, nAlignment) };
+}
+
+
+ScaleSteps::Size ScaleSteps::pick(int nWidth, int nHeight, int64_t nMaxPixels, int64_t nTargetPixels,
+                                  int64_t nMinPixels, int nAlignment)
+{
+    Size best = { nWidth, nHeight }, last = best;
+    if (best.pixels() <= nMaxPixels && best.pixels() <= nTargetPixels)
+        return best;
+
+    int64_t bestDiff = INT64_MAX;
+    for (int step = 0; step < MAX_STEPS; step++)
+    {
+        last = stepSize(nWidth, nHeight, step, nAlignment);
+        const int64_t pixels = last.pixels();
+        if (pixels <= nMaxPixels && std::abs(pixels - nTargetPixels) < bestDiff)
+        {
+            bestDiff = std::abs(pixels - nTargetPixels);
+            best = last;
+        }
+        if ((pixels <= nTargetPixels && pixels <= nMaxPixels) || pixels <= nMinPixels)
+            break;
+    }
+
+    return bestDiff == INT64_MAX ? last : best;
+}
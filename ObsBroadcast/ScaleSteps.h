@@ -0,0 +1,56 @@
+/*
+ * Copyright (c) 2013-2021 MFCXY, Inc. <mfcxy@mfcxy.com>
+ * Copyright (c) 2020 The WebRTC project authors. All Rights Reserved.
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#pragma once
+
+#ifndef SCALE_STEPS_H_
+#define SCALE_STEPS_H_
+
+#include <cstdint>
+
+
+// The downscale steps VideoTrackSource scales frames by: 3/4, 2/3, 3/4, ... (1/2, 3/8,
+// 1/4, ...) of the input the way WebRTC's VideoAdapter steps, each dimension rounded
+// down to the sink's alignment. AbrController builds its resolution ladder from the
+// same sizes, so a rung's w * h as the pixel limit selects exactly that rung; pick()
+// compares the pixels a step really produces, not the unrounded fraction of the input.
+//
+class ScaleSteps
+{
+public:
+    static const int MAX_STEPS = 12;
+    static const int MIN_PIXELS = 320 * 180;    // VideoTrackSource never limits below this
+
+    struct Size
+    {
+        int     nWidth;
+        int     nHeight;
+
+        int64_t pixels(void) const      { return (int64_t)nWidth * nHeight; }
+        bool operator==(const Size& o) const { return nWidth == o.nWidth && nHeight == o.nHeight; }
+    };
+
+    // nStep steps down from nWidth x nHeight, step 0 is the input unchanged
+    static Size stepSize(int nWidth, int nHeight, int nStep, int nAlignment);
+
+    // The step closest to nTargetPixels that fits nMaxPixels, walking down no further
+    // than the first step that fits both or is at most nMinPixels. If no step fits
+    // nMaxPixels, the smallest one tried is the closest we get.
+    static Size pick(int nWidth, int nHeight, int64_t nMaxPixels, int64_t nTargetPixels,
+                     int64_t nMinPixels, int nAlignment);
+};
+
+#endif  // SCALE_STEPS_H_
@@ -0,0 +1,226 @@
+/*
+ * Copyright (c) 2013-2021 MFCXY, Inc. <mfcxy@mfcxy.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "SidekickEventQueue.h"
+
+#include <chrono>
+#include <cstring>
+
+static_assert((SidekickEventQueue::QUEUE_SIZE & (SidekickEventQueue::QUEUE_SIZE - 1)) == 0,
+              "SidekickEventQueue::QUEUE_SIZE must be a power of 2");
+
+
+SidekickEventQueue::SidekickEventQueue()
+    : m_tail(0)
+    , m_head(0)
+    , m_wakePending(false)
+    , m_pfnWake(nullptr)
+    , m_pWakeCtx(nullptr)
+    , m_nQueued(0)
+    , m_nDelivered(0)
+    , m_nDropped(0)
+    , m_nCoalesced(0)
+    , m_nTruncated(0)
+    , m_nLatencyTotalUs(0)
+    , m_nLatencyMaxUs(0)
+{
+    for (size_t n = 0; n < QUEUE_SIZE; n++)
+        m_cells[n].seq.store(n, std::memory_order_relaxed);
+
+    for (size_t n = 0; n < SkEventTypeCount; n++)
+        m_typeGen[n].store(0, std::memory_order_relaxed);
+}
+
+
+bool SidekickEventQueue::isCoalescing(SidekickEventType evType)
+{
+    switch (evType)
+    {
+    case SkSessionId:
+    case SkUserId:
+    case SkModelState:
+    case SkStreamKey:
+    case SkServerUrl:
+    case SkUnlink:
+        return true;
+
+    default:
+        return false;
+    }
+}
+
+
+bool SidekickEventQueue::push(SidekickEventType evType, uint32_t dwArg1, uint32_t dwArg2, uint32_t dwArg3,
+                              uint32_t dwArg4, const char* pszArg1, const char* pszArg2)
+{
+    size_t nPos = m_tail.load(std::memory_order_relaxed);
+    Cell* pCell;
+
+    // Claim a cell: its seq equals our position when it's free for this lap of the ring
+    while (true)
+    {
+        pCell = &m_cells[ nPos & (QUEUE_SIZE - 1) ];
+        size_t nSeq = pCell->seq.load(std::memory_order_acquire);
+        intptr_t nDiff = (intptr_t)nSeq - (intptr_t)nPos;
+
+        if (nDiff == 0)
+        {
+            if (m_tail.compare_exchange_weak(nPos, nPos + 1, std::memory_order_relaxed))
+                break;
+        }
+        else if (nDiff < 0)
+        {
+            // consumer hasn't freed this cell yet, queue is full
+            m_nDropped.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+        else nPos = m_tail.load(std::memory_order_relaxed);
+    }
+
+    SIDEKICK_UI_EV& ev = pCell->ev;
+    gettimeofday(&ev.tvStamp, nullptr);
+    ev.qwQueuedUs = nowMicro();
+    ev.ev = evType;
+    ev.dwArg1 = dwArg1;
+    ev.dwArg2 = dwArg2;
+    ev.dwArg3 = dwArg3;
+    ev.dwArg4 = dwArg4;
+
+    if (!copyArg(ev.szArg1, pszArg1) | !copyArg(ev.szArg2, pszArg2))
+        m_nTruncated.fetch_add(1, std::memory_order_relaxed);
+
+    // The generation is the claimed ring position, so it orders events of a type the
+    // same way drain() sees them, however the producers race to publish.
+    const uint64_t qwGen = (uint64_t)nPos + 1;
+
+    // A profile re-read reloads the user id, so any user id update queued
+    // before it is stale as well.
+    if (evType == SkReadProfile)
+        raiseGen(SkUserId, qwGen);
+
+    ev.qwGen = 0;
+    if (isCoalescing(evType))
+    {
+        ev.qwGen = qwGen;
+        raiseGen(evType, qwGen);
+    }
+
+    pCell->seq.store(nPos + 1, std::memory_order_release);
+    m_nQueued.fetch_add(1, std::memory_order_relaxed);
+
+    if (!m_wakePending.exchange(true, std::memory_order_acq_rel))
+    {
+        SIDEKICK_WAKE_CB pfnWake = m_pfnWake.load(std::memory_order_acquire);
+        if (pfnWake)
+            pfnWake(m_pWakeCtx.load(std::memory_order_relaxed));
+    }
+
+    return true;
+}
+
+
+bool SidekickEventQueue::pop(SIDEKICK_UI_EV& ev)
+{
+    Cell& cell = m_cells[ m_head & (QUEUE_SIZE - 1) ];
+
+    if (cell.seq.load(std::memory_order_acquire) != m_head + 1)
+        return false;
+
+    ev = cell.ev;
+    cell.seq.store(m_head + QUEUE_SIZE, std::memory_order_release);
+    m_head++;
+
+    return true;
+}
+
+
+bool SidekickEventQueue::isSuperseded(const SIDEKICK_UI_EV& ev) const
+{
+    return ev.qwGen != 0 && ev.qwGen < m_typeGen[ev.ev].load(std::memory_order_acquire);
+}
+
+
+// Moves the type's latest generation up to qwGen, a push that claimed an earlier cell
+// but gets here later must not move it back
+void SidekickEventQueue::raiseGen(SidekickEventType evType, uint64_t qwGen)
+{
+    uint64_t qwCur = m_typeGen[evType].load(std::memory_order_relaxed);
+    while (qwCur < qwGen && !m_typeGen[evType].compare_exchange_weak(qwCur, qwGen, std::memory_order_acq_rel))
+        ;
+}
+
+
+void SidekickEventQueue::recordLatency(const SIDEKICK_UI_EV& ev)
+{
+    uint64_t nNow = nowMicro();
+    uint64_t nLatency = nNow > ev.qwQueuedUs ? nNow - ev.qwQueuedUs : 0;
+
+    m_nDelivered.fetch_add(1, std::memory_order_relaxed);
+    m_nLatencyTotalUs.fetch_add(nLatency, std::memory_order_relaxed);
+
+    // only the consumer writes the max, so no CAS loop needed
+    if (nLatency > m_nLatencyMaxUs.load(std::memory_order_relaxed))
+        m_nLatencyMaxUs.store(nLatency, std::memory_order_relaxed);
+}
+
+
+void SidekickEventQueue::setWakeup(SIDEKICK_WAKE_CB pfnWake, void* pCtx)
+{
+    m_pWakeCtx.store(pCtx, std::memory_order_relaxed);
+    m_pfnWake.store(pfnWake, std::memory_order_release);
+}
+
+
+SidekickEventQueue::Stats SidekickEventQueue::getStats(void) const
+{
+    Stats stats;
+    stats.queued        = m_nQueued.load(std::memory_order_relaxed);
+    stats.delivered     = m_nDelivered.load(std::memory_order_relaxed);
+    stats.dropped       = m_nDropped.load(std::memory_order_relaxed);
+    stats.coalesced     = m_nCoalesced.load(std::memory_order_relaxed);
+    stats.truncated     = m_nTruncated.load(std::memory_order_relaxed);
+    stats.latencyMaxUs  = m_nLatencyMaxUs.load(std::memory_order_relaxed);
+    stats.latencyAvgUs  = stats.delivered > 0 ? m_nLatencyTotalUs.load(std::memory_order_relaxed) / stats.delivered : 0;
+    return stats;
+}
+
+
+uint64_t SidekickEventQueue::nowMicro(void)
+{
+    using namespace std::chrono;
+    return (uint64_t)duration_cast< microseconds >(steady_clock::now().time_since_epoch()).count();
+}
+
+
+// Copies pszSrc into an inline SIDEKICK_EV_STRLEN buffer, returns false if it had to be truncated
+bool SidekickEventQueue::copyArg(char* pszDest, const char* pszSrc)
+{
+    if (!pszSrc)
+    {
+        pszDest[0] = '\0';
+        return true;
+    }
+
+    size_t nLen = strlen(pszSrc);
+    bool fits = nLen < SIDEKICK_EV_STRLEN;
+    if (!fits)
+        nLen = SIDEKICK_EV_STRLEN - 1;
+
+    memcpy(pszDest, pszSrc, nLen);
+    pszDest[nLen] = '\0';
+
+    return fits;
+}
@@ -0,0 +1,146 @@
+/*
+ * Copyright (c) 2013-2021 MFCXY, Inc. <mfcxy@mfcxy.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#pragma once
+
+#ifndef SIDEKICK_EVENT_QUEUE_H_
+#define SIDEKICK_EVENT_QUEUE_H_
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+#ifndef _WIN32
+#include <sys/time.h>
+#else
+#include <libfcs/UtilCommon.h>  // struct timeval
+#endif
+
+#include "SidekickTypes.h"
+
+// Bounded lock-free multi-producer, single-consumer queue of UI events.
+//
+// Any thread may push(); only the UI thread calls drain(). Events are copied into a
+// fixed ring of cells, each with its own sequence counter, so producers never take a
+// lock or allocate. A full queue drops the new event and counts it.
+//
+// State events (session, user, model state, stream key, server url, unlink) only
+// matter in their latest form. push() stamps them with their ring position as a
+// generation and raises the type's latest generation to it, and drain() discards any
+// event whose type has a later generation queued.
+//
+// The first push() after a drain calls the wakeup callback, which the UI thread
+// installs to post itself a queued call to drain right away.
+//
+class SidekickEventQueue
+{
+public:
+    static const size_t QUEUE_SIZE = 256;     // must be a power of 2
+
+    struct Stats
+    {
+        uint64_t    queued;             // events accepted by push()
+        uint64_t    delivered;          // events handed to the drain callback
+        uint64_t    dropped;            // events rejected because the queue was full
+        uint64_t    coalesced;          // events superseded by a later event of the same type
+        uint64_t    truncated;          // events with a string arg cut to SIDEKICK_EV_STRLEN
+        uint64_t    latencyAvgUs;       // mean push to delivery latency
+        uint64_t    latencyMaxUs;       // worst push to delivery latency
+    };
+
+    SidekickEventQueue();
+
+    // Producer side, safe from any thread.
+    bool push(SidekickEventType evType, uint32_t dwArg1 = 0, uint32_t dwArg2 = 0, uint32_t dwArg3 = 0,
+              uint32_t dwArg4 = 0, const char* pszArg1 = nullptr, const char* pszArg2 = nullptr);
+
+    // Consumer side, UI thread only. Calls fn(const SIDEKICK_UI_EV&) for each live event
+    // in the order they were pushed, returns the number of events delivered.
+    template< typename Func >
+    size_t drain(Func&& fn)
+    {
+        SIDEKICK_UI_EV ev;
+        size_t nDelivered = 0;
+
+        while (true)
+        {
+            while (pop(ev))
+            {
+                if (isSuperseded(ev))
+                {
+                    m_nCoalesced.fetch_add(1, std::memory_order_relaxed);
+                    continue;
+                }
+
+                recordLatency(ev);
+                fn(const_cast< const SIDEKICK_UI_EV& >(ev));
+                nDelivered++;
+            }
+
+            // Rearm the wakeup, then look again if it was set: a push that found it set
+            // didn't post one. The exchange orders the rearm before the pops that follow,
+            // so a push after it either gets seen by them or posts a fresh wakeup.
+            if (!m_wakePending.exchange(false, std::memory_order_acq_rel))
+                break;
+        }
+
+        return nDelivered;
+    }
+
+    // Installs the callback used to wake the consumer, pCtx is passed back to it.
+    void setWakeup(SIDEKICK_WAKE_CB pfnWake, void* pCtx);
+
+    Stats getStats(void) const;
+
+    // True for event types where only the most recent event is delivered
+    static bool isCoalescing(SidekickEventType evType);
+
+private:
+    struct Cell
+    {
+        std::atomic< size_t >   seq;
+        SIDEKICK_UI_EV          ev;
+    };
+
+    bool pop(SIDEKICK_UI_EV& ev);
+    bool isSuperseded(const SIDEKICK_UI_EV& ev) const;
+    void raiseGen(SidekickEventType evType, uint64_t qwGen);
+    void recordLatency(const SIDEKICK_UI_EV& ev);
+
+    static uint64_t nowMicro(void);
+    static bool copyArg(char* pszDest, const char* pszSrc);
+
+    Cell                                m_cells[ QUEUE_SIZE ];
+
+    alignas(64) std::atomic< size_t >   m_tail;         // next cell to claim, shared by producers
+    alignas(64) size_t                  m_head;         // next cell to read, consumer only
+
+    std::atomic< bool >                 m_wakePending;
+    std::atomic< SIDEKICK_WAKE_CB >     m_pfnWake;
+    std::atomic< void* >                m_pWakeCtx;
+
+    std::atomic< uint64_t >             m_typeGen[ SkEventTypeCount ];
+
+    std::atomic< uint64_t >             m_nQueued;
+    std::atomic< uint64_t >             m_nDelivered;
+    std::atomic< uint64_t >             m_nDropped;
+    std::atomic< uint64_t >             m_nCoalesced;
+    std::atomic< uint64_t >             m_nTruncated;
+    std::atomic< uint64_t >             m_nLatencyTotalUs;
+    std::atomic< uint64_t >             m_nLatencyMaxUs;
+};
+
+#endif  // SIDEKICK_EVENT_QUEUE_H_
@@ -50,6 +50,7 @@
 
 // project
 #include "SidekickProperties.h"
+#include "FrameLatency.h"
 #include "ObsBroadcast.h"
 
 extern CBroadcastCtx g_ctx;
@@ -310,7 +311,7 @@ void SidekickPropertiesUI::relabelPropertiesText(void)
 
     {
         auto lk     = g_ctx.sharedLock();
-        sUsername   = g_ctx.cfg.getString("username");
+        sUsername   = g_ctx.cfg.getString(SkCfg::Username);
         isLoggedIn  = g_ctx.isLoggedIn;
         isWebRTC    = g_ctx.isWebRTC;
         isLinked    = g_ctx.isLinked;
@@ -384,7 +385,7 @@ void MFCDock::relabelPropertiesText()
 
     {
         auto lk     = g_ctx.sharedLock();
-        sUsername   = g_ctx.cfg.getString("username");
+        sUsername   = g_ctx.cfg.getString(SkCfg::Username);
         isLoggedIn  = g_ctx.isLoggedIn;
         isWebRTC    = g_ctx.isWebRTC;
         isLinked    = g_ctx.isLinked;
@@ -429,3 +430,26 @@ void MFCDock::relabelPropertiesText()
 
     ui->logo->setVisible(mfcLogoVisible);
 }
+
+
+void MFCDock::updateLatency()
+{
+    bool isWebRTC = false, isStreaming = false;
+    {
+        auto lk     = g_ctx.sharedLock();
+        isWebRTC    = g_ctx.isWebRTC;
+        isStreaming = g_ctx.isStreaming;
+    }
+
+    auto latency = FrameLatency::instance().getStats();
+    if (!isWebRTC || !isStreaming || !latency.frames)
+    {
+        ui->latencyLabel->setVisible(false);
+        return;
+    }
+
+    const auto& total = latency.stages[FrameLatency::STAGE_TOTAL];
+    QString sText = QString("Latency %1 ms (p95 %2 ms)").arg(latency.recentTotalUs / 1000).arg(total.p95Us / 1000);
+    ui->latencyLabel->setText(sText);
+    ui->latencyLabel->setVisible(true);
+}
@@ -85,6 +85,7 @@ public:
     QLabel* loginLabel;
     QLabel* modeLabel;
     QLabel* usernameLabel;
+    QLabel* latencyLabel;
     QLabel* logo;
     QSpacerItem* expVSpacer;
 
@@ -172,6 +173,14 @@ public:
         usernameLabel->setAlignment(Qt::AlignCenter);
         buttonsVLayout->addWidget(usernameLabel);
 
+        latencyLabel = new QLabel(mfcDockContents);
+        latencyLabel->setObjectName(QStringLiteral("latencyLabel"));
+        latencyLabel->setToolTip(QStringLiteral("Capture to network latency of the WebRTC stream"));
+        sizePolicyLinkLabel.setHeightForWidth(latencyLabel->sizePolicy().hasHeightForWidth());
+        latencyLabel->setSizePolicy(sizePolicyLinkLabel);
+        latencyLabel->setAlignment(Qt::AlignCenter);
+        buttonsVLayout->addWidget(latencyLabel);
+
         logo = new QLabel(mfcDockContents);
         QPixmap mfcLogo(":/mfc_logo.png");
         QPixmap mfcLogoScaled = mfcLogo.scaledToWidth(98, Qt::SmoothTransformation);
@@ -201,9 +210,11 @@ public:
         loginLabel->setText(QApplication::translate("MFCDock", "", nullptr));
         modeLabel->setText(QApplication::translate("MFCDock", "", nullptr));
         usernameLabel->setText(QApplication::translate("MFCDock", "", nullptr));
+        latencyLabel->setText(QApplication::translate("MFCDock", "", nullptr));
         linkMfcButton->setText(QApplication::translate("MFCDock", "Link", nullptr));
         unlinkMfcButton->setText(QApplication::translate("MFCDock", "Unlink", nullptr));
         logo->setVisible(false);
+        latencyLabel->setVisible(false);
     }
 };
 
@@ -262,6 +273,7 @@ public slots:
     void onUnlink();
 
     void relabelPropertiesText();
+    void updateLatency();
 
 private:
     std::unique_ptr<Ui::MFCDock> ui;
@@ -271,27 +283,25 @@ private:
 //---/ SidekickTimer /-------------------------------------------------------------------------
 //
 // Timer Object for setting up main-thread/ui-thread callbacks from obs module exported
-// functions (which are not methods of a QObject derived class).
+// functions (which are not methods of a QObject derived class). Also the UiThread
+// executor of CTimerWheel, timer callbacks are queued to it.
 //
 class SidekickTimer : public QObject
 {
     Q_OBJECT
 
 public:
-    SidekickTimer()
-        : m_pTimer(std::make_unique<QTimer>(qApp))
-    {
-        m_pTimer->setSingleShot(false);
-        QObject::connect(m_pTimer.get(), SIGNAL(timeout()), SLOT(onTimerEvent()));
-        m_pTimer->start(250);
-    }
+    SidekickTimer();
+    ~SidekickTimer() override;
 
-    ~SidekickTimer() override = default;
+    uint64_t m_nProfileTimer;       // CTimerWheel::TimerId
+    uint64_t m_nLatencyTimer;       // CTimerWheel::TimerId
 
-    std::unique_ptr<QTimer> m_pTimer;
+    static void wakeUiThread(void* pCtx);
 
 public slots:
-    void onTimerEvent();
+    void onProfileCheck();
+    void onUiEvents();
 };
 
 #endif  // SIDEKICK_PROPERTIES_H_
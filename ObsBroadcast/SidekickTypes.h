@@ -19,8 +19,6 @@
 #ifndef SIDEKICK_TYPES_H_
 #define SIDEKICK_TYPES_H_
 
-typedef void (*SIDEKICK_TIMER_CB)(unsigned int interval, unsigned int elapsed);
-
 // State of sidekick, used to display current status in sidekick log window
 // as well as govern logic for when stream may start and how heartbeat API calls
 // are made.
@@ -50,16 +48,16 @@ enum SidekickEventType
     SkModelState,                   // new activeState for model (arg1 changed, arg2 oldState, arg3 newState)
     SkRoomEv,                       // room event received
     SkReadProfile,                  // request UI thread to exec onObsProfileChanged() to reprocess current profile in UI dlg
-    SkSetWebRtc                     // set current Sidekick supported profile to WebRTC (if arg1 is 1) or RTMP (if arg1 is 0)
+    SkSetWebRtc,                    // set current Sidekick supported profile to WebRTC (if arg1 is 1) or RTMP (if arg1 is 0)
+
+    SkEventTypeCount                // number of event types, not an actual event
 };
 
-typedef struct
-{
-    unsigned int interval;          // callback interval, in milliseconds. 1000 = 1second
-    unsigned int elapsed;           // milliseconds elapsed since last callback made.
-    SIDEKICK_TIMER_CB pFunc;        // pointer to callback function
-} SIDEKICK_TIMER_EV;
+// max length of string args inlined in a SIDEKICK_UI_EV, including the terminating null.
+// longer strings are truncated when the event is queued.
+#define SIDEKICK_EV_STRLEN  256
 
+// Fixed size so events can be copied in and out of SidekickEventQueue's ring without allocating
 typedef struct
 {
     SidekickEventType   ev;         // event type: ctx updates, api error response, api timeout, or status/log message
@@ -70,8 +68,13 @@ typedef struct
     uint32_t            dwArg3;     // dword args 3
     uint32_t            dwArg4;     // dword args 4
 
-    std::string         sArg1;      // string arg 1
-    std::string         sArg2;      // string arg 2
+    char                szArg1[SIDEKICK_EV_STRLEN]; // string arg 1
+    char                szArg2[SIDEKICK_EV_STRLEN]; // string arg 2
+
+    uint64_t            qwGen;      // coalescing generation, set by SidekickEventQueue::push()
+    uint64_t            qwQueuedUs; // monotonic queue time, for measuring event to UI latency
 } SIDEKICK_UI_EV;
 
+typedef void (*SIDEKICK_WAKE_CB)(void* pCtx);
+
 #endif  // SIDEKICK_TYPES_H_
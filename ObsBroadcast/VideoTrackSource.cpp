@@ -16,7 +16,9 @@
  */
 
 #include "VideoTrackSource.h"
+#include "FrameLatency.h"
 #include "NV12Buf.h"
+#include "ScaleSteps.h"
 
 #include <libPlugins/MFCConfigConstants.h>
 
@@ -36,17 +38,24 @@
 #include "third_party/libyuv/include/libyuv.h"
 
 #include <algorithm>
+#include <cstdint>
+#include <cstdlib>
 #include <utility>
 
 using rtc::RefCountedObject;
 
 static const int MAX_WIDTH = MFC_SERVICES_JSON_MAX_WIDTH_VALUE;
 static const int MAX_HEIGHT = MFC_SERVICES_JSON_MAX_HEIGHT_VALUE;
-static const int MAX_FPS = 30;
+static const int MAX_FPS = MFC_SERVICES_JSON_MAX_FPS_VALUE;
 static const int REQUIRED_ALIGNMENT = 2;
+static const int MIN_ADAPTED_PIXELS = ScaleSteps::MIN_PIXELS;
 
 
 VideoTrackSource::VideoTrackSource()
+    : decimator_(MFC_DEFAULT_WEBRTC_FRAMERATE)
+    , max_fps_(MFC_DEFAULT_WEBRTC_FRAMERATE)
+    , limit_pixels_(MAX_WIDTH * MAX_HEIGHT)
+    , limit_fps_(MAX_FPS)
 {
     RTC_LOG(INFO) << __FUNCTION__;
 }
@@ -68,29 +77,36 @@ scoped_refptr<VideoTrackSource> VideoTrackSource::Create()
 bool VideoTrackSource::KeepFrame(int64_t frameTimeNanos)
 {
     MutexLock lock(&next_frame_mutex_);
+    return decimator_.keepFrame(frameTimeNanos);
+}
 
-    constexpr int64_t FRAME_INTERVAL_NANOS = rtc::kNumNanosecsPerSec / MAX_FPS;
 
-    if (nextFrameTimeNanos_)
+void VideoTrackSource::SetFrameRates(int targetFps, double captureFps)
+{
     {
-        // Time until next frame should be outputted.
-        const int64_t timeUntilNextFrameNanos = (*nextFrameTimeNanos_ - frameTimeNanos);
-        // Continue if timestamp is within expected range.
-        if (abs(timeUntilNextFrameNanos) < 2 * FRAME_INTERVAL_NANOS)
-        {
-            // Drop if a frame shouldn't be outputted yet.
-            if (timeUntilNextFrameNanos > 0)
-                return false;
-            // Time to output new frame.
-            *nextFrameTimeNanos_ += FRAME_INTERVAL_NANOS;
-        }
-        return true;
+        MutexLock lock(&next_frame_mutex_);
+        decimator_.setInputFps(captureFps);
     }
-    // First timestamp received or timestamp is way outside expected range, so
-    // reset. Set first timestamp target to just half the interval to prefer
-    // keeping frames in case of jitter.
-    nextFrameTimeNanos_ = frameTimeNanos + FRAME_INTERVAL_NANOS / 2;
-    return true;
+
+    MutexLock lock(&sinks_and_wants_mutex_);
+    max_fps_ = std::min(std::max(targetFps, 1), MAX_FPS);
+    UpdateWants();
+}
+
+
+void VideoTrackSource::SetOutputLimits(int maxPixels, int maxFps)
+{
+    MutexLock lock(&sinks_and_wants_mutex_);
+    limit_pixels_ = std::min(std::max(maxPixels, MIN_ADAPTED_PIXELS), MAX_WIDTH * MAX_HEIGHT);
+    limit_fps_ = std::min(std::max(maxFps, 1), MAX_FPS);
+    UpdateWants();
+}
+
+
+FrameDecimator::Stats VideoTrackSource::GetDecimatorStats()
+{
+    MutexLock lock(&next_frame_mutex_);
+    return decimator_.getStats();
 }
 
 
@@ -101,9 +117,24 @@ void VideoTrackSource::onIncomingData(const uint8_t* dataY, uint32_t strideY,
                                       VideoRotation videoRotation)
 {
     if (!KeepFrame(frameTimeNanos))
+    {
+        FrameLatency::instance().dropped(frameId, FrameLatency::DROP_DECIMATED);
         return;
+    }
 
-    auto buffer = NV12Buf::Create(dataY, strideY, dataUV, strideUV, width, height);
+    // The planes belong to OBS and are only valid until we return, while the frame is
+    // encoded later on WebRTC's encoder queue, so it gets a copy of its own. When the
+    // sinks want fewer pixels the copy is the downscale.
+    int adaptedWidth, adaptedHeight;
+    AdaptResolution(width, height, &adaptedWidth, &adaptedHeight);
+    auto buffer = framePool_.ScaleFrom(dataY, strideY, dataUV, strideUV, width, height,
+                                       adaptedWidth, adaptedHeight);
+    if (!buffer)
+    {
+        FrameLatency::instance().dropped(frameId, FrameLatency::DROP_SOURCE);
+        OnDiscardedFrame();
+        return;
+    }
 
     auto frameTimeMicros = frameTimeNanos / rtc::kNumNanosecsPerMicrosec;
     auto timestampRtp = static_cast<uint32_t>(frameTimeMicros * 90 / rtc::kNumMicrosecsPerMillisec);
@@ -116,6 +147,7 @@ void VideoTrackSource::onIncomingData(const uint8_t* dataY, uint32_t strideY,
                   ColorSpace::MatrixID::kBT709,
                   ColorSpace::RangeID::kLimited);
 
+    FrameLatency::instance().mark(frameId, FrameLatency::DELIVERED);
     OnFrame(VideoFrame::Builder()
             .set_video_frame_buffer(buffer)
             .set_rotation(videoRotation)
@@ -128,6 +160,30 @@ void VideoTrackSource::onIncomingData(const uint8_t* dataY, uint32_t strideY,
 }
 
 
+void VideoTrackSource::AdaptResolution(int width, int height, int* adaptedWidth, int* adaptedHeight)
+{
+    MutexLock lock(&sinks_and_wants_mutex_);
+
+    const int64_t maxPixels = current_wants_.max_pixel_count;
+    const int64_t targetPixels = current_wants_.target_pixel_count.value_or(current_wants_.max_pixel_count);
+    const int alignment = std::max(current_wants_.resolution_alignment, REQUIRED_ALIGNMENT);
+
+    // The 3/4, 2/3, ... step closest to the target within the max, see ScaleSteps
+    ScaleSteps::Size size = ScaleSteps::pick(width, height, maxPixels, targetPixels, MIN_ADAPTED_PIXELS, alignment);
+    *adaptedWidth = size.nWidth;
+    *adaptedHeight = size.nHeight;
+
+    if (*adaptedWidth != adapted_width_ || *adaptedHeight != adapted_height_)
+    {
+        RTC_LOG(INFO) << "Adapting " << width << "x" << height << " to "
+                      << *adaptedWidth << "x" << *adaptedHeight
+                      << " (max pixels " << maxPixels << ", target " << targetPixels << ")";
+        adapted_width_ = *adaptedWidth;
+        adapted_height_ = *adaptedHeight;
+    }
+}
+
+
 bool VideoTrackSource::GetStats(VideoTrackSourceInterface::Stats* stats)
 {
     MutexLock lock(&stats_mutex_);
@@ -147,13 +203,14 @@ void VideoTrackSource::AddOrUpdateSink(VideoSinkInterface<VideoFrame>* sink, con
     auto copy = VideoSinkWants(wants);
     if (wants.resolution_alignment < REQUIRED_ALIGNMENT)
         copy.resolution_alignment = REQUIRED_ALIGNMENT;
-    if (wants.max_framerate_fps > MAX_FPS)
-        copy.max_framerate_fps = MAX_FPS;
     if (wants.max_pixel_count > MAX_WIDTH * MAX_HEIGHT)
         copy.max_pixel_count = MAX_WIDTH * MAX_HEIGHT;
 
     MutexLock lock(&sinks_and_wants_mutex_);
 
+    if (wants.max_framerate_fps > max_fps_)
+        copy.max_framerate_fps = max_fps_;
+
     SinkPair* sink_pair = FindSinkPair(sink);
     if (!sink_pair)
     {
@@ -260,8 +317,8 @@ VideoTrackSource::SinkPair* VideoTrackSource::FindSinkPair(const VideoSinkInterf
 void VideoTrackSource::UpdateWants()
 {
     VideoSinkWants wants;
-    wants.max_framerate_fps = MAX_FPS;
-    wants.max_pixel_count = MAX_WIDTH * MAX_HEIGHT;
+    wants.max_framerate_fps = std::min(max_fps_, limit_fps_);
+    wants.max_pixel_count = limit_pixels_;
     wants.rotation_applied = false;
     wants.resolution_alignment = REQUIRED_ALIGNMENT;
 
@@ -300,6 +357,11 @@ void VideoTrackSource::UpdateWants()
         wants.target_pixel_count.emplace(wants.max_pixel_count);
 
     current_wants_ = wants;
+
+    // The encoder's wants (lowered by WebRTC's quality scaler or a CPU overuse) pace the
+    // decimator directly, so those frames are never copied in the first place
+    MutexLock lock(&next_frame_mutex_);
+    decimator_.setTargetFps(wants.max_framerate_fps);
 }
 
 
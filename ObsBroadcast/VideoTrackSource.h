@@ -34,6 +34,9 @@
 #include "rtc_base/synchronization/mutex.h"
 #include "rtc_base/thread_annotations.h"
 
+#include "FrameBufferPool.h"
+#include "FrameDecimator.h"
+
 using absl::optional;
 using rtc::scoped_refptr;
 using rtc::VideoSinkInterface;
@@ -69,6 +72,15 @@ public:
                         int width, int height,
                         VideoRotation videoRotation);
 
+    /// Target frame rate from the profile, sinks can only lower it, and OBS's capture rate
+    void SetFrameRates(int targetFps, double captureFps);
+
+    /// Output size and rate ceiling from the bitrate controller, on top of the sinks' wants
+    void SetOutputLimits(int maxPixels, int maxFps);
+
+    NV12BufPool::Stats GetPoolStats() const { return framePool_.GetStats(); }
+    FrameDecimator::Stats GetDecimatorStats();
+
     /// VideoTrackSourceInterface implementation.
     bool is_screencast() const override { return false; }
     optional<bool> needs_denoising() const override { return optional<bool>(false); }
@@ -108,6 +120,9 @@ protected:
     const scoped_refptr<VideoFrameBuffer>& GetBlackFrameBuffer(int width, int height)
         RTC_EXCLUSIVE_LOCKS_REQUIRED(sinks_and_wants_mutex_);
 
+    /// Output size for a width x height capture under the current sink wants
+    void AdaptResolution(int width, int height, int* adaptedWidth, int* adaptedHeight);
+
     bool frame_wanted() const;
     VideoSinkWants wants() const;
 
@@ -116,11 +131,17 @@ private:
     mutable Mutex sinks_and_wants_mutex_;
     Mutex stats_mutex_;
 
-    optional<int64_t> nextFrameTimeNanos_ RTC_GUARDED_BY(next_frame_mutex_);
+    FrameDecimator decimator_ RTC_GUARDED_BY(next_frame_mutex_);
     optional<Stats> stats_ RTC_GUARDED_BY(stats_mutex_);
 
+    NV12BufPool framePool_;
     scoped_refptr<VideoFrameBuffer> black_frame_buffer_;
     VideoSinkWants current_wants_ RTC_GUARDED_BY(sinks_and_wants_mutex_);
+    int max_fps_ RTC_GUARDED_BY(sinks_and_wants_mutex_);
+    int limit_pixels_ RTC_GUARDED_BY(sinks_and_wants_mutex_);
+    int limit_fps_ RTC_GUARDED_BY(sinks_and_wants_mutex_);
+    int adapted_width_ RTC_GUARDED_BY(sinks_and_wants_mutex_) = 0;
+    int adapted_height_ RTC_GUARDED_BY(sinks_and_wants_mutex_) = 0;
     bool previous_frame_sent_to_all_sinks_ RTC_GUARDED_BY(sinks_and_wants_mutex_) = true;
 
     vector<SinkPair> sinks_;
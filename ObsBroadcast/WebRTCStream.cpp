@@ -31,16 +31,20 @@
 #include "ObsBroadcast.h"
 #include "SanitizeInputs.h"
 #include "SDPUtil.h"
+#include "X264Calibration.h"
 #include "X264Encoder.h"
 #include "webrtc_version.h"
 
 // solution
 #include <libPlugins/build_version.h>
 #include <libPlugins/ObsUtil.h>
+#include <libPlugins/MFCConfigConstants.h>
 #include <libPlugins/MFCEdgeIngest.h>
+#include <libfcs/MfcTrace.h>
 
 // obs
 #include <media-io/video-io.h>
+#include <util/platform.h>
 
 // webrtc
 #include "api/create_peerconnection_factory.h"
@@ -54,6 +58,7 @@
 #include "api/video_codecs/builtin_video_decoder_factory.h"
 //#include "api/video_codecs/builtin_video_encoder_factory.h"
 #include "pc/webrtc_sdp.h"
+#include "rtc_base/time_utils.h"
 #include "third_party/libyuv/include/libyuv.h"
 
 #include <algorithm>
@@ -183,6 +188,7 @@ WebRTCStream::WebRTCStream(obs_output_t* output)
     , m_nVideoBitrateKbps(0)
     , m_nAudioBitrateKbps(0)
     , m_nFrameRate(0)
+    , m_dCaptureFps(0)
     , m_sAudioCodec("opus")
     , network_(CreateNetwork())
     , worker_(CreateWorker())
@@ -248,20 +254,33 @@ WebRTCStream::~WebRTCStream()
 
 bool WebRTCStream::Start()
 {
+    MFC_TRACE_SCOPE("stream", "WebRTCStream::Start");
+
     if (started_)
         Stop(false);
     started_ = true;
     stopping_ = false;
 
     ResetStats();
-    ConfigureStreamParameters();
-
-    if (!CreatePeerConnection())
-        return false;
-    if (!AddTracks())
-        return false;
-    if (!OpenWebsocketConnection())
-        return false;
+    {
+        MFC_TRACE_SCOPE("stream", "ConfigureStreamParameters");
+        ConfigureStreamParameters();
+    }
+    {
+        MFC_TRACE_SCOPE("stream", "CreatePeerConnection");
+        if (!CreatePeerConnection())
+            return false;
+    }
+    {
+        MFC_TRACE_SCOPE("stream", "AddTracks");
+        if (!AddTracks())
+            return false;
+    }
+    {
+        MFC_TRACE_SCOPE("stream", "OpenWebsocketConnection");
+        if (!OpenWebsocketConnection())
+            return false;
+    }
 
     return true;
 }
@@ -277,6 +296,65 @@ bool WebRTCStream::Stop(bool normal)
     // Increase logging verbosity to log end of stream summary
     LogLevel(LoggingSeverity::LS_VERBOSE);
 
+    if (videoSource_)
+    {
+        auto pool = videoSource_->GetPoolStats();
+        obs_info("Frame pool: %llu frames, %llu buffers allocated, %zu max in use, %llu dropped exhausted, copy avg %lldus max %lldus",
+                 (unsigned long long)pool.acquired, (unsigned long long)pool.allocated, pool.maxInUse,
+                 (unsigned long long)pool.exhausted, (long long)pool.copyAvgUs, (long long)pool.copyMaxUs);
+        obs_info("Frames downscaled: %llu, scale avg %lldus max %lldus",
+                 (unsigned long long)pool.scaled, (long long)pool.scaleAvgUs, (long long)pool.scaleMaxUs);
+
+        auto fps = videoSource_->GetDecimatorStats();
+        obs_info("Frame rate %d: %llu frames kept, %llu dropped, %llu resyncs, cadence jitter avg %lldus max %lldus",
+                 fps.targetFps, (unsigned long long)fps.kept, (unsigned long long)fps.dropped,
+                 (unsigned long long)fps.resyncs, (long long)fps.jitterAvgUs, (long long)fps.jitterMaxUs);
+    }
+
+    {
+        MutexLock lock(&mutex_);
+        if (abr_)
+        {
+            auto abr = abr_->getStats();
+            obs_info("ABR: %llu intervals, %llu congested, %llu decreases, %llu increases, min %d kbps, "
+                     "%llu rungs down, %llu up, lowest rung %d, %llu PLIs, loss avg %.2f%%",
+                     (unsigned long long)abr.intervals, (unsigned long long)abr.congested,
+                     (unsigned long long)abr.decreases, (unsigned long long)abr.increases, abr.minBitrateKbps,
+                     (unsigned long long)abr.rungDowns, (unsigned long long)abr.rungUps, abr.maxRung,
+                     (unsigned long long)abr.plis, abr.lossAvg * 100);
+        }
+    }
+
+    auto i420 = NV12Buf::GetI420Stats();
+    auto i420Pool = I420BufPool::instance().GetStats();
+    obs_info("I420 conversions: %llu, %llu cache hits, avg %lldus max %lldus, %llu buffers allocated, %llu unpooled",
+             (unsigned long long)i420.conversions, (unsigned long long)i420.cacheHits,
+             (long long)i420.convertAvgUs, (long long)i420.convertMaxUs,
+             (unsigned long long)i420Pool.allocated, (unsigned long long)i420Pool.exhausted);
+
+    auto overload = X264Encoder::GetOverloadStats();
+    if (overload.levelUps)
+        obs_info("Encoder overload: %llu level ups, %llu level downs, max level %s, %llu frames skipped",
+                 (unsigned long long)overload.levelUps, (unsigned long long)overload.levelDowns,
+                 EncoderOverload::levelName((EncoderOverload::Level)overload.maxLevel),
+                 (unsigned long long)overload.skipped);
+
+    auto latency = FrameLatency::instance().getStats();
+    obs_info("Latency: %llu frames, dropped %llu decimated, %llu source, %llu encoder, %llu lost",
+             (unsigned long long)latency.frames,
+             (unsigned long long)latency.drops[FrameLatency::DROP_DECIMATED],
+             (unsigned long long)latency.drops[FrameLatency::DROP_SOURCE],
+             (unsigned long long)latency.drops[FrameLatency::DROP_ENCODER],
+             (unsigned long long)latency.drops[FrameLatency::DROP_LOST]);
+    for (int i = 0; i < FrameLatency::NUM_STAGES; i++)
+    {
+        const auto& stage = latency.stages[i];
+        if (stage.count)
+            obs_info("Latency %-9s avg %lldus p50 %lldus p95 %lldus p99 %lldus max %lldus",
+                     FrameLatency::stageName((FrameLatency::Stage)i), (long long)stage.avgUs, (long long)stage.p50Us,
+                     (long long)stage.p95Us, (long long)stage.p99Us, (long long)stage.maxUs);
+    }
+
     if (audioSender_)
         audioSender_.release();
     if (videoSender_)
@@ -301,6 +379,7 @@ bool WebRTCStream::Stop(bool normal)
 void WebRTCStream::ResetStats()
 {
     frame_id_               = 0;
+    FrameLatency::instance().reset();
     video_bitrate_bps_      = 0;
     total_bitrate_bps_      = 0;
 
@@ -352,7 +431,11 @@ void WebRTCStream::ConfigureStreamParameters()
     obs_encoder_t* pVideoEncoder = obs_output_get_video_encoder(m_pOutput);
     auto pVideoOutputInfo = video_output_get_info(obs_get_video());
     double fps = video_output_get_frame_rate(obs_get_video());
-    m_nFrameRate = std::min((int)round(fps), 30);
+    int nTargetFps = CObsUtil::getConfigOrDefault(CONFIG_SECTION, CONFIG_FRAME_RATE, MFC_DEFAULT_WEBRTC_FRAMERATE);
+    nTargetFps = std::min(std::max(nTargetFps, 1), MFC_SERVICES_JSON_MAX_FPS_VALUE);
+    m_dCaptureFps = fps;
+    m_nFrameRate = std::min((int)round(fps), nTargetFps);
+    obs_info("Frame rate: %d (capture %.2f, profile target %d)", m_nFrameRate, fps, nTargetFps);
     obs_data_t* pVideoSettings = obs_encoder_get_settings(pVideoEncoder);
     int videoBitrateKbps = (int)obs_data_get_int(pVideoSettings, "bitrate");
     obs_data_release(pVideoSettings);
@@ -373,6 +456,9 @@ void WebRTCStream::ConfigureStreamParameters()
     m_nVideoBitrateKbps = roundUp(m_nVideoBitrateKbps, m_nFrameRate);
     obs_info("Adjusted resolution: %d x %d\n", m_nWidth, m_nHeight);
 
+    // What gets calibrated the next time we're not streaming, if it hasn't been yet
+    X264Calibration::instance().setOutput(m_nWidth, m_nHeight, m_nFrameRate, m_nVideoBitrateKbps);
+
     video_bitrate_bps_ = m_nVideoBitrateKbps * 1000;
     total_bitrate_bps_ = (m_nVideoBitrateKbps + m_nAudioBitrateKbps) * 1000;
 
@@ -392,6 +478,63 @@ void WebRTCStream::ConfigureStreamParameters()
     obs_output_set_video_conversion(m_pOutput, &vsi);
 
     obs_output_set_media(m_pOutput, obs_get_video(), obs_get_audio());
+
+    ConfigureAbr();
+}
+
+
+void WebRTCStream::ConfigureAbr()
+{
+    MutexLock lock(&mutex_);
+    abr_.reset();
+
+    if (!CObsUtil::getConfigOrDefault(CONFIG_SECTION, CONFIG_ABR, MFC_DEFAULT_ABR_ENABLED))
+    {
+        obs_info("Adaptive bitrate off");
+        return;
+    }
+
+    // The stream's settings are the ceilings, the profile has the floors
+    AbrController::Config cfg;
+    cfg.nMaxBitrateKbps = m_nVideoBitrateKbps;
+    cfg.nMaxWidth       = m_nWidth;
+    cfg.nMaxHeight      = m_nHeight;
+    cfg.nMaxFps         = m_nFrameRate;
+    cfg.nMinBitrateKbps = CObsUtil::getConfigOrDefault(CONFIG_SECTION, CONFIG_ABR_MIN_BITRATE, MFC_DEFAULT_ABR_MIN_BITRATE);
+    cfg.nMinHeight      = CObsUtil::getConfigOrDefault(CONFIG_SECTION, CONFIG_ABR_MIN_HEIGHT, MFC_DEFAULT_ABR_MIN_HEIGHT);
+    cfg.nMinFps         = CObsUtil::getConfigOrDefault(CONFIG_SECTION, CONFIG_ABR_MIN_FRAME_RATE, MFC_DEFAULT_ABR_MIN_FRAME_RATE);
+    abr_ = std::make_unique<AbrController>(cfg);
+
+    const auto& ladder = abr_->ladder();
+    obs_info("Adaptive bitrate %d - %d kbps, %d rungs down to %dx%d@%d",
+             std::min(cfg.nMinBitrateKbps, cfg.nMaxBitrateKbps), cfg.nMaxBitrateKbps, (int)ladder.size(),
+             ladder.back().nWidth, ladder.back().nHeight, ladder.back().nFps);
+}
+
+
+void WebRTCStream::ApplyAbrTarget(const AbrController::Target& target)
+{
+    // The sender's max bitrate caps what the bandwidth estimator hands the encoder in
+    // SetRates(), the source does the downscaling and frame dropping
+    if (videoSender_)
+    {
+        auto params = videoSender_->GetParameters();
+        if (!params.encodings.empty())
+        {
+            params.encodings[0].max_bitrate_bps = target.nBitrateKbps * 1000;
+            params.encodings[0].max_framerate   = (double)target.rung.nFps;
+            RTCError ret = videoSender_->SetParameters(params);
+            if (!ret.ok())
+                obs_warn("Failed to set RTP parameters: %s", ret.message());
+        }
+    }
+
+    if (videoSource_)
+        videoSource_->SetOutputLimits(target.rung.nWidth * target.rung.nHeight, target.rung.nFps);
+
+    obs_debug("ABR: %d kbps, %dx%d@%d (rung %d), loss %.3f, rtt %d base %d",
+              target.nBitrateKbps, target.rung.nWidth, target.rung.nHeight, target.rung.nFps, target.nRung,
+              abr_->lastLoss(), rtt_, abr_->baseRttMs());
 }
 
 
@@ -452,6 +595,7 @@ bool WebRTCStream::AddTracks()
     videoSource_ =
         signaling_->Invoke<scoped_refptr<VideoTrackSource>>(
             RTC_FROM_HERE, []() { return VideoTrackSource::Create(); });
+    videoSource_->SetFrameRates(m_nFrameRate, m_dCaptureFps);
     videoTrack_ = factory_->CreateVideoTrack("video", videoSource_);
     auto video_result_or_error = pc_->AddTrack(videoTrack_, {stream_id});
     if (!video_result_or_error.ok())
@@ -478,18 +622,18 @@ bool WebRTCStream::OpenWebsocketConnection()
         // synchronized with a shared lock, as done in next line.
         auto lk         = g_ctx.sharedLock();
 
-        m_sVideoCodec   = g_ctx.cfg.getString("codec");
-        m_sProtocol     = g_ctx.cfg.getString("prot");
-        m_sRegion       = g_ctx.cfg.getString("region");
-        m_sVideoServer  = g_ctx.cfg.getString("videoserver");
-        sUsername       = g_ctx.cfg.getString("username");
-        sPwd            = g_ctx.cfg.getString("pwd");
-        sStreamKey      = g_ctx.cfg.getString("ctx");
-        sVidCtx         = g_ctx.cfg.getString("vidctx");
-        nSid            = g_ctx.cfg.getInt("sid");
-        nUid            = g_ctx.cfg.getInt("uid");
-        nRoomId         = g_ctx.cfg.getInt("room");
-        fCamScore       = g_ctx.cfg.getFloat("camscore");
+        m_sVideoCodec   = g_ctx.cfg.getString(SkCfg::Codec);
+        m_sProtocol     = g_ctx.cfg.getString(SkCfg::Prot);
+        m_sRegion       = g_ctx.cfg.getString(SkCfg::Region);
+        m_sVideoServer  = g_ctx.cfg.getString(SkCfg::VideoServer);
+        sUsername       = g_ctx.cfg.getString(SkCfg::Username);
+        sPwd            = g_ctx.cfg.getString(SkCfg::Pwd);
+        sStreamKey      = g_ctx.cfg.getString(SkCfg::Ctx);
+        sVidCtx         = g_ctx.cfg.getString(SkCfg::VidCtx);
+        nSid            = g_ctx.cfg.getInt(SkCfg::Sid);
+        nUid            = g_ctx.cfg.getInt(SkCfg::Uid);
+        nRoomId         = g_ctx.cfg.getInt(SkCfg::Room);
+        fCamScore       = g_ctx.cfg.getFloat(SkCfg::CamScore);
     }
     sStreamName = "ext_x_" + std::to_string(nUid) + ".f4v";
     sWsUrl      = "wss://" + m_sVideoServer + ".myfreecams.com/webrtc-session.json";
@@ -774,9 +918,17 @@ void WebRTCStream::onVideoFrame(video_data* frame)
     if (!frame || !videoSource_)
         return;
 
+    // Id 0 is what WebRTC uses for a frame without one
+    if (++frame_id_ == 0)
+        ++frame_id_;
+
+    // OBS stamps frames from os_gettime_ns() when it renders them
+    int64_t obsDelayUs = ((int64_t)os_gettime_ns() - (int64_t)frame->timestamp) / rtc::kNumNanosecsPerMicrosec;
+    FrameLatency::instance().captured(frame_id_, obsDelayUs);
+
     videoSource_->onIncomingData(frame->data[0], frame->linesize[0],
                                  frame->data[1], frame->linesize[1],
-                                 (int64_t)frame->timestamp, ++frame_id_,
+                                 (int64_t)frame->timestamp, frame_id_,
                                  m_nWidth, m_nHeight,
                                  kVideoRotation_0);
 }
@@ -892,6 +1044,12 @@ void WebRTCStream::OnStatsDelivered(const scoped_refptr<const RTCStatsReport>& r
                     prev_timestamp_ = outbound_time_us_;
                 }
 
+                // Pacer delay per packet since the last report, the send stage of the latency stats
+                const uint32_t packets = *stat->packets_sent;
+                if (packets > packets_sent_)
+                    FrameLatency::instance().sendDelay((int64_t)round((*stat->total_packet_send_delay - total_pkt_send_delay_)
+                                                                      / (packets - packets_sent_) * rtc::kNumMicrosecsPerSec));
+
                 uint64_t temp           = *stat->bytes_sent;
                 video_bytes_rtx_        = *stat->retransmitted_bytes_sent;
                 packets_sent_           = *stat->packets_sent;
@@ -920,6 +1078,27 @@ void WebRTCStream::OnStatsDelivered(const scoped_refptr<const RTCStatsReport>& r
             }
         }
 
+        if (abr_ && !stopping_)
+        {
+            AbrController::Sample sample;
+            sample.nTimeMs      = rtc::TimeMillis();
+            sample.nPacketsSent = packets_sent_;
+            sample.nPacketsLost = packets_lost_;
+            sample.nNacks       = nack_received_;
+            sample.nPlis        = pli_received_;
+            sample.nRttMs       = rtt_;
+            sample.nSendKbps    = video_bitrate_;
+
+            const int nPrevRung = abr_->target().nRung;
+            if (abr_->update(sample))
+            {
+                ApplyAbrTarget(abr_->target());
+                if (abr_->target().nRung != nPrevRung)
+                    obs_info("ABR: %dx%d@%d at %d kbps", abr_->target().rung.nWidth, abr_->target().rung.nHeight,
+                             abr_->target().rung.nFps, abr_->target().nBitrateKbps);
+            }
+        }
+
         // output every 15 seconds
         if (prev_outbound_delta_t > 14)
         {
@@ -951,6 +1130,19 @@ void WebRTCStream::OnStatsDelivered(const scoped_refptr<const RTCStatsReport>& r
             obs_info("NACK received:     %u",       nack_received_);
             obs_info("packet send delay: %d",       (int)round(total_pkt_send_delay_ / packets_sent_ * 1000));
 
+            auto latency = FrameLatency::instance().getStats();
+            const auto& total = latency.stages[FrameLatency::STAGE_TOTAL];
+            obs_info("latency:           %lld ms, p95 %lld ms, p99 %lld ms, max %lld ms",
+                     (long long)total.avgUs / 1000, (long long)total.p95Us / 1000,
+                     (long long)total.p99Us / 1000, (long long)total.maxUs / 1000);
+            obs_info("latency stages:    obs %.1f, copy %.1f, queue %.1f, encode %.1f, packetize %.1f, send %.1f ms",
+                     latency.stages[FrameLatency::STAGE_OBS].avgUs / 1000.0,
+                     latency.stages[FrameLatency::STAGE_COPY].avgUs / 1000.0,
+                     latency.stages[FrameLatency::STAGE_QUEUE].avgUs / 1000.0,
+                     latency.stages[FrameLatency::STAGE_ENCODE].avgUs / 1000.0,
+                     latency.stages[FrameLatency::STAGE_PACKETIZE].avgUs / 1000.0,
+                     latency.stages[FrameLatency::STAGE_SEND].avgUs / 1000.0);
+
             prev_video_bytes_   = video_bytes_sent_;
             prev_timestamp_     = outbound_time_us_;
 
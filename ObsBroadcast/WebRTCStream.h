@@ -26,7 +26,9 @@
 #endif
 
 // project
+#include "AbrController.h"
 #include "ADMWrapper.h"
+#include "FrameLatency.h"
 #include "VideoTrackSource.h"
 
 // solution
@@ -88,6 +90,8 @@ public:
     bool OpenWebsocketConnection();
     void SendOffer(const webrtc::SessionDescriptionInterface* desc);
     void SetBitrate();
+    void ConfigureAbr();
+    void ApplyAbrTarget(const AbrController::Target& target);
 
     void onAudioFrame(audio_data* frame);
     void onVideoFrame(video_data* frame);
@@ -141,6 +145,7 @@ public:
     uint32_t framesDropped() const { return frames_dropped_; }
     int packetsLost() const { return packets_lost_; }
     int packetsSent() const { return (int)packets_sent_; }
+    FrameLatency::Stats latencyStats() const { return FrameLatency::instance().getStats(); }
 
 private:
     obs_output_t* m_pOutput;  // OBS stream output
@@ -151,6 +156,7 @@ private:
     int m_nVideoBitrateKbps;
     int m_nAudioBitrateKbps;
     int m_nFrameRate;
+    double m_dCaptureFps;
     std::string m_sVideoCodec;
     std::string m_sAudioCodec;
     std::string m_sVideoServer;
@@ -202,6 +208,9 @@ private:
     int rtt_;
     double jitter_;
 
+    // Bitrate/resolution controller, fed from OnStatsDelivered
+    std::unique_ptr<AbrController> abr_ RTC_GUARDED_BY(mutex_);
+
     std::thread close_async_;
 
     std::unique_ptr<rtc::Thread> network_;
@@ -0,0 +1,532 @@
+/*
+ * Copyright (c) 2013-2021 MFCXY, Inc. <mfcxy@mfcxy.com>
+ * Copyright (c) 2020 The WebRTC project authors. All Rights Reserved.
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "X264Calibration.h"
+#include "X264Encoder.h"
+
+#include <libfcs/MfcJson.h>
+#include <libfcs/MfcTimer.h>
+#include <libPlugins/PluginConfigWriter.h>
+
+#include "rtc_base/logging.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include <thread>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/resource.h>
+#endif
+
+using std::string;
+using std::vector;
+
+const char* const X264Calibration::PRESETS[] = { "ultrafast", "superfast", "veryfast", "faster", "fast", "medium" };
+const int X264Calibration::NUM_PRESETS      = (int)(sizeof(PRESETS) / sizeof(PRESETS[0]));
+const int X264Calibration::DEFAULT_PRESET   = 2;
+
+
+namespace
+{
+
+// CPU time used by the whole process so far, all threads
+int64_t processCpuUs(void)
+{
+#ifdef _WIN32
+    FILETIME ftCreate, ftExit, ftKernel, ftUser;
+    if (!GetProcessTimes(GetCurrentProcess(), &ftCreate, &ftExit, &ftKernel, &ftUser))
+        return 0;
+
+    ULARGE_INTEGER k, u;
+    k.LowPart = ftKernel.dwLowDateTime;
+    k.HighPart = ftKernel.dwHighDateTime;
+    u.LowPart = ftUser.dwLowDateTime;
+    u.HighPart = ftUser.dwHighDateTime;
+    return (int64_t)((k.QuadPart + u.QuadPart) / 10);   // 100ns units
+#else
+    struct rusage ru;
+    if (getrusage(RUSAGE_SELF, &ru) != 0)
+        return 0;
+
+    return (int64_t)(ru.ru_utime.tv_sec + ru.ru_stime.tv_sec) * 1000000 + ru.ru_utime.tv_usec + ru.ru_stime.tv_usec;
+#endif
+}
+
+
+// Noise field wider and taller than the frame, each frame is a window panned across it
+struct SyntheticClip
+{
+    static const int    PAN_X   = 4;        // luma pixels per frame
+    static const int    PAN_Y   = 2;
+    static const int    BLOCK   = 64;       // side of the moving block
+
+    int                 nWidth, nHeight, nFieldW, nFieldH;
+    vector< uint8_t >   vY, vUV;
+
+    SyntheticClip(int w, int h, int nFrames)
+        : nWidth(w), nHeight(h)
+        , nFieldW(w + PAN_X * nFrames + 2)
+        , nFieldH(h + PAN_Y * nFrames + 2)
+    {
+        nFieldW &= ~1;
+        nFieldH &= ~1;
+        vY.resize((size_t)nFieldW * nFieldH);
+        vUV.resize((size_t)nFieldW * (nFieldH / 2));
+
+        // Smoothed noise, so it compresses like camera footage rather than white noise
+        std::mt19937 rng(1234);
+        for (size_t n = 0; n < vY.size(); n++)
+            vY[n] = (uint8_t)(64 + (rng() & 127));
+        for (int y = 0; y < nFieldH; y++)
+        {
+            uint8_t* pRow = &vY[(size_t)y * nFieldW];
+            for (int x = 1; x < nFieldW; x++)
+                pRow[x] = (uint8_t)((pRow[x - 1] * 3 + pRow[x]) / 4);
+        }
+        for (size_t n = 0; n < vUV.size(); n++)
+            vUV[n] = (uint8_t)(112 + (rng() & 31));
+    }
+
+    void render(int nFrame, x264_picture_t& pic) const
+    {
+        const int x0 = (nFrame * PAN_X) & ~1, y0 = (nFrame * PAN_Y) & ~1;
+
+        for (int y = 0; y < nHeight; y++)
+            memcpy(pic.img.plane[0] + (size_t)y * pic.img.i_stride[0], &vY[(size_t)(y0 + y) * nFieldW + x0], nWidth);
+        for (int y = 0; y < nHeight / 2; y++)
+            memcpy(pic.img.plane[1] + (size_t)y * pic.img.i_stride[1], &vUV[(size_t)(y0 / 2 + y) * nFieldW + x0], nWidth);
+
+        // A flat block moving against the pan, its edges give motion search something to find
+        const int nBlock = std::min(BLOCK, std::min(nWidth, nHeight) / 2);
+        const int bx = (nFrame * 12) % std::max(nWidth - nBlock, 1);
+        const int by = (nFrame * 6) % std::max(nHeight - nBlock, 1);
+        for (int y = by; y < by + nBlock; y++)
+            memset(pic.img.plane[0] + (size_t)y * pic.img.i_stride[0] + bx, 235, nBlock);
+    }
+};
+
+}  // namespace
+
+
+// static
+X264Calibration& X264Calibration::instance(void)
+{
+    static X264Calibration s_instance;
+    return s_instance;
+}
+
+
+X264Calibration::X264Calibration()
+    : m_fLoaded(false)
+    , m_fStreaming(false)
+    , m_cancel(CCancelToken::create())
+{
+}
+
+
+// static
+const char* X264Calibration::presetName(int nPreset)
+{
+    return PRESETS[nPreset >= 0 && nPreset < NUM_PRESETS ? nPreset : DEFAULT_PRESET];
+}
+
+
+void X264Calibration::setFile(const string& sPath)
+{
+    std::lock_guard< std::mutex > lock(m_mutex);
+    m_sFile     = sPath;
+    m_fLoaded   = false;
+
+    load();
+    queue();
+}
+
+
+void X264Calibration::setOutput(int nWidth, int nHeight, int nFps, int nBitrateKbps)
+{
+    std::lock_guard< std::mutex > lock(m_mutex);
+    if (!m_fLoaded)
+        load();
+
+    if (m_output.nWidth == nWidth && m_output.nHeight == nHeight && m_output.nFps == nFps
+        && m_output.nBitrateKbps == nBitrateKbps)
+        return;
+
+    m_output.nWidth         = nWidth;
+    m_output.nHeight        = nHeight;
+    m_output.nFps           = nFps;
+    m_output.nBitrateKbps   = nBitrateKbps;
+    save();
+    queue();
+}
+
+
+void X264Calibration::setStreaming(bool fStreaming)
+{
+    std::lock_guard< std::mutex > lock(m_mutex);
+    m_fStreaming = fStreaming;
+
+    // The encoder is about to need the CPU, a calibration now would measure the stream too
+    if (fStreaming)
+        m_run.cancel();
+    else
+        queue();
+}
+
+
+// static
+string X264Calibration::key(int nWidth, int nHeight, int nFps)
+{
+    return std::to_string(nWidth) + "x" + std::to_string(nHeight) + "@" + std::to_string(nFps);
+}
+
+
+X264Calibration::Config X264Calibration::configFor(int nWidth, int nHeight, int nFps)
+{
+    std::lock_guard< std::mutex > lock(m_mutex);
+    if (!m_fLoaded)
+        load();
+
+    auto it = m_configs.find(key(nWidth, nHeight, nFps));
+    if (it != m_configs.end())
+        return it->second;
+
+    // Closest pixel rate, by ratio so 360p isn't matched against 1080p just because the
+    // difference is smaller in absolute terms; ties go to the bigger entry's faster preset
+    const double dRate = (double)nWidth * nHeight * nFps;
+    double dBestRatio = 0.0, dBestRate = 0.0;
+    Config best;
+
+    for (const auto& entry : m_configs)
+    {
+        int w = 0, h = 0, fps = 0;
+        if (sscanf(entry.first.c_str(), "%dx%d@%d", &w, &h, &fps) != 3 || w <= 0 || h <= 0 || fps <= 0)
+            continue;
+
+        const double dEntryRate = (double)w * h * fps;
+        const double dRatio = std::max(dRate, dEntryRate) / std::min(dRate, dEntryRate);
+        if (dBestRatio == 0.0 || dRatio < dBestRatio || (dRatio == dBestRatio && dEntryRate > dBestRate))
+        {
+            dBestRatio = dRatio;
+            dBestRate = dEntryRate;
+            best = entry.second;
+        }
+    }
+
+    return best;
+}
+
+
+// Queues a background calibration of the configured output if it needs one and we're
+// not streaming. Called with m_mutex held.
+void X264Calibration::queue(void)
+{
+    const Output out = m_output;
+    if (m_fStreaming || m_cancel.isCancelled() || out.nWidth <= 0 || out.nHeight <= 0 || out.nFps <= 0)
+        return;
+
+    const string sKey = key(out.nWidth, out.nHeight, out.nFps);
+    if (m_configs.count(sKey) || !m_pending.insert(sKey).second)
+        return;
+
+    RTC_LOG(LS_INFO) << "x264 calibration queued for " << sKey;
+    m_run = CCancelToken::create();
+    CCancelToken run = m_run;
+    CExecutor::instance().submit([this, out, run]()
+    {
+        calibrate(out.nWidth, out.nHeight, out.nFps, out.nBitrateKbps, nullptr, run);
+    }, CExecutor::Bulk, run);
+}
+
+
+X264Calibration::Config X264Calibration::calibrate(int nWidth, int nHeight, int nFps, int nBitrateKbps,
+                                                   vector< Result >* pvResults, const CCancelToken& token)
+{
+    const string sKey = key(nWidth, nHeight, nFps);
+    const uint64_t nStartNs = MfcTimer::MonoNs();
+    Config best;
+    bool fDone = true, fAny = false;
+    Result res;
+
+    // Fastest first, the first preset that misses the budget ends the walk
+    for (int n = 0; n < NUM_PRESETS && fDone; n++)
+    {
+        Config cfg;
+        cfg.nPreset = n;
+        if ((fDone = measure(cfg, nWidth, nHeight, nFps, nBitrateKbps, token, res)) == false)
+            break;
+        if (pvResults)
+            pvResults->push_back(res);
+        if (!res.fInBudget)
+            break;
+        best = cfg;
+        fAny = true;
+    }
+
+    // Nothing fits: the fastest preset is the best there is
+    if (fDone && !fAny)
+        best.nPreset = 0;
+
+    // Half the cores often does as well and leaves the rest to OBS
+    const int nCores = (int)std::thread::hardware_concurrency();
+    if (fDone && fAny && nCores >= 4)
+    {
+        Config cfg = best;
+        cfg.nThreads = nCores / 2;
+        if ((fDone = measure(cfg, nWidth, nHeight, nFps, nBitrateKbps, token, res)) == true)
+        {
+            if (pvResults)
+                pvResults->push_back(res);
+            if (res.fInBudget)
+                best = cfg;
+        }
+    }
+
+    std::lock_guard< std::mutex > lock(m_mutex);
+    m_pending.erase(sKey);
+
+    if (!fDone)
+    {
+        RTC_LOG(LS_INFO) << "x264 calibration for " << sKey << " abandoned";
+
+        // Cut short by a stream start: if that stream is already over again, its stop
+        // found this one still pending and didn't queue another
+        if (token.isCancelled())
+            queue();
+        return Config();
+    }
+
+    if (!m_fLoaded)
+        load();
+    m_configs[sKey] = best;
+    save();
+
+    RTC_LOG(LS_INFO) << "x264 calibration for " << sKey << ": " << presetName(best.nPreset) << ", threads "
+                     << (best.nThreads > 0 ? std::to_string(best.nThreads) : string("auto")) << " in "
+                     << (MfcTimer::MonoNs() - nStartNs) / 1000000 << "ms";
+    return best;
+}
+
+
+bool X264Calibration::measure(const Config& cfg, int nWidth, int nHeight, int nFps, int nBitrateKbps,
+                              const CCancelToken& token, Result& result)
+{
+    x264_param_t params{};
+    if (!X264Encoder::FillEncoderParams(&params, cfg, nWidth, nHeight, (uint32_t)nFps, (uint32_t)nBitrateKbps, 1200))
+        return false;
+    params.i_log_level = X264_LOG_WARNING;
+
+    x264_picture_t pic;
+    if (x264_picture_alloc(&pic, X264_CSP_NV12, nWidth, nHeight) < 0)
+        return false;
+
+    x264_t* pEncoder = x264_encoder_open(&params);
+    if (!pEncoder)
+    {
+        x264_picture_clean(&pic);
+        return false;
+    }
+
+    const SyntheticClip clip(nWidth, nHeight, CALIBRATION_FRAMES);
+    vector< double > vMs;
+    vMs.reserve(CALIBRATION_FRAMES);
+    int64_t nCpuUs = 0, nWallUs = 0;
+    bool fOk = true;
+
+    for (int n = 0; n < CALIBRATION_FRAMES && fOk; n++)
+    {
+        if (token.isCancelled())
+        {
+            fOk = false;
+            break;
+        }
+
+        clip.render(n, pic);
+        pic.i_pts = n;
+        pic.i_type = X264_TYPE_AUTO;
+
+        x264_nal_t* pNal = nullptr;
+        int nNals = 0;
+        x264_picture_t picOut;
+
+        const int64_t nCpuStart = processCpuUs();
+        const uint64_t nStartNs = MfcTimer::MonoNs();
+        fOk = x264_encoder_encode(pEncoder, &pNal, &nNals, &pic, &picOut) >= 0;
+        const uint64_t nElapsedNs = MfcTimer::MonoNs() - nStartNs;
+        const int64_t nCpuElapsed = processCpuUs() - nCpuStart;
+
+        // The first frames pay for the IDR and thread startup
+        if (n >= WARMUP_FRAMES)
+        {
+            vMs.push_back((double)nElapsedNs / 1000000.0);
+            nCpuUs  += nCpuElapsed;
+            nWallUs += (int64_t)(nElapsedNs / 1000);
+        }
+    }
+
+    x264_encoder_close(pEncoder);
+    x264_picture_clean(&pic);
+
+    if (!fOk || vMs.empty())
+        return false;
+
+    double dSum = 0.0;
+    for (double d : vMs)
+        dSum += d;
+    std::sort(vMs.begin(), vMs.end());
+
+    result.cfg          = cfg;
+    result.dAvgMs       = dSum / vMs.size();
+    result.dP95Ms       = vMs[std::min(vMs.size() - 1, vMs.size() * 95 / 100)];
+    result.dCpuCores    = nWallUs > 0 ? (double)nCpuUs / nWallUs : 0.0;
+    result.fInBudget    = result.dP95Ms <= 1000.0 / nFps * BUDGET_FRACTION;
+
+    RTC_LOG(LS_INFO) << "x264 calibration " << key(nWidth, nHeight, nFps) << " " << presetName(cfg.nPreset)
+                     << " threads " << cfg.nThreads << ": avg " << result.dAvgMs << "ms, p95 " << result.dP95Ms
+                     << "ms, " << result.dCpuCores << " cores" << (result.fInBudget ? "" : ", over budget");
+    return true;
+}
+
+
+void X264Calibration::setConfig(int nWidth, int nHeight, int nFps, const Config& cfg)
+{
+    std::lock_guard< std::mutex > lock(m_mutex);
+    if (!m_fLoaded)
+        load();
+
+    m_configs[key(nWidth, nHeight, nFps)] = cfg;
+    save();
+}
+
+
+void X264Calibration::invalidate(void)
+{
+    std::lock_guard< std::mutex > lock(m_mutex);
+    if (!m_fLoaded)
+        load();
+
+    m_configs.clear();
+    save();
+}
+
+
+void X264Calibration::recalibrate(void)
+{
+    invalidate();
+
+    std::lock_guard< std::mutex > lock(m_mutex);
+    RTC_LOG(LS_INFO) << "x264 recalibration requested" << (m_fStreaming ? ", runs once the stream stops" : "");
+    queue();
+}
+
+
+void X264Calibration::stop(void)
+{
+    std::lock_guard< std::mutex > lock(m_mutex);
+    m_cancel.cancel();
+    m_run.cancel();
+}
+
+
+// Called with m_mutex held
+void X264Calibration::load(void)
+{
+    m_fLoaded = true;
+
+    MfcJsonObj js;
+    if (m_sFile.empty() || !js.loadFromFile(m_sFile))
+        return;
+
+    MfcJsonObj* pOutput = nullptr;
+    if (m_output.nWidth <= 0 && js.objectGetObject("output", &pOutput) && pOutput)
+    {
+        pOutput->objectGetInt("width", m_output.nWidth);
+        pOutput->objectGetInt("height", m_output.nHeight);
+        pOutput->objectGetInt("fps", m_output.nFps);
+        pOutput->objectGetInt("kbps", m_output.nBitrateKbps);
+    }
+
+    // Results from other hardware don't apply
+    int32_t nCores = 0;
+    if (!js.objectGetInt("cores", nCores) || nCores != (int32_t)std::thread::hardware_concurrency())
+    {
+        RTC_LOG(LS_INFO) << "x264 calibration results were measured on " << nCores << " cores, recalibrating";
+        return;
+    }
+
+    MfcJsonObj* pConfigs = nullptr;
+    if (!js.objectGetObject("configs", &pConfigs) || !pConfigs)
+        return;
+
+    for (MfcJsonIter iObj = pConfigs->objectEnum(); !pConfigs->objectEnd(iObj); iObj++)
+    {
+        const MfcJsonObj* pCfg = pConfigs->objectAt(iObj);
+        string sPreset;
+        Config cfg;
+
+        if (!pCfg->objectGetString("preset", sPreset))
+            continue;
+        cfg.nPreset = (int)(std::find_if(PRESETS, PRESETS + NUM_PRESETS,
+                                         [&sPreset](const char* psz) { return sPreset == psz; }) - PRESETS);
+        if (cfg.nPreset >= NUM_PRESETS)
+            continue;
+        pCfg->objectGetInt("threads", cfg.nThreads);
+
+        m_configs[iObj->first] = cfg;
+    }
+
+    RTC_LOG(LS_INFO) << "x264 calibration results loaded for " << m_configs.size() << " outputs";
+}
+
+
+// Called with m_mutex held
+void X264Calibration::save(void)
+{
+    if (m_sFile.empty())
+        return;
+
+    MfcJsonObj js, configs;
+    configs.clearObject();
+    for (const auto& it : m_configs)
+    {
+        MfcJsonObj cfg;
+        cfg.objectAdd("preset", presetName(it.second.nPreset));
+        cfg.objectAdd("threads", (int64_t)it.second.nThreads);
+        configs.objectAdd(it.first, cfg);
+    }
+
+    js.objectAdd("cores", (int64_t)std::thread::hardware_concurrency());
+    js.objectAdd("configs", configs);
+
+    if (m_output.nWidth > 0)
+    {
+        MfcJsonObj output;
+        output.objectAdd("width", (int64_t)m_output.nWidth);
+        output.objectAdd("height", (int64_t)m_output.nHeight);
+        output.objectAdd("fps", (int64_t)m_output.nFps);
+        output.objectAdd("kbps", (int64_t)m_output.nBitrateKbps);
+        js.objectAdd("output", output);
+    }
+
+    string sData;
+    js.Serialize(sData, MfcJsonObj::JSOPT_PRETTY);
+    CPluginConfigWriter::instance().schedule(m_sFile, sData);
+}
@@ -0,0 +1,157 @@
+/*
+ * Copyright (c) 2013-2021 MFCXY, Inc. <mfcxy@mfcxy.com>
+ * Copyright (c) 2020 The WebRTC project authors. All Rights Reserved.
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#pragma once
+
+#ifndef X264_CALIBRATION_H_
+#define X264_CALIBRATION_H_
+
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <set>
+#include <string>
+#include <vector>
+
+#include <libPlugins/Executor.h>
+
+
+// Picks the x264 preset and thread count for this machine.
+//
+// calibrate() encodes a short synthetic clip (a panning noise field with a moving block,
+// so motion search has real work) at the stream's resolution, frame rate and bitrate
+// through each preset from ultrafast up, with the same parameters X264Encoder uses. It
+// records the p95 per-frame encode time and the CPU cores the process used while
+// encoding, and stops at the first preset whose p95 misses the budget of
+// BUDGET_FRACTION of the frame interval; the slowest preset within budget wins. For
+// that preset it also tries half the cores and keeps the fewer threads if they still
+// fit, which leaves CPU to OBS's own rendering.
+//
+// Results are kept per "WxH@fps" in the file given to setFile() (x264cal.json in the
+// module config directory) along with the core count they were measured on, so they
+// survive restarts and are dropped when the hardware changes. Without a file they only
+// last for the process.
+//
+// Only the output the stream is configured for (setOutput(), remembered in the same
+// file) is calibrated, on the shared executor and never while streaming: at module load
+// and after a stream stops if it has no result yet, or on demand after recalibrate().
+// A stream start cancels a calibration in progress. configFor() never calibrates; a size
+// without a result of its own (one the downscaler, ABR or quality scaler picked) gets
+// the calibrated entry closest in pixel rate, or the default (veryfast, auto threads).
+//
+// At run time X264Encoder steps the preset down when its encode time drifts over
+// budget and back up to the calibrated one when there's room again (see
+// STEP_DOWN_FRACTION and STEP_UP_FRACTION).
+//
+class X264Calibration
+{
+public:
+    static const char* const    PRESETS[];              // fastest first
+    static const int            NUM_PRESETS;
+    static const int            DEFAULT_PRESET;         // veryfast
+    static const int            CALIBRATION_FRAMES  = 40;
+    static const int            WARMUP_FRAMES       = 5;
+    static constexpr double     BUDGET_FRACTION     = 0.5;
+    static constexpr double     STEP_DOWN_FRACTION  = 0.75;
+    static constexpr double     STEP_UP_FRACTION    = 0.3;
+
+    struct Config
+    {
+        int     nPreset     = DEFAULT_PRESET;   // index into PRESETS
+        int     nThreads    = 0;                // 0 for X264_THREADS_AUTO
+
+        bool operator==(const Config& o) const { return nPreset == o.nPreset && nThreads == o.nThreads; }
+    };
+
+    struct Result
+    {
+        Config  cfg;
+        double  dAvgMs;
+        double  dP95Ms;
+        double  dCpuCores;      // process CPU time / wall time while encoding
+        bool    fInBudget;
+    };
+
+    static X264Calibration& instance(void);
+
+    static const char* presetName(int nPreset);
+
+    // Where results are loaded from and saved to, set at module load before the first
+    // configFor(). Queues a calibration of the last configured output if it has none.
+    void setFile(const std::string& sPath);
+
+    // The output the stream is configured for, the one that gets calibrated
+    void setOutput(int nWidth, int nHeight, int nFps, int nBitrateKbps);
+
+    // Starting cancels a calibration in progress, stopping queues one if it's still needed
+    void setStreaming(bool fStreaming);
+
+    // Config for an encoder at this size, see above. Never calibrates.
+    Config configFor(int nWidth, int nHeight, int nFps);
+
+    // Runs the calibration on the calling thread, stores and persists the winner.
+    // pvResults gets every configuration tried.
+    Config calibrate(int nWidth, int nHeight, int nFps, int nBitrateKbps,
+                     std::vector< Result >* pvResults = nullptr,
+                     const CCancelToken& token = CCancelToken());
+
+    // Stores cfg for this output as if a calibration had picked it, encbench uses it to
+    // pin the preset under test
+    void setConfig(int nWidth, int nHeight, int nFps, const Config& cfg);
+
+    // Forgets every stored result
+    void invalidate(void);
+
+    // invalidate() and calibrate the configured output again, once not streaming
+    void recalibrate(void);
+
+    // Cancels a queued or running background calibration, called at unload
+    void stop(void);
+
+private:
+    X264Calibration();
+    X264Calibration(const X264Calibration&) = delete;
+    X264Calibration& operator=(const X264Calibration&) = delete;
+
+    struct Output
+    {
+        int     nWidth          = 0;
+        int     nHeight         = 0;
+        int     nFps            = 0;
+        int     nBitrateKbps    = 0;
+    };
+
+    static std::string key(int nWidth, int nHeight, int nFps);
+
+    void queue(void);
+    bool measure(const Config& cfg, int nWidth, int nHeight, int nFps, int nBitrateKbps,
+                 const CCancelToken& token, Result& result);
+    void load(void);
+    void save(void);
+
+    std::mutex                          m_mutex;
+    bool                                m_fLoaded;
+    std::string                         m_sFile;
+    std::map< std::string, Config >     m_configs;      // key() -> calibrated config
+    std::set< std::string >             m_pending;      // background calibrations queued
+    Output                              m_output;       // what the stream is configured for
+    bool                                m_fStreaming;
+    CCancelToken                        m_cancel;       // module unload
+    CCancelToken                        m_run;          // the queued or running calibration
+};
+
+#endif  // X264_CALIBRATION_H_
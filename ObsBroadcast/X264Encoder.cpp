@@ -21,12 +21,15 @@
 #define X264ENC_LOG_RTT 0
 #define X264ENC_VERBOSE_LOG 0
 #define X264ENC_TRELLIS 0
+#define X264ENC_PARSE_QP 0  // take QP from the bitstream's last slice instead of x264's frame QP
 
 #include "X264Encoder.h"
+#include "FrameLatency.h"
 #include "SanitizeInputs.h"
 #include "webrtc_version.h"
 
 #include <libPlugins/MFCConfigConstants.h>
+#include <libfcs/MfcTrace.h>
 
 #include "absl/types/optional.h"
 #include "api/video/color_space.h"
@@ -37,10 +40,12 @@
 #include "rtc_base/checks.h"
 #include "rtc_base/logging.h"
 #include "rtc_base/time_utils.h"
+#include "system_wrappers/include/clock.h"
 #include "system_wrappers/include/metrics.h"
 #include "video/video_stream_encoder.h"
 
 #include <algorithm>
+#include <atomic>
 #include <limits>
 #include <stdexcept>
 #include <string>
@@ -65,7 +70,13 @@ using RangeID = ColorSpace::RangeID;
 #endif
 
 static const uint32_t kIDRIntervalSec   = MFC_SERVICES_JSON_KEYINT_VALUE;
-static const uint32_t kMaxFramerate     = 30;
+static const uint32_t kMaxFramerate     = MFC_SERVICES_JSON_MAX_FPS_VALUE;  // VideoTrackSource paces to the profile rate
+
+static std::atomic<uint64_t> s_nOverloadLevelUps(0);
+static std::atomic<uint64_t> s_nOverloadLevelDowns(0);
+static std::atomic<uint64_t> s_nOverloadSkipped(0);
+static std::atomic<int> s_nOverloadLevel(0);
+static std::atomic<int> s_nOverloadMaxLevel(0);
 
 static const uint32_t kLongStartcodeSize  = 4;
 static const uint32_t kShortStartcodeSize = 3;
@@ -176,9 +187,9 @@ static void X264Logger(void*, int level, const char* format, va_list args)
 /// x264 uses 4-byte start codes for SPS, PPS, and the initial NALU. 3-byte start codes
 /// are used for all other NALUs.
 ///
-/// All of this data (including the start codes) is copied to |encImg->_buffer|.
-/// |encImg->_buffer| may be deleted and reallocated if a bigger buffer is required.
-static void RtpFragmentize(EncodedImage* encImg, uint32_t numNals, x264_nal_t* nal)
+/// All of this data (including the start codes) is copied to a buffer from |pool|,
+/// which becomes the encoded data of |encImg|.
+static void RtpFragmentize(EncodedImage* encImg, EncodedBufPool* pool, uint32_t numNals, x264_nal_t* nal)
 {
     size_t requiredCapacity = 0;
     size_t fragmentsCount = 0;
@@ -198,8 +209,8 @@ static void RtpFragmentize(EncodedImage* encImg, uint32_t numNals, x264_nal_t* n
             ++requiredCapacity;
     }
 
-    // Allocate required bytes.
-    auto buffer = EncodedImageBuffer::Create(requiredCapacity);
+    // Get a buffer with at least the required bytes.
+    auto buffer = pool->Acquire(requiredCapacity);
     encImg->SetEncodedData(buffer);
 
     const uint8_t startCode[4] = {0, 0, 0, 1};
@@ -247,6 +258,7 @@ X264Encoder::X264Encoder(const cricket::VideoCodec& codec)
     , hasReportedError_(false)
     , frameCount_(0)
     , rtt_ms_(0)
+    , overloadDecimator_((int)kMaxFramerate)
 {
     RTC_LOG(LS_INFO) << "Using x264 encoder";
     string pktModeStr;
@@ -336,6 +348,21 @@ int X264Encoder::InitEncode(const VideoCodec* inst, const VideoEncoder::Settings
         codec_.simulcastStream[0].height    = codec_.height;
     }
 
+    // Calibrated preset for this size, or for the nearest calibrated one when the source
+    // or ABR adapted the size. Calibration itself only runs while not streaming.
+    tuning_             = X264Calibration::instance().configFor(width_, height_, (int)fps_);
+    calibratedPreset_   = tuning_.nPreset;
+    // An overload outlives a reinit (a new size from the source), keep its faster preset
+    if (overload_.level() >= EncoderOverload::FASTER_PRESET && tuning_.nPreset > 0)
+        tuning_.nPreset--;
+    encodeAvgUs_        = 0.0;
+    overBudgetFrames_   = 0;
+    underBudgetFrames_  = 0;
+    presetChanges_      = 0;
+    RTC_LOG(LS_INFO) << "x264 preset " << X264Calibration::presetName(tuning_.nPreset) << ", threads "
+                     << (tuning_.nThreads > 0 ? std::to_string(tuning_.nThreads) : string("auto"))
+                     << " for " << width_ << "x" << height_ << "@" << fps_;
+
 #if X264ENC_VERBOSE_LOG
     RTC_LOG(INFO) << "frame width:          " << width_;
     RTC_LOG(INFO) << "frame height:         " << height_;
@@ -371,10 +398,14 @@ int X264Encoder::InitEncode(const VideoCodec* inst, const VideoEncoder::Settings
         return WEBRTC_VIDEO_CODEC_ERROR;
     }
 
-    // Initialize encoded image using the size of unencoded data for buffer capacity allocation.
-    const size_t newCapacity = CalcBufferSize(VideoType::kYV12, width_, height_);
+    rcFps_ = fps_;
+    ApplyOverloadFps();
 
-    image_.SetEncodedData(EncodedImageBuffer::Create(newCapacity));
+    // Seed the output buffer size with a few frames' worth of the target bitrate, the
+    // pool follows the real frame sizes from there.
+    encodedPool_.Reset((size_t)bitrate_kbps_ * 1000 / 8 / std::max(fps_, 1u) * 4);
+
+    image_.ClearEncodedData();
     image_._encodedWidth  = (uint32_t)width_;
     image_._encodedHeight = (uint32_t)height_;
     image_.set_size(0);
@@ -406,13 +437,26 @@ int X264Encoder::InitEncode(const VideoCodec* inst, const VideoEncoder::Settings
 unique_ptr<x264_param_t> X264Encoder::CreateEncoderParams()
 {
     auto params = make_unique<x264_param_t>();
+    if (!FillEncoderParams(params.get(), tuning_, width_, height_, fps_, bitrate_kbps_, maxPayloadSize_))
+    {
+        ReportError();
+        return nullptr;
+    }
+
+    return params;  // Either copy elision takes place or std::move is implicitly applied
+}
 
-    int ret = x264_param_default_preset(params.get(), "veryfast", "zerolatency");
+
+// static
+bool X264Encoder::FillEncoderParams(x264_param_t* params, const X264Calibration::Config& tuning,
+                                    int width, int height, uint32_t fps, uint32_t bitrateKbps,
+                                    size_t maxPayloadSize)
+{
+    int ret = x264_param_default_preset(params, X264Calibration::presetName(tuning.nPreset), "zerolatency");
     if (ret != 0)
     {
         RTC_LOG_F(LS_ERROR) << "Failed to create x264 param defaults. code: " << ret;
-        ReportError();
-        return nullptr;
+        return false;
     }
 
     params->pf_log                  = X264Logger;
@@ -424,18 +468,18 @@ unique_ptr<x264_param_t> X264Encoder::CreateEncoderParams()
     params->b_repeat_headers        = 1;
     params->b_vfr_input             = 0;
 
-    params->i_width                 = width_;
-    params->i_height                = height_;
+    params->i_width                 = width;
+    params->i_height                = height;
     params->i_fps_den               = 1;
-    params->i_fps_num               = fps_;
+    params->i_fps_num               = fps;
     params->i_timebase_den          = 90000;
     params->i_timebase_num          = params->i_timebase_den * params->i_fps_den / params->i_fps_num;
-    params->i_level_idc             = height_ > 720 ? 41 : 31;
+    params->i_level_idc             = height > 720 ? 41 : 31;
 
     /// CPU flags.
-    params->i_threads               = X264_THREADS_AUTO;
+    params->i_threads               = tuning.nThreads > 0 ? tuning.nThreads : X264_THREADS_AUTO;
     params->b_sliced_threads        = 1;
-    params->i_slice_max_size        = (int)maxPayloadSize_;  // Using single NALU per packet, limit slice size: MTU - overhead
+    params->i_slice_max_size        = (int)maxPayloadSize;  // Using single NALU per packet, limit slice size: MTU - overhead
 
     /// Bitstream parameters.
     params->b_intra_refresh         = 0;
@@ -445,13 +489,13 @@ unique_ptr<x264_param_t> X264Encoder::CreateEncoderParams()
 #else
     params->i_nal_hrd               = X264_NAL_HRD_VBR;
 #endif
-    params->i_keyint_max            = static_cast<int>(fps_ * kIDRIntervalSec);
+    params->i_keyint_max            = static_cast<int>(fps * kIDRIntervalSec);
     params->i_keyint_min            = params->i_keyint_max / 2;
     params->i_scenecut_threshold    = 0;  // For consistent GOP
 
     /// Rate control.
     params->rc.i_rc_method          = X264_RC_ABR;
-    params->rc.i_bitrate            = (int)bitrate_kbps_;
+    params->rc.i_bitrate            = (int)bitrateKbps;
     params->rc.i_vbv_max_bitrate    = params->rc.i_bitrate;
     params->rc.i_vbv_buffer_size    = params->rc.i_bitrate / kVbvBufferSizeFactor;
     params->rc.f_rate_tolerance     = 0.1f;  // Minimizes inter-frame delay variance
@@ -460,7 +504,7 @@ unique_ptr<x264_param_t> X264Encoder::CreateEncoderParams()
     if (params->rc.i_rc_method == X264_RC_CRF)
     {
         params->rc.f_rf_constant =
-            UseHqCrf(height_, params->rc.i_bitrate) ? kHighQualityCrf : kNormalQualityCrf;
+            UseHqCrf(height, params->rc.i_bitrate) ? kHighQualityCrf : kNormalQualityCrf;
     }
 
     params->analyse.i_weighted_pred = 0;  // Not supported by WebRTC's bitstream parser
@@ -475,15 +519,14 @@ unique_ptr<x264_param_t> X264Encoder::CreateEncoderParams()
     params->vui.i_transfer  = 1;  // BT.709-6
     params->vui.i_colmatrix = 1;  // BT.709-6
 
-    ret = x264_param_apply_profile(params.get(), "main");
+    ret = x264_param_apply_profile(params, "main");
     if (ret < 0)
     {
         RTC_LOG_F(LS_ERROR) << "Failed to apply x264 profile. code: " << ret;
-        ReportError();
-        return nullptr;
+        return false;
     }
 
-    return params;  // Either copy elision takes place or std::move is implicitly applied
+    return true;
 }
 
 
@@ -496,6 +539,25 @@ int32_t X264Encoder::Release()
     }
     image_.ClearEncodedData();
     encodedImageCallback_ = nullptr;
+
+    if (frameCount_ > 0)
+    {
+        auto pool = encodedPool_.GetStats();
+        RTC_LOG(LS_INFO) << "Encoded buffers: " << pool.acquired << " frames, " << pool.allocated << " allocations, "
+                         << pool.exhausted << " unpooled, peak " << pool.peakBytes << " bytes, pooled " << pool.pooledBytes << " bytes";
+        RTC_LOG(LS_INFO) << "x264 preset at release " << X264Calibration::presetName(tuning_.nPreset)
+                         << " (calibrated " << X264Calibration::presetName(calibratedPreset_) << "), "
+                         << presetChanges_ << " changes, encode avg " << (int64_t)encodeAvgUs_ << "us";
+
+        auto load = overload_.getStats(rtc::TimeMicros());
+        RTC_LOG(LS_INFO) << "Encoder overload: level " << EncoderOverload::levelName((EncoderOverload::Level)load.level)
+                         << " (max " << EncoderOverload::levelName((EncoderOverload::Level)load.maxLevel) << "), "
+                         << load.levelUps << " up, " << load.levelDowns << " down, " << overloadSkipped_ << " skipped; "
+                         << "ms at level " << load.levelUs[0] / 1000 << "/" << load.levelUs[1] / 1000 << "/"
+                         << load.levelUs[2] / 1000 << "/" << load.levelUs[3] / 1000
+                         << "; encode avg " << load.encodeAvgUs << "us max " << load.encodeMaxUs
+                         << "us, queue avg " << load.queueAvgUs << "us max " << load.queueMaxUs << "us";
+    }
     frameCount_ = 0;
 
     return WEBRTC_VIDEO_CODEC_OK;
@@ -544,7 +606,7 @@ void X264Encoder::SetRates(const RateControlParameters& parameters)
         maxFramerate_ = newMaxFramerate;
         codec_.maxFramerate = std::min(kMaxFramerate, static_cast<uint32_t>(parameters.framerate_fps + 0.5));
         fps_ = codec_.maxFramerate;
-        ReconfigureFps(fps_);
+        ApplyOverloadFps();
     }
  #endif
 
@@ -555,6 +617,8 @@ void X264Encoder::SetRates(const RateControlParameters& parameters)
 
 int32_t X264Encoder::Encode(const VideoFrame& inputFrame, const vector<VideoFrameType>* frameTypes)
 {
+    MFC_TRACE_SCOPE("encode", "X264Encoder::Encode");
+
     if (!IsInitialized())
     {
         RTC_LOG_F(LS_WARNING) << "InitEncode() has not been called";
@@ -571,6 +635,7 @@ int32_t X264Encoder::Encode(const VideoFrame& inputFrame, const vector<VideoFram
 
     if (paused_)
     {
+        FrameLatency::instance().dropped(inputFrame.id(), FrameLatency::DROP_ENCODER);
         encodedImageCallback_->OnDroppedFrame(webrtc::EncodedImageCallback::DropReason::kDroppedByEncoder);
         return WEBRTC_VIDEO_CODEC_OK;
     }
@@ -613,6 +678,7 @@ int32_t X264Encoder::Encode(const VideoFrame& inputFrame, const vector<VideoFram
         // Check whether to skip this frame.
         if ((*frameTypes)[0] == VideoFrameType::kEmptyFrame)
         {
+            FrameLatency::instance().dropped(inputFrame.id(), FrameLatency::DROP_ENCODER);
             encodedImageCallback_->OnDroppedFrame(webrtc::EncodedImageCallback::DropReason::kDroppedByEncoder);
             return WEBRTC_VIDEO_CODEC_OK;
         }
@@ -623,6 +689,21 @@ int32_t X264Encoder::Encode(const VideoFrame& inputFrame, const vector<VideoFram
 #endif
     }
 
+    // Overload protection drops frames before they cost an encode, see ApplyOverloadLevel()
+    if (!overloadDecimator_.keepFrame(inputFrame.timestamp_us() * rtc::kNumNanosecsPerMicrosec) && !firRequest && !sendIDR)
+    {
+        ++overloadSkipped_;
+        s_nOverloadSkipped++;
+        FrameLatency::instance().dropped(inputFrame.id(), FrameLatency::DROP_ENCODER);
+        encodedImageCallback_->OnDroppedFrame(webrtc::EncodedImageCallback::DropReason::kDroppedByEncoder);
+        return WEBRTC_VIDEO_CODEC_OK;
+    }
+
+    // Time the frame spent between VideoTrackSource stamping it and here, mostly WebRTC's encoder queue
+    int64_t queueUs = 0;
+    if (inputFrame.ntp_time_ms() > 0)
+        queueUs = (Clock::GetRealTimeClock()->CurrentNtpInMilliseconds() - inputFrame.ntp_time_ms()) * rtc::kNumMicrosecsPerMillisec;
+
     picIn_                  = {0};
     picIn_.i_type           = (firRequest || sendIDR) ? X264_TYPE_IDR : X264_TYPE_AUTO;  // Send an IDR-frame on FIR request.
     picIn_.i_pts            = frameCount_;
@@ -640,6 +721,8 @@ int32_t X264Encoder::Encode(const VideoFrame& inputFrame, const vector<VideoFram
 
     // Encode one picture(frame).
     auto encode_start = rtc::TimeMillis();
+    int64_t encodeStartUs = rtc::TimeMicros();
+    FrameLatency::instance().mark(inputFrame.id(), FrameLatency::ENCODE_START);
     int encodedFrameSize = x264_encoder_encode(encoder_, &nal, &numNals, &picIn_, &picOut);
     if (encodedFrameSize < 0)
     {
@@ -649,6 +732,17 @@ int32_t X264Encoder::Encode(const VideoFrame& inputFrame, const vector<VideoFram
         return WEBRTC_VIDEO_CODEC_ERROR;
     }
     auto encode_finish = rtc::TimeMillis();
+    const int64_t encodeFinishUs = rtc::TimeMicros();
+    FrameLatency::instance().mark(inputFrame.id(), FrameLatency::ENCODE_END);
+    if (adaptive_)
+    {
+        UpdatePreset(encodeFinishUs - encodeStartUs);
+
+        // Measured against the interval actually being encoded, so skipping frames counts as relief
+        const EncoderOverload::Level previousLevel = overload_.level();
+        if (overload_.update(encodeFinishUs, encodeFinishUs - encodeStartUs, queueUs, rtc::kNumMicrosecsPerSec / EncodeFps()))
+            ApplyOverloadLevel(previousLevel);
+    }
 
     //auto nalBuffer = (uint8_t*)malloc(nal->i_payload * 3 / 2 + 5 + 64);
     //x264_nal_encode(encoder_, nalBuffer, nal);
@@ -662,22 +756,26 @@ int32_t X264Encoder::Encode(const VideoFrame& inputFrame, const vector<VideoFram
     //image_.playout_delay_   = {0, 0};
 
     // Split encoded image into fragments and copy from |nal| to |image_|.
-    RtpFragmentize(&image_, numNals, nal);
+    RtpFragmentize(&image_, &encodedPool_, numNals, nal);
     image_.timing_.packetization_finish_ms = rtc::TimeMillis();
 
     // Encoder can skip frames to save bandwidth.
     if (image_.size() == 0)
     {
         RTC_LOG(INFO) << "ENCODER DROPPED FRAME";
+        FrameLatency::instance().dropped(inputFrame.id(), FrameLatency::DROP_ENCODER);
         encodedImageCallback_->OnDroppedFrame(webrtc::EncodedImageCallback::DropReason::kDroppedByEncoder);
         return WEBRTC_VIDEO_CODEC_OK;
     }
 
-    // Parse bitstream for QP.
+    // x264 reports the frame's average QP + 1, which is what the QP stats want
+    image_.qp_ = picOut.i_qpplus1 - 1;
+#if X264ENC_PARSE_QP
     bitstreamParser_.ParseBitstream(image_);
-    image_.qp_ = bitstreamParser_.GetLastSliceQp().value_or(-1);
+    image_.qp_ = bitstreamParser_.GetLastSliceQp().value_or(image_.qp_);
+#endif
     if (image_.qp_ < 0 || image_.qp_ > 51)
-        image_.qp_ = picOut.i_qpplus1;
+        image_.qp_ = -1;
 
 #if X264ENC_VERBOSE_LOG
     RTC_LOG(INFO) << "timestamp ntp:    " << image_.ntp_time_ms_;
@@ -699,8 +797,9 @@ int32_t X264Encoder::Encode(const VideoFrame& inputFrame, const vector<VideoFram
     codec_specific.codecSpecific.H264.idr_frame             = static_cast<bool>(picOut.b_keyframe);
     codec_specific.codecSpecific.H264.base_layer_sync       = false;
 
-    // Deliver encoded image.
+    // Deliver encoded image. WebRTC packetizes it in there and hands the packets to the pacer.
     encodedImageCallback_->OnEncodedImage(image_, &codec_specific);
+    FrameLatency::instance().mark(inputFrame.id(), FrameLatency::PACKETIZED);
 
     ++frameCount_;
 
@@ -724,35 +823,22 @@ VideoEncoder::EncoderInfo X264Encoder::GetEncoderInfo() const
 }
 
 
-bool X264Encoder::ReconfigureFps(uint32_t fps)
+bool X264Encoder::ReconfigureBitrate(int bitrateKbps)
 {
     x264_param_t params{};
     x264_encoder_parameters(encoder_, &params);
 
-    params.i_fps_num    = fps;
-    params.i_fps_den    = 1;
+    // Rate control spreads the bitrate over the frame rate the encoder was opened with,
+    // which x264_encoder_reconfig() doesn't change. When fewer frames are encoded than
+    // that (overload skipping, a lower rate from SetRates()), scale the bitrate and VBV
+    // up so the frames that are encoded still add up to bitrateKbps.
+    const uint32_t fps = EncodeFps();
+    params.rc.i_bitrate = (int)((int64_t)bitrateKbps * params.i_fps_num / ((int64_t)params.i_fps_den * fps));
+
+    // keyframe interval is in frames
     params.i_keyint_max = static_cast<int>(fps * kIDRIntervalSec);
     params.i_keyint_min = params.i_keyint_max / 2;
 
-    int ret = x264_encoder_reconfig(encoder_, &params);
-    if (ret < 0)
-    {
-        RTC_LOG_F(LS_WARNING) << "Failed to reconfigure encoder (fps). code: " << ret;
-        return false;
-    }
-
-    return true;
-}
-
-
-bool X264Encoder::ReconfigureBitrate(int bitrateKbps)
-{
-    x264_param_t params{};
-    x264_encoder_parameters(encoder_, &params);
-
-    // Reset rate control parameters.
-    params.rc.i_bitrate = bitrateKbps;
-
     // VBV cannot be reconfigured if using NAL-HRD.
     if (params.i_nal_hrd == X264_NAL_HRD_NONE)
     {
@@ -773,6 +859,7 @@ bool X264Encoder::ReconfigureBitrate(int bitrateKbps)
         return false;
     }
 
+    rcFps_ = fps;
     return true;
 }
 
@@ -796,6 +883,146 @@ bool X264Encoder::ReconfigureFrameSize(int width, int height)
 }
 
 
+bool X264Encoder::ReconfigurePreset(int preset)
+{
+    // Only the analysis settings of the new preset are carried over, the rest (cabac, ref
+    // count limits from the level, slicing) can't change on an open encoder.
+    x264_param_t presetParams{};
+    int ret = x264_param_default_preset(&presetParams, X264Calibration::presetName(preset), "zerolatency");
+    if (ret != 0)
+    {
+        RTC_LOG_F(LS_WARNING) << "Failed to create x264 param defaults. code: " << ret;
+        return false;
+    }
+
+    x264_param_t params{};
+    x264_encoder_parameters(encoder_, &params);
+
+    params.analyse                      = presetParams.analyse;
+    params.analyse.i_weighted_pred      = 0;  // Not supported by WebRTC's bitstream parser
+#if X264ENC_TRELLIS
+    params.analyse.i_trellis            = 1;
+    params.analyse.f_psy_trellis        = 0.15;
+#endif
+    params.i_frame_reference            = presetParams.i_frame_reference;
+    params.b_deblocking_filter          = presetParams.b_deblocking_filter;
+    params.i_deblocking_filter_alphac0  = presetParams.i_deblocking_filter_alphac0;
+    params.i_deblocking_filter_beta     = presetParams.i_deblocking_filter_beta;
+
+    ret = x264_encoder_reconfig(encoder_, &params);
+    if (ret < 0)
+    {
+        RTC_LOG_F(LS_WARNING) << "Failed to reconfigure encoder (preset). code: " << ret;
+        return false;
+    }
+
+    return true;
+}
+
+
+void X264Encoder::UpdatePreset(int64_t encodeUs)
+{
+    // EWMA over ~8 frames
+    encodeAvgUs_ = encodeAvgUs_ > 0.0 ? encodeAvgUs_ + ((double)encodeUs - encodeAvgUs_) / 8.0 : (double)encodeUs;
+
+    const double intervalUs = 1000000.0 / std::max(fps_, 1u);
+    int preset = tuning_.nPreset;
+
+    // Over budget for a second: one preset faster. Well under budget for ten seconds:
+    // one preset slower, but never past what calibration found this machine can run.
+    overBudgetFrames_   = encodeAvgUs_ > intervalUs * X264Calibration::STEP_DOWN_FRACTION ? overBudgetFrames_ + 1 : 0;
+    underBudgetFrames_  = encodeAvgUs_ < intervalUs * X264Calibration::STEP_UP_FRACTION ? underBudgetFrames_ + 1 : 0;
+
+    if (overBudgetFrames_ >= (int)fps_ && preset > 0)
+        --preset;
+    else if (underBudgetFrames_ >= 10 * (int)fps_ && preset < calibratedPreset_
+             && overload_.level() < EncoderOverload::FASTER_PRESET)
+        ++preset;
+    else
+        return;
+
+    overBudgetFrames_   = 0;
+    underBudgetFrames_  = 0;
+
+    if (!ReconfigurePreset(preset))
+        return;
+
+    RTC_LOG(LS_INFO) << "x264 preset " << X264Calibration::presetName(tuning_.nPreset) << " -> "
+                     << X264Calibration::presetName(preset) << ", encode avg " << (int64_t)encodeAvgUs_
+                     << "us of " << (int64_t)intervalUs << "us";
+    tuning_.nPreset = preset;
+    ++presetChanges_;
+}
+
+
+uint32_t X264Encoder::EncodeFps() const
+{
+    switch (overload_.level())
+    {
+    case EncoderOverload::NORMAL:
+        return fps_;
+    case EncoderOverload::SKIP_FRAMES:
+    case EncoderOverload::FASTER_PRESET:
+        return std::max(fps_ * 3 / 4, 1u);  // every 4th frame skipped
+    default:
+        return std::max(fps_ / 2, 1u);
+    }
+}
+
+
+void X264Encoder::ApplyOverloadFps()
+{
+    // x264's rate control has to know about the skipped frames or the stream would come
+    // out short. Only when the encoded rate changed: InitEncode() at NORMAL already
+    // opened the encoder at it.
+    const uint32_t fps = EncodeFps();
+    overloadDecimator_.setTargetFps(overload_.level() == EncoderOverload::NORMAL ? (int)kMaxFramerate : (int)fps);
+    if (IsInitialized() && fps != rcFps_)
+        ReconfigureBitrate((int)bitrate_kbps_);
+}
+
+
+void X264Encoder::ApplyOverloadLevel(EncoderOverload::Level previous)
+{
+    const EncoderOverload::Level level = overload_.level();
+
+    ApplyOverloadFps();
+
+    // One preset faster on the way up, UpdatePreset() brings it back once there's room
+    if (level == EncoderOverload::FASTER_PRESET && previous < level && tuning_.nPreset > 0
+        && ReconfigurePreset(tuning_.nPreset - 1))
+    {
+        tuning_.nPreset--;
+        ++presetChanges_;
+    }
+
+    if (level > previous)
+        s_nOverloadLevelUps++;
+    else
+        s_nOverloadLevelDowns++;
+    s_nOverloadLevel = (int)level;
+    if ((int)level > s_nOverloadMaxLevel.load(std::memory_order_relaxed))
+        s_nOverloadMaxLevel = (int)level;
+
+    RTC_LOG(LS_WARNING) << "Encoder overload " << EncoderOverload::levelName(previous) << " -> "
+                        << EncoderOverload::levelName(level) << ": encoding " << EncodeFps() << " of " << fps_
+                        << " fps, preset " << X264Calibration::presetName(tuning_.nPreset);
+}
+
+
+// static
+X264Encoder::OverloadStats X264Encoder::GetOverloadStats()
+{
+    OverloadStats stats;
+    stats.levelUps      = s_nOverloadLevelUps.load();
+    stats.levelDowns    = s_nOverloadLevelDowns.load();
+    stats.skipped       = s_nOverloadSkipped.load();
+    stats.level         = s_nOverloadLevel.load();
+    stats.maxLevel      = s_nOverloadMaxLevel.load();
+    return stats;
+}
+
+
 bool X264Encoder::IsInitialized() const
 {
     return encoder_ != nullptr;
@@ -30,6 +30,11 @@
 #include "modules/video_coding/include/video_codec_interface.h"
 #include "rtc_base/synchronization/mutex.h"
 
+#include "EncoderOverload.h"
+#include "FrameBufferPool.h"
+#include "FrameDecimator.h"
+#include "X264Calibration.h"
+
 #ifdef _WIN32
 #ifndef X264_API_IMPORTS
 #define X264_API_IMPORTS
@@ -51,6 +56,16 @@ using namespace webrtc;
 class X264Encoder : public webrtc::H264Encoder
 {
 public:
+    // Overload protection across all encoders, for the end of stream summary
+    struct OverloadStats
+    {
+        uint64_t    levelUps;
+        uint64_t    levelDowns;
+        uint64_t    skipped;        // frames dropped before encoding
+        int         level;          // current
+        int         maxLevel;
+    };
+
     explicit X264Encoder(const cricket::VideoCodec& codec);
     ~X264Encoder() override;
 
@@ -80,13 +95,26 @@ public:
 
     unique_ptr<x264_param_t> CreateEncoderParams();
 
+    // Fills params the way this encoder runs x264, also used by X264Calibration's test encodes
+    static bool FillEncoderParams(x264_param_t* params, const X264Calibration::Config& tuning,
+                                  int width, int height, uint32_t fps, uint32_t bitrateKbps,
+                                  size_t maxPayloadSize);
+
+    static OverloadStats GetOverloadStats();
+
     // Exposed for testing.
     webrtc::H264PacketizationMode PacketizationModeForTesting() const { return packetizationMode_; }
+    // Off keeps the configured preset and frame rate: no run time preset steps, no overload protection
+    void SetAdaptationForTesting(bool enabled) { adaptive_ = enabled; }
 
 private:
-    bool ReconfigureFps(uint32_t fps);
     bool ReconfigureBitrate(int bitrateKbps);
     bool ReconfigureFrameSize(int width, int height);
+    bool ReconfigurePreset(int preset);
+    void UpdatePreset(int64_t encodeUs);
+    void ApplyOverloadLevel(EncoderOverload::Level previous);
+    void ApplyOverloadFps();
+    uint32_t EncodeFps() const;
     bool IsInitialized() const;
     void ReportInit();
     void ReportError();
@@ -96,7 +124,8 @@ private:
 
     webrtc::EncodedImage            image_;
     webrtc::EncodedImageCallback*   encodedImageCallback_ = nullptr;
-    webrtc::H264BitstreamParser     bitstreamParser_;
+    webrtc::H264BitstreamParser     bitstreamParser_;       // only with X264ENC_PARSE_QP
+    EncodedBufPool                  encodedPool_;
     webrtc::H264PacketizationMode   packetizationMode_;
     webrtc::VideoCodec              codec_;
 
@@ -104,9 +133,22 @@ private:
     int         height_             = 0;
     double      maxFramerate_       = 0.0;
     uint32_t    fps_                = 0;
+    uint32_t    rcFps_              = 0;            // EncodeFps() the rate control is set up for
     uint32_t    bitrate_kbps_       = 0;
     size_t      maxPayloadSize_     = 0;
 
+    X264Calibration::Config tuning_;                // preset currently in use
+    int         calibratedPreset_   = X264Calibration::DEFAULT_PRESET;
+    double      encodeAvgUs_        = 0.0;          // EWMA of per-frame encode time
+    int         overBudgetFrames_   = 0;
+    int         underBudgetFrames_  = 0;
+    int         presetChanges_      = 0;
+
+    EncoderOverload overload_;
+    FrameDecimator  overloadDecimator_;                 // frames skipped under overload
+    uint64_t    overloadSkipped_    = 0;
+
+    bool        adaptive_           = true;
     bool        paused_             = false;
     bool        hasReportedInit_    = false;
     bool        hasReportedError_   = false;
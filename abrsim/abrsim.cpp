@@ -0,0 +1,365 @@
+/*
+ * Copyright (c) 2013-2021 MFCXY, Inc. <mfcxy@mfcxy.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+// abrsim: replays a network trace through the AbrController WebRTCStream runs, to tune it offline.
+//
+//   abrsim [-v] [-d seconds] [-min kbps] [-max kbps] [-hold ms] [-rung-hold ms] [-min-height px]
+//          [-loss-high f] [-loss-low f] [-rtt-rise ms] [-dec f] [-inc f] [-bpp-down f] [-bpp-up f]
+//          (-b step|sawtooth|lossy|mobile | trace.txt | -ladder)
+//
+//   -v         one CSV line per stats interval instead of just the summary
+//   -b name    built in trace
+//   -ladder    check the ladders of the common output sizes instead of running a trace
+//
+// Every resolution rung has to come back out of VideoTrackSource::AdaptResolution()
+// unchanged when ApplyAbrTarget() hands it the rung's w * h, or the stream runs at a
+// different size than the controller thinks. Each run checks its own ladder first.
+//
+// A trace file has one line per change, "seconds capacity_kbps loss_percent base_rtt_ms",
+// each holding until the next one; '#' starts a comment. The link is a single bottleneck
+// with a drop tail queue of QUEUE_MS at the current capacity: the sender transmits at the
+// target bitrate (with some frame size noise), what the link can't carry queues and adds
+// to the RTT, and what doesn't fit the queue is lost along with the trace's random loss.
+// Stats reach the controller once a second the way OnStatsDelivered does.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <ObsBroadcast/AbrController.h>
+#include <ObsBroadcast/ScaleSteps.h>
+
+static const char*  PROGNAME        = "abrsim";
+static const int    TICK_MS         = 20;
+static const int    STATS_MS        = 1000;
+static const int    QUEUE_MS        = 400;
+static const int    PACKET_BITS     = 1200 * 8;
+static const int    ALIGNMENT       = 2;        // VideoTrackSource's REQUIRED_ALIGNMENT
+
+static const struct { int nWidth, nHeight; } LADDER_SIZES[] =
+{
+    { 1920, 1080 }, { 1600, 900 }, { 1280, 720 }, { 960, 540 }, { 854, 480 }, { 640, 360 },
+};
+
+
+struct TracePoint
+{
+    double  dTime;
+    double  dCapacityKbps;
+    double  dLossPct;
+    int     nBaseRttMs;
+};
+
+
+static int usage(void)
+{
+    fprintf(stderr, "usage: %s [-v] [-d seconds] [-min kbps] [-max kbps] [-hold ms] [-rung-hold ms] [-min-height px]\n"
+                    "       [-loss-high f] [-loss-low f] [-rtt-rise ms] [-dec f] [-inc f] [-bpp-down f] [-bpp-up f]\n"
+                    "       (-b step|sawtooth|lossy|mobile | trace.txt | -ladder)\n", PROGNAME);
+    return 2;
+}
+
+
+// Feed each resolution rung's w * h through the step selection AdaptResolution() uses,
+// limited the way SetOutputLimits() limits it. Prints every rung with fPrint, otherwise
+// just the ones that don't round trip.
+static bool checkLadder(const AbrController& abr, const AbrController::Config& cfg, bool fPrint)
+{
+    const std::vector< AbrController::Rung >& vLadder = abr.ladder();
+    bool fOk = true;
+
+    if (fPrint)
+        printf("%dx%d, min height %d:\n", cfg.nMaxWidth, cfg.nMaxHeight, cfg.nMinHeight);
+
+    for (size_t n = 0; n < vLadder.size(); n++)
+    {
+        const AbrController::Rung& rung = vLadder[n];
+        if (n > 0 && rung.nWidth == vLadder[n - 1].nWidth && rung.nHeight == vLadder[n - 1].nHeight)
+            continue;
+
+        const int64_t nLimit = std::max((int64_t)rung.nWidth * rung.nHeight, (int64_t)ScaleSteps::MIN_PIXELS);
+        ScaleSteps::Size size = ScaleSteps::pick(cfg.nMaxWidth, cfg.nMaxHeight, nLimit, nLimit,
+                                                 ScaleSteps::MIN_PIXELS, ALIGNMENT);
+        const bool fMatch = size.nWidth == rung.nWidth && size.nHeight == rung.nHeight;
+        if (fPrint || !fMatch)
+            printf("  %zu  %dx%d adapts to %dx%d%s\n", n, rung.nWidth, rung.nHeight, size.nWidth, size.nHeight,
+                   fMatch ? "" : "  MISMATCH");
+        fOk = fOk && fMatch;
+    }
+    return fOk;
+}
+
+
+static bool builtinTrace(const char* pszName, std::vector< TracePoint >& vTrace)
+{
+    if (strcmp(pszName, "step") == 0)
+    {
+        // Capacity falls well under the ceiling and comes back
+        vTrace = { { 0, 4000, 0, 40 }, { 30, 1200, 0, 40 }, { 90, 600, 0, 40 }, { 120, 4000, 0, 40 } };
+    }
+    else if (strcmp(pszName, "sawtooth") == 0)
+    {
+        for (int n = 0; n < 20; n++)
+            vTrace.push_back({ n * 15.0, n % 2 ? 1500.0 : 3000.0, 0, 60 });
+    }
+    else if (strcmp(pszName, "lossy") == 0)
+    {
+        // Plenty of capacity, random loss that is and isn't worth backing off for
+        vTrace = { { 0, 5000, 0.5, 80 }, { 40, 5000, 4, 80 }, { 80, 5000, 15, 80 }, { 110, 5000, 1, 80 } };
+    }
+    else if (strcmp(pszName, "mobile") == 0)
+    {
+        // Random walk of capacity and RTT once a second
+        std::mt19937 rng(7);
+        std::uniform_real_distribution< double > step(-0.15, 0.15);
+        double dCap = 2500;
+        for (int n = 0; n < 300; n++)
+        {
+            dCap = std::min(std::max(dCap * (1.0 + step(rng)), 400.0), 5000.0);
+            vTrace.push_back({ (double)n, dCap, 1.0, 60 + (int)(rng() % 60) });
+        }
+    }
+    else
+        return false;
+
+    return true;
+}
+
+
+static bool readTrace(const char* pszFile, std::vector< TracePoint >& vTrace)
+{
+    FILE* pFile = fopen(pszFile, "r");
+    if (!pFile)
+        return false;
+
+    char szLine[256];
+    while (fgets(szLine, sizeof(szLine), pFile))
+    {
+        char* pszHash = strchr(szLine, '#');
+        if (pszHash)
+            *pszHash = '\0';
+
+        TracePoint pt = { 0, 0, 0, 0 };
+        if (sscanf(szLine, "%lf %lf %lf %d", &pt.dTime, &pt.dCapacityKbps, &pt.dLossPct, &pt.nBaseRttMs) >= 2)
+            vTrace.push_back(pt);
+    }
+
+    fclose(pFile);
+    return !vTrace.empty();
+}
+
+
+int main(int argc, char* argv[])
+{
+    AbrController::Config cfg;
+    cfg.nMaxBitrateKbps = 2500;
+    cfg.nMaxWidth       = 1280;
+    cfg.nMaxHeight      = 720;
+    cfg.nMaxFps         = 30;
+
+    std::vector< TracePoint > vTrace;
+    double dDuration = 0;
+    bool fVerbose = false, fLadder = false;
+
+    for (int n = 1; n < argc; n++)
+    {
+        const char* psz = argv[n];
+        const char* pszVal = n + 1 < argc ? argv[n + 1] : nullptr;
+
+        if (strcmp(psz, "-v") == 0)
+            fVerbose = true;
+        else if (strcmp(psz, "-ladder") == 0)
+            fLadder = true;
+        else if (!pszVal && psz[0] == '-')
+            return usage();
+        else if (strcmp(psz, "-b") == 0)
+        {
+            if (!builtinTrace(argv[++n], vTrace))
+                return usage();
+        }
+        else if (strcmp(psz, "-d") == 0)
+            dDuration = atof(argv[++n]);
+        else if (strcmp(psz, "-min") == 0)
+            cfg.nMinBitrateKbps = atoi(argv[++n]);
+        else if (strcmp(psz, "-max") == 0)
+            cfg.nMaxBitrateKbps = atoi(argv[++n]);
+        else if (strcmp(psz, "-hold") == 0)
+            cfg.nHoldMs = atoi(argv[++n]);
+        else if (strcmp(psz, "-rung-hold") == 0)
+            cfg.nRungHoldMs = atoi(argv[++n]);
+        else if (strcmp(psz, "-min-height") == 0)
+            cfg.nMinHeight = atoi(argv[++n]);
+        else if (strcmp(psz, "-loss-high") == 0)
+            cfg.dLossHigh = atof(argv[++n]);
+        else if (strcmp(psz, "-loss-low") == 0)
+            cfg.dLossLow = atof(argv[++n]);
+        else if (strcmp(psz, "-rtt-rise") == 0)
+            cfg.nRttRiseMs = atoi(argv[++n]);
+        else if (strcmp(psz, "-dec") == 0)
+            cfg.dDecrease = atof(argv[++n]);
+        else if (strcmp(psz, "-inc") == 0)
+            cfg.dIncrease = atof(argv[++n]);
+        else if (strcmp(psz, "-bpp-down") == 0)
+            cfg.dBppDown = atof(argv[++n]);
+        else if (strcmp(psz, "-bpp-up") == 0)
+            cfg.dBppUp = atof(argv[++n]);
+        else if (psz[0] != '-' && vTrace.empty())
+        {
+            if (!readTrace(psz, vTrace))
+            {
+                fprintf(stderr, "%s: can't read trace\n", psz);
+                return 1;
+            }
+        }
+        else
+            return usage();
+    }
+
+    if (fLadder)
+    {
+        bool fOk = true;
+        for (const auto& size : LADDER_SIZES)
+        {
+            AbrController::Config ladderCfg = cfg;
+            ladderCfg.nMaxWidth = size.nWidth;
+            ladderCfg.nMaxHeight = size.nHeight;
+            fOk = checkLadder(AbrController(ladderCfg), ladderCfg, true) && fOk;
+        }
+        return fOk ? 0 : 1;
+    }
+
+    if (vTrace.empty())
+        return usage();
+    if (dDuration <= 0)
+        dDuration = vTrace.back().dTime + 30;
+
+    AbrController abr(cfg);
+    if (!checkLadder(abr, cfg, false))
+    {
+        fprintf(stderr, "%s: ladder rungs don't match the sizes VideoTrackSource produces\n", PROGNAME);
+        return 1;
+    }
+    std::mt19937 rng(42);
+    std::uniform_real_distribution< double > uniform(0.0, 1.0);
+    std::normal_distribution< double > frameNoise(1.0, 0.1);
+
+    double dQueueBits = 0, dSentBits = 0, dDeliveredBits = 0, dCapacityBits = 0, dQueueDelaySum = 0;
+    double dPacketsSent = 0, dPacketsLost = 0, dPeriodBits = 0;
+    int64_t nCongestedMs = 0, nTicks = 0, nRungChanges = 0, nBitrateChanges = 0;
+    std::vector< int64_t > vRungMs(abr.ladder().size(), 0);
+    size_t nPoint = 0;
+    int nLastRung = 0;
+
+    if (fVerbose)
+        printf("time_s,capacity_kbps,target_kbps,sent_kbps,loss,rtt_ms,base_rtt_ms,rung,width,height,fps\n");
+
+    for (int64_t nNowMs = 0; nNowMs < (int64_t)(dDuration * 1000); nNowMs += TICK_MS)
+    {
+        while (nPoint + 1 < vTrace.size() && vTrace[nPoint + 1].dTime * 1000 <= nNowMs)
+            nPoint++;
+        const TracePoint& pt = vTrace[nPoint];
+        const AbrController::Target& target = abr.target();
+
+        // Sender at the target, the link drains the queue at capacity
+        const double dSend = std::max(target.nBitrateKbps * frameNoise(rng), 0.0) * TICK_MS;
+        const double dCapacity = pt.dCapacityKbps * TICK_MS;
+        const double dMaxQueue = pt.dCapacityKbps * QUEUE_MS;
+
+        dQueueBits += dSend;
+        double dOut = std::min(dQueueBits, dCapacity);
+        dQueueBits -= dOut;
+
+        double dDropped = std::max(dQueueBits - dMaxQueue, 0.0);
+        dQueueBits -= dDropped;
+
+        double dRandomLoss = dOut * pt.dLossPct / 100.0 * (0.5 + uniform(rng));
+        dDropped += dRandomLoss;
+
+        dPacketsSent += dSend / PACKET_BITS;
+        dPacketsLost += dDropped / PACKET_BITS;
+        dSentBits += dSend;
+        dPeriodBits += dSend;
+        dDeliveredBits += dOut - dRandomLoss;
+        dCapacityBits += dCapacity;
+
+        const double dQueueMs = dQueueBits / std::max(pt.dCapacityKbps, 1.0);
+        dQueueDelaySum += dQueueMs;
+        nTicks++;
+        if (dQueueMs > cfg.nRttRiseMs || dDropped > dRandomLoss)
+            nCongestedMs += TICK_MS;
+        vRungMs[target.nRung] += TICK_MS;
+
+        if ((nNowMs + TICK_MS) % STATS_MS != 0)
+            continue;
+
+        // One stats report, NACKs for the losses as the receiver would send them
+        AbrController::Sample sample;
+        sample.nTimeMs      = nNowMs + TICK_MS;
+        sample.nPacketsSent = (uint64_t)dPacketsSent;
+        sample.nPacketsLost = (int64_t)dPacketsLost;
+        sample.nNacks       = (uint32_t)dPacketsLost;
+        sample.nPlis        = 0;
+        sample.nRttMs       = pt.nBaseRttMs + (int)dQueueMs;
+        sample.nSendKbps    = (uint32_t)(dPeriodBits / STATS_MS);
+        dPeriodBits = 0;
+
+        const int nPrevBitrate = target.nBitrateKbps;
+        if (abr.update(sample))
+        {
+            if (abr.target().nBitrateKbps != nPrevBitrate)
+                nBitrateChanges++;
+            if (abr.target().nRung != nLastRung)
+            {
+                nRungChanges++;
+                nLastRung = abr.target().nRung;
+            }
+        }
+
+        if (fVerbose)
+        {
+            const AbrController::Rung& rung = abr.target().rung;
+            printf("%.0f,%.0f,%d,%u,%.3f,%d,%d,%d,%d,%d,%d\n", sample.nTimeMs / 1000.0, pt.dCapacityKbps,
+                   abr.target().nBitrateKbps, sample.nSendKbps, abr.lastLoss(), sample.nRttMs, abr.baseRttMs(),
+                   abr.target().nRung, rung.nWidth, rung.nHeight, rung.nFps);
+        }
+    }
+
+    AbrController::Stats stats = abr.getStats();
+    const double dSeconds = dDuration;
+
+    printf("duration %.0fs, capacity avg %.0f kbps, sent avg %.0f kbps, delivered avg %.0f kbps (%.0f%% of capacity)\n",
+           dSeconds, dCapacityBits / dSeconds / 1000, dSentBits / dSeconds / 1000, dDeliveredBits / dSeconds / 1000,
+           dCapacityBits > 0 ? 100.0 * dDeliveredBits / dCapacityBits : 0.0);
+    printf("queue delay avg %.0f ms, congested %.1f%% of the time, loss avg %.2f%%\n",
+           dQueueDelaySum / std::max(nTicks, (int64_t)1), 100.0 * nCongestedMs / (dSeconds * 1000), stats.lossAvg * 100);
+    printf("%llu intervals, %llu congested, %llu decreases, %llu increases, %lld bitrate changes, min %d kbps\n",
+           (unsigned long long)stats.intervals, (unsigned long long)stats.congested, (unsigned long long)stats.decreases,
+           (unsigned long long)stats.increases, (long long)nBitrateChanges, stats.minBitrateKbps);
+    printf("%lld rung changes (%llu down, %llu up), time per rung:\n",
+           (long long)nRungChanges, (unsigned long long)stats.rungDowns, (unsigned long long)stats.rungUps);
+    for (size_t n = 0; n < abr.ladder().size(); n++)
+    {
+        const AbrController::Rung& rung = abr.ladder()[n];
+        printf("  %zu  %dx%d@%d  %.1f%%\n", n, rung.nWidth, rung.nHeight, rung.nFps, 100.0 * vRungMs[n] / (dSeconds * 1000));
+    }
+
+    return 0;
+}
@@ -0,0 +1,107 @@
+/*
+ * Copyright (c) 2013-2021 MFCXY, Inc. <mfcxy@mfcxy.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+// binlogdump: renders a binary log written by _BTRACE/_BMESG (MfcBinLog) as text.
+//
+//   binlogdump [-s] [-l level] [-t tid] file.blog
+//
+//   -s         list the call site table instead of the records
+//   -l level   only records at this level or more important (0 = EMERG ... 7 = TRACE)
+//   -t tid     only records from this thread id
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <string>
+#include <vector>
+
+#include <libfcs/MfcBinLog.h>
+
+#ifdef _WIN32
+char* __progname = "binlogdump";
+#else
+const char* __progname = "binlogdump";
+#endif
+
+#ifdef _WIN32
+void proxy_blog(int nLevel, const char* pszMsg) {}
+#endif
+
+
+static int usage(void)
+{
+    fprintf(stderr, "usage: %s [-s] [-l level] [-t tid] file.blog\n", __progname);
+    return 2;
+}
+
+
+int main(int argc, char* argv[])
+{
+    const char* pszFile = nullptr;
+    bool fSites = false;
+    int nMaxLevel = ILog::MAX_LOGLEVEL;
+    long nTid = -1;
+
+    for (int n = 1; n < argc; n++)
+    {
+        if (strcmp(argv[n], "-s") == 0)
+            fSites = true;
+        else if (strcmp(argv[n], "-l") == 0 && n + 1 < argc)
+            nMaxLevel = atoi(argv[++n]);
+        else if (strcmp(argv[n], "-t") == 0 && n + 1 < argc)
+            nTid = strtol(argv[++n], nullptr, 10);
+        else if (argv[n][0] != '-' && !pszFile)
+            pszFile = argv[n];
+        else
+            return usage();
+    }
+
+    if (!pszFile)
+        return usage();
+
+    std::vector< MfcBinLog::Site > vSites;
+    std::string sModule, sErr;
+
+    bool fOk = MfcBinLog::Decode(pszFile, [&](const MfcBinLog::Record& rec)
+    {
+        if (fSites)
+            return;
+        if (rec.pSite && (int)rec.pSite->nLevel > nMaxLevel)
+            return;
+        if (nTid >= 0 && rec.dwTid != (uint32_t)nTid)
+            return;
+
+        std::string sLine = MfcBinLog::FormatRecord(rec, sModule);
+        fwrite(sLine.c_str(), sLine.size(), 1, stdout);
+        fputc('\n', stdout);
+    }, &vSites, &sModule, &sErr);
+
+    if (!fOk)
+    {
+        fprintf(stderr, "%s: %s\n", pszFile, sErr.c_str());
+        return 1;
+    }
+
+    if (fSites)
+    {
+        for (size_t n = 0; n < vSites.size(); n++)
+            printf("%4zu  %d  %s:%d, %s()  \"%s\"\n", n, (int)vSites[n].nLevel, vSites[n].sFile.c_str(),
+                   vSites[n].nLine, vSites[n].sFunction.c_str(), vSites[n].sFmt.c_str());
+    }
+
+    return 0;
+}
@@ -0,0 +1,231 @@
+/*
+ * Copyright (c) 2013-2021 MFCXY, Inc. <mfcxy@mfcxy.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+// chatselect: runs CChatServerSelector against a stub server set, offline, and checks
+// what it picks.
+//
+//   chatselect [-v]
+//
+//   -v         print the ranking after each scenario
+//
+// setServerList() stands in for serverconfig.js and setProbe() for the connect probe,
+// with connect times derived from each server's number so every run sees the same
+// network. Each scenario prints PASS or FAIL, the exit code is the number of failures.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <chrono>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <obs-module.h>
+
+#include <libPlugins/ChatServerSelector.h>
+
+OBS_DECLARE_MODULE()
+
+static const char*  PROGNAME        = "chatselect";
+static const int    NUM_SERVERS     = 40;
+static const int    PICKS           = 200;
+static const int    SETTLE_MS       = 5000;
+
+static bool s_fVerbose = false;
+
+
+static int usage(void)
+{
+    fprintf(stderr, "usage: %s [-v]\n", PROGNAME);
+    return 2;
+}
+
+
+static std::vector< std::string > stubServers(void)
+{
+    std::vector< std::string > vServers;
+    for (int n = 1; n <= NUM_SERVERS; n++)
+        vServers.push_back("xchat" + std::to_string(n));
+    return vServers;
+}
+
+
+// xchatN connects in 20ms + N * 0.5ms, every fifth one doesn't answer
+static std::vector< int64_t > stubProbe(const std::vector< std::string >& vServers, int)
+{
+    std::vector< int64_t > vConnectUs;
+    for (const auto& sName : vServers)
+    {
+        int nServer = atoi(sName.c_str() + 5);
+        vConnectUs.push_back(nServer % 5 == 0 ? -1 : 20000 + nServer * 500);
+    }
+    return vConnectUs;
+}
+
+
+static int64_t nowMs(void)
+{
+    using namespace std::chrono;
+    return duration_cast< milliseconds >(steady_clock::now().time_since_epoch()).count();
+}
+
+
+// Waits for the background refresh pickServer() queued to produce a ranking
+static bool waitRanking(CChatServerSelector& sel)
+{
+    int64_t nGiveUpMs = nowMs() + SETTLE_MS;
+    while (sel.getRanking().empty())
+    {
+        if (nowMs() > nGiveUpMs)
+            return false;
+        std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    }
+    return true;
+}
+
+
+static void printRanking(CChatServerSelector& sel)
+{
+    if (!s_fVerbose)
+        return;
+
+    for (const auto& c : sel.getRanking())
+    {
+        if (c.nConnectUs >= 0)
+            printf("    %-10s %s %.1f ms\n", c.sName.c_str(), c.bHealthy ? "ok  " : "down", c.nConnectUs / 1000.0);
+        else
+            printf("    %-10s down no answer\n", c.sName.c_str());
+    }
+}
+
+
+static bool check(bool fOk, const char* pszScenario, const std::string& sDetail)
+{
+    printf("%s  %-40s %s\n", fOk ? "PASS" : "FAIL", pszScenario, sDetail.c_str());
+    return fOk;
+}
+
+
+int main(int argc, char* argv[])
+{
+    for (int n = 1; n < argc; n++)
+    {
+        if (strcmp(argv[n], "-v") == 0)
+            s_fVerbose = true;
+        else
+            return usage();
+    }
+
+    CChatServerSelector& sel = CChatServerSelector::instance();
+    int nFailed = 0;
+
+    // The first pick can't have a ranking yet; it must come back right away with the
+    // default, even though the probe takes a second, and leave a refresh queued
+    sel.setServerList(stubServers());
+    sel.setProbe([](const std::vector< std::string >& vServers, int nTimeoutMs)
+    {
+        std::this_thread::sleep_for(std::chrono::seconds(1));
+        return stubProbe(vServers, nTimeoutMs);
+    });
+    {
+        int64_t nStartMs = nowMs();
+        std::string sPick = sel.pickServer();
+        int64_t nTookMs = nowMs() - nStartMs;
+        bool fRanked = waitRanking(sel);
+        nFailed += !check(sPick == DEFAULT_CHAT_SERVER && nTookMs < 100 && fRanked, "first pick doesn't wait",
+                          sPick + " in " + std::to_string(nTookMs) + " ms, ranked " + (fRanked ? "later" : "never"));
+    }
+
+    // Only a sample is probed, healthy servers first and fastest first
+    sel.setProbe(stubProbe);
+    sel.pickServer();
+    if (waitRanking(sel))
+    {
+        auto vRanking = sel.getRanking();
+        bool fOrdered = true;
+        for (size_t n = 1; n < vRanking.size(); n++)
+        {
+            const auto& a = vRanking[n - 1];
+            const auto& b = vRanking[n];
+            if ((!a.bHealthy && b.bHealthy) || (a.bHealthy && b.bHealthy && a.nConnectUs > b.nConnectUs))
+                fOrdered = false;
+        }
+        printRanking(sel);
+        nFailed += !check(vRanking.size() == (size_t)CChatServerSelector::PROBE_SAMPLE && fOrdered, "ranking is a sorted sample",
+                          std::to_string(vRanking.size()) + " ranked, " + (fOrdered ? "in order" : "out of order"));
+
+        // Picks stay within PICK_SPREAD_US of the best healthy server
+        int64_t nLimitUs = vRanking[0].nConnectUs + CChatServerSelector::PICK_SPREAD_US;
+        std::set< std::string > setPicked;
+        bool fInSpread = true;
+        for (int n = 0; n < PICKS; n++)
+        {
+            std::string sPick = sel.pickServer();
+            setPicked.insert(sPick);
+            for (const auto& c : vRanking)
+            {
+                if (c.sName == sPick && (!c.bHealthy || c.nConnectUs > nLimitUs))
+                    fInSpread = false;
+            }
+        }
+        nFailed += !check(fInSpread && setPicked.size() > 1, "picks spread over the fastest few",
+                          std::to_string(setPicked.size()) + " distinct servers in " + std::to_string(PICKS) + " picks");
+
+        // A reported server goes behind every healthy one and isn't picked again
+        std::string sBest = vRanking[0].sName;
+        sel.reportFailure(sBest);
+        bool fAvoided = true;
+        for (int n = 0; n < PICKS; n++)
+            fAvoided &= sel.pickServer() != sBest;
+        vRanking = sel.getRanking();
+        bool fDemoted = false;
+        for (size_t n = 0; n < vRanking.size(); n++)
+        {
+            if (vRanking[n].sName == sBest)
+                fDemoted = !vRanking[n].bHealthy && (n + 1 == vRanking.size() || !vRanking[n + 1].bHealthy);
+        }
+        printRanking(sel);
+        nFailed += !check(fAvoided && fDemoted, "reported server leaves rotation", sBest);
+    }
+    else nFailed += !check(false, "ranking is a sorted sample", "no ranking");
+
+    // Nothing answers: any server is as good as another, but never the default
+    sel.setProbe([](const std::vector< std::string >& vServers, int)
+    {
+        return std::vector< int64_t >(vServers.size(), -1);
+    });
+    sel.pickServer();
+    if (waitRanking(sel))
+    {
+        std::set< std::string > setPicked;
+        for (int n = 0; n < PICKS; n++)
+            setPicked.insert(sel.pickServer());
+        nFailed += !check(setPicked.size() > 1 && !setPicked.count(DEFAULT_CHAT_SERVER), "all probes fail",
+                          std::to_string(setPicked.size()) + " distinct servers");
+    }
+    else nFailed += !check(false, "all probes fail", "no ranking");
+
+    // After stop() no refresh is queued and picks still return
+    sel.setProbe(stubProbe);
+    sel.stop();
+    std::string sPick = sel.pickServer();
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    nFailed += !check(sPick == DEFAULT_CHAT_SERVER && sel.getRanking().empty(), "stopped selector stays put", sPick);
+
+    return nFailed;
+}
@@ -11,6 +11,7 @@ function(MFCDefines TheTarget)
 		MFC_BROWSER_LOGIN=${MFC_BROWSER_LOGIN}
 		MFC_DEFAULT_BROADCAST_URL="${MFC_DEFAULT_BROADCAST_URL}"
 		MFC_FILE_SVR="${MFC_FILE_SVR}"
+		MFC_LOG_COMPILED_LEVEL=${MFC_LOG_COMPILED_LEVEL}
 		MFC_LOG_LEVEL=${MFC_LOG_LEVEL}
 		MFC_LOG_OUTPUT_MASK=${MFC_LOG_OUTPUT_MASK}
 		MFC_MAX_DEADCOUNT=${MFC_MAX_DEADCOUNT}
@@ -17,6 +17,7 @@ function(SET_VARIABLES)
 
 	set(MFC_LOG_LEVEL "ILog::LogLevel::MAX_LOGLEVEL" CACHE STRING "Default logging level")
 	set(MFC_LOG_OUTPUT_MASK "10" CACHE STRING "Default logging output mask")
+	set(MFC_LOG_COMPILED_LEVEL "7" CACHE STRING "Log calls above this level (0=EMERG ... 5=NOTICE, 6=DBG, 7=TRACE) are compiled out")
 	set(MFC_NO_UPDATES "0" CACHE STRING "Flag to turn off the updates. ObsUpdater will do everything but update")
 	set(MFC_DO_CEF_BUILD "1" CACHE STRING "Flag to turn off CEF builds. Set to FALSE for no CEF build")
 	set(MFC_NO_AUTOSTART_CEFLOGIN "0" CACHE STRING "Set to TRUE to disable MFCCefLogin auto start")
@@ -0,0 +1,815 @@
+/*
+ * Copyright (c) 2013-2021 MFCXY, Inc. <mfcxy@mfcxy.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+// encbench: runs frames through X264Encoder outside of OBS, for encoder throughput and
+// rate control numbers per resolution and preset.
+//
+//   encbench [-csv] [-n frames] [-r fps] [-b kbps] [-t threads] [-s WxH,...] [-p preset,...]
+//            [-in WxH] [-pattern pan|noise|still | clip.y4m | clip.nv12]
+//   encbench -i420 [-n frames] [-s WxH,...]
+//   encbench -scale [-n frames] [-s WxH,...]
+//
+//   -csv       one CSV line per resolution and preset instead of the table
+//   -n         frames encoded per run (300)
+//   -r         frame rate (the Y4M header's, else 30)
+//   -b         bitrate, the highest SanitizeInputs allows for the height if not given
+//   -t         x264 threads, 0 for auto
+//   -s         output sizes, the clip's own size or 640x360,1280x720,1920x1080 for a pattern
+//   -p         presets, all of X264Calibration::PRESETS if not given
+//   -in        frame size of a raw NV12 clip
+//   -i420      time NV12 to I420 conversion instead, at 1280x720,1920x1080,2560x1440
+//              unless -s says otherwise
+//   -scale     time the capture copy and downscale instead, from 1280x720,1920x1080,
+//              2560x1440 unless -s says otherwise
+//
+// Each run goes through InitEncode(), SetRates() and Encode() the way WebRTC drives the
+// encoder, with a stub EncodedImageCallback collecting the output. The run is split in
+// thirds with SetRates() targets of b, b/2 and b, so the bitrate columns show how close
+// x264 gets to a target and how well it follows a change. Frames are fed as fast as the
+// encoder takes them; the encode times are the Encode() calls, fragmentizing included.
+// The encoder's run time preset stepping and overload protection are switched off so
+// every run stays on the preset asked for.
+//
+// Clips are looped when shorter than -n and scaled with NV12BufPool like captured frames;
+// the scaling isn't timed. At most MAX_CLIP_FRAMES of a clip are kept in memory.
+//
+// -i420 times the conversion software sinks and the adaptation paths ask for with
+// NV12Buf::ToI420(), on pan pattern frames: into a fresh I420Buffer per call, into one
+// from I420BufPool, and three consumers asking for the same frame, once as three fresh
+// conversions and once through ToI420()'s cached copy.
+//
+// -scale times what VideoTrackSource does with each captured frame: NV12BufPool::CopyFrom()
+// at the captured size, and ScaleFrom() to every step of the 3/4, 2/3 ladder that
+// AdaptResolution() can pick, ScaleSteps down to the first at or under its MIN_PIXELS.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <memory>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <ObsBroadcast/FrameBufferPool.h>
+#include <ObsBroadcast/NV12Buf.h>
+#include <ObsBroadcast/SanitizeInputs.h>
+#include <ObsBroadcast/ScaleSteps.h>
+#include <ObsBroadcast/X264Calibration.h>
+#include <ObsBroadcast/X264Encoder.h>
+
+#include "api/video/video_frame.h"
+#include "api/video_codecs/sdp_video_format.h"
+#include "rtc_base/logging.h"
+#include "rtc_base/time_utils.h"
+#include "api/video/i420_buffer.h"
+#include "third_party/libyuv/include/libyuv/convert.h"
+#include "third_party/libyuv/include/libyuv/convert_from.h"
+
+static const char*  PROGNAME            = "encbench";
+static const int    MAX_CLIP_FRAMES     = 120;
+static const int    RATE_SEGMENTS       = 3;
+static const size_t MAX_PAYLOAD         = 1200;
+
+
+struct Size
+{
+    int     nWidth;
+    int     nHeight;
+};
+
+
+// NV12 frames at the source size, frame n of a run is frame n % count()
+class FrameSource
+{
+public:
+    virtual ~FrameSource() = default;
+
+    virtual int width(void) const = 0;
+    virtual int height(void) const = 0;
+    virtual int count(void) const = 0;
+    virtual void frame(int nFrame, const uint8_t*& pY, const uint8_t*& pUV) = 0;
+};
+
+
+// Frames read from a Y4M (I420, converted) or raw NV12 file
+class ClipSource : public FrameSource
+{
+public:
+    ClipSource(int w, int h) : m_nWidth(w), m_nHeight(h) {}
+
+    int width(void) const override  { return m_nWidth; }
+    int height(void) const override { return m_nHeight; }
+    int count(void) const override  { return (int)m_vFrames.size(); }
+
+    void frame(int nFrame, const uint8_t*& pY, const uint8_t*& pUV) override
+    {
+        const std::vector< uint8_t >& v = m_vFrames[nFrame % m_vFrames.size()];
+        pY  = v.data();
+        pUV = v.data() + (size_t)m_nWidth * m_nHeight;
+    }
+
+    size_t frameBytes(void) const { return (size_t)m_nWidth * m_nHeight + (size_t)m_nWidth * (m_nHeight / 2); }
+
+    void add(std::vector< uint8_t >&& vFrame) { m_vFrames.push_back(std::move(vFrame)); }
+
+private:
+    int                                     m_nWidth, m_nHeight;
+    std::vector< std::vector< uint8_t > >   m_vFrames;
+};
+
+
+// Generated frames at the output size, so nothing gets scaled:
+//   pan    smoothed noise panning with a block moving against it, the same kind of
+//          content X264Calibration measures with
+//   noise  unrelated noise frames (NOISE_FRAMES cycling), the worst case for motion
+//          search and rate control
+//   still  a fixed gradient with a small moving block, close to the best case
+class PatternSource : public FrameSource
+{
+public:
+    static const int    NOISE_FRAMES    = 8;        // more than x264 references at any preset we run
+    static const int    PAN_X           = 4;
+    static const int    PAN_Y           = 2;
+    static const int    PAN_FRAMES      = 300;      // then it pans back, so the field stays small
+
+    PatternSource(const std::string& sPattern, int w, int h, int nFrames)
+        : m_sPattern(sPattern), m_nWidth(w), m_nHeight(h), m_nFieldW(w), m_nFieldH(h), m_nFrames(nFrames)
+    {
+        std::mt19937 rng(1234);
+        int nFields = 1;
+
+        if (m_sPattern == "pan")
+        {
+            m_nFieldW = (w + PAN_X * PAN_FRAMES + 2) & ~1;
+            m_nFieldH = (h + PAN_Y * PAN_FRAMES + 2) & ~1;
+        }
+        else if (m_sPattern == "noise")
+            nFields = NOISE_FRAMES;
+
+        m_vField.resize((size_t)nFields * fieldBytes());
+        for (int n = 0; n < nFields; n++)
+        {
+            uint8_t* pY = &m_vField[(size_t)n * fieldBytes()];
+            uint8_t* pUV = pY + (size_t)m_nFieldW * m_nFieldH;
+
+            if (m_sPattern == "still")
+            {
+                for (int y = 0; y < m_nFieldH; y++)
+                    for (int x = 0; x < m_nFieldW; x++)
+                        pY[(size_t)y * m_nFieldW + x] = (uint8_t)(16 + (x + y) * 200 / (m_nFieldW + m_nFieldH));
+                memset(pUV, 128, (size_t)m_nFieldW * (m_nFieldH / 2));
+                continue;
+            }
+
+            for (size_t i = 0; i < (size_t)m_nFieldW * m_nFieldH; i++)
+                pY[i] = (uint8_t)(64 + (rng() & 127));
+            for (size_t i = 0; i < (size_t)m_nFieldW * (m_nFieldH / 2); i++)
+                pUV[i] = (uint8_t)(112 + (rng() & 31));
+
+            // Panned noise gets smoothed so it compresses like camera footage
+            if (m_sPattern == "pan")
+            {
+                for (int y = 0; y < m_nFieldH; y++)
+                {
+                    uint8_t* pRow = pY + (size_t)y * m_nFieldW;
+                    for (int x = 1; x < m_nFieldW; x++)
+                        pRow[x] = (uint8_t)((pRow[x - 1] * 3 + pRow[x]) / 4);
+                }
+            }
+        }
+
+        m_vFrame.resize((size_t)w * h + (size_t)w * (h / 2));
+    }
+
+    static bool valid(const std::string& sPattern) { return sPattern == "pan" || sPattern == "noise" || sPattern == "still"; }
+
+    int width(void) const override  { return m_nWidth; }
+    int height(void) const override { return m_nHeight; }
+    int count(void) const override  { return m_nFrames; }
+
+    void frame(int nFrame, const uint8_t*& pY, const uint8_t*& pUV) override
+    {
+        int x0 = 0, y0 = 0, nField = 0;
+        if (m_sPattern == "pan")
+        {
+            int nPos = nFrame % (2 * PAN_FRAMES);
+            if (nPos >= PAN_FRAMES)
+                nPos = 2 * PAN_FRAMES - 1 - nPos;
+            x0 = (nPos * PAN_X) & ~1;
+            y0 = (nPos * PAN_Y) & ~1;
+        }
+        else if (m_sPattern == "noise")
+            nField = nFrame % NOISE_FRAMES;
+
+        const uint8_t* pFieldY = &m_vField[(size_t)nField * fieldBytes()];
+        const uint8_t* pFieldUV = pFieldY + (size_t)m_nFieldW * m_nFieldH;
+        uint8_t* pDstY = m_vFrame.data();
+        uint8_t* pDstUV = pDstY + (size_t)m_nWidth * m_nHeight;
+
+        for (int y = 0; y < m_nHeight; y++)
+            memcpy(pDstY + (size_t)y * m_nWidth, pFieldY + (size_t)(y0 + y) * m_nFieldW + x0, m_nWidth);
+        for (int y = 0; y < m_nHeight / 2; y++)
+            memcpy(pDstUV + (size_t)y * m_nWidth, pFieldUV + (size_t)(y0 / 2 + y) * m_nFieldW + x0, m_nWidth);
+
+        if (m_sPattern != "noise")
+        {
+            const int nBlock = std::min(m_sPattern == "pan" ? 64 : 32, std::min(m_nWidth, m_nHeight) / 2);
+            const int bx = (nFrame * 12) % std::max(m_nWidth - nBlock, 1);
+            const int by = (nFrame * 6) % std::max(m_nHeight - nBlock, 1);
+            for (int y = by; y < by + nBlock; y++)
+                memset(pDstY + (size_t)y * m_nWidth + bx, 235, nBlock);
+        }
+
+        pY  = pDstY;
+        pUV = pDstUV;
+    }
+
+private:
+    size_t fieldBytes(void) const { return (size_t)m_nFieldW * m_nFieldH + (size_t)m_nFieldW * (m_nFieldH / 2); }
+
+    std::string             m_sPattern;
+    int                     m_nWidth, m_nHeight, m_nFieldW, m_nFieldH, m_nFrames;
+    std::vector< uint8_t >  m_vField;
+    std::vector< uint8_t >  m_vFrame;
+};
+
+
+// Stands in for WebRTC's side of the encoder, remembers what the last Encode() produced
+class BenchSink : public webrtc::EncodedImageCallback
+{
+public:
+    Result OnEncodedImage(const webrtc::EncodedImage& image, const webrtc::CodecSpecificInfo*) override
+    {
+        m_fDelivered    = true;
+        m_nBytes        = image.size();
+        m_fKey          = image._frameType == webrtc::VideoFrameType::kVideoFrameKey;
+        return Result(Result::OK);
+    }
+
+    void OnDroppedFrame(DropReason) override
+    {
+        m_nDropped++;
+    }
+
+    void reset(void)
+    {
+        m_fDelivered    = false;
+        m_nBytes        = 0;
+        m_fKey          = false;
+    }
+
+    bool        m_fDelivered    = false;
+    size_t      m_nBytes        = 0;
+    bool        m_fKey          = false;
+    int         m_nDropped      = 0;
+};
+
+
+struct RunResult
+{
+    bool                    fOk;
+    double                  dFps;
+    double                  dP50Ms, dP90Ms, dP99Ms, dMaxMs;
+    int                     nTargetKbps[ RATE_SEGMENTS ];
+    double                  dActualKbps[ RATE_SEGMENTS ];
+    int                     nKeyFrames;
+    double                  dKeyAvgKB, dKeyMaxKB, dDeltaAvgKB;
+    int                     nDropped;
+};
+
+
+static int usage(void)
+{
+    fprintf(stderr, "usage: %s [-csv] [-n frames] [-r fps] [-b kbps] [-t threads] [-s WxH,...] [-p preset,...]\n"
+                    "       [-in WxH] [-pattern pan|noise|still | clip.y4m | clip.nv12]\n"
+                    "       %s -i420 [-n frames] [-s WxH,...]\n"
+                    "       %s -scale [-n frames] [-s WxH,...]\n", PROGNAME, PROGNAME, PROGNAME);
+    return 2;
+}
+
+
+static bool parseSize(const char* psz, Size& size)
+{
+    return sscanf(psz, "%dx%d", &size.nWidth, &size.nHeight) == 2
+        && size.nWidth > 0 && size.nHeight > 0 && !(size.nWidth & 1) && !(size.nHeight & 1);
+}
+
+
+static std::vector< std::string > splitList(const char* psz)
+{
+    std::vector< std::string > v;
+    std::string s(psz);
+    size_t nStart = 0, nComma;
+    while ((nComma = s.find(',', nStart)) != std::string::npos)
+    {
+        v.push_back(s.substr(nStart, nComma - nStart));
+        nStart = nComma + 1;
+    }
+    v.push_back(s.substr(nStart));
+    return v;
+}
+
+
+static double percentile(const std::vector< double >& vSorted, int nPct)
+{
+    return vSorted[std::min(vSorted.size() - 1, vSorted.size() * nPct / 100)];
+}
+
+
+// "YUV4MPEG2 W1280 H720 F30:1 Ip A1:1 C420jpeg" followed by "FRAME[ params]\n" and I420 planes
+static std::unique_ptr< ClipSource > readY4m(FILE* pFile, int& nFps)
+{
+    char szHeader[256];
+    if (!fgets(szHeader, sizeof(szHeader), pFile) || strncmp(szHeader, "YUV4MPEG2 ", 10) != 0)
+        return nullptr;
+
+    int w = 0, h = 0, nFpsNum = 0, nFpsDen = 1;
+    for (char* psz = strtok(szHeader + 10, " \n"); psz; psz = strtok(nullptr, " \n"))
+    {
+        if (psz[0] == 'W')
+            w = atoi(psz + 1);
+        else if (psz[0] == 'H')
+            h = atoi(psz + 1);
+        else if (psz[0] == 'F')
+            sscanf(psz + 1, "%d:%d", &nFpsNum, &nFpsDen);
+        else if (psz[0] == 'C' && strncmp(psz, "C420", 4) != 0)
+        {
+            fprintf(stderr, "%s: only 4:2:0 Y4M is supported, not %s\n", PROGNAME, psz + 1);
+            return nullptr;
+        }
+    }
+    if (w <= 0 || h <= 0 || (w & 1) || (h & 1))
+        return nullptr;
+    if (nFpsNum > 0 && nFpsDen > 0)
+        nFps = (nFpsNum + nFpsDen / 2) / nFpsDen;
+
+    auto pClip = std::make_unique< ClipSource >(w, h);
+    std::vector< uint8_t > vI420((size_t)w * h * 3 / 2);
+    char szFrame[256];
+
+    while (pClip->count() < MAX_CLIP_FRAMES && fgets(szFrame, sizeof(szFrame), pFile) && strncmp(szFrame, "FRAME", 5) == 0)
+    {
+        if (fread(vI420.data(), 1, vI420.size(), pFile) != vI420.size())
+            break;
+
+        const uint8_t* pY = vI420.data();
+        const uint8_t* pU = pY + (size_t)w * h;
+        const uint8_t* pV = pU + (size_t)(w / 2) * (h / 2);
+        std::vector< uint8_t > vNV12(pClip->frameBytes());
+        libyuv::I420ToNV12(pY, w, pU, w / 2, pV, w / 2, vNV12.data(), w, vNV12.data() + (size_t)w * h, w, w, h);
+        pClip->add(std::move(vNV12));
+    }
+
+    return pClip;
+}
+
+
+static std::unique_ptr< ClipSource > readNv12(FILE* pFile, const Size& size)
+{
+    auto pClip = std::make_unique< ClipSource >(size.nWidth, size.nHeight);
+    while (pClip->count() < MAX_CLIP_FRAMES)
+    {
+        std::vector< uint8_t > vNV12(pClip->frameBytes());
+        if (fread(vNV12.data(), 1, vNV12.size(), pFile) != vNV12.size())
+            break;
+        pClip->add(std::move(vNV12));
+    }
+    return pClip;
+}
+
+
+static RunResult run(FrameSource& source, const Size& size, int nPreset, int nThreads, int nFps, int nKbps, int nFrames)
+{
+    RunResult res{};
+
+    X264Calibration::Config cfg;
+    cfg.nPreset     = nPreset;
+    cfg.nThreads    = nThreads;
+    X264Calibration::instance().setConfig(size.nWidth, size.nHeight, nFps, cfg);
+
+    auto pEncoder = X264Encoder::Create(webrtc::SdpVideoFormat("H264"));
+    pEncoder->SetAdaptationForTesting(false);
+
+    webrtc::VideoCodec codec;
+    codec.codecType     = webrtc::kVideoCodecH264;
+    codec.width         = (uint16_t)size.nWidth;
+    codec.height        = (uint16_t)size.nHeight;
+    codec.maxFramerate  = (uint32_t)nFps;
+    codec.startBitrate  = (unsigned int)nKbps;
+    codec.maxBitrate    = (unsigned int)nKbps;
+
+    BenchSink sink;
+    const webrtc::VideoEncoder::Settings settings(webrtc::VideoEncoder::Capabilities(false),
+                                                  (int)std::thread::hardware_concurrency(), MAX_PAYLOAD);
+    if (pEncoder->RegisterEncodeCompleteCallback(&sink) != WEBRTC_VIDEO_CODEC_OK
+        || pEncoder->InitEncode(&codec, settings) != WEBRTC_VIDEO_CODEC_OK)
+        return res;
+
+    NV12BufPool pool(4);
+    std::vector< double > vMs;
+    vMs.reserve(nFrames);
+    double dKeyBytes = 0, dDeltaBytes = 0, dSegmentBytes[ RATE_SEGMENTS ] = {};
+    int nDeltaFrames = 0, nSegmentFrames[ RATE_SEGMENTS ] = {};
+    int64_t nTotalUs = 0;
+
+    for (int n = 0; n < nFrames; n++)
+    {
+        // Halve the target for the middle third
+        const int nSegment = n * RATE_SEGMENTS / nFrames;
+        if (n == 0 || nSegment != (n - 1) * RATE_SEGMENTS / nFrames)
+        {
+            res.nTargetKbps[nSegment] = nSegment == 1 ? nKbps / 2 : nKbps;
+
+            webrtc::VideoBitrateAllocation allocation;
+            allocation.SetBitrate(0, 0, (uint32_t)res.nTargetKbps[nSegment] * 1000);
+            pEncoder->SetRates(webrtc::VideoEncoder::RateControlParameters(allocation, (double)nFps));
+        }
+
+        const uint8_t *pY, *pUV;
+        source.frame(n, pY, pUV);
+        auto buffer = pool.ScaleFrom(pY, source.width(), pUV, source.width(), source.width(), source.height(),
+                                     size.nWidth, size.nHeight);
+        const webrtc::VideoFrame frame = webrtc::VideoFrame::Builder()
+            .set_video_frame_buffer(buffer)
+            .set_timestamp_rtp((uint32_t)((int64_t)n * 90000 / nFps))
+            .set_timestamp_us((int64_t)n * rtc::kNumMicrosecsPerSec / nFps)
+            .build();
+
+        sink.reset();
+        const int64_t nStartUs = rtc::TimeMicros();
+        if (pEncoder->Encode(frame, nullptr) != WEBRTC_VIDEO_CODEC_OK)
+            return res;
+        const int64_t nElapsedUs = rtc::TimeMicros() - nStartUs;
+
+        nTotalUs += nElapsedUs;
+        vMs.push_back(nElapsedUs / 1000.0);
+
+        if (!sink.m_fDelivered)
+            continue;
+        dSegmentBytes[nSegment] += sink.m_nBytes;
+        nSegmentFrames[nSegment]++;
+        if (sink.m_fKey)
+        {
+            res.nKeyFrames++;
+            dKeyBytes += sink.m_nBytes;
+            res.dKeyMaxKB = std::max(res.dKeyMaxKB, sink.m_nBytes / 1024.0);
+        }
+        else
+        {
+            nDeltaFrames++;
+            dDeltaBytes += sink.m_nBytes;
+        }
+    }
+
+    pEncoder->Release();
+
+    std::sort(vMs.begin(), vMs.end());
+    res.fOk         = true;
+    res.dFps        = nTotalUs > 0 ? nFrames * 1000000.0 / nTotalUs : 0.0;
+    res.dP50Ms      = percentile(vMs, 50);
+    res.dP90Ms      = percentile(vMs, 90);
+    res.dP99Ms      = percentile(vMs, 99);
+    res.dMaxMs      = vMs.back();
+    res.dKeyAvgKB   = res.nKeyFrames ? dKeyBytes / res.nKeyFrames / 1024.0 : 0.0;
+    res.dDeltaAvgKB = nDeltaFrames ? dDeltaBytes / nDeltaFrames / 1024.0 : 0.0;
+    res.nDropped    = sink.m_nDropped;
+
+    // Frames (delivered or not) cover 1/fps of stream time each
+    for (int n = 0; n < RATE_SEGMENTS; n++)
+    {
+        const int nSegmentLen = (n + 1) * nFrames / RATE_SEGMENTS - n * nFrames / RATE_SEGMENTS;
+        res.dActualKbps[n] = nSegmentLen ? dSegmentBytes[n] * 8 * nFps / nSegmentLen / 1000.0 : 0.0;
+    }
+
+    return res;
+}
+
+
+static void convertI420(const uint8_t* pY, const uint8_t* pUV, int w, int h, webrtc::I420Buffer* pI420)
+{
+    libyuv::NV12ToI420(pY, w, pUV, w,
+                       pI420->MutableDataY(), pI420->StrideY(),
+                       pI420->MutableDataU(), pI420->StrideU(),
+                       pI420->MutableDataV(), pI420->StrideV(),
+                       w, h);
+}
+
+
+static int runI420(const std::vector< Size >& vSizes, int nFrames)
+{
+    enum { FRESH = 0, POOLED, FRESH_X3, TOI420_X3, MAX_COLUMN };
+
+    printf("NV12 to I420, %d frames, us per frame\n\n", nFrames);
+    printf("  size          fresh   pooled  3x fresh  3x ToI420\n");
+
+    for (const Size& size : vSizes)
+    {
+        const int w = size.nWidth, h = size.nHeight;
+        PatternSource source("pan", w, h, nFrames);
+        int64_t nSumNs[ MAX_COLUMN ] = {};
+
+        for (int n = 0; n < nFrames; n++)
+        {
+            const uint8_t *pY, *pUV;
+            source.frame(n, pY, pUV);
+
+            int64_t nStartNs = rtc::TimeNanos();
+            convertI420(pY, pUV, w, h, webrtc::I420Buffer::Create(w, h).get());
+            nSumNs[FRESH] += rtc::TimeNanos() - nStartNs;
+
+            nStartNs = rtc::TimeNanos();
+            convertI420(pY, pUV, w, h, I420BufPool::instance().Create(w, h).get());
+            nSumNs[POOLED] += rtc::TimeNanos() - nStartNs;
+
+            nStartNs = rtc::TimeNanos();
+            for (int nSink = 0; nSink < 3; nSink++)
+                convertI420(pY, pUV, w, h, webrtc::I420Buffer::Create(w, h).get());
+            nSumNs[FRESH_X3] += rtc::TimeNanos() - nStartNs;
+
+            // a new NV12Buf per frame, the way VideoTrackSource hands them out
+            auto buffer = NV12Buf::Create(pY, w, pUV, w, w, h);
+            nStartNs = rtc::TimeNanos();
+            for (int nSink = 0; nSink < 3; nSink++)
+                buffer->ToI420();
+            nSumNs[TOI420_X3] += rtc::TimeNanos() - nStartNs;
+        }
+
+        printf("  %-11s %7lld  %7lld  %8lld  %9lld\n", (std::to_string(w) + "x" + std::to_string(h)).c_str(),
+               (long long)(nSumNs[FRESH] / nFrames / 1000), (long long)(nSumNs[POOLED] / nFrames / 1000),
+               (long long)(nSumNs[FRESH_X3] / nFrames / 1000), (long long)(nSumNs[TOI420_X3] / nFrames / 1000));
+    }
+
+    const NV12Buf::I420Stats conv = NV12Buf::GetI420Stats();
+    const I420BufPool::Stats pool = I420BufPool::instance().GetStats();
+    printf("\nToI420 %llu conversions, %llu cache hits; pool %llu created, %llu allocated, %llu unpooled\n",
+           (unsigned long long)conv.conversions, (unsigned long long)conv.cacheHits,
+           (unsigned long long)pool.created, (unsigned long long)pool.allocated, (unsigned long long)pool.exhausted);
+    return 0;
+}
+
+
+static int runScale(const std::vector< Size >& vSizes, int nFrames)
+{
+    printf("NV12 capture copy and downscale, %d frames, us per frame\n\n", nFrames);
+    printf("  from        to           step      avg      max\n");
+
+    for (const Size& size : vSizes)
+    {
+        const int w = size.nWidth, h = size.nHeight;
+        PatternSource source("pan", w, h, nFrames);
+
+        // The copy first, then the same steps AdaptResolution() takes
+        int n = 1, d = 1;
+        for (int nStep = 0; nStep < ScaleSteps::MAX_STEPS; nStep++)
+        {
+            const ScaleSteps::Size step = ScaleSteps::stepSize(w, h, nStep, 2);
+            const int sw = step.nWidth, sh = step.nHeight;
+            NV12BufPool pool(4);
+            int64_t nSumNs = 0, nMaxNs = 0;
+
+            for (int nFrame = 0; nFrame < nFrames; nFrame++)
+            {
+                const uint8_t *pY, *pUV;
+                source.frame(nFrame, pY, pUV);
+
+                const int64_t nStartNs = rtc::TimeNanos();
+                auto buffer = n == d ? pool.CopyFrom(pY, w, pUV, w, w, h)
+                                     : pool.ScaleFrom(pY, w, pUV, w, w, h, sw, sh);
+                const int64_t nElapsedNs = rtc::TimeNanos() - nStartNs;
+
+                nSumNs += nElapsedNs;
+                nMaxNs = std::max(nMaxNs, nElapsedNs);
+            }
+
+            printf("  %-11s %-11s %5s  %7lld  %7lld\n",
+                   (std::to_string(w) + "x" + std::to_string(h)).c_str(),
+                   (std::to_string(sw) + "x" + std::to_string(sh)).c_str(),
+                   n == d ? "copy" : (std::to_string(n) + "/" + std::to_string(d)).c_str(),
+                   (long long)(nSumNs / nFrames / 1000), (long long)(nMaxNs / 1000));
+
+            if (step.pixels() <= ScaleSteps::MIN_PIXELS)
+                break;
+            if (nStep % 2 == 0)
+            {
+                n *= 3;
+                d *= 4;
+            }
+            else
+            {
+                n *= 2;
+                d *= 3;
+            }
+        }
+    }
+
+    return 0;
+}
+
+
+int main(int argc, char* argv[])
+{
+    std::vector< Size > vSizes;
+    std::vector< int > vPresets;
+    std::string sPattern = "pan", sClip;
+    Size inSize = { 0, 0 };
+    int nFrames = 300, nFps = 0, nKbps = 0, nThreads = 0;
+    bool fCsv = false, fI420 = false, fScale = false;
+
+    for (int n = 1; n < argc; n++)
+    {
+        const char* psz = argv[n];
+        const char* pszVal = n + 1 < argc ? argv[n + 1] : nullptr;
+
+        if (strcmp(psz, "-csv") == 0)
+            fCsv = true;
+        else if (strcmp(psz, "-i420") == 0)
+            fI420 = true;
+        else if (strcmp(psz, "-scale") == 0)
+            fScale = true;
+        else if (!pszVal && psz[0] == '-')
+            return usage();
+        else if (strcmp(psz, "-n") == 0)
+            nFrames = atoi(argv[++n]);
+        else if (strcmp(psz, "-r") == 0)
+            nFps = atoi(argv[++n]);
+        else if (strcmp(psz, "-b") == 0)
+            nKbps = atoi(argv[++n]);
+        else if (strcmp(psz, "-t") == 0)
+            nThreads = atoi(argv[++n]);
+        else if (strcmp(psz, "-pattern") == 0)
+        {
+            sPattern = argv[++n];
+            if (!PatternSource::valid(sPattern))
+                return usage();
+        }
+        else if (strcmp(psz, "-in") == 0)
+        {
+            if (!parseSize(argv[++n], inSize))
+                return usage();
+        }
+        else if (strcmp(psz, "-s") == 0)
+        {
+            for (const std::string& s : splitList(argv[++n]))
+            {
+                Size size;
+                if (!parseSize(s.c_str(), size))
+                    return usage();
+                vSizes.push_back(size);
+            }
+        }
+        else if (strcmp(psz, "-p") == 0)
+        {
+            for (const std::string& s : splitList(argv[++n]))
+            {
+                const int nPreset = (int)(std::find_if(X264Calibration::PRESETS, X264Calibration::PRESETS + X264Calibration::NUM_PRESETS,
+                                                       [&s](const char* pszPreset) { return s == pszPreset; }) - X264Calibration::PRESETS);
+                if (nPreset >= X264Calibration::NUM_PRESETS)
+                {
+                    fprintf(stderr, "%s: unknown preset %s\n", PROGNAME, s.c_str());
+                    return 2;
+                }
+                vPresets.push_back(nPreset);
+            }
+        }
+        else if (psz[0] != '-' && sClip.empty())
+            sClip = psz;
+        else
+            return usage();
+    }
+
+    if (nFrames < RATE_SEGMENTS || nThreads < 0)
+        return usage();
+
+    if (fI420 || fScale)
+    {
+        if (vSizes.empty())
+            vSizes = { { 1280, 720 }, { 1920, 1080 }, { 2560, 1440 } };
+        return fI420 ? runI420(vSizes, nFrames) : runScale(vSizes, nFrames);
+    }
+
+    rtc::LogMessage::LogToDebug(rtc::LS_WARNING);
+    rtc::LogMessage::LogTimestamps(false);
+
+    std::unique_ptr< ClipSource > pClip;
+    if (!sClip.empty())
+    {
+        FILE* pFile = fopen(sClip.c_str(), "rb");
+        if (!pFile)
+        {
+            fprintf(stderr, "%s: can't open %s\n", PROGNAME, sClip.c_str());
+            return 1;
+        }
+
+        int nClipFps = 0;
+        const bool fY4m = sClip.size() > 4 && sClip.compare(sClip.size() - 4, 4, ".y4m") == 0;
+        if (fY4m)
+            pClip = readY4m(pFile, nClipFps);
+        else if (inSize.nWidth > 0)
+            pClip = readNv12(pFile, inSize);
+        else
+        {
+            fclose(pFile);
+            fprintf(stderr, "%s: raw NV12 needs -in WxH\n", PROGNAME);
+            return 2;
+        }
+        fclose(pFile);
+
+        if (!pClip || pClip->count() == 0)
+        {
+            fprintf(stderr, "%s: no frames read from %s\n", PROGNAME, sClip.c_str());
+            return 1;
+        }
+        if (nFps <= 0)
+            nFps = nClipFps;
+        if (vSizes.empty())
+            vSizes.push_back({ pClip->width(), pClip->height() });
+    }
+
+    if (nFps <= 0)
+        nFps = 30;
+    if (vSizes.empty())
+        vSizes = { { 640, 360 }, { 1280, 720 }, { 1920, 1080 } };
+    if (vPresets.empty())
+    {
+        for (int n = 0; n < X264Calibration::NUM_PRESETS; n++)
+            vPresets.push_back(n);
+    }
+
+    if (fCsv)
+        printf("width,height,fps,preset,threads,encode_fps,p50_ms,p90_ms,p99_ms,max_ms,"
+               "target1_kbps,actual1_kbps,target2_kbps,actual2_kbps,target3_kbps,actual3_kbps,"
+               "keyframes,key_avg_kb,key_max_kb,delta_avg_kb,dropped\n");
+    else
+        printf("%s, %d frames at %d fps, %s threads, %u cores\n", pClip ? sClip.c_str() : sPattern.c_str(), nFrames, nFps,
+               nThreads ? std::to_string(nThreads).c_str() : "auto", std::thread::hardware_concurrency());
+
+    for (const Size& size : vSizes)
+    {
+        int nSizeKbps = nKbps;
+        if (nSizeKbps <= 0)
+        {
+            nSizeKbps = 100000;
+            SanitizeInputs::ConstrainBitrate(size.nHeight, nSizeKbps);
+        }
+
+        std::unique_ptr< PatternSource > pPattern;
+        if (!pClip)
+            pPattern = std::make_unique< PatternSource >(sPattern, size.nWidth, size.nHeight, nFrames);
+        FrameSource& source = pClip ? (FrameSource&)*pClip : (FrameSource&)*pPattern;
+
+        if (!fCsv)
+            printf("\n%dx%d@%d, %d kbps\n"
+                   "  preset       fps   p50 ms  p90 ms  p99 ms  max ms  kbps target/actual (error)                                 IDR  avg KB  max KB  P avg KB\n",
+                   size.nWidth, size.nHeight, nFps, nSizeKbps);
+
+        for (int nPreset : vPresets)
+        {
+            const RunResult res = run(source, size, nPreset, nThreads, nFps, nSizeKbps, nFrames);
+            const char* pszPreset = X264Calibration::presetName(nPreset);
+            if (!res.fOk)
+            {
+                fprintf(stderr, "%s: %dx%d %s failed\n", PROGNAME, size.nWidth, size.nHeight, pszPreset);
+                continue;
+            }
+
+            if (fCsv)
+            {
+                printf("%d,%d,%d,%s,%d,%.1f,%.2f,%.2f,%.2f,%.2f", size.nWidth, size.nHeight, nFps, pszPreset, nThreads,
+                       res.dFps, res.dP50Ms, res.dP90Ms, res.dP99Ms, res.dMaxMs);
+                for (int n = 0; n < RATE_SEGMENTS; n++)
+                    printf(",%d,%.0f", res.nTargetKbps[n], res.dActualKbps[n]);
+                printf(",%d,%.1f,%.1f,%.2f,%d\n", res.nKeyFrames, res.dKeyAvgKB, res.dKeyMaxKB, res.dDeltaAvgKB, res.nDropped);
+                continue;
+            }
+
+            printf("  %-10s %6.1f  %6.2f  %6.2f  %6.2f  %6.2f ", pszPreset, res.dFps, res.dP50Ms, res.dP90Ms, res.dP99Ms, res.dMaxMs);
+            for (int n = 0; n < RATE_SEGMENTS; n++)
+            {
+                const double dErr = res.nTargetKbps[n] ? 100.0 * (res.dActualKbps[n] - res.nTargetKbps[n]) / res.nTargetKbps[n] : 0.0;
+                printf(" %5d/%5.0f (%+5.1f%%)", res.nTargetKbps[n], res.dActualKbps[n], dErr);
+            }
+            printf("  %3d  %6.1f  %6.1f  %8.2f", res.nKeyFrames, res.dKeyAvgKB, res.dKeyMaxKB, res.dDeltaAvgKB);
+            if (res.nDropped)
+                printf("  (%d dropped)", res.nDropped);
+            printf("\n");
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,231 @@
+/*
+ * Copyright (c) 2013-2021 MFCXY, Inc. <mfcxy@mfcxy.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+// ipcbench: round trip latency of the shared memory IPC (CMessageManager rings and doorbells)
+// between two processes.
+//
+//   ipcbench [-n count] [-s bytes] [-gap us] [-client]
+//
+//   -n count   round trips to time, after WARMUP untimed ones (default 10000)
+//   -s bytes   payload per message, up to BUF_SIZE - 1 (default 64)
+//   -gap us    pause between round trips so both sides go back to sleep on their doorbell
+//   -client    be the echo side of an ipcbench already running in another shell
+//
+// The timing side creates its own segment (BENCH_SEGMENT, never the plugin's) and sends
+// a ping to PONG_ADDR; the echo side sleeps in waitMessage() and sends it straight back
+// to PING_ADDR. Outside Windows the echo side is forked off, on Windows start a second
+// "ipcbench -client" once the first one says it's waiting. Reports the round trip
+// distribution and the one way delivery latency each ring measured.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifndef _WIN32
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+#include <libPlugins/IPCShared.h>
+
+using namespace MFC_Shared_Mem;
+
+static const char*  PROGNAME        = "ipcbench";
+static const char*  BENCH_SEGMENT   = "MFCIpcBench";
+static const char*  PING_ADDR       = "benchPing";
+static const char*  PONG_ADDR       = "benchPong";
+static const int    WARMUP          = 100;
+static const int    WAIT_MS         = 2000;
+static const int    CONNECT_MS      = 30000;
+
+
+static int usage(void)
+{
+    fprintf(stderr, "usage: %s [-n count] [-s bytes] [-gap us] [-client]\n", PROGNAME);
+    return 2;
+}
+
+
+static int64_t nowUs(void)
+{
+    using namespace std::chrono;
+    return duration_cast< microseconds >(steady_clock::now().time_since_epoch()).count();
+}
+
+
+// Echo side: returns every ping to PING_ADDR until MSG_TYPE_SHUTDOWN
+static int runClient(void)
+{
+    CMessageManager mgr;
+    int64_t nGiveUpUs = nowUs() + CONNECT_MS * 1000LL;
+    while (!mgr.init(false, BENCH_SEGMENT))
+    {
+        if (nowUs() > nGiveUpUs)
+        {
+            fprintf(stderr, "%s: no ipcbench segment to join\n", PROGNAME);
+            return 1;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    }
+
+    CSharedMemMsg msg;
+    while (true)
+    {
+        mgr.waitMessage(PONG_ADDR, WAIT_MS);
+        while (mgr.getNextMessage(&msg, PONG_ADDR))
+        {
+            if (msg.getID() == MSG_TYPE_SHUTDOWN)
+                return 0;
+
+            CSharedMemMsg reply(PING_ADDR, PONG_ADDR, MSG_TYPE_PING, msg.getMessage());
+            mgr.sendMessage(reply);
+        }
+    }
+}
+
+
+// One ping and its echo, false if the echo didn't come back in time
+static bool roundTrip(CMessageManager& mgr, const std::string& sPayload)
+{
+    CSharedMemMsg msg(PONG_ADDR, PING_ADDR, MSG_TYPE_PING, sPayload.c_str());
+    if (!mgr.sendMessage(msg))
+        return false;
+
+    int64_t nDeadlineUs = nowUs() + WAIT_MS * 1000LL;
+    while (nowUs() < nDeadlineUs)
+    {
+        if (mgr.getNextMessage(&msg, PING_ADDR))
+            return true;
+        mgr.waitMessage(PING_ADDR, WAIT_MS);
+    }
+    return false;
+}
+
+
+int main(int argc, char* argv[])
+{
+    int nCount = 10000;
+    int nBytes = 64;
+    int nGapUs = 0;
+    bool fClient = false;
+
+    for (int n = 1; n < argc; n++)
+    {
+        const char* psz = argv[n];
+        const char* pszVal = n + 1 < argc ? argv[n + 1] : nullptr;
+
+        if (strcmp(psz, "-client") == 0)
+            fClient = true;
+        else if (!pszVal)
+            return usage();
+        else if (strcmp(psz, "-n") == 0)
+            nCount = atoi(argv[++n]);
+        else if (strcmp(psz, "-s") == 0)
+            nBytes = atoi(argv[++n]);
+        else if (strcmp(psz, "-gap") == 0)
+            nGapUs = atoi(argv[++n]);
+        else
+            return usage();
+    }
+
+    if (fClient)
+        return runClient();
+
+    if (nCount <= 0 || nBytes < 0 || nBytes >= BUF_SIZE || nGapUs < 0)
+        return usage();
+
+    CMessageManager mgr;
+    if (!mgr.init(true, BENCH_SEGMENT))
+    {
+        fprintf(stderr, "%s: can't create shared memory segment %s\n", PROGNAME, BENCH_SEGMENT);
+        return 1;
+    }
+
+#ifndef _WIN32
+    pid_t pid = fork();
+    if (pid < 0)
+    {
+        perror("fork");
+        return 1;
+    }
+    if (pid == 0)
+        _exit(runClient());
+#else
+    printf("waiting, start \"%s -client\" in another shell\n", PROGNAME);
+    fflush(stdout);
+#endif
+
+    std::string sPayload((size_t)nBytes, 'x');
+    std::vector< int64_t > vRttUs;
+    vRttUs.reserve((size_t)nCount);
+    int nLost = 0;
+
+    for (int n = 0; n < WARMUP + nCount; n++)
+    {
+        if (nGapUs > 0)
+            std::this_thread::sleep_for(std::chrono::microseconds(nGapUs));
+
+        int64_t nStartUs = nowUs();
+        if (!roundTrip(mgr, sPayload))
+        {
+            // the first one may be waiting on the echo side to start
+            if (n > 0 && ++nLost > 10)
+                break;
+            continue;
+        }
+        if (n >= WARMUP)
+            vRttUs.push_back(nowUs() - nStartUs);
+    }
+
+    mgr.sendMessage(PONG_ADDR, PING_ADDR, MSG_TYPE_SHUTDOWN, "");
+#ifndef _WIN32
+    waitpid(pid, nullptr, 0);
+#endif
+
+    if (vRttUs.empty())
+    {
+        fprintf(stderr, "%s: no round trips completed\n", PROGNAME);
+        return 1;
+    }
+
+    std::sort(vRttUs.begin(), vRttUs.end());
+    int64_t nSumUs = 0;
+    for (int64_t nUs : vRttUs)
+        nSumUs += nUs;
+    auto pct = [&vRttUs](double d) { return (long long)vRttUs[std::min(vRttUs.size() - 1, (size_t)(d * vRttUs.size()))]; };
+
+    printf("%zu round trips of %d bytes, gap %d us, %d lost\n", vRttUs.size(), nBytes, nGapUs, nLost);
+    printf("round trip us: avg %lld  p50 %lld  p90 %lld  p99 %lld  max %lld\n",
+           (long long)(nSumUs / (int64_t)vRttUs.size()), pct(0.50), pct(0.90), pct(0.99), (long long)vRttUs.back());
+
+    for (const char* pszAddr : { PONG_ADDR, PING_ADDR })
+    {
+        CShmRing::Stats stats;
+        if (mgr.getStats(pszAddr, stats))
+            printf("ring %-10s %u sent, %u received, %u dropped, %u stale, one way avg %llu us max %llu us\n", pszAddr,
+                   stats.sent, stats.received, stats.dropped, stats.stale,
+                   (unsigned long long)stats.latencyAvgUs, (unsigned long long)stats.latencyMaxUs);
+    }
+
+    shared_memory_object::remove(BENCH_SEGMENT);
+    return 0;
+}
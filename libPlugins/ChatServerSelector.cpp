@@ -0,0 +1,417 @@
+/*
+ * Copyright (c) 2013-2021 MFCXY, Inc. <mfcxy@mfcxy.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+// System Includes
+#include <algorithm>
+#include <cstdlib>
+#include <ctime>
+#include <random>
+
+#include <curl/curl.h>
+
+// obs
+#include <obs-module.h>
+
+// solution includes
+#include <libfcs/Log.h>
+#include <libfcs/fcslib_string.h>
+
+// project includes
+#include "ChatServerSelector.h"
+#include "Executor.h"
+#include "HttpRequest.h"
+#include "PluginConfigWriter.h"
+
+#include <nlohmann/json.hpp>
+
+using njson = nlohmann::json;
+using std::string;
+using std::vector;
+using std::lock_guard;
+using std::unique_lock;
+using std::mutex;
+
+
+CChatServerSelector& CChatServerSelector::instance(void)
+{
+    static CChatServerSelector s_selector;
+    return s_selector;
+}
+
+
+CChatServerSelector::CChatServerSelector()
+    : m_configTtl(3600)
+    , m_refreshInterval(600)
+    , m_bRefreshing(false)
+    , m_bStopped(false)
+    , m_cancel(CCancelToken::create())
+{}
+
+
+CChatServerSelector::~CChatServerSelector()
+{
+    stop();
+}
+
+
+string CChatServerSelector::pickServer(void)
+{
+    unique_lock< mutex > lk(m_mutex);
+
+    // Callers are on the UI thread, so the network is never waited on here
+    if (m_ranking.empty() || Clock::now() - m_tmRanked > m_refreshInterval)
+    {
+        lk.unlock();
+        refresh(false);
+        lk.lock();
+    }
+
+    if (m_ranking.empty())
+        return DEFAULT_CHAT_SERVER;
+
+    static std::mt19937 s_gen(std::random_device{}());
+
+    // healthy servers are sorted to the front, fastest first
+    size_t nPick = 0;
+    if (m_ranking[0].bHealthy)
+    {
+        int64_t nLimit = m_ranking[0].nConnectUs + PICK_SPREAD_US;
+        while (nPick < m_ranking.size() && m_ranking[nPick].bHealthy && m_ranking[nPick].nConnectUs <= nLimit)
+            nPick++;
+    }
+    else nPick = m_ranking.size();  // nothing answered, any of them is as good as another
+
+    std::uniform_int_distribution< size_t > distr(0, nPick - 1);
+    return m_ranking[ distr(s_gen) ].sName;
+}
+
+
+void CChatServerSelector::reportFailure(const string& sName)
+{
+    lock_guard< mutex > lk(m_mutex);
+    for (auto iCandidate = m_ranking.begin(); iCandidate != m_ranking.end(); ++iCandidate)
+    {
+        if (iCandidate->sName == sName)
+        {
+            Candidate failed = *iCandidate;
+            failed.bHealthy = false;
+
+            // move it behind every healthy server
+            m_ranking.erase(iCandidate);
+            auto iPos = std::find_if(m_ranking.begin(), m_ranking.end(), [](const Candidate& c) { return !c.bHealthy; });
+            m_ranking.insert(iPos, failed);
+
+            _TRACE("chat server %s marked unhealthy", sName.c_str());
+            break;
+        }
+    }
+}
+
+
+void CChatServerSelector::refresh(bool bWait)
+{
+    if (bWait)
+    {
+        doRefresh();
+        return;
+    }
+
+    {
+        lock_guard< mutex > lk(m_mutex);
+        if (m_bRefreshing || m_bStopped)
+            return;
+        m_bRefreshing = true;
+    }
+
+    CCancelToken cancel = m_cancel;
+    CExecutor::instance().submit([this, cancel]()
+    {
+        // stopped before a worker got to it, nothing left to refresh for
+        if (!cancel.isCancelled())
+            doRefresh();
+
+        lock_guard< mutex > lkDone(m_mutex);
+        m_bRefreshing = false;
+        m_cvDone.notify_all();
+    }, CExecutor::Bulk);
+}
+
+
+void CChatServerSelector::setServerList(const vector< string >& vServers)
+{
+    lock_guard< mutex > lk(m_mutex);
+    m_vStubServers = vServers;
+    m_ranking.clear();
+}
+
+
+void CChatServerSelector::setProbe(ProbeFn fnProbe)
+{
+    lock_guard< mutex > lk(m_mutex);
+    m_fnProbe = fnProbe;
+    m_ranking.clear();
+}
+
+
+void CChatServerSelector::setIntervals(std::chrono::seconds configTtl, std::chrono::seconds refreshInterval)
+{
+    lock_guard< mutex > lk(m_mutex);
+    m_configTtl = configTtl;
+    m_refreshInterval = refreshInterval;
+}
+
+
+void CChatServerSelector::stop(void)
+{
+    unique_lock< mutex > lk(m_mutex);
+    m_bStopped = true;
+    m_cancel.cancel();
+
+    m_cvDone.wait(lk, [this]() { return !m_bRefreshing; });
+}
+
+
+vector< CChatServerSelector::Candidate > CChatServerSelector::getRanking(void) const
+{
+    lock_guard< mutex > lk(m_mutex);
+    return m_ranking;
+}
+
+
+void CChatServerSelector::doRefresh(void)
+{
+    lock_guard< mutex > lkRefresh(m_refreshMutex);
+    vector< string > vServers;
+    ProbeFn fnProbe;
+
+    if (!loadServerList(vServers) || vServers.empty())
+    {
+        _MESG("no chat servers from serverconfig, falling back to %s", DEFAULT_CHAT_SERVER);
+        vServers.push_back(DEFAULT_CHAT_SERVER);
+    }
+
+    {
+        lock_guard< mutex > lk(m_mutex);
+        fnProbe = m_fnProbe ? m_fnProbe : connectProbe;
+    }
+
+    // Only probe a random sample, every client probing every server would be a lot of connects
+    static std::mt19937 s_gen(std::random_device{}());
+    std::shuffle(vServers.begin(), vServers.end(), s_gen);
+    if (vServers.size() > (size_t)PROBE_SAMPLE)
+        vServers.resize((size_t)PROBE_SAMPLE);
+
+    vector< int64_t > vConnectUs = fnProbe(vServers, PROBE_TIMEOUT_MS);
+    vector< Candidate > vRanking;
+
+    for (size_t n = 0; n < vServers.size(); n++)
+    {
+        int64_t nConnectUs = n < vConnectUs.size() ? vConnectUs[n] : -1;
+        vRanking.push_back(Candidate{ vServers[n], nConnectUs, nConnectUs >= 0 });
+    }
+
+    std::stable_sort(vRanking.begin(), vRanking.end(), [](const Candidate& a, const Candidate& b)
+    {
+        if (a.bHealthy != b.bHealthy)
+            return a.bHealthy;
+        return a.bHealthy && a.nConnectUs < b.nConnectUs;
+    });
+
+    if (vRanking[0].bHealthy)
+        _TRACE("chat servers ranked; best %s at %.1f ms of %zu probed",
+               vRanking[0].sName.c_str(), vRanking[0].nConnectUs / 1000.0, vRanking.size());
+    else
+        _MESG("chat server probe failed for all %zu servers", vRanking.size());
+
+    lock_guard< mutex > lk(m_mutex);
+    m_ranking.swap(vRanking);
+    m_tmRanked = Clock::now();
+}
+
+
+bool CChatServerSelector::loadServerList(vector< string >& vServers)
+{
+    std::chrono::seconds configTtl;
+    {
+        lock_guard< mutex > lk(m_mutex);
+        if (!m_vStubServers.empty())
+        {
+            vServers = m_vStubServers;
+            return true;
+        }
+        configTtl = m_configTtl;
+    }
+
+    string sETag, sLastModified;
+    int64_t nFetched = 0;
+    bool bCached = readCache(vServers, sETag, sLastModified, nFetched);
+
+    if (bCached && (int64_t)time(nullptr) - nFetched < (int64_t)configTtl.count())
+        return true;
+
+    CCurlHttpRequest httpreq;
+    long nStatus = 0;
+    unsigned int dwLen = 0;
+
+    uint8_t* pResponse = httpreq.GetConditional(SERVERCONFIG_URL, sETag, sLastModified, &nStatus, &dwLen, nullptr);
+    if (pResponse != nullptr)
+    {
+        vector< string > vFresh;
+        bool bParsed = parseServerConfig((const char*)pResponse, vFresh);
+        free(pResponse);
+
+        if (bParsed)
+        {
+            vServers.swap(vFresh);
+            writeCache(vServers, sETag, sLastModified);
+            return true;
+        }
+        _MESG("Error parsing serverconfig");
+    }
+    else if (nStatus == 304 && bCached)
+    {
+        // still current, just restart the ttl
+        writeCache(vServers, sETag, sLastModified);
+        return true;
+    }
+    else _MESG("Error fetching serverconfig: HTTP %ld %s", nStatus, httpreq.getResultString().c_str());
+
+    // a stale list beats no list
+    return bCached;
+}
+
+
+bool CChatServerSelector::readCache(vector< string >& vServers, string& sETag, string& sLastModified, int64_t& nFetched)
+{
+    char* pszPath = obs_module_config_path(SERVERCONFIG_CACHE_FILE);
+    string sPath = pszPath ? pszPath : "", sData;
+    bfree(pszPath);
+
+    if (sPath.empty() || stdGetFileContents(sPath, sData) == 0)
+        return false;
+
+    njson js = njson::parse(sData, nullptr, false);
+    if (js.is_discarded() || !js.is_object() || !js["servers"].is_array())
+        return false;
+
+    vServers.clear();
+    for (const auto& server : js["servers"])
+    {
+        if (server.is_string())
+            vServers.push_back(server.get< string >());
+    }
+
+    sETag         = js.value("etag", "");
+    sLastModified = js.value("lastModified", "");
+    nFetched      = js.value("fetched", (int64_t)0);
+
+    return !vServers.empty();
+}
+
+
+void CChatServerSelector::writeCache(const vector< string >& vServers, const string& sETag, const string& sLastModified)
+{
+    char* pszPath = obs_module_config_path(SERVERCONFIG_CACHE_FILE);
+    string sPath = pszPath ? pszPath : "";
+    bfree(pszPath);
+
+    njson js;
+    js["servers"]       = vServers;
+    js["etag"]          = sETag;
+    js["lastModified"]  = sLastModified;
+    js["fetched"]       = (int64_t)time(nullptr);
+
+    if (sPath.empty() || !CPluginConfigWriter::atomicWriteFile(sPath, js.dump()))
+        _MESG("unable to write serverconfig cache to %s", sPath.c_str());
+}
+
+
+bool CChatServerSelector::parseServerConfig(const char* pszData, vector< string >& vServers)
+{
+    njson res = njson::parse(pszData, nullptr, false);
+    if (res.is_discarded() || !res.is_object() || !res["websocket_servers"].is_object())
+        return false;
+
+    for (const auto& it : res["websocket_servers"].items())
+        vServers.push_back(it.key());
+
+    return !vServers.empty();
+}
+
+
+// static
+vector< int64_t > CChatServerSelector::connectProbe(const vector< string >& vServers, int nTimeoutMs)
+{
+    vector< int64_t > vConnectUs(vServers.size(), -1);
+    vector< CURL* > vEasy(vServers.size(), nullptr);
+
+    curl_global_init(CURL_GLOBAL_ALL);
+    CURLM* pMulti = curl_multi_init();
+
+    for (size_t n = 0; n < vServers.size(); n++)
+    {
+        if ((vEasy[n] = curl_easy_init()) != nullptr)
+        {
+            string sUrl = "https://" + hostName(vServers[n]) + "/";
+            curl_easy_setopt(vEasy[n], CURLOPT_URL, sUrl.c_str());
+            curl_easy_setopt(vEasy[n], CURLOPT_CONNECT_ONLY, 1L);
+            curl_easy_setopt(vEasy[n], CURLOPT_TIMEOUT_MS, (long)nTimeoutMs);
+            curl_easy_setopt(vEasy[n], CURLOPT_NOSIGNAL, 1L);
+            curl_multi_add_handle(pMulti, vEasy[n]);
+        }
+    }
+
+    int nRunning = 0;
+    do
+    {
+        if (curl_multi_perform(pMulti, &nRunning) != CURLM_OK)
+            break;
+        if (nRunning > 0)
+            curl_multi_poll(pMulti, nullptr, 0, 100, nullptr);
+    } while (nRunning > 0);
+
+    CURLMsg* pMsg;
+    int nLeft = 0;
+    while ((pMsg = curl_multi_info_read(pMulti, &nLeft)) != nullptr)
+    {
+        if (pMsg->msg != CURLMSG_DONE || pMsg->data.result != CURLE_OK)
+            continue;
+
+        auto iEasy = std::find(vEasy.begin(), vEasy.end(), pMsg->easy_handle);
+        if (iEasy != vEasy.end())
+        {
+            // TCP + TLS handshake, leave out the DNS lookup
+            curl_off_t tmLookup = 0, tmConnected = 0;
+            curl_easy_getinfo(pMsg->easy_handle, CURLINFO_NAMELOOKUP_TIME_T, &tmLookup);
+            curl_easy_getinfo(pMsg->easy_handle, CURLINFO_APPCONNECT_TIME_T, &tmConnected);
+            vConnectUs[ iEasy - vEasy.begin() ] = (int64_t)(tmConnected - tmLookup);
+        }
+    }
+
+    for (CURL* pEasy : vEasy)
+    {
+        if (pEasy)
+        {
+            curl_multi_remove_handle(pMulti, pEasy);
+            curl_easy_cleanup(pEasy);
+        }
+    }
+
+    curl_multi_cleanup(pMulti);
+    curl_global_cleanup();
+
+    return vConnectUs;
+}
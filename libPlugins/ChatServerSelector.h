@@ -0,0 +1,136 @@
+/*
+ * Copyright (c) 2013-2021 MFCXY, Inc. <mfcxy@mfcxy.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#pragma once
+
+#ifndef CHAT_SERVER_SELECTOR_H_
+#define CHAT_SERVER_SELECTOR_H_
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "Executor.h"
+
+#ifndef DEFAULT_CHAT_SERVER
+#define DEFAULT_CHAT_SERVER         "xchat100"
+#endif
+
+#define SERVERCONFIG_URL            "https://assets.mfcimg.com/_js/serverconfig.js"
+#define SERVERCONFIG_CACHE_FILE     "serverconfig.json"
+
+// Picks the FCS chat server for EdgeChatSock.
+//
+// The websocket_servers list from serverconfig.js is cached on disk and only
+// revalidated (If-None-Match / If-Modified-Since) once the cache is older than the
+// config TTL. A random sample of the servers is then probed concurrently by timing
+// a TCP+TLS connect to each, and the healthy ones are kept ranked by that time.
+// The ranking is refreshed in the background (a Bulk task on CExecutor) once it is
+// older than the refresh interval, and warmed the same way at module load. Nothing
+// ever waits on the network in pickServer(): until the first ranking is in it
+// returns DEFAULT_CHAT_SERVER.
+//
+// pickServer() returns a server from the fastest few (anything within
+// PICK_SPREAD_US of the best) so clients with similar latency don't all pile onto
+// one server. reportFailure() takes a server out of rotation until the next refresh.
+//
+// setServerList() and setProbe() replace serverconfig.js and the network probe,
+// which lets the selection logic run against a stub server set offline.
+//
+class CChatServerSelector
+{
+public:
+    static const int        PROBE_SAMPLE        = 16;           // servers probed per refresh
+    static const int        PROBE_TIMEOUT_MS    = 1500;
+    static const int64_t    PICK_SPREAD_US      = 10000;
+
+    struct Candidate
+    {
+        std::string     sName;          // e.g. xchat42
+        int64_t         nConnectUs;     // last probed connect time, -1 if the probe failed
+        bool            bHealthy;
+    };
+
+    // Returns the connect time in microseconds for each server name, -1 where it failed.
+    typedef std::function< std::vector< int64_t > (const std::vector< std::string >& vServers, int nTimeoutMs) > ProbeFn;
+
+    static CChatServerSelector& instance(void);
+
+    ~CChatServerSelector();
+
+    // Best healthy server name, DEFAULT_CHAT_SERVER while there is no ranking yet.
+    // Never blocks, a missing or stale ranking kicks off a background refresh.
+    std::string pickServer(void);
+
+    // Take sName out of rotation, e.g. after we failed to connect to it.
+    void reportFailure(const std::string& sName);
+
+    // Reload the server list and re-probe. With bWait false it runs in the background.
+    void refresh(bool bWait);
+
+    // Replace serverconfig.js with a fixed server list, empty to go back to it.
+    void setServerList(const std::vector< std::string >& vServers);
+
+    // Replace the network probe, nullptr to go back to connectProbe().
+    void setProbe(ProbeFn fnProbe);
+
+    void setIntervals(std::chrono::seconds configTtl, std::chrono::seconds refreshInterval);
+
+    // Waits for any background refresh to finish, no more refreshes after this.
+    void stop(void);
+
+    std::vector< Candidate > getRanking(void) const;
+
+    static std::string hostName(const std::string& sName) { return sName + ".myfreecams.com"; }
+
+    // Default probe, times a TCP+TLS connect to port 443 of every server at once
+    static std::vector< int64_t > connectProbe(const std::vector< std::string >& vServers, int nTimeoutMs);
+
+private:
+    CChatServerSelector();
+    CChatServerSelector(const CChatServerSelector&) = delete;
+    CChatServerSelector& operator=(const CChatServerSelector&) = delete;
+
+    typedef std::chrono::steady_clock Clock;
+
+    void doRefresh(void);
+    bool loadServerList(std::vector< std::string >& vServers);
+    bool readCache(std::vector< std::string >& vServers, std::string& sETag, std::string& sLastModified, int64_t& nFetched);
+    void writeCache(const std::vector< std::string >& vServers, const std::string& sETag, const std::string& sLastModified);
+
+    static bool parseServerConfig(const char* pszData, std::vector< std::string >& vServers);
+
+    mutable std::mutex              m_mutex;            // protects everything below
+    std::vector< Candidate >        m_ranking;          // healthy first, fastest first
+    std::vector< std::string >      m_vStubServers;
+    ProbeFn                         m_fnProbe;
+    Clock::time_point               m_tmRanked;
+    std::chrono::seconds            m_configTtl;
+    std::chrono::seconds            m_refreshInterval;
+    bool                            m_bRefreshing;
+    bool                            m_bStopped;
+    std::condition_variable         m_cvDone;           // background refresh finished
+    CCancelToken                    m_cancel;           // cancelled by stop()
+
+    std::mutex                      m_refreshMutex;     // one refresh at a time
+};
+
+#endif  // CHAT_SERVER_SELECTOR_H_
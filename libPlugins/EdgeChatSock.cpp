@@ -26,7 +26,6 @@
 #include <chrono>
 #include <iostream>
 #include <iterator>
-#include <random>
 #include <thread>
 
 // obs
@@ -34,11 +33,12 @@
 #include <obs-frontend-api.h>
 
 // solution
-#include <libPlugins/HttpRequest.h>
+#include <libPlugins/ChatServerSelector.h>
 #include <libPlugins/ObsUtil.h>
 #include <libPlugins/ObsServicesJson.h>
 #include <libfcs/Log.h>
 #include <libfcs/MfcJson.h>
+#include <libfcs/MfcTrace.h>
 #include <libfcs/fcs.h>
 #include <libfcs/FcMsg.h>
 #include <ObsBroadcast/ObsBroadcast.h>
@@ -47,9 +47,6 @@
 #include "EdgeChatSock.h"
 #include "CollectSystemInfo.h"
 
-#include <nlohmann/json.hpp>
-
-using njson = nlohmann::json;
 using std::string;
 
 std::unique_ptr<FcsWebsocket> proxy_createFcsWebsocket(void);
@@ -68,11 +65,14 @@ EdgeChatSock::EdgeChatSock()
     , m_updatesSent(0)
     , m_modelId(0)
     , m_modelState(SkUninitialized)
-    , m_retryConnect(false)
+    , m_timerId(CTimerWheel::INVALID_TIMER)
+    , m_connectFailures(0)
     , m_edgeConnected(false)
     , m_edgeLoggedIn(false)
     , m_virtualCameraActive(false)
-{}
+{
+    startTimer();
+}
 
 
 EdgeChatSock::EdgeChatSock(const string& sUser, uint32_t dwModelId, const string& sToken, const string& sUrl)
@@ -81,11 +81,14 @@ EdgeChatSock::EdgeChatSock(const string& sUser, uint32_t dwModelId, const string
     , m_updatesSent(0)
     , m_modelId(dwModelId)
     , m_modelState(SkUninitialized)
-    , m_retryConnect(false)
+    , m_timerId(CTimerWheel::INVALID_TIMER)
+    , m_connectFailures(0)
     , m_edgeConnected(false)
     , m_edgeLoggedIn(false)
     , m_virtualCameraActive(false)
 {
+    startTimer();
+
     if ( ! start(sUser, sToken, sUrl) )
     {
         _MESG(  "unable to start EdgeChatSock to %s",
@@ -97,16 +100,27 @@ EdgeChatSock::EdgeChatSock(const string& sUser, uint32_t dwModelId, const string
 EdgeChatSock::~EdgeChatSock()
 {
     obs_info(__FUNCTION__);
+    CTimerWheel::instance().cancel(m_timerId);
     stop();
 }
 
 
+void EdgeChatSock::startTimer(void)
+{
+    // On the UI thread, like the rest of the socket's start/stop calls. The first
+    // reconnect attempt is 3 seconds out, the same as after a failed connect.
+    m_sinceConnect.Start();
+    m_timerId = CTimerWheel::instance().addPeriodic(1000, [this]() { onTimerEvent(); },
+                                                    CTimerWheel::UiThread, 0, "edgeChatSock");
+}
+
+
 bool EdgeChatSock::start(const string& sUser, const string& sToken, const string& sUrl)
 {
     bool retVal = false;
 
     stop();  // Stop just in case
-    m_retryConnect = 0;
+    m_sinceConnect.Start();
 
     if ((m_edgeClient = proxy_createFcsWebsocket()) != nullptr)
     {
@@ -130,27 +144,33 @@ bool EdgeChatSock::start(const string& sUser, const string& sToken, const string
 }
 
 
-void EdgeChatSock::onTimerEvent(size_t pulseCx)
+void EdgeChatSock::onTimerEvent(void)
 {
-    // we're called every ~250ms, so retryCount >= 12 = >= 3 seconds
     if (!m_edgeConnected)
     {
-        if (++m_retryConnect >= 12)
+        if (m_sinceConnect.ElapsedMs() >= 3000)
         {
-            // start will reset m_retryConnect as well as call stop for us
+            // If we're on a chatserver picked from serverconfig and keep failing to get
+            // through to it, take it out of rotation and move on to the next best one
+            string sServer = FcsServerName(m_serverUrl);
+            if (!sServer.empty() && ++m_connectFailures >= MAX_CONNECT_FAILURES)
+            {
+                _MESG("giving up on chat server %s after %d reconnects", sServer.c_str(), m_connectFailures);
+                CChatServerSelector::instance().reportFailure(sServer);
+                m_serverUrl = FcsServerUrl(FcsServer());
+                m_connectFailures = 0;
+            }
+
+            // start will restart m_sinceConnect as well as call stop for us
             start(m_username, m_authToken, m_serverUrl);
         }
     }
     else if (m_edgeClient)
     {
-        // Every 5 seconds (approx) when connected
-        if ((pulseCx % 3) == 0)
+        if (m_sincePing.ElapsedMs() >= 5000)
         {
-            if (m_sincePing.Stop() > 5)
-            {
-                m_edgeClient->send( FcMsg::textMsg(true, FCTYPE_NULL, 0, 0, 0, 0, 0, nullptr) );
-                m_sincePing.Start();
-            }
+            m_edgeClient->send( FcMsg::textMsg(true, FCTYPE_NULL, 0, 0, 0, 0, 0, nullptr) );
+            m_sincePing.Start();
         }
     }
 }
@@ -173,11 +193,12 @@ bool EdgeChatSock::stop()
 void EdgeChatSock::onConnected(void)
 {
     //obs_debug("EdgeChatSock::onConnected");
-    m_edgeConnected = true;
-    m_edgeLoggedIn  = false;
-    m_retryConnect  = 0;
-    m_sessionId     = 0;
-    m_modelState    = g_ctx.activeState;
+    m_edgeConnected     = true;
+    m_edgeLoggedIn      = false;
+    m_connectFailures   = 0;
+    m_sinceConnect.Start();
+    m_sessionId         = 0;
+    m_modelState        = g_ctx.activeState;
 
     // send version/login banner
     if (m_edgeClient->send( stdprintf("fcsws_%d", DEFAULT_WEBSOCK_VERSION) ) )
@@ -200,7 +221,7 @@ void EdgeChatSock::onDisconnected(void)
     m_edgeLoggedIn          = false;
     m_virtualCameraActive   = false;
     m_sessionId             = 0;
-    m_retryConnect          = 0;
+    m_sinceConnect.Start();
     m_modelState            = g_ctx.activeState;
 }
 
@@ -269,12 +290,14 @@ bool EdgeChatSock::preDisconnect(bool wait)
 
 void EdgeChatSock::onMsg(string& sMsg)
 {
+    MFC_TRACE_SPAN(span, "edge", "EdgeChatSock::onMsg");
     uint32_t dwResp = FCRESPONSE_UNKNOWN;
     MfcJsonObj js(JSON_T_NONE), jsResp;
     FcMsg msg;
 
     if (msg.readFromText(m_partialFrame, sMsg, &js))
     {
+        span.SetArg("type", msg.dwType);
         switch (msg.dwType)
         {
         case FCTYPE_LOGIN:
@@ -412,7 +435,7 @@ uint32_t EdgeChatSock::onAgentQuery_request(FcMsg& msg, MfcJsonObj& jsData, MfcJ
             {
                 if (g_ctx.activeState == SkStreamStopped)
                 {
-                    string sNewKey = g_ctx.cfg.getString("ctx");
+                    string sNewKey = g_ctx.cfg.getString(SkCfg::Ctx);
                     string sEncKey;
 
                     if (sNewKey.size() > 10 && sNewKey.at(10) == '/')
@@ -600,64 +623,32 @@ void EdgeChatSock::onSessionState(FcMsg& msg, MfcJsonObj& jsData)
 }
 
 
-// Produces random integers uniformly distributed on the interval [min, max]
-int randomInt(int min, int max)
+// static
+std::string EdgeChatSock::FcsServer()
 {
-    std::random_device rd;                              // obtain a random number from hardware
-    std::mt19937 gen(rd());                             // seed the generator
-    std::uniform_int_distribution<> distr(min, max);    // define the range
-    return distr(gen);
+    return CChatServerSelector::instance().pickServer();
 }
 
 
 // static
-std::string EdgeChatSock::FcsServer()
+std::string EdgeChatSock::FcsServerUrl(const string& sServer)
 {
-    unsigned int dwLen = 0;
-    const string serverConfigUrl("https://assets.mfcimg.com/_js/serverconfig.js");
-    string server = "";
+    return "wss://" + CChatServerSelector::hostName(sServer) + "/fcsl";
+}
 
-    try
-    {
-        CCurlHttpRequest httpreq;
-        uint8_t* pResponse = httpreq.Get(serverConfigUrl, &dwLen);
-        if (pResponse != nullptr)
-        {
-            njson res = njson::parse((char*)pResponse, nullptr, false);
-            free(pResponse);
-            pResponse = nullptr;
-            if (res.is_discarded())
-            {
-                _MESG("Error parsing serverconfig");
-                return "xchat100";
-            }
-            njson wsServers = res["websocket_servers"];
-            std::vector<string> servers;
-            for (const auto& it: wsServers.items())
-            {
-                servers.push_back(it.key());
-            }
 
-            server = servers[randomInt(0, (int)servers.size() - 1)];
-        }
-    }
-    catch (const std::exception& e)
-    {
-        _MESG("Error fetching chat server: %s", e.what());
-        server = "xchat100";
-    }
-    catch (const string& e)
-    {
-        _MESG("Error fetching chat server: %s", e.c_str());
-        server = "xchat100";
-    }
-    catch (...)
+// static
+std::string EdgeChatSock::FcsServerName(const string& sUrl)
+{
+    const string sPrefix("wss://"), sSuffix(CChatServerSelector::hostName("") + "/fcsl");
+
+    if (sUrl.size() > sPrefix.size() + sSuffix.size()
+    &&  sUrl.compare(0, sPrefix.size(), sPrefix) == 0
+    &&  sUrl.compare(sUrl.size() - sSuffix.size(), sSuffix.size(), sSuffix) == 0)
     {
-        _MESG("Error fetching chat server");
-        server = "xchat100";
+        return sUrl.substr(sPrefix.size(), sUrl.size() - sPrefix.size() - sSuffix.size());
     }
-
-    return server;
+    return "";
 }
 
 #if 0
@@ -34,6 +34,7 @@
 #include <libfcs/FcMsg.h>
 #include <libfcs/MfcTimer.h>
 #include <ObsBroadcast/SidekickTypes.h>
+#include <libPlugins/TimerWheel.h>
 #include <websocket-client/FcsWebsocket.h>
 
 #ifndef DEFAULT_EDGECHAT_SERVER
@@ -46,12 +47,17 @@ typedef SidekickActiveState ModelState;
 class EdgeChatSock : public FcsWebsocket::FcsListener
 {
 public:
+    // Failed reconnects in a row before the chat server is reported and replaced,
+    // fewer could just be our own network dropping out for a few seconds
+    static const int MAX_CONNECT_FAILURES = 5;
+
     EdgeChatSock();
     EdgeChatSock(const std::string& sUser, uint32_t dwModelId, const std::string& sToken, const std::string& sUrl);
 
     ~EdgeChatSock() override;
 
-    void onTimerEvent(size_t pulseCx);
+    void startTimer(void);
+    void onTimerEvent(void);
     bool start(const std::string& sUser, const std::string& sToken, const std::string& sUrl);
     bool stop();
 
@@ -76,9 +82,13 @@ public:
     void onAgentUpdate(MfcJsonObj& jsData);
     void onAgentJoin(uint32_t dwOp, MfcJsonObj& jsData);
 
-    // Randomly selects an active FCS chatserver from serverconfig.js
+    // Picks a low latency, healthy FCS chatserver from serverconfig.js (see CChatServerSelector)
     static std::string FcsServer();
 
+    // websocket url for an FCS chatserver name, and the reverse (empty if sUrl isn't one)
+    static std::string FcsServerUrl(const std::string& sServer);
+    static std::string FcsServerName(const std::string& sUrl);
+
     static uint32_t addErrMsg(MfcJsonObj& js, uint32_t dwErr)
     {
         js.objectAdd("_err", dwErr);
@@ -122,11 +132,13 @@ public:
     uint32_t        m_modelId;
     ModelState      m_modelState;
 
-    size_t          m_retryConnect;
+    CTimerWheel::TimerId m_timerId; // periodic onTimerEvent() on the UI thread
+    int             m_connectFailures;  // reconnect attempts on m_serverUrl since we were last connected
     bool            m_edgeConnected;
     bool            m_edgeLoggedIn;
     bool            m_virtualCameraActive;
 
+    MfcTimer        m_sinceConnect; // last connect attempt or disconnect, for the reconnect backoff
     MfcTimer        m_sincePing;
 };
 
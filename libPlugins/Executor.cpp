@@ -0,0 +1,326 @@
+/*
+ * Copyright (c) 2013-2021 MFCXY, Inc. <mfcxy@mfcxy.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+// System Includes
+#include <algorithm>
+
+// solution includes
+#include <libfcs/Log.h>
+#include <libfcs/MfcTimer.h>
+#include <libfcs/MfcTrace.h>
+
+// project includes
+#include "Executor.h"
+
+using std::lock_guard;
+using std::unique_lock;
+using std::mutex;
+
+// Worker the current thread is, if it is one
+static thread_local CExecutor*  s_pOwner    = nullptr;
+static thread_local size_t      s_nWorker   = 0;
+
+
+static void updateMax(std::atomic< int64_t >& nMax, int64_t nVal)
+{
+    int64_t nCur = nMax.load(std::memory_order_relaxed);
+    while (nVal > nCur && !nMax.compare_exchange_weak(nCur, nVal, std::memory_order_relaxed))
+        ;
+}
+
+
+CExecutor& CExecutor::instance(void)
+{
+    static CExecutor s_executor;
+    return s_executor;
+}
+
+
+CExecutor::CExecutor()
+    : m_nBulkLimit(1)
+    , m_bStarted(false)
+    , m_bStop(false)
+    , m_nNext(0)
+    , m_nSubmitting(0)
+    , m_nIdle(0)
+    , m_nBulkRunning(0)
+    , m_nSubmitted(0)
+    , m_nExecuted(0)
+    , m_nCancelled(0)
+    , m_nStolen(0)
+    , m_nInlined(0)
+    , m_nMaxDepth(0)
+{
+    for (size_t n = 0; n < MAX_PRIORITY; n++)
+    {
+        m_nDepth[n] = 0;
+        m_nWaitSumNs[n] = 0;
+        m_nWaitMaxNs[n] = 0;
+        m_nStarted[n] = 0;
+    }
+}
+
+
+CExecutor::~CExecutor()
+{
+    stop();
+}
+
+
+void CExecutor::start(void)
+{
+    lock_guard< mutex > lk(m_startMutex);
+    if (m_bStarted || m_bStop)
+        return;
+
+    size_t nWorkers = std::thread::hardware_concurrency() / 2;
+    nWorkers = std::min(std::max(nWorkers, (size_t)2), MAX_WORKERS);
+    m_nBulkLimit = nWorkers - 1;
+
+    for (size_t n = 0; n < nWorkers; n++)
+        m_workers.emplace_back(new Worker);
+    for (size_t n = 0; n < nWorkers; n++)
+        m_workers[n]->thread = std::thread(&CExecutor::run, this, n);
+
+    _TRACE("Executor started with %zu workers", nWorkers);
+    m_bStarted.store(true, std::memory_order_release);
+}
+
+
+bool CExecutor::submit(Task fn, Priority priority, const CCancelToken& token)
+{
+    if (!fn)
+        return false;
+    if (priority < 0 || priority >= MAX_PRIORITY)
+        priority = Bulk;
+
+    if (!m_bStarted.load(std::memory_order_acquire))
+        start();
+
+    // m_nSubmitting keeps stop() from joining the workers while we're between the
+    // check of m_bStop and the push
+    m_nSubmitting++;
+    if (m_bStop.load())
+    {
+        m_nSubmitting--;
+        m_nInlined++;
+        if (!token.isCancelled())
+            fn();
+        return false;
+    }
+
+    size_t nWorker = s_pOwner == this ? s_nWorker : m_nNext++ % m_workers.size();
+    Item item{ std::move(fn), token, (int64_t)MfcTimer::MonoNs(), nWorker };
+
+    // counted before the push, so a task is never taken before it's counted
+    size_t nDepth = ++m_nDepth[priority] + m_nDepth[priority == Latency ? Bulk : Latency].load();
+    {
+        lock_guard< mutex > lk(m_workers[nWorker]->mutex);
+        m_workers[nWorker]->queue[priority].push_back(std::move(item));
+    }
+    m_nSubmitted++;
+    m_nSubmitting--;
+
+    size_t nMax = m_nMaxDepth.load(std::memory_order_relaxed);
+    while (nDepth > nMax && !m_nMaxDepth.compare_exchange_weak(nMax, nDepth, std::memory_order_relaxed))
+        ;
+
+    if (m_nIdle.load() > 0)
+    {
+        lock_guard< mutex > lk(m_parkMutex);
+        m_cvPark.notify_one();
+    }
+    return true;
+}
+
+
+void CExecutor::stop(void)
+{
+    {
+        lock_guard< mutex > lk(m_startMutex);
+        if (m_bStop)
+            return;
+        m_bStop = true;
+    }
+
+    // let a submit() that got past the m_bStop check finish its push
+    while (m_nSubmitting.load() > 0)
+        std::this_thread::yield();
+
+    {
+        lock_guard< mutex > lk(m_parkMutex);
+        m_cvPark.notify_all();
+    }
+
+    // workers drain the queues before they exit
+    for (auto& pWorker : m_workers)
+    {
+        if (pWorker->thread.joinable() && pWorker->thread.get_id() != std::this_thread::get_id())
+            pWorker->thread.join();
+    }
+}
+
+
+bool CExecutor::runnable(void) const
+{
+    if (m_nDepth[Latency].load() > 0)
+        return true;
+    return m_nDepth[Bulk].load() > 0 && (m_bStop.load() || m_nBulkRunning.load() < m_nBulkLimit);
+}
+
+
+// Next task for nWorker: Latency before Bulk, own deque (oldest first) before
+// stealing from the others (newest first)
+bool CExecutor::take(size_t nWorker, Item& item, Priority& priority)
+{
+    size_t nWorkers = m_workers.size();
+
+    for (int nPri = Latency; nPri < MAX_PRIORITY; nPri++)
+    {
+        if (m_nDepth[nPri].load() == 0)
+            continue;
+
+        // reserve a Bulk slot first so two workers can't both take the last one
+        bool fReserved = false;
+        if (nPri == Bulk)
+        {
+            size_t nRunning = m_nBulkRunning.load();
+            while (!fReserved && (nRunning < m_nBulkLimit || m_bStop.load()))
+                fReserved = m_nBulkRunning.compare_exchange_weak(nRunning, nRunning + 1);
+
+            if (!fReserved)
+                continue;
+        }
+
+        for (size_t n = 0; n < nWorkers; n++)
+        {
+            Worker& worker = *m_workers[(nWorker + n) % nWorkers];
+            lock_guard< mutex > lk(worker.mutex);
+            std::deque< Item >& queue = worker.queue[nPri];
+
+            if (queue.empty())
+                continue;
+
+            if (n == 0)
+            {
+                item = std::move(queue.front());
+                queue.pop_front();
+            }
+            else
+            {
+                item = std::move(queue.back());
+                queue.pop_back();
+                m_nStolen++;
+            }
+
+            m_nDepth[nPri]--;
+            priority = (Priority)nPri;
+            return true;
+        }
+
+        if (fReserved)
+            m_nBulkRunning--;
+    }
+
+    return false;
+}
+
+
+void CExecutor::execute(Item& item, Priority priority)
+{
+    if (item.token.isCancelled())
+        m_nCancelled++;
+    else
+    {
+        int64_t nWaitNs = (int64_t)MfcTimer::MonoNs() - item.nQueuedNs;
+        m_nWaitSumNs[priority] += nWaitNs;
+        updateMax(m_nWaitMaxNs[priority], nWaitNs);
+        m_nStarted[priority]++;
+
+        MFC_TRACE_SCOPE("executor", priority == Latency ? "latency" : "bulk");
+        item.fn();
+        m_nExecuted++;
+    }
+    item.fn = nullptr;
+
+    if (priority == Bulk)
+    {
+        // a Bulk task may have been waiting on this slot
+        m_nBulkRunning--;
+        if (m_nDepth[Bulk].load() > 0 && m_nIdle.load() > 0)
+        {
+            lock_guard< mutex > lk(m_parkMutex);
+            m_cvPark.notify_one();
+        }
+    }
+}
+
+
+void CExecutor::run(size_t nWorker)
+{
+    s_pOwner = this;
+    s_nWorker = nWorker;
+    MfcTrace::SetThreadName("worker");
+
+    while (true)
+    {
+        Item item;
+        Priority priority;
+
+        if (take(nWorker, item, priority))
+        {
+            execute(item, priority);
+            continue;
+        }
+
+        unique_lock< mutex > lk(m_parkMutex);
+        m_nIdle++;
+        if (!runnable())
+        {
+            if (m_bStop.load())
+            {
+                m_nIdle--;
+                break;
+            }
+            m_cvPark.wait(lk);
+        }
+        m_nIdle--;
+    }
+
+    s_pOwner = nullptr;
+}
+
+
+CExecutor::Stats CExecutor::getStats(void) const
+{
+    Stats stats;
+    stats.submitted     = m_nSubmitted.load();
+    stats.executed      = m_nExecuted.load();
+    stats.cancelled     = m_nCancelled.load();
+    stats.stolen        = m_nStolen.load();
+    stats.inlined       = m_nInlined.load();
+    stats.depth         = m_nDepth[Latency].load() + m_nDepth[Bulk].load();
+    stats.maxDepth      = m_nMaxDepth.load();
+    stats.workers       = m_workers.size();
+
+    for (size_t n = 0; n < MAX_PRIORITY; n++)
+    {
+        uint64_t nStarted = m_nStarted[n].load();
+        stats.avgWaitUs[n] = nStarted ? (m_nWaitSumNs[n].load() / (int64_t)nStarted) / 1000 : 0;
+        stats.maxWaitUs[n] = m_nWaitMaxNs[n].load() / 1000;
+    }
+    return stats;
+}
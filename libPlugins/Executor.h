@@ -0,0 +1,162 @@
+/*
+ * Copyright (c) 2013-2021 MFCXY, Inc. <mfcxy@mfcxy.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#pragma once
+
+#ifndef EXECUTOR_H_
+#define EXECUTOR_H_
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Shared flag a caller flips to abandon work it handed off. Copies share the flag, a
+// default constructed token is never cancelled.
+class CCancelToken
+{
+public:
+    CCancelToken() {}
+
+    static CCancelToken create(void)
+    {
+        CCancelToken token;
+        token.m_pFlag = std::make_shared< std::atomic< bool > >(false);
+        return token;
+    }
+
+    void cancel(void) const                 { if (m_pFlag) m_pFlag->store(true, std::memory_order_release); }
+    bool isCancelled(void) const            { return m_pFlag && m_pFlag->load(std::memory_order_acquire); }
+
+private:
+    std::shared_ptr< std::atomic< bool > >  m_pFlag;
+};
+
+
+// Worker pool for the plugin's background work, instead of a thread per subsystem.
+//
+// A fixed set of workers (half the cores, 2 to MAX_WORKERS), started on the first
+// submit(). Each worker owns a deque per priority; a task submitted from a worker goes
+// on that worker's deque, anything else is spread round robin. A worker takes the
+// oldest task from its own deques and, once those are empty, steals the newest from
+// another worker's, so a burst submitted to one worker is picked up by the rest.
+//
+// Latency tasks are always taken before Bulk ones, and Bulk tasks may only occupy
+// all but one worker, so a slow probe or disk write can't hold up a latency task for
+// longer than it takes one to finish. Idle workers sleep until something is queued.
+//
+// A task submitted with a cancel token is dropped if the token is cancelled before
+// the task starts; a running task can poll the token itself.
+//
+class CExecutor
+{
+public:
+    static const size_t     MAX_WORKERS         = 4;
+
+    typedef std::function< void(void) > Task;
+
+    enum Priority
+    {
+        Latency         = 0,        // user visible or on a deadline, keep them short
+        Bulk,                       // probes, reports, disk writes
+        MAX_PRIORITY
+    };
+
+    struct Stats
+    {
+        uint64_t        submitted;
+        uint64_t        executed;
+        uint64_t        cancelled;              // dropped before they started
+        uint64_t        stolen;                 // run by a worker other than the one they were queued on
+        uint64_t        inlined;                // run on the caller because the pool was stopped
+        size_t          depth;                  // tasks queued right now
+        size_t          maxDepth;
+        size_t          workers;
+        int64_t         avgWaitUs[ MAX_PRIORITY ];  // queued to started
+        int64_t         maxWaitUs[ MAX_PRIORITY ];
+    };
+
+    static CExecutor& instance(void);
+
+    ~CExecutor();
+
+    // Queues fn to run on a worker. After stop() it runs on the caller instead and
+    // false is returned.
+    bool submit(Task fn, Priority priority = Bulk, const CCancelToken& token = CCancelToken());
+
+    // Runs everything still queued and joins the workers. Later submits run inline.
+    void stop(void);
+
+    Stats getStats(void) const;
+
+private:
+    struct Item
+    {
+        Task            fn;
+        CCancelToken    token;
+        int64_t         nQueuedNs;
+        size_t          nWorker;                // deque it was queued on
+    };
+
+    struct Worker
+    {
+        std::mutex          mutex;              // protects the deques
+        std::deque< Item >  queue[ MAX_PRIORITY ];
+        std::thread         thread;
+    };
+
+    CExecutor();
+    CExecutor(const CExecutor&) = delete;
+    CExecutor& operator=(const CExecutor&) = delete;
+
+    void start(void);
+    void run(size_t nWorker);
+    bool take(size_t nWorker, Item& item, Priority& priority);
+    bool runnable(void) const;
+    void execute(Item& item, Priority priority);
+
+    std::vector< std::unique_ptr< Worker > >    m_workers;
+    size_t                                      m_nBulkLimit;   // workers Bulk tasks may occupy at once
+
+    std::mutex                                  m_startMutex;   // start() and stop()
+    std::atomic< bool >                         m_bStarted;
+    std::atomic< bool >                         m_bStop;
+    std::atomic< size_t >                       m_nNext;        // round robin for outside submitters
+    std::atomic< size_t >                       m_nSubmitting;  // submit() calls between the m_bStop check and the push
+
+    std::mutex                                  m_parkMutex;
+    std::condition_variable                     m_cvPark;
+    std::atomic< size_t >                       m_nIdle;
+    std::atomic< size_t >                       m_nDepth[ MAX_PRIORITY ];
+    std::atomic< size_t >                       m_nBulkRunning;
+
+    std::atomic< uint64_t >                     m_nSubmitted;
+    std::atomic< uint64_t >                     m_nExecuted;
+    std::atomic< uint64_t >                     m_nCancelled;
+    std::atomic< uint64_t >                     m_nStolen;
+    std::atomic< uint64_t >                     m_nInlined;
+    std::atomic< size_t >                       m_nMaxDepth;
+    std::atomic< int64_t >                      m_nWaitSumNs[ MAX_PRIORITY ];
+    std::atomic< int64_t >                      m_nWaitMaxNs[ MAX_PRIORITY ];
+    std::atomic< uint64_t >                     m_nStarted[ MAX_PRIORITY ];
+};
+
+#endif  // EXECUTOR_H_
@@ -286,6 +286,123 @@ uint8_t* CCurlHttpRequest::Get(const string& sUrl)
 }
 
 
+/// Header callback for GetConditional(), picks the validators out of the response headers.
+static size_t header_validators(char* buffer, size_t size, size_t nitems, void* pUser)
+{
+    size_t realsize = size * nitems;
+    std::pair<string, string>* pValidators = reinterpret_cast<std::pair<string, string>*>(pUser);
+    string sLine(buffer, realsize);
+    size_t nColon = sLine.find(':');
+
+    if (nColon != string::npos)
+    {
+        string sName = sLine.substr(0, nColon);
+        string sValue = sLine.substr(nColon + 1);
+        sValue.erase(0, sValue.find_first_not_of(" \t"));
+        sValue.erase(sValue.find_last_not_of(" \t\r\n") + 1);
+
+        for (auto& ch : sName)
+            ch = (char)tolower((unsigned char)ch);
+
+        if (sName == "etag")
+            pValidators->first = sValue;
+        else if (sName == "last-modified")
+            pValidators->second = sValue;
+    }
+    return realsize;
+}
+
+/// HTTP GET request revalidating a cached copy
+/// @return pointer to response, nullptr on error or if the server replied 304
+uint8_t* CCurlHttpRequest::GetConditional(const string& sUrl, string& sETag, string& sLastModified,
+                                          long* pnStatus, unsigned int* pSize, PROGRESS_CALLBACK pfnProgress)
+{
+    CURL* curl;
+    CURLcode res;
+    CWriteBackBuffer buf;
+    uint8_t* pResponse = nullptr;
+    char pErrorBuffer[CURL_ERROR_SIZE + 1] = { '\0' };
+    std::pair<string, string> validators;
+    long nStatus = 0;
+
+    curl_global_init(CURL_GLOBAL_ALL);
+
+    curl = curl_easy_init();
+    if (curl)
+    {
+        struct curl_slist* headers = nullptr;
+        if (! sETag.empty())
+            headers = curl_slist_append(headers, ("If-None-Match: " + sETag).c_str());
+        if (! sLastModified.empty())
+            headers = curl_slist_append(headers, ("If-Modified-Since: " + sLastModified).c_str());
+
+        curl_easy_setopt(curl, CURLOPT_URL, sUrl.c_str());
+        curl_easy_setopt(curl, CURLOPT_HTTPGET, 1);
+        if (headers)
+            curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
+
+        curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, write_data);
+        curl_easy_setopt(curl, CURLOPT_WRITEDATA, &buf);
+        curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION, header_validators);
+        curl_easy_setopt(curl, CURLOPT_HEADERDATA, &validators);
+
+        // Some servers don't like requests that are made without a user-agent field.
+        curl_easy_setopt(curl, CURLOPT_USERAGENT, "curl/7.73.0");
+
+        if (pfnProgress)
+        {
+            curl_easy_setopt(curl, CURLOPT_XFERINFOFUNCTION, pfnProgress);
+            curl_easy_setopt(curl, CURLOPT_NOPROGRESS, 0);
+        }
+
+        curl_easy_setopt(curl, CURLOPT_ERRORBUFFER, pErrorBuffer);
+        curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1L);
+
+        res = curl_easy_perform(curl);
+        if (res == CURLE_OK)
+            curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &nStatus);
+
+        if (res != CURLE_OK || nStatus != 200)
+        {
+            if (res != CURLE_OK)
+            {
+                // Both error messages are useful.
+                string sE = curl_easy_strerror(res);
+                sE += "/";
+                sE += pErrorBuffer;
+                _TRACE("curl_easy_perform() failed: %s\n", sE.c_str());
+                setResultString(sE.c_str());
+            }
+            if (nullptr != buf.getBuffer())
+                free(buf.getBuffer());
+            if (nullptr != pSize)
+                *pSize = 0;
+        }
+        else
+        {
+            pResponse = buf.getBuffer();
+            if (nullptr != pSize)
+                *pSize = (unsigned int)buf.getSize();
+        }
+
+        // a 304 may or may not repeat the validators, keep the old ones if not
+        if (! validators.first.empty())
+            sETag = validators.first;
+        if (! validators.second.empty())
+            sLastModified = validators.second;
+
+        setResult(res);
+        curl_slist_free_all(headers);
+        curl_easy_cleanup(curl);
+    }
+    curl_global_cleanup();
+
+    if (nullptr != pnStatus)
+        *pnStatus = nStatus;
+    return pResponse;
+}
+
+
 /// Return the result code from the last HTTP request.
 int CCurlHttpRequest::getResult() { return m_nResult; }
 void CCurlHttpRequest::setResult(int n) { m_nResult = n; }
@@ -70,6 +70,12 @@ public:
     uint8_t* Get(const std::string& sUrl, unsigned int* pSize);
     uint8_t* Get(const std::string& sUrl);
 
+    /// HTTP GET request revalidating a cached copy. Sends If-None-Match / If-Modified-Since
+    /// when sETag / sLastModified are set and updates them from the response headers.
+    /// *pnStatus gets the HTTP status, 304 means the cached copy is still current.
+    uint8_t* GetConditional(const std::string& sUrl, std::string& sETag, std::string& sLastModified,
+                            long* pnStatus, unsigned int* pSize, PROGRESS_CALLBACK pfnProgress);
+
     /// Result code from the last HTTP request.
     int getResult() override;
     void setResult(int n) override;
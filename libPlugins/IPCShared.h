@@ -24,19 +24,35 @@
 #define WIN32_LEAN_AND_MEAN
 #endif
 #include <Windows.h>
+#elif defined(__linux__)
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#else
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/stat.h>
+#include <unistd.h>
 #endif
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cctype>
+#include <cstdarg>
+#include <cstdint>
+#include <cstring>
+#include <mutex>
 #include <string>
 #include <cstdlib>
 #include <ctime>
 
-#include <boost/interprocess/allocators/allocator.hpp>
-#include <boost/interprocess/containers/list.hpp>
 #include <boost/interprocess/managed_shared_memory.hpp>
-#include <boost/interprocess/sync/interprocess_semaphore.hpp>
 #include <boost/interprocess/sync/interprocess_mutex.hpp>
 #include <boost/algorithm/string.hpp>
 #include <boost/thread/lock_guard.hpp>
+#include <boost/date_time/posix_time/posix_time.hpp>
 //#include <boost/thread/thread.hpp>
 
 #define BUF_SIZE                        1024
@@ -44,11 +60,9 @@
 
 // names of shared memory objects.
 #define SHARED_MEMNAME                  "MFCSharedMemoryYYXX"
-#define CONTAINER_NAME                  "MyBoostList"
+#define SHARED_MEMSIZE                  (256 * 1024)
+#define RING_TABLE_NAME                 "fcsRingTable"
 #define MFC_SEMA_NAME                   "fcsSEMA"
-#define MFC_CLIENT_MUTEX_NAME           "fcsClientMutex"
-#define MFC_SERVER_MUTEX_NAME           "fcsServerMutex"
-#define MAX_QUE_SIZE                    20
 
 #define ADDR_FCSLOGIN                   "fcsLoginCEF"
 #define ADDR_OBS_BROADCAST_Plugin       "obsBPlugin"
@@ -118,6 +132,7 @@ public:
 
     // Get the return addr of this package
     char* getFrom() { return m_szFrom; }
+    const char* getFrom() const { return m_szFrom; }
     void setFrom(const char* p) { strncpy(m_szFrom, p, ADDR_BUF_SIZE); }
 
     // Get the address of this memory package.
@@ -126,13 +141,27 @@ public:
 
     // get the messge payload.
     char* getMessage() { return m_szBuffer; }
-    void setMessage(const char* p) { strncpy(m_szBuffer, p, ADDR_BUF_SIZE); }
+    const char* getMessage() const { return m_szBuffer; }
+    void setMessage(const char* p) { strncpy(m_szBuffer, p, BUF_SIZE - 1); }
 
-    int getID() { return m_nMsgID; }
+    int getID() const { return m_nMsgID; }
     void setID(int n) { m_nMsgID = n; }
 
+    // Fill in from a ring record, the from and payload bytes aren't null terminated.
+    void assign(const char* pTo, const char* pFrom, size_t nFromLen, int nMsgID, const char* pBuf, size_t nBufLen)
+    {
+        setTo(pTo);
+        nFromLen = std::min< size_t >(nFromLen, ADDR_BUF_SIZE - 1);
+        nBufLen = std::min< size_t >(nBufLen, BUF_SIZE - 1);
+        memcpy(m_szFrom, pFrom, nFromLen);
+        m_szFrom[nFromLen] = '\0';
+        memcpy(m_szBuffer, pBuf, nBufLen);
+        m_szBuffer[nBufLen] = '\0';
+        m_nMsgID = nMsgID;
+    }
+
 private:
-    // no std::strings, this object lives in shared memory.
+    // fixed size buffers, records are copied in and out of the shared memory rings.
     char m_szTo[ADDR_BUF_SIZE];
     char m_szFrom[ADDR_BUF_SIZE];
     char m_szBuffer[BUF_SIZE];
@@ -213,28 +242,471 @@ public:
 
 
 // boost typedefs for readability
-typedef boost::interprocess::allocator<CSharedMemMsg, managed_shared_memory::segment_manager>   ShmemListAllocator;
-typedef boost::interprocess::list<CSharedMemMsg, ShmemListAllocator>                            ShmemList;
 typedef boost::interprocess::interprocess_mutex                                                 ShmemMutex;
 typedef boost::lock_guard<ShmemMutex>                                                           ShmemLockGuard;
 typedef unique_ptr<boost::interprocess::managed_shared_memory>                                  ManagedShmemPtr;
 
 
+// Compares two addresses ignoring case, without allocating.
+inline bool addrEquals(const char* pA, const char* pB)
+{
+    for (size_t n = 0; n < ADDR_BUF_SIZE; n++)
+    {
+        if (toupper((unsigned char)pA[n]) != toupper((unsigned char)pB[n]))
+            return false;
+        if (pA[n] == '\0')
+            return true;
+    }
+    return true;
+}
+
+
+// Message ring for one receiving address, lives in the managed segment.
+//
+// Each message is stored as a variable-length record: a small header followed by
+// the sender address and payload bytes, rounded up to 8 bytes. Records never wrap;
+// if one doesn't fit before the end of the buffer the sender claims the remainder
+// as a filler record and starts over at offset 0.
+//
+// There is a single reader per address, but senders to one address live in
+// several processes (login helper, cef renderers, ...), so senders claim space
+// with a CAS on m_nTail instead of a plain store. Neither side ever takes a lock.
+// A sender marks its record claimed (length | REC_CLAIMED) as soon as the CAS
+// succeeds and publishes it by storing the plain length last; the reader zeroes
+// what it consumed before handing the space back, so unclaimed space always reads
+// as a zero length.
+//
+// A sender that dies between claim and publish would wedge the ring, so the reader
+// times how long the record at its head has been stuck and skips it after
+// STALE_CLAIM_US: by its claimed length, or if the sender died before even marking
+// the claim, up to the next record header past it (nothing was written in between).
+// Either way it counts in m_nStale.
+//
+// When the ring is full the new message is dropped and counted in m_nDropped.
+//
+// Each ring has a doorbell for its reader. The ring only holds the m_nRinging word;
+// the kernel object a reader sleeps on is per process, see CShmDoorbell. A sender
+// signals it only when it is the first to ring since the reader last woke up, so
+// a burst of sends costs one wakeup. Records carry their send time so the reader
+// can track delivery latency; steady_clock is system wide on the platforms we ship.
+//
+class CShmRing
+{
+public:
+    static const uint32_t RING_SIZE = 16384;    // bytes, must be a power of 2
+
+    struct Stats
+    {
+        uint32_t    sent;               // messages queued
+        uint32_t    received;           // messages read
+        uint32_t    dropped;            // messages rejected because the ring was full
+        uint32_t    stale;              // claims skipped because the sender never published them
+        uint64_t    latencyAvgUs;       // mean send to read latency
+        uint64_t    latencyMaxUs;       // worst send to read latency
+    };
+
+    CShmRing()
+        : m_nTail(0)
+        , m_nHead(0)
+        , m_nSent(0)
+        , m_nRecv(0)
+        , m_nDropped(0)
+        , m_nStale(0)
+        , m_nRinging(0)
+        , m_nStallHead(0)
+        , m_qwStallUs(0)
+        , m_nLatencyTotalUs(0)
+        , m_nLatencyMaxUs(0)
+    {
+        memset(m_szAddr, '\0', ADDR_BUF_SIZE);
+        memset(m_buf, '\0', RING_SIZE);
+    }
+
+    const char* getAddr() const         { return m_szAddr;                                      }
+    void setAddr(const char* p)         { strncpy(m_szAddr, p, ADDR_BUF_SIZE - 1);              }
+
+    uint32_t getSent() const            { return m_nSent.load(std::memory_order_relaxed);       }
+    uint32_t getReceived() const        { return m_nRecv.load(std::memory_order_relaxed);       }
+    uint32_t getDropped() const         { return m_nDropped.load(std::memory_order_relaxed);    }
+    uint32_t getStale() const           { return m_nStale.load(std::memory_order_relaxed);      }
+
+    // Messages sent but not yet read.
+    uint32_t getPending() const         { return getSent() - getReceived();                     }
+
+    Stats getStats() const
+    {
+        Stats stats;
+        stats.sent          = getSent();
+        stats.received      = getReceived();
+        stats.dropped       = getDropped();
+        stats.stale         = getStale();
+        stats.latencyMaxUs  = m_nLatencyMaxUs.load(std::memory_order_relaxed);
+        stats.latencyAvgUs  = stats.received > 0 ? m_nLatencyTotalUs.load(std::memory_order_relaxed) / stats.received : 0;
+        return stats;
+    }
+
+    // Mark a wakeup pending, any process or thread. True if this is the first ring
+    // since the reader last woke, the caller must then signal the doorbell.
+    bool ring()                         { return m_nRinging.exchange(1, std::memory_order_seq_cst) == 0;  }
+
+    // Reader side, take the pending wakeup. Rearms the doorbell, so a send racing
+    // with the drain that follows rings again.
+    bool answer()                       { return m_nRinging.exchange(0, std::memory_order_seq_cst) != 0;  }
+
+    // the word a futex doorbell sleeps on
+    std::atomic<uint32_t>* ringWord()   { return &m_nRinging;                                   }
+
+    // Producer side, any process or thread. The caller rings the doorbell.
+    bool push(const char* pFrom, int nMsgID, const char* pMsg)
+    {
+        size_t nFromLen = strnlen(pFrom, ADDR_BUF_SIZE - 1);
+        size_t nMsgLen  = strnlen(pMsg, BUF_SIZE - 1);
+        uint32_t nRecLen = recordLen(nFromLen, nMsgLen);
+        uint32_t nTail = m_nTail.load(std::memory_order_relaxed);
+        uint32_t nOff, nPad;
+
+        while (true)
+        {
+            nOff = nTail & (RING_SIZE - 1);
+            nPad = (nOff + nRecLen > RING_SIZE) ? RING_SIZE - nOff : 0;
+
+            uint32_t nUsed = nTail - m_nHead.load(std::memory_order_acquire);
+            if (nUsed + nPad + nRecLen > RING_SIZE)
+            {
+                m_nDropped.fetch_add(1, std::memory_order_relaxed);
+                return false;
+            }
+
+            if (m_nTail.compare_exchange_weak(nTail, nTail + nPad + nRecLen, std::memory_order_acq_rel))
+                break;
+        }
+
+        if (nPad > 0)
+        {
+            header(nOff)->dwLen.store(nPad | REC_FILLER, std::memory_order_release);
+            nOff = 0;
+        }
+
+        RecHdr* pHdr = header(nOff);
+        uint8_t* pData = m_buf + nOff + sizeof(RecHdr);
+        pHdr->dwLen.store(nRecLen | REC_CLAIMED, std::memory_order_release);
+
+        pHdr->nMsgID = nMsgID;
+        pHdr->qwSentUs = nowMicro();
+        pHdr->wFromLen = (uint16_t)nFromLen;
+        pHdr->wMsgLen = (uint16_t)nMsgLen;
+        memcpy(pData, pFrom, nFromLen);
+        memcpy(pData + nFromLen, pMsg, nMsgLen);
+
+        pHdr->dwLen.store(nRecLen, std::memory_order_release);
+        m_nSent.fetch_add(1, std::memory_order_relaxed);
+        return true;
+    }
+
+    // Consumer side, only the owner of this address. Returns false if the ring is
+    // empty or the next record is still being written.
+    bool pop(CSharedMemMsg* pMsg)
+    {
+        uint32_t nHead = m_nHead.load(std::memory_order_relaxed);
+        uint32_t nTail;
+
+        while (nHead != (nTail = m_nTail.load(std::memory_order_acquire)))
+        {
+            uint32_t nOff = nHead & (RING_SIZE - 1);
+            RecHdr* pHdr = header(nOff);
+            uint32_t nLen = pHdr->dwLen.load(std::memory_order_acquire);
+
+            if (nLen == 0 || (nLen & REC_CLAIMED) != 0)
+            {
+                if (!isStale(nHead))
+                    return false;
+
+                // an unmarked claim is all zeros up to the next record
+                nLen = nLen != 0 ? nLen & ~REC_CLAIMED : unmarkedLen(nHead, nTail);
+                if (nLen == 0)
+                    return false;
+
+                if (nOff + nLen <= RING_SIZE)
+                    memset(m_buf + nOff, '\0', nLen);
+                nHead += nLen;
+                m_nHead.store(nHead, std::memory_order_release);
+                m_nStale.fetch_add(1, std::memory_order_relaxed);
+                m_qwStallUs = 0;
+                continue;
+            }
+            m_qwStallUs = 0;
+
+            bool bFiller = (nLen & REC_FILLER) != 0;
+            nLen &= ~REC_FILLER;
+
+            if (!bFiller)
+            {
+                const char* pData = (const char*)(m_buf + nOff + sizeof(RecHdr));
+                pMsg->assign(m_szAddr, pData, pHdr->wFromLen, pHdr->nMsgID, pData + pHdr->wFromLen, pHdr->wMsgLen);
+                recordLatency(pHdr->qwSentUs);
+            }
+
+            memset(m_buf + nOff, '\0', nLen);
+            nHead += nLen;
+            m_nHead.store(nHead, std::memory_order_release);
+
+            if (!bFiller)
+            {
+                m_nRecv.fetch_add(1, std::memory_order_relaxed);
+                return true;
+            }
+        }
+        return false;
+    }
+
+private:
+    static const uint32_t REC_FILLER = 0x80000000;
+    static const uint32_t REC_CLAIMED = 0x40000000;     // claimed, not published yet
+    static const uint64_t STALE_CLAIM_US = 2000000;     // a push takes microseconds
+
+    struct RecHdr
+    {
+        std::atomic<uint32_t>   dwLen;      // whole record incl. header, 0 until published
+        int32_t                 nMsgID;
+        uint64_t                qwSentUs;   // steady_clock time of the send
+        uint16_t                wFromLen;
+        uint16_t                wMsgLen;
+    };
+
+    static uint64_t nowMicro()
+    {
+        using namespace std::chrono;
+        return (uint64_t)duration_cast< microseconds >(steady_clock::now().time_since_epoch()).count();
+    }
+
+    // reader only, so the max needs no CAS loop
+    void recordLatency(uint64_t qwSentUs)
+    {
+        uint64_t qwNow = nowMicro();
+        uint64_t qwLatency = qwNow > qwSentUs ? qwNow - qwSentUs : 0;
+
+        m_nLatencyTotalUs.fetch_add(qwLatency, std::memory_order_relaxed);
+        if (qwLatency > m_nLatencyMaxUs.load(std::memory_order_relaxed))
+            m_nLatencyMaxUs.store(qwLatency, std::memory_order_relaxed);
+    }
+
+    static uint32_t recordLen(size_t nFromLen, size_t nMsgLen)
+    {
+        return (uint32_t)((sizeof(RecHdr) + nFromLen + nMsgLen + 7) & ~(size_t)7);
+    }
+
+    RecHdr* header(uint32_t nOff)       { return reinterpret_cast<RecHdr*>(m_buf + nOff); }
+
+    // Reader only. True once the record at nHead has been stuck for STALE_CLAIM_US,
+    // timed from when the reader first found it unpublished.
+    bool isStale(uint32_t nHead)
+    {
+        uint64_t qwNow = nowMicro();
+        if (m_qwStallUs == 0 || m_nStallHead != nHead)
+        {
+            m_nStallHead = nHead;
+            m_qwStallUs = qwNow;
+            return false;
+        }
+        return qwNow - m_qwStallUs >= STALE_CLAIM_US;
+    }
+
+    // Reader only. Length of a claim whose sender died before marking it: records are
+    // 8 byte aligned and nothing in between was written, so it ends at the next
+    // nonzero header. 0 while no later record has shown up to measure against.
+    uint32_t unmarkedLen(uint32_t nHead, uint32_t nTail)
+    {
+        for (uint32_t nPos = nHead + 8; nPos != nTail; nPos += 8)
+        {
+            if (header(nPos & (RING_SIZE - 1))->dwLen.load(std::memory_order_acquire) != 0)
+                return nPos - nHead;
+        }
+        return 0;
+    }
+
+    char                    m_szAddr[ADDR_BUF_SIZE];    // receiving address
+    std::atomic<uint32_t>   m_nTail;                    // next byte to claim, shared by senders
+    std::atomic<uint32_t>   m_nHead;                    // next byte to read, reader only
+    std::atomic<uint32_t>   m_nSent;
+    std::atomic<uint32_t>   m_nRecv;
+    std::atomic<uint32_t>   m_nDropped;
+    std::atomic<uint32_t>   m_nStale;
+    std::atomic<uint32_t>   m_nRinging;                 // 1 while a wakeup is pending for the reader
+    uint32_t                m_nStallHead;               // reader only, m_nHead when it got stuck
+    uint64_t                m_qwStallUs;                // reader only, when it got stuck, 0 if it isn't
+    std::atomic<uint64_t>   m_nLatencyTotalUs;
+    std::atomic<uint64_t>   m_nLatencyMaxUs;
+    alignas(8) uint8_t      m_buf[RING_SIZE];
+};
+
+static_assert((CShmRing::RING_SIZE & (CShmRing::RING_SIZE - 1)) == 0, "CShmRing::RING_SIZE must be a power of 2");
+static_assert(std::atomic<uint32_t>::is_always_lock_free, "shared memory rings need lock-free 32 bit atomics");
+static_assert(std::atomic<uint64_t>::is_always_lock_free, "shared memory rings need lock-free 64 bit atomics");
+
+
+// Process side of a ring's doorbell. Kernel handles can't live in shared memory,
+// so every process opens its own, named after the segment and address so they all
+// reach the same object:
+//
+//   linux      futex on the ring's m_nRinging word, nothing to open
+//   win32      named auto-reset event
+//   mac        named FIFO in /tmp; the reader polls it and a sender writes a byte.
+//              There is no sem_timedwait() on mac and Mach semaphores can't be
+//              shared by name, a FIFO is the portable timed kernel wait
+//
+// boost's interprocess_semaphore used to do this, but off linux it is a spin/yield
+// loop that wakes every scheduler tick while it waits.
+class CShmDoorbell
+{
+public:
+    CShmDoorbell()
+        : m_pRing(nullptr)
+#ifdef _WIN32
+        , m_hEvent(nullptr)
+#elif !defined(__linux__)
+        , m_fdRead(-1)
+        , m_fdKeep(-1)
+#endif
+    {}
+
+    ~CShmDoorbell()
+    {
+#ifdef _WIN32
+        if (m_hEvent)
+            CloseHandle(m_hEvent);
+#elif !defined(__linux__)
+        if (m_fdRead >= 0)
+            close(m_fdRead);
+        if (m_fdKeep >= 0)
+            close(m_fdKeep);
+#endif
+    }
+
+    CShmDoorbell(const CShmDoorbell&) = delete;
+    CShmDoorbell& operator=(const CShmDoorbell&) = delete;
+
+    bool isOpen() const                 { return m_pRing.load(std::memory_order_acquire) != nullptr; }
+
+    // Attach to pRing, sName is unique to the segment and address.
+    bool open(CShmRing* pRing, const std::string& sName)
+    {
+#ifdef _WIN32
+        m_hEvent = CreateEventA(nullptr, FALSE, FALSE, sName.c_str());
+        if (!m_hEvent)
+            return false;
+#elif !defined(__linux__)
+        m_sPath = "/tmp/" + sName;
+        if (mkfifo(m_sPath.c_str(), 0600) != 0 && errno != EEXIST)
+            return false;
+#else
+        (void)sName;
+#endif
+        m_pRing.store(pRing, std::memory_order_release);
+        return true;
+    }
+
+    // Sender side, any thread.
+    void ring()
+    {
+        CShmRing* pRing = m_pRing.load(std::memory_order_acquire);
+        if (!pRing->ring())
+            return;
+#if defined(_WIN32)
+        SetEvent(m_hEvent);
+#elif defined(__linux__)
+        syscall(SYS_futex, pRing->ringWord(), FUTEX_WAKE, 1, nullptr, nullptr, 0);
+#else
+        // ENXIO means nobody reads this address yet, it finds m_nRinging set when it
+        // first waits. A full pipe already holds a pending wakeup.
+        int fd = ::open(m_sPath.c_str(), O_WRONLY | O_NONBLOCK);
+        if (fd >= 0)
+        {
+#ifdef F_SETNOSIGPIPE
+            fcntl(fd, F_SETNOSIGPIPE, 1);
+#endif
+            char ch = 0;
+            ssize_t nRv = write(fd, &ch, 1);
+            (void)nRv;
+            close(fd);
+        }
+#endif
+    }
+
+    // Reader side, the one thread reading this address. Sleeps until the doorbell
+    // rings or nTimeoutMs passes, returns false on timeout.
+    bool wait(unsigned int nTimeoutMs)
+    {
+        CShmRing* pRing = m_pRing.load(std::memory_order_acquire);
+        if (pRing->answer())
+            return true;
+#if defined(_WIN32)
+        bool bRang = WaitForSingleObject(m_hEvent, nTimeoutMs) == WAIT_OBJECT_0;
+#elif defined(__linux__)
+        // returns at once if a sender set the word since answer()
+        struct timespec ts = { (time_t)(nTimeoutMs / 1000), (long)(nTimeoutMs % 1000) * 1000000L };
+        syscall(SYS_futex, pRing->ringWord(), FUTEX_WAIT, 0, &ts, nullptr, 0);
+        bool bRang = false;
+#else
+        bool bRang = false;
+        if (m_fdRead < 0)
+        {
+            // our own write end keeps poll() from reporting hangup while no sender has it open
+            m_fdRead = ::open(m_sPath.c_str(), O_RDONLY | O_NONBLOCK);
+            if (m_fdRead >= 0)
+                m_fdKeep = ::open(m_sPath.c_str(), O_WRONLY | O_NONBLOCK);
+        }
+        // without the FIFO poll() still sleeps out the timeout, we just can't be woken early
+        struct pollfd pfd = { m_fdRead, POLLIN, 0 };
+        if (poll(&pfd, m_fdRead >= 0 ? 1 : 0, (int)std::min(nTimeoutMs, (unsigned int)INT32_MAX)) > 0)
+        {
+            char buf[64];
+            while (read(m_fdRead, buf, sizeof(buf)) > 0)
+                ;
+            bRang = true;
+        }
+#endif
+        return pRing->answer() || bRang;
+    }
+
+private:
+    std::atomic<CShmRing*>  m_pRing;
+#if defined(_WIN32)
+    HANDLE                  m_hEvent;
+#elif !defined(__linux__)
+    std::string             m_sPath;
+    int                     m_fdRead;           // reader only
+    int                     m_fdKeep;
+#endif
+};
+
+
+// Fixed directory of rings, one per address, constructed once by the server.
+// Slots are claimed under the segment mutex and published through m_nRings, so
+// lookups just scan the published slots.
+struct CShmRingTable
+{
+    static const uint32_t MAX_RINGS = 8;
+
+    CShmRingTable() : m_nRings(0) {}
+
+    std::atomic<uint32_t>   m_nRings;
+    CShmRing                m_rings[MAX_RINGS];
+};
+
+
 // this class handles access to the message queue between the processes.
 class CMessageManager
 {
 public:
     CMessageManager()
-        : m_pList(nullptr)
+        : m_pRings(nullptr)
         , m_pSegment(nullptr)
         , m_pIPCMutex(nullptr)
-        , m_pIPCServerMutex(nullptr)
-        , m_pIPCClientMutex(nullptr)
     {}
 
     ~CMessageManager()
     {
-        m_pList = nullptr; // m_pList doesn't belong to us, let boost handle it.
+        m_pRings = nullptr; // m_pRings doesn't belong to us, let boost handle it.
         m_pSegment = nullptr;
         if (isServer())
         {
@@ -247,26 +719,28 @@ public:
 
     bool isInitialized()
     {
-        return nullptr != m_pList;
+        return nullptr != m_pRings;
     }
 
-    // Initialize the shared memory objects.
-    virtual bool init(bool bServer)
+    // Initialize the shared memory objects. pszSegment is only changed by tools that
+    // must not touch the segment of a running plugin.
+    virtual bool init(bool bServer, const char* pszSegment = SHARED_MEMNAME)
     {
         setServer(bServer);
+        m_sSegment = pszSegment;
         bool bRv = true;
         string s;
         if (bServer)
         {
             // if server, remove the object and start over.
-            shared_memory_object::remove(SHARED_MEMNAME);
-            m_pSegment = make_unique<managed_shared_memory>(open_or_create, SHARED_MEMNAME, 65536);
+            shared_memory_object::remove(pszSegment);
+            m_pSegment = make_unique<managed_shared_memory>(open_or_create, pszSegment, SHARED_MEMSIZE);
         }
         else
         {
             try
             {
-                m_pSegment = make_unique<managed_shared_memory>(open_only, SHARED_MEMNAME);
+                m_pSegment = make_unique<managed_shared_memory>(open_only, pszSegment);
             }
             catch (interprocess_exception& e)
             {
@@ -290,18 +764,12 @@ public:
                 // note, we don't have to send the memory manager in the second set of ()!!!!!
                 // the mutex doesn't need to alloc any memory!
                 m_pIPCMutex = m_pSegment->construct<ShmemMutex>(MFC_SEMA_NAME)();
-                m_pIPCServerMutex = m_pSegment->construct<ShmemMutex>(MFC_SERVER_MUTEX_NAME)();
-                m_pIPCClientMutex = m_pSegment->construct<ShmemMutex>(MFC_CLIENT_MUTEX_NAME)();
             }
             else
             {
                 // create mutex in shared memory.
                 if (m_pSegment->find<ShmemMutex>(MFC_SEMA_NAME).first)
-                {
                     m_pIPCMutex = m_pSegment->find<ShmemMutex>(MFC_SEMA_NAME).first;
-                    m_pIPCServerMutex = m_pSegment->find<ShmemMutex>(MFC_SERVER_MUTEX_NAME).first;
-                    m_pIPCClientMutex = m_pSegment->find<ShmemMutex>(MFC_CLIENT_MUTEX_NAME).first;
-                }
                 else
                 {
                     //_TRACE("Couldn't find %s to create shared memory mutex", MFC_SEMA_NAME);
@@ -315,91 +783,75 @@ public:
                 assert(getMutex());
                 ShmemLockGuard guard(*(getMutex()));
 
-                // create boost list container object in shared memory.
-                m_pList = nullptr;
-                if (m_pSegment->find<ShmemList>(CONTAINER_NAME).first)
-                    m_pList = m_pSegment->find<ShmemList>(CONTAINER_NAME).first;
-                else
-                    m_pList = m_pSegment->construct<ShmemList>(CONTAINER_NAME)(m_pSegment->get_segment_manager());
+                // create the ring directory in shared memory.
+                m_pRings = m_pSegment->find_or_construct<CShmRingTable>(RING_TABLE_NAME)();
             }
         }
         //_TRACE("CMemoryManager returned %d", bRv);
         return bRv;
     }
 
-    // remove all members from the list.
+    // Drop every message waiting in any ring. Only safe while no reader is active.
     void clear()
     {
-        assert(m_pList);
-        ShmemLockGuard guard(*getMutex());
-        m_pList->clear();
-    }
-
-#ifdef UNUSED_CODE
-    // this just blindly returns the next message.  This is a test only function.
-    bool getNextMessage(CSharedMemMsg* pMsg)
-    {
-        assert(m_pList);
-        ShmemLockGuard guard(*getMutex());
-        ShmemList::iterator itr = m_pList->begin();
-        if (itr != m_pList->end())
+        assert(m_pRings);
+        CSharedMemMsg msg;
+        uint32_t nRings = m_pRings->m_nRings.load(std::memory_order_acquire);
+        for (uint32_t n = 0; n < nRings; n++)
         {
-            *pMsg = *itr;
-            m_pList->pop_front();
-            return true;
+            while (m_pRings->m_rings[n].pop(&msg))
+                ;
         }
-        return false;
     }
-#endif
 
     // get the next message that is addressed to me.
     bool getNextMessage(CSharedMemMsg* pMsg, const char* pTo)
     {
-        bool bDone = false;
-        if (m_pList)
-        {
-            assert(m_pList);
-            ShmemLockGuard guard(*getMutex());
-            string sTo = boost::to_upper_copy<string>(pTo);
-
-            // walk the list looking for the first message with a matching address.
-            for (ShmemList::iterator itr = m_pList->begin(); !bDone && itr != m_pList->end(); itr++)
-            {
-                CSharedMemMsg msg = *itr;
-                string sAddressedTo = boost::to_upper_copy<string>(msg.getTo());
-                if (sAddressedTo == sTo)
-                {
-                    *pMsg = msg;
-                    m_pList->erase(itr);
-                    bDone = true;
-                }
-            }
-        }
-        return bDone;
+        CShmRing* pRing = findRing(pTo, true);
+        return pRing ? pRing->pop(pMsg) : false;
     }
 
     // Counts the number of messages in the qeuue addressed to me
     int dump(const char* pTo)
     {
-        assert(m_pList);
-        ShmemLockGuard guard(*getMutex());
-        string sTo = boost::to_upper_copy<string>(pTo);
+        CShmRing* pRing = findRing(pTo, false);
+        return pRing ? (int)pRing->getPending() : 0;
+    }
 
-        int nCnt = 0;
-        // walk the list looking for the first message with a matching address.
-        for (ShmemList::iterator itr = m_pList->begin(); itr != m_pList->end(); itr++)
-        {
-            CSharedMemMsg msg = *itr;
-            string sAddressedTo = boost::to_upper_copy<string>(msg.getTo());
-            if (sAddressedTo == sTo)
-            {
-                nCnt++;
-            }
-        }
-        return nCnt;
+    // Number of messages to pTo that were dropped because its ring was full
+    uint32_t getDropped(const char* pTo)
+    {
+        CShmRing* pRing = findRing(pTo, false);
+        return pRing ? pRing->getDropped() : 0;
+    }
+
+    // Message counts and delivery latency for pTo, false if nothing was ever sent to it
+    bool getStats(const char* pTo, CShmRing::Stats& stats)
+    {
+        CShmRing* pRing = findRing(pTo, false);
+        if (pRing)
+            stats = pRing->getStats();
+        return pRing != nullptr;
+    }
+
+    // Block until a message for pTo arrives, notify(pTo) is called, or nTimeoutMs
+    // passes. Returns false on timeout; call getNextMessage() until it returns false
+    // after waking up either way.
+    bool waitMessage(const char* pTo, unsigned int nTimeoutMs)
+    {
+        CShmDoorbell* pBell = findBell(findRing(pTo, true));
+        return pBell ? pBell->wait(nTimeoutMs) : false;
+    }
+
+    // Wake whoever is waiting on pTo without sending anything, e.g. to stop a worker.
+    void notify(const char* pTo)
+    {
+        CShmDoorbell* pBell = findBell(findRing(pTo, true));
+        if (pBell)
+            pBell->ring();
     }
 
-    void sendMessage(const char* pTo, const char* pFrom, int nType, const char* pFormat, ...)
+    bool sendMessage(const char* pTo, const char* pFrom, int nType, const char* pFormat, ...)
     {
         char buffer[1024] = { '\0' };
         va_list args;
@@ -407,47 +859,91 @@ public:
         vsnprintf(buffer, 1023, pFormat, args);
         va_end(args);
         CSharedMemMsg msg(pTo, pFrom, nType, buffer);
-        sendMessage(msg);
+        return sendMessage(msg);
     }
 
-    // add a message to the queue
-    void sendMessage(const CSharedMemMsg& msg)
+    // add a message to the queue, returns false if it was dropped
+    bool sendMessage(const CSharedMemMsg& msg)
     {
-        if (m_pList)
+        bool bRv = false;
+        CShmRing* pRing = findRing(msg.getTo(), true);
+        if (pRing && pRing->push(msg.getFrom(), msg.getID(), msg.getMessage()))
         {
-            {
-                ShmemLockGuard guard(*getMutex());
-                if (m_pList->size() > MAX_QUE_SIZE)
-                {
-                    m_pList->pop_front();
-                }
-                m_pList->push_back(msg);
-            }
-            string sTo = msg.getTo();
-            if (sTo == ADDR_OBS_BROADCAST_Plugin)
-            {
-                // this signals the broadcast plugin that a message is pending in the que.
-                getBroadcastPluginMutex()->unlock();
-            }
-            else getClientMutex()->unlock();
+            CShmDoorbell* pBell = findBell(pRing);
+            if (pBell)
+                pBell->ring();
+            bRv = true;
         }
+        return bRv;
     }
 
     ShmemMutex* getMutex()                  { return m_pIPCMutex;       }
-    ShmemMutex* getClientMutex()            { return m_pIPCClientMutex; }
-    ShmemMutex* getBroadcastPluginMutex()   { return m_pIPCServerMutex; }
 
     bool isServer()                         { return m_bIsServer;       }
     void setServer(bool b)                  { m_bIsServer = b;          }
 
 private:
+    // Find the ring for pTo. With bCreate, claims a free slot for an address that
+    // hasn't been used yet; that slow path is the only one taking the segment mutex.
+    CShmRing* findRing(const char* pTo, bool bCreate)
+    {
+        if (!m_pRings || !pTo || !*pTo)
+            return nullptr;
+
+        uint32_t nRings = m_pRings->m_nRings.load(std::memory_order_acquire);
+        for (uint32_t n = 0; n < nRings; n++)
+        {
+            if (addrEquals(m_pRings->m_rings[n].getAddr(), pTo))
+                return &m_pRings->m_rings[n];
+        }
+
+        if (!bCreate)
+            return nullptr;
+
+        ShmemLockGuard guard(*getMutex());
+
+        // another process may have added it while we waited for the lock
+        for (uint32_t n = nRings; n < m_pRings->m_nRings.load(std::memory_order_acquire); n++)
+        {
+            if (addrEquals(m_pRings->m_rings[n].getAddr(), pTo))
+                return &m_pRings->m_rings[n];
+        }
+
+        nRings = m_pRings->m_nRings.load(std::memory_order_relaxed);
+        if (nRings >= CShmRingTable::MAX_RINGS)
+            return nullptr;
+
+        CShmRing* pRing = &m_pRings->m_rings[nRings];
+        pRing->setAddr(pTo);
+        m_pRings->m_nRings.store(nRings + 1, std::memory_order_release);
+        return pRing;
+    }
+
+    // This process's doorbell for pRing, opened on first use.
+    CShmDoorbell* findBell(CShmRing* pRing)
+    {
+        if (!pRing)
+            return nullptr;
+
+        CShmDoorbell* pBell = &m_bells[pRing - m_pRings->m_rings];
+        if (!pBell->isOpen())
+        {
+            std::lock_guard<std::mutex> lk(m_bellMutex);
+            if (!pBell->isOpen() && !pBell->open(pRing, m_sSegment + "." + pRing->getAddr()))
+                return nullptr;
+        }
+        return pBell;
+    }
+
     bool                    m_bIsServer;
-    ShmemList*              m_pList;
+    CShmRingTable*          m_pRings;
     ManagedShmemPtr         m_pSegment;
+    std::string             m_sSegment;
+
+    ShmemMutex*             m_pIPCMutex;        // guards claiming new rings
 
-    ShmemMutex*             m_pIPCMutex;
-    ShmemMutex*             m_pIPCServerMutex;  // signal the server that there are waiting messages
-    ShmemMutex*             m_pIPCClientMutex;  // signal the client there are waiting messages.
+    CShmDoorbell            m_bells[CShmRingTable::MAX_RINGS];  // same slots as m_pRings->m_rings
+    std::mutex              m_bellMutex;        // guards opening them
 };
 
 };  // namespace MFC_Shared_Mem
@@ -49,6 +49,10 @@
 #define CONFIG_WIDTH                            "width"
 #define CONFIG_CODEC                            "codec"
 #define CONFIG_FRAME_RATE                       "framerate"
+#define CONFIG_ABR                              "abr"
+#define CONFIG_ABR_MIN_BITRATE                  "abrminkbps"
+#define CONFIG_ABR_MIN_HEIGHT                   "abrminheight"
+#define CONFIG_ABR_MIN_FRAME_RATE               "abrminfps"
 #define CONFIG_MODEL_USER_NAME                  "modeluser"
 #define CONFIG_MODEL_PWD                        "pwd"
 #define CONFIG_TOKEN                            "sidekick_tok"
@@ -111,6 +115,10 @@
 #define MFC_DEFAULT_WEBRTC_WIDTH                1280
 #define MFC_DEFAULT_WEBRTC_HEIGHT               720
 #define MFC_DEFAULT_WEBRTC_FRAMERATE            30
+#define MFC_DEFAULT_ABR_ENABLED                 true
+#define MFC_DEFAULT_ABR_MIN_BITRATE             300
+#define MFC_DEFAULT_ABR_MIN_HEIGHT              360
+#define MFC_DEFAULT_ABR_MIN_FRAME_RATE          15
 
 #define JSON_MODEL_STRM_KEY                     "modelStreamingKey"
 #define JSON_PLUGIN_TYPE                        "pluginType"
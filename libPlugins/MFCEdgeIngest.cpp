@@ -23,7 +23,12 @@
 
 #include <algorithm>
 #include <cctype>
+#include <chrono>
+#include <map>
+#include <memory>
+#include <mutex>
 #include <regex>
+#include <vector>
 
 #define MFC_EDGE_DETAILS_URL "https://modelweb.mfcimg.com/edge/details.json"
 #define MFC_EDGE_RTP_INFO_URL "https://rtp-edgeingest.myfreecams.com/edge/info.json"
@@ -32,8 +37,31 @@
 #define MFC_DEFAULT_BROADCAST_URL "rtmp://publish.myfreecams.com/NxServer"
 #endif
 
+#define EDGE_RACE_BUDGET_MS     2000    // longest a stream start waits on the region race
+#define EDGE_CACHE_TTL_SEC      600     // how long edge ips and connect times are reused
+
 using njson = nlohmann::json;
 using std::string;
+using std::vector;
+
+typedef std::chrono::steady_clock EdgeClock;
+
+struct EdgeInfo
+{
+    string              site;
+    string              ip;
+    int64_t             connectUs = -1;     // TCP connect time to ip, -1 if unmeasured or it failed
+    EdgeClock::time_point expires;
+};
+
+// Regional ingests raced by WebrtcTcpIp(), see rtp-edgeingest-<region>.myfreecams.com
+static const char* const s_edgeRegions[] = { "tuk", "ord", "ams", "buh", "syd", "sao", "tyo" };
+
+static std::mutex                   s_edgeMutex;        // protects the cache below
+static std::map< string, EdgeInfo > s_edgeCache;        // by site
+static string                       s_edgeNearest;      // site the geo dns endpoint sent us to
+static EdgeClock::time_point        s_edgeRaced;        // when the last race finished
+static std::mutex                   s_edgeRaceMutex;    // one race at a time
 
 
 static string ToLower(const string& s)
@@ -45,6 +73,192 @@ static string ToLower(const string& s)
 }
 
 
+static string RegionInfoUrl(const string& region)
+{
+    return string("https://rtp-edgeingest-") + ToLower(region) + ".myfreecams.com/edge/info.json";
+}
+
+
+static size_t EdgeWriteBody(void* buffer, size_t size, size_t nmemb, void* pUser)
+{
+    reinterpret_cast< string* >(pUser)->append(reinterpret_cast< char* >(buffer), size * nmemb);
+    return size * nmemb;
+}
+
+
+// Parses an info.json response, |site| is left alone if the response doesn't name one
+static bool ParseEdgeInfo(const string& sBody, string& site, string& ip)
+{
+    njson res = njson::parse(sBody, nullptr, false);
+    if (res.is_discarded() || !res.is_object() || !res["ip"].is_string())
+        return false;
+
+    ip = res["ip"].get< string >();
+    if (res["site"].is_string())
+        site = ToLower(res["site"].get< string >());
+    return !ip.empty();
+}
+
+
+// Best cached edge: quickest measured connect, else the geo dns pick. Caller holds s_edgeMutex.
+static const EdgeInfo* BestCachedEdge(void)
+{
+    const EdgeInfo* pBest = nullptr;
+    EdgeClock::time_point now = EdgeClock::now();
+
+    if (s_edgeRaced == EdgeClock::time_point() || now >= s_edgeRaced + std::chrono::seconds(EDGE_CACHE_TTL_SEC))
+        return nullptr;
+
+    for (const auto& entry : s_edgeCache)
+    {
+        const EdgeInfo& info = entry.second;
+        if (info.connectUs >= 0 && info.expires > now && (!pBest || info.connectUs < pBest->connectUs))
+            pBest = &info;
+    }
+
+    if (!pBest)
+    {
+        auto iNearest = s_edgeCache.find(s_edgeNearest);
+        if (iNearest != s_edgeCache.end() && iNearest->second.expires > now)
+            pBest = &iNearest->second;
+    }
+    return pBest;
+}
+
+
+// Fetches info.json from the geo dns endpoint and every regional endpoint at once. As each
+// answer arrives we start timing a TCP connect to that edge on |port|, so lookups and
+// connects overlap. Whatever has been measured when |budgetMs| runs out goes in the cache.
+static void RaceEdges(int port, int budgetMs)
+{
+    struct Probe
+    {
+        CURL*   curl = nullptr;
+        string  site;               // empty for the geo dns endpoint until it answers
+        string  body;
+        bool    connect = false;    // TCP connect timing rather than an info.json fetch
+        bool    attached = false;
+    };
+
+    vector< std::unique_ptr< Probe > > vProbes;
+    std::map< string, EdgeInfo > results;
+    string nearest;
+
+    EdgeClock::time_point deadline = EdgeClock::now() + std::chrono::milliseconds(budgetMs);
+    curl_global_init(CURL_GLOBAL_ALL);
+    CURLM* multi = curl_multi_init();
+
+    auto addProbe = [&](const string& url, const string& site, bool connect)
+    {
+        std::unique_ptr< Probe > probe(new Probe);
+        if ((probe->curl = curl_easy_init()) == nullptr)
+            return;
+
+        probe->site = site;
+        probe->connect = connect;
+        curl_easy_setopt(probe->curl, CURLOPT_URL, url.c_str());
+        curl_easy_setopt(probe->curl, CURLOPT_TIMEOUT_MS, (long)budgetMs);
+        curl_easy_setopt(probe->curl, CURLOPT_NOSIGNAL, 1L);
+        curl_easy_setopt(probe->curl, CURLOPT_PRIVATE, probe.get());
+        if (connect)
+            curl_easy_setopt(probe->curl, CURLOPT_CONNECT_ONLY, 1L);
+        else
+        {
+            curl_easy_setopt(probe->curl, CURLOPT_WRITEFUNCTION, EdgeWriteBody);
+            curl_easy_setopt(probe->curl, CURLOPT_WRITEDATA, &probe->body);
+            curl_easy_setopt(probe->curl, CURLOPT_USERAGENT, "curl/7.73.0");
+        }
+
+        probe->attached = (curl_multi_add_handle(multi, probe->curl) == CURLM_OK);
+        vProbes.push_back(std::move(probe));
+    };
+
+    addProbe(MFC_EDGE_RTP_INFO_URL, "", false);
+    for (const char* region : s_edgeRegions)
+        addProbe(RegionInfoUrl(region), region, false);
+
+    int running = 0;
+    bool added = true;
+    while (running > 0 || added)
+    {
+        added = false;
+        if (curl_multi_perform(multi, &running) != CURLM_OK)
+            break;
+
+        CURLMsg* msg;
+        int left = 0;
+        while ((msg = curl_multi_info_read(multi, &left)) != nullptr)
+        {
+            if (msg->msg != CURLMSG_DONE)
+                continue;
+
+            Probe* probe = nullptr;
+            curl_easy_getinfo(msg->easy_handle, CURLINFO_PRIVATE, &probe);
+            bool ok = (msg->data.result == CURLE_OK);
+
+            if (probe->connect)
+            {
+                curl_off_t tmConnect = 0;
+                if (ok && curl_easy_getinfo(msg->easy_handle, CURLINFO_CONNECT_TIME_T, &tmConnect) == CURLE_OK)
+                    results[ probe->site ].connectUs = (int64_t)tmConnect;
+            }
+            else
+            {
+                long status = 0;
+                string site = probe->site, ip;
+                curl_easy_getinfo(msg->easy_handle, CURLINFO_RESPONSE_CODE, &status);
+
+                if (ok && status == 200 && ParseEdgeInfo(probe->body, site, ip) && !site.empty())
+                {
+                    if (probe->site.empty())
+                        nearest = site;
+
+                    // the geo dns answer duplicates one of the regions, only time each site once
+                    if (results.find(site) == results.end())
+                    {
+                        results[ site ].site = site;
+                        results[ site ].ip = ip;
+                        addProbe(string("http://") + ip + ":" + std::to_string(port) + "/", site, true);
+                        added = true;
+                    }
+                }
+            }
+
+            curl_multi_remove_handle(multi, msg->easy_handle);
+            probe->attached = false;
+        }
+
+        auto remaining = std::chrono::duration_cast< std::chrono::milliseconds >(deadline - EdgeClock::now()).count();
+        if (remaining <= 0)
+            break;
+        if (running > 0 && !added)
+            curl_multi_poll(multi, nullptr, 0, (int)std::min< long long >(remaining, 100), nullptr);
+    }
+
+    for (auto& probe : vProbes)
+    {
+        if (probe->attached)
+            curl_multi_remove_handle(multi, probe->curl);
+        curl_easy_cleanup(probe->curl);
+    }
+    curl_multi_cleanup(multi);
+    curl_global_cleanup();
+
+    std::lock_guard< std::mutex > lk(s_edgeMutex);
+    EdgeClock::time_point now = EdgeClock::now();
+    for (auto& entry : results)
+    {
+        entry.second.expires = now + std::chrono::seconds(EDGE_CACHE_TTL_SEC);
+        s_edgeCache[ entry.first ] = entry.second;
+        _TRACE("edge ingest %s: %s connect %.1f ms", entry.first.c_str(), entry.second.ip.c_str(),
+               entry.second.connectUs >= 0 ? entry.second.connectUs / 1000.0 : -1.0);
+    }
+    if (!nearest.empty())
+        s_edgeNearest = nearest;
+    s_edgeRaced = now;
+}
+
+
 // static
 string MFCEdgeIngest::RtmpPublishUrl()
 {
@@ -66,11 +280,9 @@ MFCEdgeIngest::SiteIpPort MFCEdgeIngest::WebrtcTcpIpPort(const std::string& vide
 {
     string ip, site;
     MFCEdgeIngest::SiteIpPort siteIpPort;
-    if (!MFCEdgeIngest::WebrtcTcpIp(site, ip))
-        return siteIpPort;
 
     int port = WebrtcTcpPort(videoServer);
-    if (port > 0)
+    if (port > 0 && MFCEdgeIngest::WebrtcTcpIp(port, site, ip))
     {
         siteIpPort.site = site;
         siteIpPort.tcpIp = ip;
@@ -100,39 +312,64 @@ MFCEdgeIngest::SiteIpPort MFCEdgeIngest::WebrtcTcpIpPort(const string& videoServ
 
 
 // static
-bool MFCEdgeIngest::WebrtcTcpIp(std::string& site, std::string& ip)
+void MFCEdgeIngest::ClearCache()
 {
-    try
-    {
-        const string url = MFC_EDGE_RTP_INFO_URL;
-        unsigned int dwLen = 0;
-        CCurlHttpRequest httpreq;
-        uint8_t* pResponse = httpreq.Get(url, &dwLen, "", nullptr);
-        if (!pResponse)
-            return false;
+    std::lock_guard< std::mutex > lk(s_edgeMutex);
+    s_edgeCache.clear();
+    s_edgeNearest.clear();
+    s_edgeRaced = EdgeClock::time_point();
+}
 
-        const auto res = njson::parse((char*)pResponse);
-        ip = res["ip"].get<string>();
-        site = ToLower(res["site"].get<string>());
 
-        free(pResponse);
-        pResponse = nullptr;
-        return true;
+// static
+bool MFCEdgeIngest::WebrtcTcpIp(int port, std::string& site, std::string& ip)
+{
+    // Only one caller races, anyone arriving meanwhile waits and then reads the cache
+    std::lock_guard< std::mutex > lkRace(s_edgeRaceMutex);
+    {
+        std::lock_guard< std::mutex > lk(s_edgeMutex);
+        if (const EdgeInfo* pBest = BestCachedEdge())
+        {
+            site = pBest->site;
+            ip = pBest->ip;
+            return true;
+        }
     }
-    catch (const std::exception& e)
+
+    RaceEdges(port, EDGE_RACE_BUDGET_MS);
+
+    std::lock_guard< std::mutex > lk(s_edgeMutex);
+    if (const EdgeInfo* pBest = BestCachedEdge())
     {
-        _MESG("Error fetching edge IP: %s", e.what());
-        return false;
+        site = pBest->site;
+        ip = pBest->ip;
+        _MESG("Selected edge ingest %s (%s)%s", site.c_str(), ip.c_str(),
+              pBest->connectUs >= 0 ? "" : ", no connect times measured");
+        return true;
     }
+
+    _MESG("Error fetching edge IP: no edge ingest answered within %d ms", EDGE_RACE_BUDGET_MS);
+    return false;
 }
 
 
 // static
 bool MFCEdgeIngest::WebrtcTcpIp(const string& region, std::string& ip)
 {
+    const string site = ToLower(region);
+    {
+        std::lock_guard< std::mutex > lk(s_edgeMutex);
+        auto iCached = s_edgeCache.find(site);
+        if (iCached != s_edgeCache.end() && iCached->second.expires > EdgeClock::now() && !iCached->second.ip.empty())
+        {
+            ip = iCached->second.ip;
+            return true;
+        }
+    }
+
     try
     {
-        const string url = string("https://rtp-edgeingest-") + ToLower(region) + ".myfreecams.com/edge/info.json";
+        const string url = RegionInfoUrl(region);
         unsigned int dwLen = 0;
         CCurlHttpRequest httpreq;
         uint8_t* pResponse = httpreq.Get(url, &dwLen, "", nullptr);
@@ -144,6 +381,14 @@ bool MFCEdgeIngest::WebrtcTcpIp(const string& region, std::string& ip)
 
         free(pResponse);
         pResponse = nullptr;
+
+        std::lock_guard< std::mutex > lk(s_edgeMutex);
+        EdgeInfo& info = s_edgeCache[ site ];
+        if (info.ip != ip)
+            info.connectUs = -1;
+        info.site = site;
+        info.ip = ip;
+        info.expires = EdgeClock::now() + std::chrono::seconds(EDGE_CACHE_TTL_SEC);
         return true;
     }
     catch (const std::exception& e)
@@ -157,8 +402,8 @@ bool MFCEdgeIngest::WebrtcTcpIp(const string& region, std::string& ip)
 // static
 int MFCEdgeIngest::WebrtcTcpPort(const string& videoServer)
 {
+    static const std::regex re("video([0-9]{3,4})");
     std::smatch match;
-    std::regex re("video([0-9]{3,4})");
     if (!std::regex_search(videoServer, match, re))
         return 0;
 
@@ -45,7 +45,9 @@ public:
     static std::string RtmpPublishUrl(const std::string& region);
 
     /**
-     * Nearest WebRTC edge ingest site, ip address, and port for |videoServer|.
+     * Fastest WebRTC edge ingest site, ip address, and port for |videoServer|.
+     * Races every regional ingest and returns the one with the quickest TCP connect,
+     * results are cached for EDGE_CACHE_TTL_SEC so later calls don't touch the network.
      * @param videoServer - Example: "video343"
      */
     static SiteIpPort WebrtcTcpIpPort(const std::string& videoServer);
@@ -57,11 +59,16 @@ public:
      */
     static SiteIpPort WebrtcTcpIpPort(const std::string& videoServer, const std::string& region);
 
+    /**
+     * Forget cached edge lookups and timings, the next call races the regions again.
+     */
+    static void ClearCache();
+
 private:
     /**
-     * WebRTC ingest |ip| address for nearest |site|.
+     * WebRTC ingest |ip| address for the fastest |site|, measured by connecting to |port|.
      */
-    static bool WebrtcTcpIp(std::string& site, std::string& ip);
+    static bool WebrtcTcpIp(int port, std::string& site, std::string& ip);
 
     /**
      * WebRTC ingest |ip| address for |region|.
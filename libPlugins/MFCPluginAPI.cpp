@@ -55,8 +55,7 @@ using std::string;
 
 CBroadcastCtx g_ctx(true);
 
-std::deque<SIDEKICK_UI_EV>  CBroadcastCtx::sm_eventQueue;
-std::recursive_mutex        CBroadcastCtx::sm_eventLock;
+SidekickEventQueue          CBroadcastCtx::sm_events;
 EdgeChatSock*               CBroadcastCtx::sm_edgeSock = nullptr;
 
 
@@ -87,10 +86,10 @@ int CMFCPluginAPI::StartupReport(int nPluginType)
     //if ( ! g_ctx.readPluginConfig())
     //    _MESG("FAILED to readPluginConfig()....");
 
-    int nUserId         = g_ctx.cfg.getInt("uid");
-    string sModelUser   = g_ctx.cfg.getString("username");
-    string sModelPwd    = g_ctx.cfg.getString("vidctx");
-    string sStreamKey   = g_ctx.cfg.getString("ctx");
+    int nUserId         = g_ctx.cfg.getInt(SkCfg::Uid);
+    string sModelUser   = g_ctx.cfg.getString(SkCfg::Username);
+    string sModelPwd    = g_ctx.cfg.getString(SkCfg::VidCtx);
+    string sStreamKey   = g_ctx.cfg.getString(SkCfg::Ctx);
 
     if (sStreamKey.empty())
     {
@@ -188,8 +187,8 @@ int CMFCPluginAPI::SendSystemReport(void)
     g_ctx.readPluginConfig(false);
     MfcJsonObj json;
 
-    json.objectAdd("modelUserID", g_ctx.cfg.getInt("uid"));
-    string sMSK = g_ctx.cfg.getString("ctx");
+    json.objectAdd("modelUserID", g_ctx.cfg.getInt(SkCfg::Uid));
+    string sMSK = g_ctx.cfg.getString(SkCfg::Ctx);
     json.objectAdd("modelStreamingKey", sMSK);
 
     // add the parameters as an array.
@@ -265,18 +264,18 @@ int CMFCPluginAPI::SendHeartBeat(void)
     string sPayload, tokenKey, sErr, sKey;
     time_t nNow = time(nullptr), tokenTm = 0;
 
-    uint32_t nUid = g_ctx.cfg.getInt("uid");
+    uint32_t nUid = g_ctx.cfg.getInt(SkCfg::Uid);
     if (nUid == 0)
         return ERR_NEED_LOGIN;
 
-    if (    g_ctx.cfg.getString("tok", tokenKey)
-        &&  g_ctx.cfg.getTime("tok_tm", tokenTm)
+    if (    g_ctx.cfg.getString(SkCfg::Tok, tokenKey)
+        &&  g_ctx.cfg.getTime(SkCfg::TokTm, tokenTm)
         &&  (nNow - tokenTm) < 300)
     {
         // continue existing session with fcs service using tok that is less than 5m old
         sKey = "tok";
     }
-    else if (g_ctx.cfg.getString("ctx", tokenKey) && tokenKey.size() > 3)
+    else if (g_ctx.cfg.getString(SkCfg::Ctx, tokenKey) && tokenKey.size() > 3)
     {
         sKey = "sk";
     }
@@ -323,22 +322,22 @@ int CMFCPluginAPI::SendHeartBeat(void)
                 if (nErr == S_OK)
                 {
                     SidekickActiveState prevState = g_ctx.activeState;
-                    int prevUid = g_ctx.cfg.getInt("uid");
+                    int prevUid = g_ctx.cfg.getInt(SkCfg::Uid);
                     nErr = EFAULT;
 
                     if (g_ctx.DeserializeCfg(jo, true))
                     {
-                        g_ctx.cfg.set("tok_tm", nNow);
-                        g_ctx.cfg.writePluginConfig();
+                        g_ctx.cfg.set(SkCfg::TokTm, nNow);
+                        g_ctx.cfg.savePluginConfig();
                         nErr = S_OK;
 
                         // Debug log if we detect state or uid changes as a result of the new plugin config data
-                        if (g_ctx.activeState != prevState || g_ctx.cfg.getInt("uid") != prevUid)
+                        if (g_ctx.activeState != prevState || g_ctx.cfg.getInt(SkCfg::Uid) != prevUid)
                         {
                             blog(   100,
                                     "[svcAgent Heartbeat] uid: %u => %u skState: %s (%u => %u)",
                                     prevUid,
-                                    g_ctx.cfg.getInt("uid"),
+                                    g_ctx.cfg.getInt(SkCfg::Uid),
                                     CBroadcastCtx::MapSidekickState(g_ctx.activeState),
                                     (unsigned int)prevState,
                                     (unsigned int)g_ctx.activeState);
@@ -384,8 +383,8 @@ int CMFCPluginAPI::SendHeartBeat(void)
                 }
                 else if (nErr == EPERM)
                 {
-                    uint32_t nCurSid = g_ctx.cfg.getInt("sid");
-                    uint32_t nCurUid = g_ctx.cfg.getInt("uid");
+                    uint32_t nCurSid = g_ctx.cfg.getInt(SkCfg::Sid);
+                    uint32_t nCurUid = g_ctx.cfg.getInt(SkCfg::Uid);
 
                     // Sidekick agent svc response had error, make sure to correct g_ctx state if it thinks we are linked
                     g_ctx.clear(true);
@@ -439,9 +438,9 @@ int CMFCPluginAPI::ShutdownReport(int nPluginType)
     auto lk = g_ctx.sharedLock();
     MfcJsonObj json;
 
-    json.objectAdd("modelUserID", g_ctx.cfg.getInt("uid"));
+    json.objectAdd("modelUserID", g_ctx.cfg.getInt(SkCfg::Uid));
     json.objectAdd("pluginType", nPluginType);
-    json.objectAdd("modelStreamingKey", g_ctx.cfg.getString("ctx"));
+    json.objectAdd("modelStreamingKey", g_ctx.cfg.getString(SkCfg::Ctx));
 
 #ifdef _DEBUG
     string s = json.prettySerialize();
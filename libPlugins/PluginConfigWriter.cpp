@@ -0,0 +1,376 @@
+/*
+ * Copyright (c) 2013-2021 MFCXY, Inc. <mfcxy@mfcxy.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+// System Includes
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <stdio.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#include <io.h>
+#include <share.h>
+#else
+#include <unistd.h>
+#endif
+
+// solution includes
+#include <libfcs/Log.h>
+#include <libfcs/fcslib_string.h>
+
+// project includes
+#include "PluginConfigWriter.h"
+
+using std::string;
+using std::unique_lock;
+using std::lock_guard;
+using std::mutex;
+
+
+CPluginConfigWriter& CPluginConfigWriter::instance(void)
+{
+    static CPluginConfigWriter s_writer;
+    return s_writer;
+}
+
+
+CPluginConfigWriter::CPluginConfigWriter()
+    : m_nSeq(0)
+    , m_nInFlight(0)
+    , m_stopped(false)
+    , m_debounce(500)
+    , m_maxDelay(3000)
+    , m_nRequests(0)
+    , m_nWrites(0)
+    , m_nCoalesced(0)
+    , m_nUnchanged(0)
+    , m_nFailed(0)
+{}
+
+
+CPluginConfigWriter::~CPluginConfigWriter()
+{
+    // obs_module_unload() calls stop(). At exit the timer wheel may already be gone, so
+    // nothing here touches it: anything still pending is written directly, its timer
+    // is left to die with the wheel.
+    std::map< string, Pending > pendingWrites;
+    {
+        lock_guard< mutex > lk(m_mutex);
+        pendingWrites.swap(m_pending);
+    }
+
+    for (const auto& pending : pendingWrites)
+        commit(pending.first, pending.second.sData, pending.second.nSeq);
+}
+
+
+void CPluginConfigWriter::setDebounce(std::chrono::milliseconds debounce, std::chrono::milliseconds maxDelay)
+{
+    lock_guard< mutex > lk(m_mutex);
+    m_debounce = debounce;
+    m_maxDelay = maxDelay < debounce ? debounce : maxDelay;
+}
+
+
+CPluginConfigWriter::Stats CPluginConfigWriter::getStats(void) const
+{
+    Stats stats;
+    stats.requests  = m_nRequests;
+    stats.writes    = m_nWrites;
+    stats.coalesced = m_nCoalesced;
+    stats.unchanged = m_nUnchanged;
+    stats.failed    = m_nFailed;
+    return stats;
+}
+
+
+void CPluginConfigWriter::schedule(const string& sFilename, const string& sData)
+{
+    unique_lock< mutex > lk(m_mutex);
+    uint64_t nSeq = ++m_nSeq;
+    m_nRequests++;
+
+    if (m_stopped)
+    {
+        // Shutting down (or already shut down), nobody left to write it later
+        lk.unlock();
+        commit(sFilename, sData, nSeq);
+        return;
+    }
+
+    Clock::time_point tmNow = Clock::now();
+    auto iPending = m_pending.find(sFilename);
+
+    if (iPending != m_pending.end())
+    {
+        // Push the deadline out by another debounce window, but never further
+        // than maxDelay from the first change that hasn't been written yet.
+        Pending& pending = iPending->second;
+        pending.sData = sData;
+        pending.nSeq = nSeq;
+        pending.tmDue = std::min(tmNow + m_debounce, pending.tmFirst + m_maxDelay);
+        m_nCoalesced++;
+
+        CTimerWheel::instance().cancel(pending.nTimer);
+    }
+    else iPending = m_pending.emplace(sFilename, Pending{ sData, nSeq, tmNow, tmNow + m_debounce, CTimerWheel::INVALID_TIMER }).first;
+
+    if (!armTimer(sFilename, iPending->second))
+    {
+        // The timer wheel is already shut down, write it ourselves
+        m_pending.erase(iPending);
+        lk.unlock();
+        commit(sFilename, sData, nSeq);
+    }
+}
+
+
+bool CPluginConfigWriter::writeNow(const string& sFilename, const string& sData)
+{
+    unique_lock< mutex > lk(m_mutex);
+    uint64_t nSeq = ++m_nSeq;
+    m_nRequests++;
+
+    // Whatever was pending for this file is older than sData, drop it.
+    auto iPending = m_pending.find(sFilename);
+    if (iPending != m_pending.end())
+    {
+        CTimerWheel::instance().cancel(iPending->second.nTimer);
+        m_pending.erase(iPending);
+        m_nCoalesced++;
+    }
+
+    lk.unlock();
+    return commit(sFilename, sData, nSeq);
+}
+
+
+void CPluginConfigWriter::flush(void)
+{
+    unique_lock< mutex > lk(m_mutex);
+    std::vector< std::pair< string, Pending > > vBatch;
+
+    for (auto& pending : m_pending)
+    {
+        CTimerWheel::instance().cancel(pending.second.nTimer);
+        vBatch.emplace_back(pending.first, std::move(pending.second));
+    }
+    m_pending.clear();
+
+    m_nInFlight += vBatch.size();
+    lk.unlock();
+
+    for (const auto& item : vBatch)
+        commit(item.first, item.second.sData, item.second.nSeq);
+
+    lk.lock();
+    m_nInFlight -= vBatch.size();
+
+    // and wait out any write a worker is already doing
+    m_cvIdle.notify_all();
+    m_cvIdle.wait(lk, [this]() { return m_nInFlight == 0; });
+}
+
+
+void CPluginConfigWriter::stop(void)
+{
+    {
+        lock_guard< mutex > lk(m_mutex);
+        if (m_stopped)
+            return;
+
+        m_stopped = true;
+    }
+
+    // schedule() writes synchronously from here on, write out what is still pending
+    flush();
+
+    Stats stats = getStats();
+    _TRACE("Config writer stopped; %llu requests, %llu writes, %llu coalesced, %llu unchanged, %llu failed",
+           (unsigned long long)stats.requests,
+           (unsigned long long)stats.writes,
+           (unsigned long long)stats.coalesced,
+           (unsigned long long)stats.unchanged,
+           (unsigned long long)stats.failed);
+}
+
+
+// Puts the timer for pending's deadline on the wheel, false if the wheel is stopped
+bool CPluginConfigWriter::armTimer(const string& sFilename, Pending& pending)
+{
+    auto delay = std::chrono::duration_cast< std::chrono::milliseconds >(pending.tmDue - Clock::now());
+
+    pending.nTimer = CTimerWheel::instance().addOneShot(std::max< int64_t >(delay.count(), 0),
+                                                        [this, sFilename]() { writePending(sFilename); },
+                                                        CTimerWheel::BulkWorker, "configWrite");
+    return pending.nTimer != CTimerWheel::INVALID_TIMER;
+}
+
+
+// Runs on a CExecutor worker when the debounce timer for sFilename fires
+void CPluginConfigWriter::writePending(const string& sFilename)
+{
+    unique_lock< mutex > lk(m_mutex);
+    auto iPending = m_pending.find(sFilename);
+    if (iPending == m_pending.end())
+        return;
+
+    // a timer re-armed by a schedule() that raced with this one firing is moot now
+    Pending pending = std::move(iPending->second);
+    m_pending.erase(iPending);
+    CTimerWheel::instance().cancel(pending.nTimer);
+
+    m_nInFlight++;
+    lk.unlock();
+
+    commit(sFilename, pending.sData, pending.nSeq);
+
+    lk.lock();
+    m_nInFlight--;
+    m_cvIdle.notify_all();
+}
+
+
+bool CPluginConfigWriter::commit(const string& sFilename, const string& sData, uint64_t nSeq)
+{
+    lock_guard< mutex > lk(m_ioMutex);
+    auto iWritten = m_written.find(sFilename);
+
+    if (iWritten == m_written.end())
+    {
+        // First time we've seen this file, compare against what is on disk now
+        string sDisk;
+        stdGetFileContents(sFilename, sDisk);
+        iWritten = m_written.emplace(sFilename, std::make_pair((uint64_t)0, sDisk)).first;
+    }
+
+    uint64_t& nWrittenSeq = iWritten->second.first;
+    string& sWritten = iWritten->second.second;
+
+    if (nSeq < nWrittenSeq)
+    {
+        // A newer version already made it to disk through writeNow()
+        m_nCoalesced++;
+        return true;
+    }
+
+    nWrittenSeq = nSeq;
+
+    if (sData == sWritten)
+    {
+        m_nUnchanged++;
+        return true;
+    }
+
+    if (!atomicWriteFile(sFilename, sData))
+    {
+        m_nFailed++;
+        // Forget what we think is on disk so the next attempt isn't skipped
+        m_written.erase(iWritten);
+        return false;
+    }
+
+    sWritten = sData;
+    m_nWrites++;
+    return true;
+}
+
+
+bool CPluginConfigWriter::atomicWriteFile(const string& sFilename, const string& sData)
+{
+    string sTmpFile = sFilename + ".tmp";
+    size_t nWrote = 0, nSz = sData.size();
+    bool retVal = false;
+    int nFd, n;
+
+#ifdef _WIN32
+    if (_sopen_s(&nFd, sTmpFile.c_str(), _O_WRONLY | _O_BINARY | _O_CREAT | _O_TRUNC, _SH_DENYRW, _S_IREAD | _S_IWRITE) != 0)
+        nFd = -1;
+#else
+    nFd = open(sTmpFile.c_str(), O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP);
+#endif
+
+    if (nFd == -1)
+    {
+        _MESG("unable to open %s for writing: %s (%d)", sTmpFile.c_str(), strerror(errno), errno);
+        return false;
+    }
+
+    while (nWrote < nSz)
+    {
+#ifdef _WIN32
+        n = _write(nFd, sData.c_str() + nWrote, (unsigned int)(nSz - nWrote));
+#else
+        n = (int)write(nFd, sData.c_str() + nWrote, nSz - nWrote);
+#endif
+        if (n < 0)
+        {
+            if (errno == EINTR)
+                continue;
+
+            _MESG("unable to write() to %s [%zu of %zu bytes]: %s (%d)",
+                  sTmpFile.c_str(), nWrote, nSz, strerror(errno), errno);
+            break;
+        }
+        nWrote += (size_t)n;
+    }
+
+    if (nWrote == nSz)
+    {
+#ifdef _WIN32
+        retVal = (_commit(nFd) == 0);
+#else
+        retVal = (fsync(nFd) == 0);
+#endif
+        if (!retVal)
+            _MESG("unable to fsync %s: %s (%d)", sTmpFile.c_str(), strerror(errno), errno);
+    }
+
+#ifdef _WIN32
+    _close(nFd);
+#else
+    close(nFd);
+#endif
+
+    if (retVal)
+    {
+#ifdef _WIN32
+        retVal = (MoveFileExA(sTmpFile.c_str(), sFilename.c_str(), MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH) != 0);
+        if (!retVal)
+            _MESG("unable to move %s over %s: error %lu", sTmpFile.c_str(), sFilename.c_str(), GetLastError());
+#else
+        retVal = (rename(sTmpFile.c_str(), sFilename.c_str()) == 0);
+        if (!retVal)
+            _MESG("unable to rename %s to %s: %s (%d)", sTmpFile.c_str(), sFilename.c_str(), strerror(errno), errno);
+#endif
+    }
+
+    if (!retVal)
+    {
+#ifdef _WIN32
+        _unlink(sTmpFile.c_str());
+#else
+        unlink(sTmpFile.c_str());
+#endif
+    }
+
+    return retVal;
+}
@@ -0,0 +1,121 @@
+/*
+ * Copyright (c) 2013-2021 MFCXY, Inc. <mfcxy@mfcxy.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#pragma once
+
+#ifndef PLUGIN_CONFIG_WRITER_H_
+#define PLUGIN_CONFIG_WRITER_H_
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <string>
+
+#include "TimerWheel.h"
+
+// Write-behind persistence for plugin config files.
+//
+// schedule() records the latest serialized contents for a file and returns right away.
+// It is written once no new changes have arrived for the debounce window, or once
+// maxDelay has passed since the first unwritten change, whichever is first: each
+// pending file has a one-shot CTimerWheel timer for its deadline that hands the write
+// to a CExecutor worker. Bursts of updates collapse into one write. Writes go to a
+// temp file that is fsync'ed and then renamed over the target, so a crash never leaves
+// a half written config behind. A write is skipped if the bytes match what is already
+// on disk.
+//
+class CPluginConfigWriter
+{
+public:
+    struct Stats
+    {
+        uint64_t    requests;       // schedule() and writeNow() calls
+        uint64_t    writes;         // files actually written to disk
+        uint64_t    coalesced;      // requests folded into a later pending write
+        uint64_t    unchanged;      // writes avoided because contents were identical
+        uint64_t    failed;         // write, fsync or rename failures
+    };
+
+    static CPluginConfigWriter& instance(void);
+
+    ~CPluginConfigWriter();
+
+    // Queue sData to be written to sFilename after the debounce window.
+    void schedule(const std::string& sFilename, const std::string& sData);
+
+    // Write sData to sFilename synchronously, superseding anything pending for it.
+    bool writeNow(const std::string& sFilename, const std::string& sData);
+
+    // Write out everything pending now, returns after all writes complete.
+    void flush(void);
+
+    // Flushes pending writes, schedule() after stop() falls back to writing synchronously.
+    void stop(void);
+
+    void setDebounce(std::chrono::milliseconds debounce, std::chrono::milliseconds maxDelay);
+
+    Stats getStats(void) const;
+
+    // Writes sData to sFilename.tmp, fsyncs, then renames it over sFilename.
+    static bool atomicWriteFile(const std::string& sFilename, const std::string& sData);
+
+private:
+    CPluginConfigWriter();
+    CPluginConfigWriter(const CPluginConfigWriter&) = delete;
+    CPluginConfigWriter& operator=(const CPluginConfigWriter&) = delete;
+
+    typedef std::chrono::steady_clock Clock;
+
+    struct Pending
+    {
+        std::string         sData;
+        uint64_t            nSeq;
+        Clock::time_point   tmFirst;    // first change not yet on disk
+        Clock::time_point   tmDue;      // when the write is due
+        CTimerWheel::TimerId nTimer;    // fires at tmDue
+    };
+
+    bool armTimer(const std::string& sFilename, Pending& pending);
+    void writePending(const std::string& sFilename);
+
+    // Writes sData unless a newer sequence was already written or the bytes match
+    // what was last written. Serialized by m_ioMutex.
+    bool commit(const std::string& sFilename, const std::string& sData, uint64_t nSeq);
+
+    mutable std::mutex                  m_mutex;        // protects m_pending, m_nSeq & m_nInFlight
+    std::condition_variable             m_cvIdle;       // m_nInFlight went down
+    std::map< std::string, Pending >    m_pending;
+    uint64_t                            m_nSeq;
+    size_t                              m_nInFlight;    // writes taken out of m_pending but not done yet
+    bool                                m_stopped;
+
+    std::chrono::milliseconds           m_debounce;
+    std::chrono::milliseconds           m_maxDelay;
+
+    std::mutex                          m_ioMutex;      // protects m_written
+    std::map< std::string, std::pair< uint64_t, std::string > > m_written;
+
+    std::atomic< uint64_t >             m_nRequests;
+    std::atomic< uint64_t >             m_nWrites;
+    std::atomic< uint64_t >             m_nCoalesced;
+    std::atomic< uint64_t >             m_nUnchanged;
+    std::atomic< uint64_t >             m_nFailed;
+};
+
+#endif  // PLUGIN_CONFIG_WRITER_H_
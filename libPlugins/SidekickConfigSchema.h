@@ -0,0 +1,143 @@
+/*
+ * Copyright (c) 2013-2021 MFCXY, Inc. <mfcxy@mfcxy.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#pragma once
+
+#ifndef SIDEKICK_CONFIG_SCHEMA_H_
+#define SIDEKICK_CONFIG_SCHEMA_H_
+
+#include <cstddef>
+#include <cstdint>
+
+// Every well known key of the sidekick plugin config is declared once here, with
+// its json key name, data type and default value. Each entry gets a dense slot
+// index in SkCfg, so typed lookups in SidekickModelConfig are an array index
+// instead of a string compare and map lookup. Keys not declared here still
+// round-trip through the plugin config json, they just have no slot or default.
+//
+//  X( slot,            json key,       type,       default         )
+#define SIDEKICK_CONFIG_SCHEMA(X)                                       \
+    X( Sid,             "sid",          Int,        0               )   \
+    X( Uid,             "uid",          Int,        0               )   \
+    X( Room,            "room",         Int,        0               )   \
+    X( RetryCount,      "retrycount",   Int,        5               )   \
+    X( HbInterval,      "hbinterval",   Int,        60              )   \
+    X( Username,        "username",     String,     ""              )   \
+    X( Codec,           "codec",        String,     "h264"          )   \
+    X( Prot,            "prot",         String,     "TCP"           )   \
+    X( Pwd,             "pwd",          String,     ""              )   \
+    X( StreamKey,       "streamkey",    String,     ""              )   \
+    X( Ctx,             "ctx",          String,     ""              )   \
+    X( VidCtx,          "vidctx",       String,     ""              )   \
+    X( Version,         "version",      String,     "default"       )   \
+    X( StreamName,      "streamName",   String,     "ext_x_0.f4v"   )   \
+    X( Tok,             "tok",          String,     ""              )   \
+    X( Region,          "region",       String,     ""              )   \
+    X( VideoServer,     "videoserver",  String,     ""              )   \
+    X( StreamUrl,       "streamurl",    String,     ""              )   \
+    X( ServiceType,     "serviceType",  String,     ""              )   \
+    X( LogLevels,       "loglevels",    String,     ""              )   \
+    X( SendLogs,        "sendlogs",     Bool,       false           )   \
+    X( Trace,           "trace",        Bool,       false           )   \
+    X( UpdUpd,          "updupd",       Bool,       false           )   \
+    X( UpdSr,           "updsr",        Bool,       false           )   \
+    X( AllowConnect,    "allowConnect", Bool,       true            )   \
+    X( CamScore,        "camscore",     Float,      0.00            )   \
+    X( TokTm,           "tok_tm",       Time,       0               )   \
+    X( Stamp,           "stamp",        Time,       0               )
+
+
+enum class SkCfgType : uint8_t
+{
+    Int,
+    String,
+    Bool,
+    Float,
+    Time
+};
+
+
+// Dense slot index of each key declared in SIDEKICK_CONFIG_SCHEMA.
+enum class SkCfg : uint32_t
+{
+#define SKCFG_SLOT(slot, key, type, def) slot,
+    SIDEKICK_CONFIG_SCHEMA(SKCFG_SLOT)
+#undef SKCFG_SLOT
+    Count
+};
+
+static constexpr size_t SkCfgCount = static_cast< size_t >(SkCfg::Count);
+
+
+struct SkCfgKeyDef
+{
+    const char* pszKey;
+    SkCfgType   type;
+    int64_t     nDefault;       // Int, Time and Bool defaults
+    double      dDefault;       // Float defaults
+    const char* pszDefault;     // String defaults
+
+    static constexpr SkCfgKeyDef makeInt(const char* k, int64_t n)         { return { k, SkCfgType::Int,    n, 0.0, ""  }; }
+    static constexpr SkCfgKeyDef makeTime(const char* k, int64_t n)        { return { k, SkCfgType::Time,   n, 0.0, ""  }; }
+    static constexpr SkCfgKeyDef makeBool(const char* k, bool f)           { return { k, SkCfgType::Bool,   f ? 1 : 0, 0.0, "" }; }
+    static constexpr SkCfgKeyDef makeFloat(const char* k, double d)        { return { k, SkCfgType::Float,  0, d,   ""  }; }
+    static constexpr SkCfgKeyDef makeString(const char* k, const char* s)  { return { k, SkCfgType::String, 0, 0.0, s   }; }
+};
+
+
+inline constexpr SkCfgKeyDef g_skCfgSchema[SkCfgCount] =
+{
+#define SKCFG_DEF(slot, key, type, def) SkCfgKeyDef::make##type(key, def),
+    SIDEKICK_CONFIG_SCHEMA(SKCFG_DEF)
+#undef SKCFG_DEF
+};
+
+
+constexpr const SkCfgKeyDef& skCfgDef(SkCfg slot)
+{
+    return g_skCfgSchema[ static_cast< size_t >(slot) ];
+}
+
+
+constexpr bool skCfgKeyEquals(const char* pszA, const char* pszB)
+{
+    while (*pszA && *pszA == *pszB)
+    {
+        ++pszA;
+        ++pszB;
+    }
+    return *pszA == *pszB;
+}
+
+
+// Maps a json key name to its slot, or SkCfg::Count if the key isn't part of
+// the schema. Evaluated at compile time when passed a string literal in a
+// constant expression, e.g. constexpr SkCfg k = skCfgSlot("uid");
+constexpr SkCfg skCfgSlot(const char* pszKey)
+{
+    for (size_t n = 0; n < SkCfgCount; n++)
+        if (skCfgKeyEquals(g_skCfgSchema[ n ].pszKey, pszKey))
+            return static_cast< SkCfg >(n);
+
+    return SkCfg::Count;
+}
+
+
+static_assert(skCfgSlot("sid") == SkCfg::Sid,       "config schema slot lookup is broken");
+static_assert(skCfgSlot("stamp") == SkCfg::Stamp,   "config schema slot lookup is broken");
+static_assert(skCfgSlot("bogus") == SkCfg::Count,   "config schema slot lookup is broken");
+
+#endif  // SIDEKICK_CONFIG_SCHEMA_H_
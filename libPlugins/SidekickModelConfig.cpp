@@ -36,15 +36,13 @@
 #include "libfcs/fcs_b64.h"
 
 // project includes
-//#include "MFCConfigConstants.h"
+#include "MFCConfigConstants.h"
 #include "ObsServicesJson.h"
 #include "ObsUtil.h"
+#include "PluginConfigWriter.h"
 #include "SidekickModelConfig.h"
 
-bool                        SidekickModelConfig::sm_initialized = false;
 size_t                      SidekickModelConfig::sm_nRefCx = 0;
-map< string, MfcJsonObj >   SidekickModelConfig::sm_reqProps;
-vector< string >            SidekickModelConfig::sm_vAllocs;
 
 
 #ifdef _WIN32
@@ -55,70 +53,62 @@ bool DirectoryExists(const char* szPath)
 }
 #endif
 
-void SidekickModelConfig::initializeDefaults(void)
+void SidekickModelConfig::bindSlot(SkCfg key)
 {
-    unsigned int n;
-
-    if (!sm_initialized)
-    {
-        sm_initialized = true;
-
-        sm_vAllocs.clear();
-        sm_reqProps.clear();
-
-        // Initialize default properties:
-        // integers, strings, booleans, double/floats, and time_ts -- their key name string and default
-        // value, by data type.
-        //
-        // TODO: Change over to a single json initialized block of key/values instead of this
-        // kludgey hack.
-        //
-        const char* ppszKeys1[] = { "sid",          "uid",          "retrycount",   "hbinterval"    };
-        int64_t     pnVals[]    = { 0,              0,              5,              60              };
-
-        const char* ppszKeys2[] = { "username",     "codec",        "prot",         "pwd",          "streamkey",    "ctx",          "version",      "streamName",   "tok",          "region",       "videoserver",  "streamurl" };
-        const char* ppszVals[]  = { "",    "h264",         "TCP",          "",             "",             "",             "default",      "ext_x_0.f4v",  "" ,            "",             "",             ""          };
-
-        const char* ppszKeys3[] = { "sendlogs",     "updupd",       "updsr",        "allowConnect"  };
-        bool        pfVals[]    = { false,          false,          false,          true            };
-
-        const char* ppszKeys4[] = { "camscore"  };
-        double      pdVals[]    = { 0.00        };
+    m_pSlots[ static_cast< size_t >(key) ] = m_jsConfig.objectGet( skCfgDef(key).pszKey );
+}
 
-        const char* ppszKeys5[] = { "tok_tm",       "stamp" };
-        time_t      ptmVals[]   = { 0,              0       };
+void SidekickModelConfig::bindSlots(void)
+{
+    for (size_t n = 0; n < SkCfgCount; n++)
+        bindSlot( static_cast< SkCfg >(n) );
+}
 
-        // these keys arent saved to the profile config, only the global plugin config
-        //const char* ppszPluginKeys[] = { "tm_tok", "tok", "ctx", "pwd", "username" };
+// Pushes the "loglevels" spec (see Log::SetTagLevels) to the runtime log filter and
+// turns span tracing on or off from "trace", so both can be changed by editing
+// sidekick.json while running. Turning tracing off writes the trace next to the logs.
+void SidekickModelConfig::applyLogConfig(void)
+{
+    bool fTrace = getBool(SkCfg::Trace);
+    if (fTrace != MfcTrace::IsEnabled())
+    {
+        MfcTrace::Enable(fTrace);
+        if (fTrace)
+            _MESG("span tracing enabled");
+        else
+            dumpTrace();
+    }
 
-        // Build required properties map with each key's default JSON value
-        for (n = 0; n < sizeof(ppszKeys1) / sizeof(ppszKeys1[0]); n++)
-            sm_reqProps[ ppszKeys1[ n ] ] = MfcJsonObj( pnVals[ n ] );
+    string sSpec = getString(SkCfg::LogLevels);
+    string sCur = Log::GetTagLevels();
 
-        for (n = 0; n < sizeof(ppszKeys2) / sizeof(ppszKeys2[0]); n++)
-            sm_reqProps[ ppszKeys2[ n ] ] = MfcJsonObj( ppszVals[ n ] );
+    if (!Log::SetTagLevels(sSpec))
+        Log::Mesg(ILog::WARNING, "ignoring unrecognized entries in loglevels: %s", sSpec.c_str());
 
-        for (n = 0; n < sizeof(ppszKeys3) / sizeof(ppszKeys3[0]); n++)
-            sm_reqProps[ ppszKeys3[ n ] ] = MfcJsonObj( pfVals[ n ] );
+    string sNew = Log::GetTagLevels();
+    if (sNew != sCur)
+        Log::Mesg("log levels now %s", sNew.c_str());
+}
 
-        for (n = 0; n < sizeof(ppszKeys4) / sizeof(ppszKeys4[0]); n++)
-            sm_reqProps[ ppszKeys4[ n ] ] = MfcJsonObj( pdVals[ n ] );
+// Writes the spans recorded so far as Chrome trace json to the log directory
+bool SidekickModelConfig::dumpTrace(void)
+{
+    string sFile = CObsUtil::AppendPath(CObsUtil::getLogPath(), BROADCAST_FILENAME "-trace.json");
+    size_t nEvents = 0;
+    bool retVal = MfcTrace::Dump(sFile, &nEvents);
 
-        for (n = 0; n < sizeof(ppszKeys5) / sizeof(ppszKeys5[0]); n++)
-            sm_reqProps[ ppszKeys5[ n ] ] = MfcJsonObj( (int64_t)ptmVals[ n ] );
+    if (retVal)
+        _MESG("wrote %zu trace events to %s", nEvents, sFile.c_str());
+    else
+        _MESG("unable to write trace events to %s", sFile.c_str());
 
-        sm_initialized = true;
-    }
+    MfcTrace::Clear();
+    return retVal;
 }
 
-bool SidekickModelConfig::writePluginConfig(void) const
+// Returns path of the plugin config file, making sure its directory exists
+string SidekickModelConfig::pluginConfigPath(void)
 {
-    bool retVal = false;
-
-    // scoped lock of mutex if we are a sharedCtx instance
-    unique_lock< recursive_mutex >  lk(m_csMutex, std::defer_lock);
-    if (isSharedCtx)                lk.lock();
-
     std::string sPluginPath = obs_module_config_path("");
 
 #ifdef _WIN32
@@ -129,16 +119,23 @@ bool SidekickModelConfig::writePluginConfig(void) const
     mkdir(sPluginPath.c_str(), 0770);
 #endif
 
-    std::string sPluginCfg = obs_module_config_path("sidekick.json");
+    return obs_module_config_path("sidekick.json");
+}
 
-#ifdef _WIN32
+bool SidekickModelConfig::writePluginConfig(void) const
+{
+    bool retVal = false;
 
-#endif
+    // scoped lock of mutex if we are a sharedCtx instance
+    unique_lock< recursive_mutex >  lk(m_csMutex, std::defer_lock);
+    if (isSharedCtx)                lk.lock();
+
+    std::string sPluginCfg = pluginConfigPath();
 
     string sData;
     if (m_jsConfig.Serialize(sData) > 0)
     {
-        if (stdSetFileContents(sPluginCfg, sData))
+        if (CPluginConfigWriter::instance().writeNow(sPluginCfg, sData))
         {
             retVal = true;
         }
@@ -150,10 +147,32 @@ bool SidekickModelConfig::writePluginConfig(void) const
     return retVal;
 }
 
+bool SidekickModelConfig::savePluginConfig(void) const
+{
+    bool retVal = false;
+    string sData;
+
+    {
+        unique_lock< recursive_mutex > lk = sharedLock();
+        if (m_jsConfig.Serialize(sData) > 0)
+            retVal = true;
+        else _MESG("failed to serialize plugin config; 0 bytes of data");
+    }
+
+    if (retVal)
+        CPluginConfigWriter::instance().schedule(pluginConfigPath(), sData);
+
+    return retVal;
+}
+
 bool SidekickModelConfig::readPluginConfig(void)
 {
+    unique_lock< recursive_mutex > lk = sharedLock();
     bool retVal = false;
 
+    // a save still in its debounce window would otherwise be read back as the old file
+    CPluginConfigWriter::instance().flush();
+
     std::string sPluginCfg = obs_module_config_path("sidekick.json");
     if ( m_jsConfig.loadFromFile( sPluginCfg ) )
     {
@@ -161,6 +180,8 @@ bool SidekickModelConfig::readPluginConfig(void)
     }
     else _MESG("config failed to load, unable to open '%s' for reading", sPluginCfg.c_str());
 
+    bindSlots();
+    applyLogConfig();
     return retVal;
 }
 
@@ -191,219 +212,349 @@ bool SidekickModelConfig::Deserialize(const string& sData)
         retVal = m_jsConfig.Deserialize(sData);
     }
 
+    bindSlots();
     return retVal;
 }
 
-bool SidekickModelConfig::set(const string& sKey, const string& sVal)
+//---------------------------------------------------------------------------
+// Typed (schema slot) setters
+//
+bool SidekickModelConfig::set(SkCfg key, const string& sVal)
 {
     unique_lock< recursive_mutex > lk = sharedLock();
-    return m_jsConfig.objectAdd(sKey, sVal);
+    bool retVal = m_jsConfig.objectAdd(skCfgDef(key).pszKey, sVal);
+    bindSlot(key);
+    return retVal;
 }
 
-bool SidekickModelConfig::set(const string& sKey, int64_t nVal)
+bool SidekickModelConfig::set(SkCfg key, int64_t nVal)
 {
     unique_lock< recursive_mutex > lk = sharedLock();
-    return m_jsConfig.objectAdd(sKey, nVal);
+    bool retVal = m_jsConfig.objectAdd(skCfgDef(key).pszKey, nVal);
+    bindSlot(key);
+    return retVal;
 }
 
 #ifndef _WIN32
-bool SidekickModelConfig::set(const string& sKey, time_t nVal)
+bool SidekickModelConfig::set(SkCfg key, time_t nVal)
 {
-    unique_lock< recursive_mutex > lk = sharedLock();
-    return m_jsConfig.objectAdd(sKey, nVal);
+    return set(key, (int64_t)nVal);
 }
 #endif
 
-bool SidekickModelConfig::set(const string& sKey, float dVal)
+bool SidekickModelConfig::set(SkCfg key, double dVal)
 {
     unique_lock< recursive_mutex > lk = sharedLock();
-    return m_jsConfig.objectAdd(sKey, dVal);
+    bool retVal = m_jsConfig.objectAdd(skCfgDef(key).pszKey, dVal);
+    bindSlot(key);
+    return retVal;
 }
 
-bool SidekickModelConfig::set(const string& sKey, int nVal)
+bool SidekickModelConfig::set(SkCfg key, bool fVal)
 {
     unique_lock< recursive_mutex > lk = sharedLock();
-    return m_jsConfig.objectAdd(sKey, nVal);
+    bool retVal = m_jsConfig.objectAdd(skCfgDef(key).pszKey, fVal);
+    bindSlot(key);
+    return retVal;
 }
 
-bool SidekickModelConfig::set(const string& sKey, bool fVal)
+bool SidekickModelConfig::set(SkCfg key, int nVal)
+{
+    return set(key, (int64_t)nVal);
+}
+
+//---------------------------------------------------------------------------
+// Typed (schema slot) getters
+//
+bool SidekickModelConfig::getFloat(SkCfg key, float& dValue) const
 {
     unique_lock< recursive_mutex > lk = sharedLock();
-    return m_jsConfig.objectAdd(sKey, fVal);
+    const SkCfgKeyDef& def = skCfgDef(key);
+    const MfcJsonObj* pVal = slot(key);
+    bool retVal = true;
+
+    if (pVal && pVal->isFloat())
+        dValue = (float)pVal->m_dVal;       // Found non-default value for this key
+    else if (def.type == SkCfgType::Float)
+        dValue = (float)def.dDefault;       // Found default float value for this key
+    else if (def.type == SkCfgType::Int || def.type == SkCfgType::Time)
+        dValue = (float)def.nDefault;       // Default int value cast to float
+    else
+        retVal = false;
+
+    return retVal;
 }
 
-bool SidekickModelConfig::getFloat(const string& sKey, float& dValue) const
+bool SidekickModelConfig::getBool(SkCfg key, bool& fValue) const
 {
     unique_lock< recursive_mutex > lk = sharedLock();
-    map< string, MfcJsonObj >::iterator iProp;
-    bool retVal = false;
-    double dVal;
+    const SkCfgKeyDef& def = skCfgDef(key);
+    const MfcJsonObj* pVal = slot(key);
+    bool retVal = true;
+
+    if (pVal && pVal->isBoolean())
+        fValue = pVal->m_fVal;              // Found non-default value for this key
+    else if (def.type == SkCfgType::Bool
+         ||  def.type == SkCfgType::Int
+         ||  def.type == SkCfgType::Time)
+        fValue = (def.nDefault != 0);       // Default bool, or int cast to bool
+    else
+        retVal = false;
 
-    initializeDefaults();
+    return retVal;
+}
 
-    if (m_jsConfig.objectGetFloat(sKey, dVal))
+bool SidekickModelConfig::getInt(SkCfg key, int64_t& nValue) const
+{
+    unique_lock< recursive_mutex > lk = sharedLock();
+    const SkCfgKeyDef& def = skCfgDef(key);
+    const MfcJsonObj* pVal = slot(key);
+    bool retVal = true;
+
+    if (pVal && pVal->isInt())
+        nValue = pVal->m_nVal;              // Found non-default value for this key
+    else if (def.type == SkCfgType::Int || def.type == SkCfgType::Time)
+        nValue = def.nDefault;              // Found default int value for this key
+    else if (def.type == SkCfgType::Float)
+        nValue = (int)def.dDefault;         // Default float value cast to int
+    else
+        retVal = false;
+
+    return retVal;
+}
+
+bool SidekickModelConfig::getInt(SkCfg key, int& nValue) const
+{
+    int64_t nVal;
+    bool retVal = false;
+
+    if (getInt(key, nVal))
     {
-        // Found non-default value for this key, copied into dValue
-        dValue = (float)dVal;
+        nValue = (int)nVal;
         retVal = true;
     }
-    else if ((iProp = sm_reqProps.find(sKey)) != sm_reqProps.end())
+    return retVal;
+}
+
+bool SidekickModelConfig::getTime(SkCfg key, time_t& nValue) const
+{
+    int64_t nVal;
+    bool retVal = false;
+
+    if (getInt(key, nVal))
     {
-        if (iProp->second.isFloat())
-        {
-            // Found default float value for this key, copied to dValue
-            dValue = (float)iProp->second.m_dVal;
-            retVal = true;
-        }
-        else if (iProp->second.isInt())
-        {
-            // Found default int value for this key, cast to
-            // float and copied to dValue
-            dValue = (float)iProp->second.m_nVal;
-            retVal = true;
-        }
+        nValue = (time_t)nVal;
+        retVal = true;
     }
-
     return retVal;
 }
 
-bool SidekickModelConfig::getBool(const string& sKey, bool& fValue) const
+bool SidekickModelConfig::getString(SkCfg key, string& sValue) const
 {
     unique_lock< recursive_mutex > lk = sharedLock();
-    map< string, MfcJsonObj >::iterator iProp;
-    bool retVal = false;
+    const SkCfgKeyDef& def = skCfgDef(key);
+    const MfcJsonObj* pVal = slot(key);
+    bool retVal = true;
 
-    initializeDefaults();
-
-    if (m_jsConfig.objectGetBool(sKey, fValue))
+    if (pVal && pVal->isString())
     {
-        // Found non-default value for this key, copied into nValue
-        retVal = true;
+        // Found non-default value for this key, copied into sValue
+        sValue = pVal->m_sVal;
     }
-    else if ((iProp = sm_reqProps.find(sKey)) != sm_reqProps.end())
+    else switch (def.type)
     {
-        if (iProp->second.isBoolean())
-        {
-            // Found default int value for this key, copoed to nValue
-            fValue = iProp->second.m_fVal;
-            retVal = true;
-        }
-        else if (iProp->second.isInt())
-        {
-            // Found default float value for this key, cast to int and copied to nValue
-            fValue = (iProp->second.m_nVal == 0 ? false : true);
-            retVal = true;
-        }
+        case SkCfgType::String:
+            sValue = def.pszDefault;
+            break;
+
+        case SkCfgType::Int:
+        case SkCfgType::Time:
+            stdprintf(sValue, "%lld", (long long)def.nDefault);
+            break;
+
+        case SkCfgType::Float:
+            stdprintf(sValue, "%f", def.dDefault);
+            break;
+
+        case SkCfgType::Bool:
+            sValue = def.nDefault ? "true" : "false";
+            break;
+
+        default:
+            retVal = false;
+            break;
     }
 
     return retVal;
 }
 
-bool SidekickModelConfig::getInt(const string& sKey, int& nValue) const
+// Helper methods that return the value if found (or defaulted), otherwise 0 or empty
+string SidekickModelConfig::getString(SkCfg key) const
+{
+    string sVal;
+    getString(key, sVal);
+    return sVal;
+}
+
+float SidekickModelConfig::getFloat(SkCfg key) const
+{
+    float dVal = 0;
+    getFloat(key, dVal);
+    return dVal;
+}
+
+time_t SidekickModelConfig::getTime(SkCfg key) const
 {
+    time_t tmVal = 0;
+    getTime(key, tmVal);
+    return tmVal;
+}
+
+int SidekickModelConfig::getInt(SkCfg key) const
+{
+    int nVal = 0;
+    getInt(key, nVal);
+    return nVal;
+}
+
+bool SidekickModelConfig::getBool(SkCfg key) const
+{
+    bool fVal = false;
+    getBool(key, fVal);
+    return fVal;
+}
+
+//---------------------------------------------------------------------------
+// String keyed setters & getters. Keys declared in the schema are forwarded
+// to the typed methods, anything else is read from or written to the json
+// config directly, without defaults.
+//
+bool SidekickModelConfig::set(const string& sKey, const string& sVal)
+{
+    SkCfg key = slotOf(sKey);
+    if (key != SkCfg::Count)
+        return set(key, sVal);
+
     unique_lock< recursive_mutex > lk = sharedLock();
-    bool retVal = false;
-    int64_t nVal;
+    return m_jsConfig.objectAdd(sKey, sVal);
+}
 
-    if (getInt(sKey, nVal))
-    {
-        nValue = (int)nVal;
-        retVal = true;
-    }
-    return retVal;
+bool SidekickModelConfig::set(const string& sKey, int64_t nVal)
+{
+    SkCfg key = slotOf(sKey);
+    if (key != SkCfg::Count)
+        return set(key, nVal);
+
+    unique_lock< recursive_mutex > lk = sharedLock();
+    return m_jsConfig.objectAdd(sKey, nVal);
 }
 
-bool SidekickModelConfig::getTime(const string& sKey, time_t& nValue) const
+#ifndef _WIN32
+bool SidekickModelConfig::set(const string& sKey, time_t nVal)
+{
+    return set(sKey, (int64_t)nVal);
+}
+#endif
+
+bool SidekickModelConfig::set(const string& sKey, float dVal)
 {
+    SkCfg key = slotOf(sKey);
+    if (key != SkCfg::Count)
+        return set(key, (double)dVal);
+
     unique_lock< recursive_mutex > lk = sharedLock();
+    return m_jsConfig.objectAdd(sKey, dVal);
+}
+
+bool SidekickModelConfig::set(const string& sKey, int nVal)
+{
+    return set(sKey, (int64_t)nVal);
+}
+
+bool SidekickModelConfig::set(const string& sKey, bool fVal)
+{
+    SkCfg key = slotOf(sKey);
+    if (key != SkCfg::Count)
+        return set(key, fVal);
+
+    unique_lock< recursive_mutex > lk = sharedLock();
+    return m_jsConfig.objectAdd(sKey, fVal);
+}
+
+bool SidekickModelConfig::getFloat(const string& sKey, float& dValue) const
+{
+    SkCfg key = slotOf(sKey);
+    if (key != SkCfg::Count)
+        return getFloat(key, dValue);
+
+    unique_lock< recursive_mutex > lk = sharedLock();
+    double dVal;
     bool retVal = false;
-    int64_t nVal;
 
-    if (getInt(sKey, nVal))
+    if (m_jsConfig.objectGetFloat(sKey, dVal))
     {
-        nValue = (time_t)nVal;
+        dValue = (float)dVal;
         retVal = true;
     }
     return retVal;
 }
 
+bool SidekickModelConfig::getBool(const string& sKey, bool& fValue) const
+{
+    SkCfg key = slotOf(sKey);
+    if (key != SkCfg::Count)
+        return getBool(key, fValue);
+
+    unique_lock< recursive_mutex > lk = sharedLock();
+    return m_jsConfig.objectGetBool(sKey, fValue);
+}
 
 bool SidekickModelConfig::getInt(const string& sKey, int64_t& nValue) const
 {
+    SkCfg key = slotOf(sKey);
+    if (key != SkCfg::Count)
+        return getInt(key, nValue);
+
     unique_lock< recursive_mutex > lk = sharedLock();
-    map< string, MfcJsonObj >::iterator iProp;
-    bool retVal = false;
+    return m_jsConfig.objectGetInt(sKey, nValue);
+}
 
-    initializeDefaults();
+bool SidekickModelConfig::getInt(const string& sKey, int& nValue) const
+{
+    int64_t nVal;
+    bool retVal = false;
 
-    if (m_jsConfig.objectGetInt(sKey, nValue))
+    if (getInt(sKey, nVal))
     {
-        // Found non-default value for this key, copied into nValue
+        nValue = (int)nVal;
         retVal = true;
     }
-    else if ((iProp = sm_reqProps.find(sKey)) != sm_reqProps.end())
-    {
-        if (iProp->second.isInt())
-        {
-            // Found default int value for this key, copoed to nValue
-            nValue = iProp->second.m_nVal;
-            retVal = true;
-        }
-        else if (iProp->second.isFloat())
-        {
-            // Found default float value for this key, cast to int and copied to nValue
-            nValue = (int)iProp->second.m_dVal;
-            retVal = true;
-        }
-    }
-
     return retVal;
 }
 
-bool SidekickModelConfig::getString(const string& sKey, string& sValue) const
+bool SidekickModelConfig::getTime(const string& sKey, time_t& nValue) const
 {
-    unique_lock< recursive_mutex > lk = sharedLock();
-    map< string, MfcJsonObj >::iterator iProp;
+    int64_t nVal;
     bool retVal = false;
 
-    initializeDefaults();
-
-    if (m_jsConfig.objectGetString(sKey, sValue))
+    if (getInt(sKey, nVal))
     {
-        // Found non-default value for this key, copied into sValue
+        nValue = (time_t)nVal;
         retVal = true;
     }
-    else if ((iProp = sm_reqProps.find(sKey)) != sm_reqProps.end())
-    {
-        if (iProp->second.isString())
-        {
-            // Found default int value for this key, copied to sValue
-            sValue = iProp->second.m_sVal;
-            retVal = true;
-        }
-        else if (iProp->second.isInt())
-        {
-            // Found default int value for this key, copied to sValue
-            stdprintf(sValue, "%d", iProp->second.m_nVal);
-            retVal = true;
-        }
-        else if (iProp->second.isFloat())
-        {
-            // Found default float value for this key, cast to int and copied to nValue
-            stdprintf(sValue, "%f", iProp->second.m_dVal);
-            retVal = true;
-        }
-        else
-        {
-            // For anything else, serialize the value into a string
-            // if the type doesn't match
-            retVal = iProp->second.Serialize(sValue);
-        }
-    }
-
     return retVal;
 }
 
+bool SidekickModelConfig::getString(const string& sKey, string& sValue) const
+{
+    SkCfg key = slotOf(sKey);
+    if (key != SkCfg::Count)
+        return getString(key, sValue);
+
+    unique_lock< recursive_mutex > lk = sharedLock();
+    return m_jsConfig.objectGetString(sKey, sValue);
+}
+
 // Helper method that returns an integer if found (or defaulted), otherwise 0
 int SidekickModelConfig::getInt(const string& sKey) const
 {
@@ -426,24 +577,18 @@ time_t SidekickModelConfig::getTime(const string& sKey) const
     return tmVal;
 }
 
-void SidekickModelConfig::clear(void)
+string SidekickModelConfig::getString(const string& sKey) const
 {
-    unique_lock< recursive_mutex > lk = sharedLock();
-    m_jsConfig.clear();
+    string sVal;
+    getString(sKey, sVal);
+    return sVal;
 }
 
-const char* SidekickModelConfig::getString(const string& sKey) const
+void SidekickModelConfig::clear(void)
 {
     unique_lock< recursive_mutex > lk = sharedLock();
-    string sVal;
-
-    if (getString(sKey, sVal))
-    {
-        sm_vAllocs.push_back(sVal);
-    }
-    else sm_vAllocs.push_back("");
-
-    return sm_vAllocs.back().c_str();
+    m_jsConfig.clear();
+    bindSlots();
 }
 
 
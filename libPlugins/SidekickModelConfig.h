@@ -37,9 +37,11 @@
 #include <libfcs/Log.h>
 #include <libfcs/fcslib_string.h>
 #include <libfcs/MfcJson.h>
+#include <libfcs/MfcTrace.h>
 
 // Solutions includes
 #include <libPlugins/Portable.h>
+#include <libPlugins/SidekickConfigSchema.h>
 
 using std::map;
 using std::recursive_mutex;
@@ -66,7 +68,7 @@ public:
         clear();
     }
 
-    SidekickModelConfig(const SidekickModelConfig& other)
+    SidekickModelConfig(const SidekickModelConfig& other) : isSharedCtx(false)
     {
         if (sm_nRefCx++ == 0)
             _TRACE("Initial instance of SidekickModelConfig created.");
@@ -78,6 +80,7 @@ public:
         // Copy over jsConfig, but not any other
         // state vars like isSharedCtx or our mutex.
         m_jsConfig = other.m_jsConfig;
+        bindSlots();
     }
 
     const SidekickModelConfig& operator=(const SidekickModelConfig& other)
@@ -89,23 +92,14 @@ public:
         // Copy over jsConfig, but not any other
         // state vars like isSharedCtx or our mutex.
         m_jsConfig = other.m_jsConfig;
+        bindSlots();
         return *this;
     }
 
     virtual ~SidekickModelConfig()
     {
         clear();
-        if (--sm_nRefCx == 0)
-        {
-            // This is crashing on the mac, because the static variables are destroyed BEFORE
-            // the ObsBroadcastCtx static variable!
-            // preprocess it away for now, it's on exit after all.
-#ifdef _WIN32
-            sm_vAllocs.clear();
-            sm_reqProps.clear();
-            sm_initialized = false;
-#endif
-        }
+        sm_nRefCx--;
     }
 
     unique_lock< recursive_mutex > sharedLock(void) const
@@ -120,16 +114,49 @@ public:
 
     void clear(void);
 
-    static void initializeDefaults(void);
-
     bool readPluginConfig(void);
+
+    // Writes the plugin config to disk before returning.
     bool writePluginConfig(void) const;
 
+    // Queues the plugin config to be written by CPluginConfigWriter once updates
+    // settle down. Preferred over writePluginConfig() unless the file is read back
+    // right away, as the unlink paths do.
+    bool savePluginConfig(void) const;
+
     // saves SiekickModelConfig memebr properties to json object
     bool Serialize(MfcJsonObj& js);
     bool Serialize(string& sData);
     bool Deserialize(const string& sData);
 
+    // Typed access to keys declared in SIDEKICK_CONFIG_SCHEMA (SidekickConfigSchema.h).
+    // Reads are an array index into the slot table, falling back on the schema default
+    // when the key isn't set or was set with a mismatched type. No allocations are made
+    // except when copying a string value out to the caller.
+    bool    set(SkCfg key, const string& sVal);
+#ifndef _WIN32
+    bool    set(SkCfg key, time_t nVal);
+#endif
+    bool    set(SkCfg key, int64_t nVal);
+    bool    set(SkCfg key, double dVal);
+    bool    set(SkCfg key, bool fVal);
+    bool    set(SkCfg key, int nVal);
+
+    bool    getString(SkCfg key, string& sValue) const;
+    bool    getFloat(SkCfg key, float& dValue) const;
+    bool    getTime(SkCfg key, time_t& nValue) const;
+    bool    getBool(SkCfg key, bool& fValue) const;
+    bool    getInt(SkCfg key, int64_t& nValue) const;
+    bool    getInt(SkCfg key, int& nValue) const;
+
+    string  getString(SkCfg key) const;
+    float   getFloat(SkCfg key) const;
+    time_t  getTime(SkCfg key) const;
+    int     getInt(SkCfg key) const;
+    bool    getBool(SkCfg key) const;
+
+    // String keyed access, kept for keys that aren't part of the schema. Schema keys
+    // are resolved to their slot and handled by the typed methods above.
     bool    set(const string& sKey, const string& sVal);
 #ifndef _WIN32
     bool    set(const string& sKey, time_t nVal);
@@ -146,20 +173,32 @@ public:
     bool    getInt(const string& sKey, int64_t& nValue) const;
     bool    getInt(const string& sKey, int& nValue) const;
 
-    // Returns a char* string copy of any string value in config that is found (defaulted or not),
-    // otherwise an empty string. As long as sm_vAllocs isn't cleared, this should be safe (meaning
-    // the strings don't get freed as soon as the method or object instant go out of scope), although
-    // in a multi-threaded scenario this method should have a mutex protecting the sm_vAllocs object
-    // to ensure atomic operations on it
-    const char* getString(const string& sKey) const;
+    // Returns a copy of any string value in config that is found (defaulted or not),
+    // otherwise an empty string.
+    string      getString(const string& sKey) const;
     float       getFloat(const string& sKey) const;
     time_t      getTime(const string& sKey) const;
     int         getInt(const string& sKey) const;
 
     bool        isShared(void) const { return isSharedCtx; }
 
+    // Writes recorded trace spans (see MfcTrace) to MFCBroadcast-trace.json in the log dir
+    static bool dumpTrace(void);
+
+    static SkCfg slotOf(const string& sKey) { return skCfgSlot(sKey.c_str()); }
+
 
 protected:
+    static string pluginConfigPath(void);
+
+    // Points each schema slot at its value node inside m_jsConfig, or nullptr
+    // if the key isn't set. Must be called whenever m_jsConfig is modified.
+    void bindSlot(SkCfg key);
+    void bindSlots(void);
+    void applyLogConfig(void);
+
+    const MfcJsonObj* slot(SkCfg key) const { return m_pSlots[ static_cast< size_t >(key) ]; }
+
     // isSharedCtx set to true when this class is the MFCBroadcast's g_ctx instance,
     // which can be used across libraries within the same DLL/EXE and
     // the same process. Other processes may use this object, but won't
@@ -172,11 +211,11 @@ protected:
     // between threads of same process
     mutable recursive_mutex             m_csMutex;
 
+    // json config is still the backing store for import/export, so keys outside
+    // of the schema and the on-disk format are preserved as they were.
     MfcJsonObj                          m_jsConfig;
+    MfcJsonObj*                         m_pSlots[ SkCfgCount ];
 
-    static bool                         sm_initialized;
-    static map< string, MfcJsonObj >    sm_reqProps;
-    static vector< string >             sm_vAllocs;
     static size_t                       sm_nRefCx;
 
 
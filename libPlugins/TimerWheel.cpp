@@ -0,0 +1,562 @@
+/*
+ * Copyright (c) 2013-2021 MFCXY, Inc. <mfcxy@mfcxy.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+// System Includes
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <limits>
+
+// solution includes
+#include <libfcs/Log.h>
+#include <libfcs/MfcTimer.h>
+#include <libfcs/MfcTrace.h>
+
+// project includes
+#include "Executor.h"
+#include "TimerWheel.h"
+
+using std::lock_guard;
+using std::unique_lock;
+using std::mutex;
+using std::vector;
+
+static const uint64_t   NO_TICK         = std::numeric_limits< uint64_t >::max();
+static const int64_t    TICK_NS         = CTimerWheel::TICK_MS * 1000000;
+static const size_t     L0_BITS         = 8;            // log2(L0_SLOTS)
+static const size_t     LN_BITS         = 6;            // log2(LN_SLOTS)
+static const uint64_t   MAX_SPAN        = 1ULL << (L0_BITS + LN_BITS * (CTimerWheel::LEVELS - 1));
+static const int        MAX_SCAN_BLOCKS = 4096;         // L0 rotations nextWakeTick() looks ahead
+
+
+struct CTimerWheel::Entry
+{
+    TimerId                 id;
+    Callback                fn;
+    Executor                executor;
+    const char*             pszName;
+    int64_t                 nPeriodNs;
+    int64_t                 nJitterNs;
+    uint64_t                nSlackTicks;
+    int64_t                 nBaseNs;        // deadline without jitter, advanced by the period
+    uint64_t                nDueTick;       // deadline with jitter and slack applied
+    int                     nLevel;         // where it sits on the wheel, -1 while off it
+    size_t                  nSlot;
+    size_t                  nPos;           // index in its slot
+    std::atomic< bool >     fCancelled;
+    std::atomic< bool >     fQueued;        // handed to its executor and not started yet
+
+    Entry() : nLevel(-1), nSlot(0), nPos(0), fCancelled(false), fQueued(false) {}
+};
+
+
+static size_t levelShift(size_t nLevel)
+{
+    return nLevel == 0 ? 0 : L0_BITS + LN_BITS * (nLevel - 1);
+}
+
+
+CTimerWheel& CTimerWheel::instance(void)
+{
+    static CTimerWheel s_wheel;
+    return s_wheel;
+}
+
+
+CTimerWheel::CTimerWheel()
+    : m_nUpper(0)
+    , m_nCurTick(0)
+    , m_nWakeTick(NO_TICK)
+    , m_nNextId(1)
+    , m_rng((unsigned)MfcTimer::MonoNs())
+    , m_bStop(false)
+    , m_nStartNs((int64_t)MfcTimer::MonoNs())
+    , m_nScheduled(0)
+    , m_nFired(0)
+    , m_nCancelled(0)
+    , m_nCoalesced(0)
+    , m_nMissed(0)
+    , m_nUnrouted(0)
+    , m_nWakeups(0)
+    , m_nLagSumNs(0)
+    , m_nLagMaxNs(0)
+{
+    memset(m_nL0Bits, 0, sizeof(m_nL0Bits));
+
+    // The timer thread runs its own callbacks inline
+    m_fnPost[TimerThread] = [](std::function< void(void) > fn) { fn(); };
+
+    m_fnPost[Worker] = [](std::function< void(void) > fn)
+    {
+        CExecutor::instance().submit(std::move(fn), CExecutor::Latency);
+    };
+    m_fnPost[BulkWorker] = [](std::function< void(void) > fn)
+    {
+        CExecutor::instance().submit(std::move(fn), CExecutor::Bulk);
+    };
+}
+
+
+CTimerWheel::~CTimerWheel()
+{
+    stop();
+}
+
+
+int64_t CTimerWheel::nowNs(void) const
+{
+    return (int64_t)MfcTimer::MonoNs() - m_nStartNs;
+}
+
+
+CTimerWheel::TimerId CTimerWheel::add(const Options& opts, Callback fn)
+{
+    if (!fn || opts.executor < 0 || opts.executor >= MAX_EXECUTOR)
+        return INVALID_TIMER;
+
+    EntryPtr pEntry = std::make_shared< Entry >();
+    pEntry->fn          = std::move(fn);
+    pEntry->executor    = opts.executor;
+    pEntry->pszName     = opts.pszName ? opts.pszName : "";
+    pEntry->nPeriodNs   = std::max< int64_t >(opts.nPeriodMs, 0) * 1000000;
+    pEntry->nJitterNs   = std::max< int64_t >(opts.nJitterMs, 0) * 1000000;
+    pEntry->nSlackTicks = (uint64_t)(std::max< int64_t >(opts.nSlackMs, 0) / TICK_MS);
+
+    // A period shorter than a tick would fire every tick anyway
+    if (pEntry->nPeriodNs > 0 && pEntry->nPeriodNs < TICK_NS)
+        pEntry->nPeriodNs = TICK_NS;
+
+    lock_guard< mutex > lk(m_mutex);
+    if (m_bStop)
+        return INVALID_TIMER;
+
+    pEntry->id = m_nNextId++;
+    setDeadline(pEntry, nowNs() + std::max< int64_t >(opts.nDelayMs, 0) * 1000000);
+    place(pEntry);
+    m_timers[pEntry->id] = pEntry;
+    m_nScheduled++;
+
+    if (!m_thread.joinable())
+        m_thread = std::thread(&CTimerWheel::run, this);
+    else if (pEntry->nDueTick < m_nWakeTick)
+        m_cv.notify_one();
+
+    return pEntry->id;
+}
+
+
+CTimerWheel::TimerId CTimerWheel::addOneShot(int64_t nDelayMs, Callback fn, Executor executor, const char* pszName)
+{
+    Options opts;
+    opts.nDelayMs   = nDelayMs;
+    opts.executor   = executor;
+    opts.pszName    = pszName;
+    return add(opts, std::move(fn));
+}
+
+
+CTimerWheel::TimerId CTimerWheel::addPeriodic(int64_t nPeriodMs, Callback fn, Executor executor, int64_t nJitterMs, const char* pszName)
+{
+    Options opts;
+    opts.nDelayMs   = nPeriodMs;
+    opts.nPeriodMs  = nPeriodMs;
+    opts.nJitterMs  = nJitterMs;
+    opts.executor   = executor;
+    opts.pszName    = pszName;
+    return add(opts, std::move(fn));
+}
+
+
+bool CTimerWheel::cancel(TimerId id)
+{
+    lock_guard< mutex > lk(m_mutex);
+
+    auto it = m_timers.find(id);
+    if (it == m_timers.end())
+        return false;
+
+    EntryPtr pEntry = it->second;
+    m_timers.erase(it);
+
+    pEntry->fCancelled.store(true, std::memory_order_release);
+    unplace(pEntry);
+    m_nCancelled++;
+    return true;
+}
+
+
+void CTimerWheel::setExecutor(Executor executor, PostFn fnPost)
+{
+    if (executor <= TimerThread || executor >= MAX_EXECUTOR)
+        return;
+
+    lock_guard< mutex > lk(m_mutex);
+    m_fnPost[executor] = std::move(fnPost);
+}
+
+
+void CTimerWheel::stop(void)
+{
+    {
+        lock_guard< mutex > lk(m_mutex);
+        m_bStop = true;
+
+        for (auto& timer : m_timers)
+            timer.second->fCancelled.store(true, std::memory_order_release);
+        m_timers.clear();
+
+        for (size_t nLevel = 0; nLevel < LEVELS; nLevel++)
+            for (size_t nSlot = 0; nSlot < L0_SLOTS; nSlot++)
+                m_slots[nLevel][nSlot].clear();
+        memset(m_nL0Bits, 0, sizeof(m_nL0Bits));
+        m_nUpper = 0;
+
+        m_cv.notify_one();
+    }
+
+    if (m_thread.joinable() && m_thread.get_id() != std::this_thread::get_id())
+        m_thread.join();
+}
+
+
+CTimerWheel::Stats CTimerWheel::getStats(void) const
+{
+    Stats stats;
+    stats.scheduled     = m_nScheduled.load();
+    stats.fired         = m_nFired.load();
+    stats.cancelled     = m_nCancelled.load();
+    stats.coalesced     = m_nCoalesced.load();
+    stats.missed        = m_nMissed.load();
+    stats.unrouted      = m_nUnrouted.load();
+    stats.wakeups       = m_nWakeups.load();
+    stats.avgLagUs      = stats.fired ? (int64_t)(m_nLagSumNs.load() / (int64_t)stats.fired) / 1000 : 0;
+    stats.maxLagUs      = m_nLagMaxNs.load() / 1000;
+
+    lock_guard< mutex > lk(m_mutex);
+    stats.active        = m_timers.size();
+    return stats;
+}
+
+
+// Sets the next deadline of pEntry from nBaseNs, the time it's due before jitter/slack
+void CTimerWheel::setDeadline(const EntryPtr& pEntry, int64_t nBaseNs)
+{
+    int64_t nDueNs = nBaseNs;
+    if (pEntry->nJitterNs > 0)
+        nDueNs += (int64_t)(std::uniform_real_distribution< double >(0.0, 1.0)(m_rng) * (double)pEntry->nJitterNs);
+
+    // round up to a tick, so a timer never fires early
+    uint64_t nTick = (uint64_t)((std::max< int64_t >(nDueNs, 0) + TICK_NS - 1) / TICK_NS);
+
+    // with slack, line up on a multiple of the slack so timers with the same slack share ticks
+    if (pEntry->nSlackTicks > 1)
+        nTick = ((nTick + pEntry->nSlackTicks - 1) / pEntry->nSlackTicks) * pEntry->nSlackTicks;
+
+    pEntry->nBaseNs = nBaseNs;
+    pEntry->nDueTick = nTick;
+}
+
+
+// Puts pEntry in the slot for its deadline, relative to the next tick to be processed
+void CTimerWheel::place(const EntryPtr& pEntry)
+{
+    uint64_t nBase = m_nCurTick + 1;
+    uint64_t nDue = std::max(pEntry->nDueTick, nBase);
+    uint64_t nDelta = nDue - nBase;
+    size_t nLevel = 0;
+
+    // Past the top level, park it as far out as the wheel goes, it's re-placed on cascade
+    if (nDelta >= MAX_SPAN)
+        nDue = nBase + MAX_SPAN - 1, nDelta = MAX_SPAN - 1;
+
+    while (nLevel + 1 < LEVELS && nDelta >= (1ULL << (L0_BITS + LN_BITS * nLevel)))
+        nLevel++;
+
+    size_t nSlot = (size_t)(nDue >> levelShift(nLevel)) & (nLevel == 0 ? L0_SLOTS - 1 : LN_SLOTS - 1);
+
+    vector< EntryPtr >& vSlot = m_slots[nLevel][nSlot];
+    pEntry->nLevel = (int)nLevel;
+    pEntry->nSlot = nSlot;
+    pEntry->nPos = vSlot.size();
+    vSlot.push_back(pEntry);
+
+    if (nLevel == 0)
+        m_nL0Bits[nSlot / 64] |= (1ULL << (nSlot % 64));
+    else
+        m_nUpper++;
+}
+
+
+void CTimerWheel::unplace(const EntryPtr& pEntry)
+{
+    if (pEntry->nLevel < 0)
+        return;
+
+    // swap the last entry of the slot into its place
+    vector< EntryPtr >& vSlot = m_slots[pEntry->nLevel][pEntry->nSlot];
+    if (pEntry->nPos < vSlot.size() && vSlot[pEntry->nPos] == pEntry)
+    {
+        vSlot[pEntry->nPos] = vSlot.back();
+        vSlot[pEntry->nPos]->nPos = pEntry->nPos;
+        vSlot.pop_back();
+
+        if (pEntry->nLevel == 0)
+        {
+            if (vSlot.empty())
+                m_nL0Bits[pEntry->nSlot / 64] &= ~(1ULL << (pEntry->nSlot % 64));
+        }
+        else m_nUpper--;
+    }
+    pEntry->nLevel = -1;
+}
+
+
+// Moves the level nLevel slot that comes due at nTick (the start of an L0 rotation)
+// down to the levels below it
+void CTimerWheel::cascade(size_t nLevel, uint64_t nTick)
+{
+    size_t nSlot = (size_t)(nTick >> levelShift(nLevel)) & (LN_SLOTS - 1);
+    vector< EntryPtr > vMove;
+    vMove.swap(m_slots[nLevel][nSlot]);
+
+    for (const EntryPtr& pEntry : vMove)
+    {
+        m_nUpper--;
+        pEntry->nLevel = -1;
+        place(pEntry);
+    }
+}
+
+
+// True if nTick starts an L0 rotation that cascades entries down from the levels above
+bool CTimerWheel::cascadesAt(uint64_t nTick) const
+{
+    if ((nTick & (L0_SLOTS - 1)) != 0)
+        return false;
+
+    for (size_t nLevel = 1; nLevel < LEVELS; nLevel++)
+    {
+        size_t nSlot = (size_t)(nTick >> levelShift(nLevel)) & (LN_SLOTS - 1);
+        if (!m_slots[nLevel][nSlot].empty())
+            return true;
+        if (nSlot != 0)
+            break;
+    }
+    return false;
+}
+
+
+// First tick after the current one that has something to do: an occupied L0 slot, or
+// the start of an L0 rotation whose cascade brings entries down. NO_TICK if the wheel is empty.
+uint64_t CTimerWheel::nextWakeTick(void) const
+{
+    uint64_t nFrom = m_nCurTick + 1;
+    bool fUpper = m_nUpper > 0;
+
+    if (!fUpper && !(m_nL0Bits[0] | m_nL0Bits[1] | m_nL0Bits[2] | m_nL0Bits[3]))
+        return NO_TICK;
+
+    // L0 entries are all within the next L0_SLOTS ticks
+    for (uint64_t nTick = nFrom; nTick < nFrom + L0_SLOTS; nTick++)
+    {
+        size_t nSlot = (size_t)(nTick & (L0_SLOTS - 1));
+        if (m_nL0Bits[nSlot / 64] & (1ULL << (nSlot % 64)))
+            return nTick;
+        if (nSlot == 0 && fUpper && cascadesAt(nTick))
+            return nTick;
+    }
+
+    if (!fUpper)
+        return NO_TICK;
+
+    // past that only cascades, look for the first rotation that brings something down
+    uint64_t nTick = (nFrom + L0_SLOTS + L0_SLOTS - 1) & ~(uint64_t)(L0_SLOTS - 1);
+    for (int n = 0; n < MAX_SCAN_BLOCKS; n++, nTick += L0_SLOTS)
+    {
+        if (cascadesAt(nTick))
+            return nTick;
+    }
+
+    return nTick;
+}
+
+
+// Processes every tick up to nNowTick, collecting what came due into vDue and
+// putting periodic timers back on the wheel for their next period. One-shots stay
+// in m_timers until claim(), so they can still be cancelled while queued.
+void CTimerWheel::advance(uint64_t nNowTick, vector< Due >& vDue)
+{
+    int64_t nNowNs = nowNs();
+
+    while (m_nCurTick < nNowTick)
+    {
+        uint64_t nTick = nextWakeTick();
+        if (nTick > nNowTick)
+        {
+            m_nCurTick = nNowTick;
+            break;
+        }
+
+        // placement during the cascade is relative to nTick itself
+        m_nCurTick = nTick - 1;
+        if ((nTick & (L0_SLOTS - 1)) == 0)
+        {
+            for (size_t nLevel = 1; nLevel < LEVELS; nLevel++)
+            {
+                cascade(nLevel, nTick);
+                if (((nTick >> levelShift(nLevel)) & (LN_SLOTS - 1)) != 0)
+                    break;
+            }
+        }
+
+        size_t nSlot = (size_t)(nTick & (L0_SLOTS - 1));
+        vector< EntryPtr > vFired;
+        vFired.swap(m_slots[0][nSlot]);
+        m_nL0Bits[nSlot / 64] &= ~(1ULL << (nSlot % 64));
+        m_nCurTick = nTick;
+
+        for (const EntryPtr& pEntry : vFired)
+        {
+            pEntry->nLevel = -1;
+
+            // parked past the top level and not actually due yet
+            if (pEntry->nDueTick > nTick)
+            {
+                place(pEntry);
+                continue;
+            }
+
+            vDue.push_back({ pEntry, (int64_t)pEntry->nDueTick * TICK_NS, nullptr });
+
+            if (pEntry->nPeriodNs > 0)
+            {
+                int64_t nBaseNs = pEntry->nBaseNs + pEntry->nPeriodNs;
+                if (nBaseNs <= nNowNs)
+                {
+                    int64_t nSkip = (nNowNs - nBaseNs) / pEntry->nPeriodNs + 1;
+                    m_nMissed += (uint64_t)nSkip;
+                    nBaseNs += nSkip * pEntry->nPeriodNs;
+                }
+                setDeadline(pEntry, nBaseNs);
+                place(pEntry);
+            }
+        }
+    }
+}
+
+
+// Called on the executor right before a callback runs, false if it was cancelled
+// while queued. A one-shot is done with from here on and leaves m_timers.
+bool CTimerWheel::claim(const EntryPtr& pEntry)
+{
+    if (pEntry->nPeriodNs > 0)
+        return !pEntry->fCancelled.load(std::memory_order_acquire);
+
+    lock_guard< mutex > lk(m_mutex);
+    if (pEntry->fCancelled.load(std::memory_order_acquire))
+        return false;
+
+    m_timers.erase(pEntry->id);
+    return true;
+}
+
+
+void CTimerWheel::recordLag(int64_t nLagNs)
+{
+    if (nLagNs < 0)
+        nLagNs = 0;
+
+    m_nLagSumNs += nLagNs;
+
+    int64_t nMax = m_nLagMaxNs.load(std::memory_order_relaxed);
+    while (nLagNs > nMax && !m_nLagMaxNs.compare_exchange_weak(nMax, nLagNs, std::memory_order_relaxed))
+        ;
+}
+
+
+void CTimerWheel::run(void)
+{
+    MfcTrace::SetThreadName("timerwheel");
+
+    vector< Due > vRun;
+
+    unique_lock< mutex > lk(m_mutex);
+    while (!m_bStop)
+    {
+        uint64_t nNowTick = tickOf(nowNs());
+        if (m_nCurTick < nNowTick)
+            advance(nNowTick, vRun);
+
+        if (!vRun.empty())
+        {
+            for (Due& due : vRun)
+            {
+                due.fnPost = m_fnPost[due.pEntry->executor];
+
+                // nowhere to run it, a one-shot that can't run is done
+                if (!due.fnPost && due.pEntry->nPeriodNs == 0)
+                    m_timers.erase(due.pEntry->id);
+            }
+
+            lk.unlock();
+            for (Due& due : vRun)
+            {
+                if (!due.fnPost)
+                {
+                    m_nUnrouted++;
+                    continue;
+                }
+
+                // still waiting on its executor from last time, this run folds into that one
+                if (due.pEntry->fQueued.exchange(true, std::memory_order_acq_rel))
+                {
+                    m_nCoalesced++;
+                    continue;
+                }
+
+                EntryPtr pEntry = due.pEntry;
+                int64_t nDueNs = due.nDueNs;
+                due.fnPost([this, pEntry, nDueNs]()
+                {
+                    pEntry->fQueued.store(false, std::memory_order_release);
+                    if (!claim(pEntry))
+                        return;
+
+                    recordLag(nowNs() - nDueNs);
+                    m_nFired++;
+
+                    MFC_TRACE_SCOPE("timer", pEntry->pszName);
+                    pEntry->fn();
+                });
+            }
+            vRun.clear();
+            lk.lock();
+            continue;
+        }
+
+        m_nWakeTick = nextWakeTick();
+        if (m_nWakeTick == NO_TICK)
+            m_cv.wait(lk);
+        else
+        {
+            int64_t nWaitNs = (int64_t)m_nWakeTick * TICK_NS - nowNs();
+            if (nWaitNs > 0)
+                m_cv.wait_for(lk, std::chrono::nanoseconds(nWaitNs));
+        }
+        m_nWakeTick = NO_TICK;
+        m_nWakeups++;
+    }
+}
@@ -0,0 +1,181 @@
+/*
+ * Copyright (c) 2013-2021 MFCXY, Inc. <mfcxy@mfcxy.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#pragma once
+
+#ifndef TIMER_WHEEL_H_
+#define TIMER_WHEEL_H_
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+// One scheduler for the plugin's one-shot and periodic work.
+//
+// Timers live in a hierarchical timing wheel of TICK_MS ticks: the first level has one
+// slot per tick for the next L0_SLOTS ticks, every level above covers LN_SLOTS times
+// the span of the one below and is cascaded down when the level below wraps. Adding
+// and cancelling are O(1) and a wakeup only touches the slot that is due.
+//
+// A single thread drives the wheel and sleeps until the next occupied tick (or the
+// next cascade), so nothing wakes up while no timer is due. Due callbacks are handed
+// to the executor the timer was added with: the timer thread itself, the CExecutor
+// worker pool, or the UI thread through the post function the plugin registers with
+// setExecutor().
+//
+// Periodic timers keep their phase (the next deadline is the previous one plus the
+// period, not "now" plus the period). Jitter adds a random 0..nJitterMs to every
+// deadline so timers started together spread out, slack lets a deadline move up to
+// nSlackMs later to land on a tick shared with other timers of the same slack. If a
+// periodic callback is still queued on its executor when it comes due again, the new
+// run is coalesced into the queued one instead of piling up.
+//
+// Lag (time from a deadline to its callback starting) is tracked per wheel and
+// reported by getStats().
+//
+class CTimerWheel
+{
+public:
+    static const int64_t    TICK_MS             = 10;
+    static const size_t     L0_SLOTS            = 256;          // 2.56s at 10ms ticks
+    static const size_t     LN_SLOTS            = 64;           // 164s, 2.9h, 7.7 days
+    static const size_t     LEVELS              = 4;
+
+    typedef uint64_t                                            TimerId;
+    typedef std::function< void(void) >                         Callback;
+    typedef std::function< void(std::function< void(void) >) >  PostFn;
+
+    static const TimerId    INVALID_TIMER       = 0;
+
+    enum Executor
+    {
+        TimerThread     = 0,        // run on the wheel's own thread, keep these short
+        UiThread,                   // posted through the function set with setExecutor()
+        Worker,                     // CExecutor, Latency priority
+        BulkWorker,                 // CExecutor, Bulk priority
+        MAX_EXECUTOR
+    };
+
+    struct Options
+    {
+        int64_t         nDelayMs    = 0;            // first deadline, from now
+        int64_t         nPeriodMs   = 0;            // 0 for a one-shot timer
+        int64_t         nJitterMs   = 0;
+        int64_t         nSlackMs    = 0;
+        Executor        executor    = TimerThread;
+        const char*     pszName     = "";           // string literal, shown in logs
+    };
+
+    struct Stats
+    {
+        uint64_t        scheduled;          // timers added
+        uint64_t        fired;              // callbacks run
+        uint64_t        cancelled;
+        uint64_t        coalesced;          // runs merged into one still queued on its executor
+        uint64_t        missed;             // periods skipped because the timer fell a whole period behind
+        uint64_t        unrouted;           // runs dropped because their executor wasn't set
+        uint64_t        wakeups;            // times the wheel thread woke up
+        int64_t         avgLagUs;
+        int64_t         maxLagUs;
+        size_t          active;             // timers scheduled, or one-shots queued on their executor
+    };
+
+    static CTimerWheel& instance(void);
+
+    ~CTimerWheel();
+
+    TimerId add(const Options& opts, Callback fn);
+
+    TimerId addOneShot(int64_t nDelayMs, Callback fn, Executor executor = TimerThread, const char* pszName = "");
+
+    TimerId addPeriodic(int64_t nPeriodMs, Callback fn, Executor executor = TimerThread,
+                        int64_t nJitterMs = 0, const char* pszName = "");
+
+    // A callback already handed to its executor and running may still finish, one that
+    // is only queued there will not run. Returns false if the timer was already gone.
+    bool cancel(TimerId id);
+
+    // fnPost queues a callable to run on that executor's thread, nullptr to unset it.
+    // Runs for an executor that isn't set are dropped and counted in Stats::unrouted.
+    void setExecutor(Executor executor, PostFn fnPost);
+
+    // Stops the wheel thread, drops every timer and doesn't accept new ones.
+    void stop(void);
+
+    Stats getStats(void) const;
+
+private:
+    struct Entry;
+    typedef std::shared_ptr< Entry > EntryPtr;
+
+    struct Due
+    {
+        EntryPtr        pEntry;
+        int64_t         nDueNs;             // the deadline it fired for, before a periodic moves on
+        PostFn          fnPost;
+    };
+
+    CTimerWheel();
+    CTimerWheel(const CTimerWheel&) = delete;
+    CTimerWheel& operator=(const CTimerWheel&) = delete;
+
+    void run(void);
+    void advance(uint64_t nNowTick, std::vector< Due >& vDue);
+    void cascade(size_t nLevel, uint64_t nTick);
+    void place(const EntryPtr& pEntry);
+    void unplace(const EntryPtr& pEntry);
+    bool cascadesAt(uint64_t nTick) const;
+    uint64_t nextWakeTick(void) const;
+    void setDeadline(const EntryPtr& pEntry, int64_t nBaseNs);
+    bool claim(const EntryPtr& pEntry);
+    void recordLag(int64_t nLagNs);
+
+    int64_t nowNs(void) const;
+    uint64_t tickOf(int64_t nNs) const { return (uint64_t)(nNs / (TICK_MS * 1000000)); }
+
+    mutable std::mutex                      m_mutex;        // protects the wheel and the maps below
+    std::condition_variable                 m_cv;
+    std::vector< EntryPtr >                 m_slots[ LEVELS ][ L0_SLOTS ];
+    uint64_t                                m_nL0Bits[ L0_SLOTS / 64 ];
+    size_t                                  m_nUpper;       // entries on levels above 0
+    std::unordered_map< TimerId, EntryPtr > m_timers;
+    PostFn                                  m_fnPost[ MAX_EXECUTOR ];
+    uint64_t                                m_nCurTick;     // last tick processed
+    uint64_t                                m_nWakeTick;    // tick the wheel thread sleeps until
+    TimerId                                 m_nNextId;
+    std::minstd_rand                        m_rng;
+    bool                                    m_bStop;
+    std::thread                             m_thread;
+    int64_t                                 m_nStartNs;     // MfcTimer::MonoNs() at construction, tick 0
+
+    std::atomic< uint64_t >                 m_nScheduled;
+    std::atomic< uint64_t >                 m_nFired;
+    std::atomic< uint64_t >                 m_nCancelled;
+    std::atomic< uint64_t >                 m_nCoalesced;
+    std::atomic< uint64_t >                 m_nMissed;
+    std::atomic< uint64_t >                 m_nUnrouted;
+    std::atomic< uint64_t >                 m_nWakeups;
+    std::atomic< int64_t >                  m_nLagSumNs;
+    std::atomic< int64_t >                  m_nLagMaxNs;
+};
+
+#endif  // TIMER_WHEEL_H_
@@ -27,6 +27,7 @@
 
 */
 
+#include <ctype.h>
 #include <stdio.h>
 #include <stdarg.h>
 #include <string.h>
@@ -46,6 +47,38 @@
 void proxy_blog(int nLevel, const char* pszMsg);
 MfcLog Log::sm_Log;
 
+std::atomic< uint8_t > Log::sm_nTagLevels[ Log::MAX_LOGTAG ] =
+{
+    ILog::TRACE,        // LT_DEFAULT
+    ILog::TRACE,        // LT_FCS
+    ILog::TRACE,        // LT_PLUGINS
+    ILog::TRACE,        // LT_BROADCAST
+    ILog::TRACE,        // LT_CEF
+    ILog::TRACE,        // LT_UPDATER
+};
+
+static const char* s_pszTagNames[ Log::MAX_LOGTAG ] =
+{
+    "default",
+    "fcs",
+    "plugins",
+    "broadcast",
+    "cef",
+    "updater",
+};
+
+static const char* s_pszLevelNames[ ILog::MAX_LOGLEVEL ] =
+{
+    "emerg",
+    "alert",
+    "crit",
+    "err",
+    "warning",
+    "notice",
+    "dbg",
+    "trace",
+};
+
 
 void Log::Setup(const string& sLogDir)
 {
@@ -306,6 +339,136 @@ void Log::Flush(void)
 }
 
 
+void Log::SetAsync(bool fAsync)
+{
+    sm_Log.SetAsync(fAsync);
+}
+
+
+bool Log::IsAsync(void)
+{
+    return sm_Log.IsAsync();
+}
+
+
+bool Log::GetAsyncStats(MfcLogWriter::Stats& stats)
+{
+    return sm_Log.GetAsyncStats(stats);
+}
+
+
+bool Log::OpenBinLog(const string& sFile, size_t nRingSz)
+{
+    return sm_Log.BinLog().Open(sFile, MfcLog::ModuleName(), nRingSz);
+}
+
+
+void Log::CloseBinLog(void)
+{
+    sm_Log.BinLog().Close();
+}
+
+
+void Log::SetTagLevel(LogTag nTag, ILog::LogLevel nLevel)
+{
+    if (nTag >= 0 && nTag < MAX_LOGTAG && nLevel >= ILog::EMERG && nLevel < ILog::MAX_LOGLEVEL)
+        sm_nTagLevels[nTag].store((uint8_t)nLevel, std::memory_order_relaxed);
+}
+
+
+ILog::LogLevel Log::GetTagLevel(LogTag nTag)
+{
+    if (nTag >= 0 && nTag < MAX_LOGTAG)
+        return (ILog::LogLevel)sm_nTagLevels[nTag].load(std::memory_order_relaxed);
+    return ILog::TRACE;
+}
+
+
+const char* Log::TagName(LogTag nTag)
+{
+    return (nTag >= 0 && nTag < MAX_LOGTAG) ? s_pszTagNames[nTag] : "unknown";
+}
+
+
+bool Log::SetTagLevels(const string& sSpec)
+{
+    ILog::LogLevel nLevels[ MAX_LOGTAG ];
+    string sClean;
+    bool retVal = true;
+
+    for (int n = 0; n < MAX_LOGTAG; n++)
+        nLevels[n] = ILog::TRACE;
+
+    for (char ch : sSpec)
+        if (!isspace((unsigned char)ch))
+            sClean += (char)tolower((unsigned char)ch);
+
+    for (const string& sEntry : stdsplit(sClean, ','))
+    {
+        if (sEntry.empty())
+            continue;
+
+        size_t nPos = sEntry.find('=');
+        if (nPos == string::npos)
+        {
+            retVal = false;
+            continue;
+        }
+
+        string sTag = sEntry.substr(0, nPos), sLevel = sEntry.substr(nPos + 1);
+
+        int nLevel = -1;
+        if (sLevel.size() == 1 && sLevel[0] >= '0' && sLevel[0] <= '7')
+            nLevel = sLevel[0] - '0';
+        else if (sLevel == "debug")
+            nLevel = ILog::DBG;
+        for (int n = 0; nLevel < 0 && n < ILog::MAX_LOGLEVEL; n++)
+            if (sLevel == s_pszLevelNames[n])
+                nLevel = n;
+
+        int nTag = -1;
+        if (sTag == "*")
+            nTag = MAX_LOGTAG;
+        for (int n = 0; nTag < 0 && n < MAX_LOGTAG; n++)
+            if (sTag == s_pszTagNames[n])
+                nTag = n;
+
+        if (nLevel < 0 || nTag < 0)
+        {
+            retVal = false;
+            continue;
+        }
+
+        if (nTag == MAX_LOGTAG)
+        {
+            for (int n = 0; n < MAX_LOGTAG; n++)
+                nLevels[n] = (ILog::LogLevel)nLevel;
+        }
+        else nLevels[nTag] = (ILog::LogLevel)nLevel;
+    }
+
+    for (int n = 0; n < MAX_LOGTAG; n++)
+        SetTagLevel((LogTag)n, nLevels[n]);
+
+    return retVal;
+}
+
+
+string Log::GetTagLevels(void)
+{
+    string sSpec;
+    for (int n = 0; n < MAX_LOGTAG; n++)
+    {
+        if (!sSpec.empty())
+            sSpec += ',';
+        sSpec += s_pszTagNames[n];
+        sSpec += '=';
+        sSpec += s_pszLevelNames[ GetTagLevel((LogTag)n) ];
+    }
+    return sSpec;
+}
+
+
 void Log::SetStampMask(int nValue)
 {
     sm_Log.SetStampMask(nValue);
@@ -25,19 +25,56 @@
 #include <syslog.h>
 #endif
 #include <time.h>
+
+#include <atomic>
+
 #include "Compat.h"
 
 #include "ILog.h"
 #include "MfcLog.h"
 
-#define _TRACE(pszFmt, ...)         Log::TraceMarker(               __FILE__, __FUNCTION__, __LINE__, ILog::TRACE,  pszFmt, ##__VA_ARGS__)
-#ifdef _LOGDEBUG_
-#define _DBG(pszFmt, ...)           Log::TraceMarker(               __FILE__, __FUNCTION__, __LINE__, ILog::DBG,    pszFmt, ##__VA_ARGS__)
+// Compile time floor: call sites with a level above it (0 = EMERG ... 7 = TRACE) expand
+// to nothing, arguments included. Set with the MFC_LOG_COMPILED_LEVEL cmake variable.
+#ifndef MFC_LOG_COMPILED_LEVEL
+#define MFC_LOG_COMPILED_LEVEL      7
+#endif
+
+// Slot in the runtime level table (see Log::LogTag) used by the macros below. Each
+// target sets it for its own sources; a file may define it before including Log.h.
+#ifndef MFC_LOG_TAG
+#define MFC_LOG_TAG                 Log::LT_DEFAULT
+#endif
+
+#define _LOGON(nLevel)              ((nLevel) <= MFC_LOG_COMPILED_LEVEL && Log::Enabled(MFC_LOG_TAG, nLevel))
+
+#if MFC_LOG_COMPILED_LEVEL >= 7
+#define _TRACE(pszFmt, ...)         do { if (_LOGON(ILog::TRACE))  Log::TraceMarker(__FILE__, __FUNCTION__, __LINE__, ILog::TRACE,  pszFmt, ##__VA_ARGS__); } while (0)
+#else
+#define _TRACE(...)                 do {} while (0)
+#endif
+#if defined(_LOGDEBUG_) && MFC_LOG_COMPILED_LEVEL >= 6
+#define _DBG(pszFmt, ...)           do { if (_LOGON(ILog::DBG))    Log::TraceMarker(__FILE__, __FUNCTION__, __LINE__, ILog::DBG,    pszFmt, ##__VA_ARGS__); } while (0)
 #else
 #define _DBG(...)
 #endif
-#define _MESG(pszFmt, ...)          Log::TraceMarker(               __FILE__, __FUNCTION__, __LINE__, ILog::NOTICE, pszFmt, ##__VA_ARGS__)
-#define _RMESG(retVal, pszFmt, ...) Log::TraceMarkerRetVal(retVal,  __FILE__, __FUNCTION__, __LINE__, ILog::NOTICE, pszFmt, ##__VA_ARGS__)
+#if MFC_LOG_COMPILED_LEVEL >= 5
+#define _MESG(pszFmt, ...)          do { if (_LOGON(ILog::NOTICE)) Log::TraceMarker(__FILE__, __FUNCTION__, __LINE__, ILog::NOTICE, pszFmt, ##__VA_ARGS__); } while (0)
+#define _RMESG(retVal, pszFmt, ...) (_LOGON(ILog::NOTICE) ? Log::TraceMarkerRetVal(retVal, __FILE__, __FUNCTION__, __LINE__, ILog::NOTICE, pszFmt, ##__VA_ARGS__) : (retVal))
+#else
+#define _MESG(...)                  do {} while (0)
+#define _RMESG(retVal, ...)         (retVal)
+#endif
+
+// Deferred formatting: raw arguments go to the binary log (see MfcBinLog), and
+// only fall back to the text log when the binary log isn't open.
+#define _BLOG(nLevel, pszFmt, ...)                                                                              \
+    do {                                                                                                        \
+        static std::atomic< uint64_t > s_qwBinSite(0);                                                          \
+        if (_LOGON(nLevel))                                                                                     \
+            Log::BinMarker(s_qwBinSite, __FILE__, __FUNCTION__, __LINE__, nLevel, pszFmt, ##__VA_ARGS__);       \
+    } while (0)
+#define _BTRACE(pszFmt, ...)        _BLOG(ILog::TRACE,  pszFmt, ##__VA_ARGS__)
+#define _BMESG(pszFmt, ...)         _BLOG(ILog::NOTICE, pszFmt, ##__VA_ARGS__)
 
 /*
 
@@ -78,6 +115,58 @@ public:
 
     static void Flush(void);
 
+    // Queue log lines to a background writer instead of writing them on the caller's thread
+    static void SetAsync(bool fAsync);
+    static bool IsAsync(void);
+    static bool GetAsyncStats(MfcLogWriter::Stats& stats);
+
+    // Binary log channel used by _BTRACE/_BMESG
+    static bool OpenBinLog(const string& sFile, size_t nRingSz = MfcBinLog::DEFAULT_RING_SZ);
+    static void CloseBinLog(void);
+
+    template< typename... Args >
+    static void BinMarker(std::atomic< uint64_t >& qwSite, const char* pszFile, const char* pszFunction, int nLine,
+                          ILog::LogLevel nLevel, const char* pszFmt, const Args&... args)
+    {
+        MfcBinLog& binLog = sm_Log.BinLog();
+        uint32_t dwSite = MfcBinLog::NO_SITE;
+
+        if (binLog.IsOpen())
+            dwSite = binLog.SiteId(qwSite, nLevel, pszFile, pszFunction, nLine, pszFmt);
+
+        if (dwSite == MfcBinLog::NO_SITE || !binLog.Write(dwSite, args...))
+            TraceMarker(pszFile, pszFunction, nLine, nLevel, pszFmt, args...);
+    }
+
+    // Runtime level table, one slot per module. The logging macros check their slot with a
+    // single relaxed load before any argument is evaluated, so a disabled site costs a
+    // compare and a branch.
+    enum LogTag
+    {
+        LT_DEFAULT  = 0,            // anything built without MFC_LOG_TAG
+        LT_FCS,                     // libfcs
+        LT_PLUGINS,                 // libPlugins
+        LT_BROADCAST,               // ObsBroadcast
+        LT_CEF,                     // MFCCefLogin
+        LT_UPDATER,                 // ObsUpdater
+        MAX_LOGTAG
+    };
+
+    static bool Enabled(LogTag nTag, ILog::LogLevel nLevel)
+    {
+        return (int)nLevel <= (int)sm_nTagLevels[nTag].load(std::memory_order_relaxed);
+    }
+
+    static void SetTagLevel(LogTag nTag, ILog::LogLevel nLevel);
+    static ILog::LogLevel GetTagLevel(LogTag nTag);
+    static const char* TagName(LogTag nTag);
+
+    // Applies a "tag=level,tag=level" spec, e.g. "plugins=notice,broadcast=trace" or "*=err".
+    // Tags not named go back to TRACE. Levels are names (emerg ... notice, dbg, trace) or 0-7.
+    // Returns false if any entry was not understood; the valid ones are still applied.
+    static bool SetTagLevels(const string& sSpec);
+    static string GetTagLevels(void);
+
     static void _Mesg(ILog::LogLevel nLevel, const char* pszMsg);           // Internal format that writes the log, no variable args
 
     static bool TraceFor(uint32_t dwUserId)
@@ -125,6 +214,7 @@ public:
     // -------------------------------------------------------------------
 
     static MfcLog sm_Log;
+    static std::atomic< uint8_t > sm_nTagLevels[ MAX_LOGTAG ];
 };
 
 #endif // LOG_H
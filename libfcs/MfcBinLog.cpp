@@ -0,0 +1,761 @@
+/*
+ * Copyright (c) 2013-2021 MFCXY, Inc. <mfcxy@mfcxy.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef _WIN32
+#include <sys/mman.h>
+#include <sys/time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#ifdef __APPLE__
+#include <pthread.h>
+#else
+#include <sys/syscall.h>
+#endif
+#else
+#include <winsock2.h>
+#include <windows.h>
+#include <process.h>
+#endif
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include <algorithm>
+
+#include "Compat.h"
+#include "fcslib_string.h"
+#include "MfcBinLog.h"
+#include "UtilCommon.h"
+#include "UtilString.h"
+
+using std::string;
+
+
+// Layout of the mapped file: FileHdr padded to HDR_SZ, the site table, then the ring
+struct MfcBinLog::FileHdr
+{
+    uint32_t                dwMagic;
+    uint32_t                dwVersion;
+    uint64_t                qwRingSz;
+    uint64_t                qwSitesSz;
+    std::atomic< uint64_t > qwWritePos;         // bytes reserved in the ring so far
+    std::atomic< uint32_t > dwSitesUsed;        // bytes used in the site table
+    std::atomic< uint32_t > dwSiteCount;
+    uint64_t                qwStartUs;
+    int32_t                 nPid;
+    char                    szModule[64];
+};
+
+struct MfcBinLog::RecHdr
+{
+    uint32_t    dwCommit;                       // CommitWord(pos), written last
+    uint16_t    wLen;                           // whole record, 8 byte aligned
+    uint16_t    wArgs;                          // encoded argument bytes
+    uint32_t    dwSite;
+    uint32_t    dwTid;
+    uint64_t    qwTimeUs;
+};
+
+static const size_t HDR_SZ = 4096;
+
+// Site table entry: SiteHdr then file, function and format, each nul terminated
+struct SiteHdr
+{
+    uint16_t    wLen;                           // whole entry, 4 byte aligned
+    uint8_t     nLevel;
+    uint8_t     bReserved;
+    int32_t     nLine;
+};
+
+static_assert(sizeof(MfcBinLog::ArgBuf::data) + 24 <= 0xFFFF, "record length must fit in RecHdr::wLen");
+
+
+static uint64_t nowUs(void)
+{
+    struct timeval tvNow;
+    gettimeofday(&tvNow, NULL);
+    return (uint64_t)tvNow.tv_sec * 1000000 + (uint64_t)tvNow.tv_usec;
+}
+
+
+MfcBinLog::MfcBinLog()
+    : m_fOpen(false)
+    , m_dwGen(0)
+    , m_pHdr(nullptr)
+    , m_pSites(nullptr)
+    , m_pRing(nullptr)
+    , m_qwRingMask(0)
+    , m_nMapSz(0)
+#ifdef _WIN32
+    , m_hFile(INVALID_HANDLE_VALUE)
+    , m_hMapping(NULL)
+#else
+    , m_nFd(-1)
+#endif
+{}
+
+
+MfcBinLog::~MfcBinLog()
+{
+    Close();
+    Unmap();
+}
+
+
+bool MfcBinLog::Open(const string& sFile, const char* pszModule, size_t nRingSz)
+{
+    std::lock_guard< std::mutex > lk(m_siteMutex);
+
+    // One session per instance: Write() and Commit() run without the lock, so a
+    // mapping can't go away while they might still be inside it, not even after Close()
+    if (m_pHdr)
+        return false;
+
+    // Ring size must be a power of 2 so positions wrap with a mask
+    size_t nSz = 64 * 1024;
+    while (nSz < nRingSz)
+        nSz <<= 1;
+
+    // Keep the previous session around, it's usually the one we want after a crash
+    string sPrev = sFile + ".1";
+#ifdef _WIN32
+    _unlink(sPrev.c_str());
+#else
+    unlink(sPrev.c_str());
+#endif
+    rename(sFile.c_str(), sPrev.c_str());
+
+    m_nMapSz = HDR_SZ + SITES_SZ + nSz;
+    void* pMap = nullptr;
+
+#ifdef _WIN32
+    m_hFile = CreateFileA(sFile.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_DELETE,
+                          NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (m_hFile == INVALID_HANDLE_VALUE)
+        return false;
+
+    m_hMapping = CreateFileMappingA(m_hFile, NULL, PAGE_READWRITE, (DWORD)((uint64_t)m_nMapSz >> 32), (DWORD)m_nMapSz, NULL);
+    if (m_hMapping)
+        pMap = MapViewOfFile(m_hMapping, FILE_MAP_ALL_ACCESS, 0, 0, m_nMapSz);
+#else
+    m_nFd = open(sFile.c_str(), O_RDWR | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+    if (m_nFd == -1)
+        return false;
+
+    if (ftruncate(m_nFd, (off_t)m_nMapSz) == 0)
+    {
+        pMap = mmap(nullptr, m_nMapSz, PROT_READ | PROT_WRITE, MAP_SHARED, m_nFd, 0);
+        if (pMap == MAP_FAILED)
+            pMap = nullptr;
+    }
+#endif
+
+    if (!pMap)
+    {
+        Unmap();
+        return false;
+    }
+
+    // A fresh file reads back as zeros, only the header needs filling in
+    m_pHdr = new (pMap) FileHdr();
+    m_pHdr->dwMagic = FILE_MAGIC;
+    m_pHdr->dwVersion = FILE_VERSION;
+    m_pHdr->qwRingSz = nSz;
+    m_pHdr->qwSitesSz = SITES_SZ;
+    m_pHdr->qwWritePos.store(0, std::memory_order_relaxed);
+    m_pHdr->dwSitesUsed.store(0, std::memory_order_relaxed);
+    m_pHdr->dwSiteCount.store(0, std::memory_order_relaxed);
+    m_pHdr->qwStartUs = nowUs();
+#ifdef _WIN32
+    m_pHdr->nPid = _getpid();
+#else
+    m_pHdr->nPid = getpid();
+#endif
+    fcs_strlcpy(m_pHdr->szModule, pszModule ? pszModule : "", sizeof(m_pHdr->szModule));
+
+    m_pSites = (char*)pMap + HDR_SZ;
+    m_pRing = m_pSites + SITES_SZ;
+    m_qwRingMask = nSz - 1;
+
+    // New session: every call site has to register again
+    m_dwGen.fetch_add(1, std::memory_order_acq_rel);
+    m_fOpen.store(true, std::memory_order_release);
+    return true;
+}
+
+
+void MfcBinLog::Close(void)
+{
+    std::lock_guard< std::mutex > lk(m_siteMutex);
+
+    if (!m_fOpen.exchange(false, std::memory_order_acq_rel))
+        return;
+
+#ifdef _WIN32
+    FlushViewOfFile(m_pHdr, 0);
+#else
+    msync(m_pHdr, m_nMapSz, MS_ASYNC);
+#endif
+}
+
+
+void MfcBinLog::Unmap(void)
+{
+#ifdef _WIN32
+    if (m_pHdr)
+        UnmapViewOfFile(m_pHdr);
+    if (m_hMapping)
+        CloseHandle(m_hMapping);
+    if (m_hFile != INVALID_HANDLE_VALUE)
+        CloseHandle(m_hFile);
+    m_hMapping = NULL;
+    m_hFile = INVALID_HANDLE_VALUE;
+#else
+    if (m_pHdr)
+        munmap(m_pHdr, m_nMapSz);
+    if (m_nFd != -1)
+        close(m_nFd);
+    m_nFd = -1;
+#endif
+
+    m_pHdr = nullptr;
+    m_pSites = nullptr;
+    m_pRing = nullptr;
+}
+
+
+uint32_t MfcBinLog::SiteId(std::atomic< uint64_t >& qwCache, ILog::LogLevel nLevel, const char* pszFile,
+                           const char* pszFunction, int nLine, const char* pszFmt)
+{
+    uint32_t dwGen = m_dwGen.load(std::memory_order_acquire);
+    uint64_t qwSite = qwCache.load(std::memory_order_acquire);
+
+    if ((uint32_t)(qwSite >> 32) == dwGen)
+        return (uint32_t)qwSite;
+
+    std::lock_guard< std::mutex > lk(m_siteMutex);
+
+    // Somebody else may have registered it while we waited
+    dwGen = m_dwGen.load(std::memory_order_relaxed);
+    qwSite = qwCache.load(std::memory_order_acquire);
+    if ((uint32_t)(qwSite >> 32) == dwGen)
+        return (uint32_t)qwSite;
+
+    if (!m_fOpen.load(std::memory_order_relaxed))
+        return NO_SITE;
+
+    // Only keep the file name, same as the text log's trace header
+    const char* pszShortFile = pszFile;
+    for (const char* pch = pszFile; *pch; pch++)
+        if (*pch == '/' || *pch == '\\')
+            pszShortFile = pch + 1;
+
+    size_t nFile = strlen(pszShortFile) + 1;
+    size_t nFunction = strlen(pszFunction) + 1;
+    size_t nFmt = strlen(pszFmt) + 1;
+    size_t nEntry = (sizeof(SiteHdr) + nFile + nFunction + nFmt + 3) & ~(size_t)3;
+    uint32_t dwUsed = m_pHdr->dwSitesUsed.load(std::memory_order_relaxed);
+    uint32_t dwSite = NO_SITE;
+
+    if (nEntry <= 0xFFFF && dwUsed + nEntry <= SITES_SZ)
+    {
+        char* pEntry = m_pSites + dwUsed;
+        SiteHdr hdr = { (uint16_t)nEntry, (uint8_t)nLevel, 0, nLine };
+
+        memcpy(pEntry, &hdr, sizeof(hdr));
+        pEntry += sizeof(hdr);
+        memcpy(pEntry, pszShortFile, nFile);
+        pEntry += nFile;
+        memcpy(pEntry, pszFunction, nFunction);
+        pEntry += nFunction;
+        memcpy(pEntry, pszFmt, nFmt);
+
+        dwSite = m_pHdr->dwSiteCount.load(std::memory_order_relaxed);
+        m_pHdr->dwSitesUsed.store(dwUsed + (uint32_t)nEntry, std::memory_order_release);
+        m_pHdr->dwSiteCount.store(dwSite + 1, std::memory_order_release);
+    }
+
+    // A full table caches NO_SITE too, so the site goes to the text log for this session
+    qwCache.store(((uint64_t)dwGen << 32) | dwSite, std::memory_order_release);
+    return dwSite;
+}
+
+
+void MfcBinLog::EncodeArg(ArgBuf& buf, const char* pszVal)
+{
+    if (!pszVal)
+        pszVal = "(null)";
+
+    size_t nLen = strnlen(pszVal, MAX_STRING);
+    if (buf.nLen + 1 + sizeof(uint16_t) + nLen > MAX_PAYLOAD)
+    {
+        buf.fTruncated = true;
+        return;
+    }
+
+    uint16_t wLen = (uint16_t)nLen;
+    buf.data[buf.nLen++] = ARG_STR;
+    memcpy(buf.data + buf.nLen, &wLen, sizeof(wLen));
+    buf.nLen += sizeof(wLen);
+    memcpy(buf.data + buf.nLen, pszVal, nLen);
+    buf.nLen += nLen;
+}
+
+
+uint32_t MfcBinLog::ThreadId(void)
+{
+    static thread_local uint32_t s_dwTid = 0;
+
+    if (s_dwTid == 0)
+    {
+#if defined(_WIN32)
+        s_dwTid = (uint32_t)GetCurrentThreadId();
+#elif defined(__APPLE__)
+        uint64_t qwTid = 0;
+        pthread_threadid_np(NULL, &qwTid);
+        s_dwTid = (uint32_t)qwTid;
+#else
+        s_dwTid = (uint32_t)syscall(SYS_gettid);
+#endif
+    }
+
+    return s_dwTid;
+}
+
+
+void MfcBinLog::CopyIn(uint64_t qwPos, const void* pSrc, size_t nSz)
+{
+    size_t nOff = (size_t)(qwPos & m_qwRingMask);
+    size_t nFirst = std::min(nSz, (size_t)(m_qwRingMask + 1) - nOff);
+
+    memcpy(m_pRing + nOff, pSrc, nFirst);
+    if (nFirst < nSz)
+        memcpy(m_pRing, (const char*)pSrc + nFirst, nSz - nFirst);
+}
+
+
+bool MfcBinLog::Commit(uint32_t dwSite, const char* pArgs, size_t nArgs)
+{
+    if (!m_fOpen.load(std::memory_order_acquire))
+        return false;
+
+    RecHdr rec;
+    size_t nLen = (sizeof(rec) + nArgs + 7) & ~(size_t)7;
+    uint64_t qwPos = m_pHdr->qwWritePos.fetch_add(nLen, std::memory_order_relaxed);
+
+    rec.dwCommit = 0;
+    rec.wLen = (uint16_t)nLen;
+    rec.wArgs = (uint16_t)nArgs;
+    rec.dwSite = dwSite;
+    rec.dwTid = ThreadId();
+    rec.qwTimeUs = nowUs();
+
+    // Everything but the commit word first; records are 8 byte aligned, so the
+    // commit word never straddles the end of the ring
+    CopyIn(qwPos + sizeof(rec.dwCommit), (const char*)&rec + sizeof(rec.dwCommit), sizeof(rec) - sizeof(rec.dwCommit));
+    CopyIn(qwPos + sizeof(rec), pArgs, nArgs);
+
+    std::atomic_thread_fence(std::memory_order_release);
+    uint32_t dwCommit = CommitWord(qwPos);
+    CopyIn(qwPos, &dwCommit, sizeof(dwCommit));
+
+    return true;
+}
+
+
+//---------------------------------------------------------------------------
+// Offline decoding
+//
+
+namespace
+{
+    // Pulls tagged arguments back out of a record, converting between the
+    // integer types as the format string asks for them
+    class ArgReader
+    {
+    public:
+        ArgReader(const char* pArgs, size_t nLen) : m_p(pArgs), m_pEnd(pArgs + nLen) {}
+
+        bool nextInt(int64_t& nVal)
+        {
+            char chType;
+            uint64_t qwVal;
+            if (!nextScalar(chType, qwVal))
+                return false;
+
+            if (chType == MfcBinLog::ARG_I32)       nVal = (int32_t)(uint32_t)qwVal;
+            else if (chType == MfcBinLog::ARG_F64)  { double d; memcpy(&d, &qwVal, sizeof(d)); nVal = (int64_t)d; }
+            else                                    nVal = (int64_t)qwVal;
+            return true;
+        }
+
+        bool nextDouble(double& dVal)
+        {
+            char chType;
+            uint64_t qwVal;
+            if (!nextScalar(chType, qwVal))
+                return false;
+
+            if (chType == MfcBinLog::ARG_F64)       memcpy(&dVal, &qwVal, sizeof(dVal));
+            else if (chType == MfcBinLog::ARG_I32)  dVal = (double)(int32_t)(uint32_t)qwVal;
+            else if (chType == MfcBinLog::ARG_I64)  dVal = (double)(int64_t)qwVal;
+            else                                    dVal = (double)qwVal;
+            return true;
+        }
+
+        bool nextString(string& sVal)
+        {
+            if (m_p >= m_pEnd || *m_p != MfcBinLog::ARG_STR)
+            {
+                int64_t nVal;
+                if (!nextInt(nVal))
+                    return false;
+                // not a string (or a string that didn't fit), show what we have
+                sVal = "<" + std::to_string(nVal) + ">";
+                return true;
+            }
+
+            uint16_t wLen;
+            if (m_p + 1 + sizeof(wLen) > m_pEnd)
+                return false;
+            memcpy(&wLen, m_p + 1, sizeof(wLen));
+            if (m_p + 1 + sizeof(wLen) + wLen > m_pEnd)
+                return false;
+
+            sVal.assign(m_p + 1 + sizeof(wLen), wLen);
+            m_p += 1 + sizeof(wLen) + wLen;
+            return true;
+        }
+
+    private:
+        bool nextScalar(char& chType, uint64_t& qwVal)
+        {
+            if (m_p >= m_pEnd)
+                return false;
+
+            chType = *m_p;
+            if (chType == MfcBinLog::ARG_STR)
+            {
+                string s;
+                nextString(s);
+                qwVal = 0;
+                return true;
+            }
+
+            size_t nSz = (chType == MfcBinLog::ARG_I32 || chType == MfcBinLog::ARG_U32) ? 4 : 8;
+            if (m_p + 1 + nSz > m_pEnd)
+                return false;
+
+            if (nSz == 4)
+            {
+                uint32_t dwVal;
+                memcpy(&dwVal, m_p + 1, sizeof(dwVal));
+                qwVal = dwVal;
+            }
+            else memcpy(&qwVal, m_p + 1, sizeof(qwVal));
+
+            m_p += 1 + nSz;
+            return true;
+        }
+
+        const char* m_p;
+        const char* m_pEnd;
+    };
+}
+
+
+string MfcBinLog::Render(const string& sFmt, const char* pArgs, size_t nLen)
+{
+    ArgReader args(pArgs, nLen);
+    const char* p = sFmt.c_str();
+    char szTmp[1024];
+    string sOut;
+
+    while (*p)
+    {
+        if (*p != '%')
+        {
+            sOut += *p++;
+            continue;
+        }
+        if (p[1] == '%')
+        {
+            sOut += '%';
+            p += 2;
+            continue;
+        }
+
+        const char* pszSpec = p++;
+        string sSpec = "%";
+        int64_t nStar;
+
+        while (*p && strchr("-+ #0", *p))
+            sSpec += *p++;
+
+        if (*p == '*')
+        {
+            sSpec += args.nextInt(nStar) ? std::to_string(nStar) : "";
+            p++;
+        }
+        else while (*p >= '0' && *p <= '9')
+            sSpec += *p++;
+
+        if (*p == '.')
+        {
+            sSpec += *p++;
+            if (*p == '*')
+            {
+                sSpec += args.nextInt(nStar) ? std::to_string(nStar) : "0";
+                p++;
+            }
+            else while (*p >= '0' && *p <= '9')
+                sSpec += *p++;
+        }
+
+        // Length modifiers don't matter, every value was widened when it was written
+        while (*p && strchr("hlLqjzt", *p))
+            p++;
+
+        char chConv = *p;
+        if (chConv)
+            p++;
+
+        bool fOk = true;
+        switch (chConv)
+        {
+        case 'd':
+        case 'i':
+        {
+            int64_t nVal;
+            if ((fOk = args.nextInt(nVal)))
+                snprintf(szTmp, sizeof(szTmp), (sSpec + "lld").c_str(), (long long)nVal);
+            break;
+        }
+        case 'u':
+        case 'x':
+        case 'X':
+        case 'o':
+        {
+            int64_t nVal;
+            if ((fOk = args.nextInt(nVal)))
+                snprintf(szTmp, sizeof(szTmp), (sSpec + "ll" + chConv).c_str(), (unsigned long long)nVal);
+            break;
+        }
+        case 'c':
+        {
+            int64_t nVal;
+            if ((fOk = args.nextInt(nVal)))
+                snprintf(szTmp, sizeof(szTmp), (sSpec + "c").c_str(), (int)nVal);
+            break;
+        }
+        case 'f':
+        case 'F':
+        case 'e':
+        case 'E':
+        case 'g':
+        case 'G':
+        case 'a':
+        case 'A':
+        {
+            double dVal;
+            if ((fOk = args.nextDouble(dVal)))
+                snprintf(szTmp, sizeof(szTmp), (sSpec + chConv).c_str(), dVal);
+            break;
+        }
+        case 's':
+        {
+            string sVal;
+            if ((fOk = args.nextString(sVal)))
+                snprintf(szTmp, sizeof(szTmp), (sSpec + "s").c_str(), sVal.c_str());
+            break;
+        }
+        case 'p':
+        {
+            int64_t nVal;
+            if ((fOk = args.nextInt(nVal)))
+                snprintf(szTmp, sizeof(szTmp), "0x%llx", (unsigned long long)nVal);
+            break;
+        }
+        default:
+            // Unknown conversion, copy it through untouched
+            sOut.append(pszSpec, p - pszSpec);
+            continue;
+        }
+
+        sOut += fOk ? szTmp : "<?>";
+    }
+
+    return sOut;
+}
+
+
+bool MfcBinLog::Decode(const string& sFile, const std::function< void(const Record&) >& fnRecord,
+                       std::vector< Site >* pvSites, string* psModule, string* psError)
+{
+    string sErr, sData;
+    std::vector< Site > vSites;
+
+    if (!stdGetFileContents(sFile, sData))
+        sErr = "unable to read " + sFile;
+    else if (sData.size() < HDR_SZ)
+        sErr = "file too small";
+
+    // Read the header fields by offset, the atomics in FileHdr can't be copied
+    FileHdr hdr;
+    if (sErr.empty())
+    {
+        memcpy(&hdr.dwMagic,    sData.data() + offsetof(FileHdr, dwMagic),   sizeof(hdr.dwMagic));
+        memcpy(&hdr.dwVersion,  sData.data() + offsetof(FileHdr, dwVersion), sizeof(hdr.dwVersion));
+        memcpy(&hdr.qwRingSz,   sData.data() + offsetof(FileHdr, qwRingSz),  sizeof(hdr.qwRingSz));
+        memcpy(&hdr.qwSitesSz,  sData.data() + offsetof(FileHdr, qwSitesSz), sizeof(hdr.qwSitesSz));
+        memcpy(hdr.szModule,    sData.data() + offsetof(FileHdr, szModule),  sizeof(hdr.szModule));
+        hdr.szModule[ sizeof(hdr.szModule) - 1 ] = '\0';
+
+        if (hdr.dwMagic != FILE_MAGIC)
+            sErr = "not a binary log file";
+        else if (hdr.dwVersion != FILE_VERSION)
+            sErr = stdprintf("unsupported version %u", hdr.dwVersion);
+        else if (hdr.qwRingSz == 0 || (hdr.qwRingSz & (hdr.qwRingSz - 1)) != 0
+              || sData.size() < HDR_SZ + hdr.qwSitesSz + hdr.qwRingSz)
+            sErr = "truncated or corrupt header";
+    }
+
+    if (!sErr.empty())
+    {
+        if (psError)
+            *psError = sErr;
+        return false;
+    }
+
+    uint64_t qwWritePos;
+    uint32_t dwSitesUsed, dwSiteCount;
+    memcpy(&qwWritePos,  sData.data() + offsetof(FileHdr, qwWritePos),  sizeof(qwWritePos));
+    memcpy(&dwSitesUsed, sData.data() + offsetof(FileHdr, dwSitesUsed), sizeof(dwSitesUsed));
+    memcpy(&dwSiteCount, sData.data() + offsetof(FileHdr, dwSiteCount), sizeof(dwSiteCount));
+
+    // Site table
+    const char* pSites = sData.data() + HDR_SZ;
+    size_t nOff = 0;
+    dwSitesUsed = (uint32_t)std::min< uint64_t >(dwSitesUsed, hdr.qwSitesSz);
+
+    for (uint32_t n = 0; n < dwSiteCount && nOff + sizeof(SiteHdr) <= dwSitesUsed; n++)
+    {
+        SiteHdr siteHdr;
+        memcpy(&siteHdr, pSites + nOff, sizeof(siteHdr));
+        if (siteHdr.wLen < sizeof(SiteHdr) || nOff + siteHdr.wLen > dwSitesUsed)
+            break;
+
+        const char* pch = pSites + nOff + sizeof(SiteHdr);
+        const char* pEnd = pSites + nOff + siteHdr.wLen;
+        Site site;
+        site.nLevel = (ILog::LogLevel)siteHdr.nLevel;
+        site.nLine = siteHdr.nLine;
+        site.sFile.assign(pch, strnlen(pch, pEnd - pch));
+        pch += site.sFile.size() + 1;
+        if (pch < pEnd)
+        {
+            site.sFunction.assign(pch, strnlen(pch, pEnd - pch));
+            pch += site.sFunction.size() + 1;
+        }
+        if (pch < pEnd)
+            site.sFmt.assign(pch, strnlen(pch, pEnd - pch));
+
+        vSites.push_back(site);
+        nOff += siteHdr.wLen;
+    }
+
+    // Filled in before the records so the callback can use it
+    if (psModule)
+        *psModule = hdr.szModule;
+
+    // Ring: start at the oldest byte that can still be intact and resync on the
+    // commit word, the first records there were probably half overwritten
+    const char* pRing = sData.data() + HDR_SZ + hdr.qwSitesSz;
+    uint64_t qwMask = hdr.qwRingSz - 1;
+    uint64_t qwPos = qwWritePos > hdr.qwRingSz ? ((qwWritePos - hdr.qwRingSz + 7) & ~(uint64_t)7) : 0;
+    char recBuf[ sizeof(RecHdr) + MAX_PAYLOAD + 8 ];
+
+    auto copyOut = [&](uint64_t qwAt, void* pDst, size_t nSz)
+    {
+        size_t nAt = (size_t)(qwAt & qwMask);
+        size_t nFirst = std::min(nSz, (size_t)(hdr.qwRingSz - nAt));
+        memcpy(pDst, pRing + nAt, nFirst);
+        if (nFirst < nSz)
+            memcpy((char*)pDst + nFirst, pRing, nSz - nFirst);
+    };
+
+    while (qwPos + sizeof(RecHdr) <= qwWritePos)
+    {
+        RecHdr rec;
+        copyOut(qwPos, &rec, sizeof(rec));
+
+        bool fValid = rec.dwCommit == CommitWord(qwPos)
+                   && rec.wLen >= sizeof(RecHdr) && (rec.wLen & 7) == 0
+                   && rec.wLen <= sizeof(recBuf) && sizeof(RecHdr) + rec.wArgs <= rec.wLen
+                   && qwPos + rec.wLen <= qwWritePos;
+
+        if (!fValid)
+        {
+            qwPos += 8;
+            continue;
+        }
+
+        copyOut(qwPos, recBuf, rec.wLen);
+
+        Record out;
+        out.qwPos = qwPos;
+        out.qwTimeUs = rec.qwTimeUs;
+        out.dwTid = rec.dwTid;
+        out.pSite = rec.dwSite < vSites.size() ? &vSites[rec.dwSite] : nullptr;
+        out.sText = out.pSite ? Render(out.pSite->sFmt, recBuf + sizeof(RecHdr), rec.wArgs)
+                              : stdprintf("<unknown site %u>", rec.dwSite);
+        fnRecord(out);
+
+        qwPos += rec.wLen;
+    }
+
+    if (pvSites)
+        *pvSites = vSites;
+
+    return true;
+}
+
+
+string MfcBinLog::FormatRecord(const Record& rec, const string& sModule)
+{
+    time_t tSec = (time_t)(rec.qwTimeUs / 1000000);
+    struct tm tmRec;
+
+#ifdef _WIN32
+    localtime_s(&tmRec, &tSec);
+#else
+    localtime_r(&tSec, &tmRec);
+#endif
+
+    string sLine = stdprintf("[%s %02d-%02d %02d:%02d:%02d.%04d %u] ",
+                             sModule.c_str(),
+                             tmRec.tm_mon + 1, tmRec.tm_mday,
+                             tmRec.tm_hour, tmRec.tm_min, tmRec.tm_sec,
+                             (int)((rec.qwTimeUs % 1000000) / 1000),
+                             rec.dwTid);
+
+    if (rec.pSite)
+        sLine += stdprintf("[%s:%d, %s()]  ", rec.pSite->sFile.c_str(), rec.pSite->nLine, rec.pSite->sFunction.c_str());
+
+    sLine += rec.sText;
+    return sLine;
+}
@@ -0,0 +1,234 @@
+/*
+ * Copyright (c) 2013-2021 MFCXY, Inc. <mfcxy@mfcxy.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#pragma once
+
+#ifndef MFC_BIN_LOG_H
+#define MFC_BIN_LOG_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include "ILog.h"
+
+// Binary log channel with deferred formatting.
+//
+// Instead of running vsnprintf, a _BTRACE/_BMESG call site is registered once per
+// session (file, line, function, level and format string go into the site table of
+// the log file) and every call after that appends a compact record: site id,
+// timestamp, thread id and the raw arguments, each tagged with its type. Strings are
+// copied (up to MAX_STRING bytes), everything else is a single store.
+//
+// Records go into a ring in a memory mapped file, so the newest RingSz bytes survive
+// a crash of the process. Writers reserve space with one fetch_add on the shared write
+// position; the first word of a record is its commit marker (derived from the record's
+// position) and is written last. Old records are overwritten, nothing ever blocks.
+//
+// Decode() reads a file back offline and renders each record through its format
+// string, the binlogdump tool is a thin command line wrapper around it.
+//
+class MfcBinLog
+{
+public:
+    static const uint32_t   FILE_MAGIC          = 0x4C42464D;       // "MFBL"
+    static const uint32_t   FILE_VERSION        = 1;
+    static const size_t     DEFAULT_RING_SZ     = 8 * 1024 * 1024;
+    static const size_t     SITES_SZ            = 256 * 1024;       // site table bytes
+    static const size_t     MAX_PAYLOAD         = 1024;             // encoded argument bytes per record
+    static const size_t     MAX_STRING          = 256;              // longer string args are truncated
+    static const uint32_t   NO_SITE             = 0xFFFFFFFF;
+
+    // Type tag in front of every encoded argument
+    enum ArgType
+    {
+        ARG_I32         = 'i',
+        ARG_U32         = 'u',
+        ARG_I64         = 'I',
+        ARG_U64         = 'U',
+        ARG_F64         = 'f',
+        ARG_STR         = 's',      // uint16_t length then the bytes, no terminator
+        ARG_PTR         = 'p',
+    };
+
+    struct Site
+    {
+        ILog::LogLevel  nLevel;
+        int             nLine;
+        std::string     sFile;
+        std::string     sFunction;
+        std::string     sFmt;
+    };
+
+    struct Record
+    {
+        uint64_t        qwPos;          // position in the ring, grows for the whole session
+        uint64_t        qwTimeUs;       // gettimeofday() in microseconds
+        uint32_t        dwTid;
+        const Site*     pSite;
+        std::string     sText;          // rendered message
+    };
+
+    // Stack buffer the arguments are encoded into before the record is reserved
+    struct ArgBuf
+    {
+        char        data[ MAX_PAYLOAD ];
+        size_t      nLen;
+        bool        fTruncated;
+
+        ArgBuf() : nLen(0), fTruncated(false) {}
+
+        void put(char chType, const void* pVal, size_t nSz)
+        {
+            if (nLen + 1 + nSz > MAX_PAYLOAD)
+            {
+                fTruncated = true;
+                return;
+            }
+            data[nLen++] = chType;
+            memcpy(data + nLen, pVal, nSz);
+            nLen += nSz;
+        }
+    };
+
+    MfcBinLog();
+    ~MfcBinLog();
+
+    MfcBinLog(const MfcBinLog&) = delete;
+    MfcBinLog& operator=(const MfcBinLog&) = delete;
+
+    // Creates sFile (moving an existing one to sFile.1) and starts the session.
+    // pszModule is stored in the header and shown by the decoder. Only once per
+    // instance: returns false if it was opened before, even if it has been closed.
+    bool Open(const std::string& sFile, const char* pszModule, size_t nRingSz = DEFAULT_RING_SZ);
+
+    // Stops accepting records and syncs the file. The mapping itself is only released
+    // at destruction, so a thread still inside Write() is safe.
+    void Close(void);
+
+    bool IsOpen(void) const { return m_fOpen.load(std::memory_order_acquire); }
+
+    // Site id for a call site in the current session, registering it on first use.
+    // qwCache is a static at the call site, NO_SITE if the site table is full.
+    uint32_t SiteId(std::atomic< uint64_t >& qwCache, ILog::LogLevel nLevel, const char* pszFile,
+                    const char* pszFunction, int nLine, const char* pszFmt);
+
+    template< typename... Args >
+    bool Write(uint32_t dwSite, const Args&... args)
+    {
+        ArgBuf buf;
+        EncodeArgs(buf, args...);
+        return Commit(dwSite, buf.data, buf.nLen);
+    }
+
+    // Offline side: calls fnRecord for every intact record in sFile, oldest first
+    static bool Decode(const std::string& sFile, const std::function< void(const Record&) >& fnRecord,
+                       std::vector< Site >* pvSites = nullptr, std::string* psModule = nullptr, std::string* psError = nullptr);
+
+    // Renders pArgs (as written by Write()) through the printf style sFmt
+    static std::string Render(const std::string& sFmt, const char* pArgs, size_t nLen);
+
+    // "[module MM-DD HH:MM:SS.mmmm tid] [file:line, function()]  text", same layout as the text log
+    static std::string FormatRecord(const Record& rec, const std::string& sModule);
+
+    // OS thread id of the caller, cached per thread
+    static uint32_t ThreadId(void);
+
+private:
+    struct FileHdr;
+    struct RecHdr;
+
+    bool Commit(uint32_t dwSite, const char* pArgs, size_t nArgs);
+    void CopyIn(uint64_t qwPos, const void* pSrc, size_t nSz);
+    void Unmap(void);
+
+    static uint32_t CommitWord(uint64_t qwPos) { return (uint32_t)(qwPos >> 3) ^ 0xB10CB10C; }
+
+    static void EncodeArgs(ArgBuf&) {}
+
+    template< typename T, typename... Rest >
+    static void EncodeArgs(ArgBuf& buf, const T& arg, const Rest&... rest)
+    {
+        EncodeArg(buf, arg);
+        EncodeArgs(buf, rest...);
+    }
+
+    template< typename T >
+    static typename std::enable_if< std::is_integral< T >::value >::type EncodeArg(ArgBuf& buf, T val)
+    {
+        if (sizeof(T) <= sizeof(uint32_t))
+        {
+            uint32_t dwVal = (uint32_t)val;
+            buf.put(std::is_signed< T >::value ? ARG_I32 : ARG_U32, &dwVal, sizeof(dwVal));
+        }
+        else
+        {
+            uint64_t qwVal = (uint64_t)val;
+            buf.put(std::is_signed< T >::value ? ARG_I64 : ARG_U64, &qwVal, sizeof(qwVal));
+        }
+    }
+
+    template< typename T >
+    static typename std::enable_if< std::is_enum< T >::value >::type EncodeArg(ArgBuf& buf, T val)
+    {
+        EncodeArg(buf, (typename std::underlying_type< T >::type)val);
+    }
+
+    template< typename T >
+    static typename std::enable_if< std::is_floating_point< T >::value >::type EncodeArg(ArgBuf& buf, T val)
+    {
+        double dVal = (double)val;
+        buf.put(ARG_F64, &dVal, sizeof(dVal));
+    }
+
+    template< typename T >
+    static void EncodeArg(ArgBuf& buf, const T* pVal)
+    {
+        uint64_t qwVal = (uint64_t)(uintptr_t)pVal;
+        buf.put(ARG_PTR, &qwVal, sizeof(qwVal));
+    }
+
+    static void EncodeArg(ArgBuf& buf, std::nullptr_t)
+    {
+        uint64_t qwVal = 0;
+        buf.put(ARG_PTR, &qwVal, sizeof(qwVal));
+    }
+
+    static void EncodeArg(ArgBuf& buf, const char* pszVal);
+
+    std::atomic< bool >     m_fOpen;
+    std::atomic< uint32_t > m_dwGen;        // session number, call site caches are keyed on it
+    FileHdr*                m_pHdr;
+    char*                   m_pSites;
+    char*                   m_pRing;
+    uint64_t                m_qwRingMask;
+    size_t                  m_nMapSz;
+    std::mutex              m_siteMutex;    // site registration, Open() and Close()
+
+#ifdef _WIN32
+    void*                   m_hFile;
+    void*                   m_hMapping;
+#else
+    int                     m_nFd;
+#endif
+};
+
+#endif // MFC_BIN_LOG_H
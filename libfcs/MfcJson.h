@@ -225,7 +225,7 @@ public:
 
     bool objectAdd(const string& sKey, MfcJsonObj* pObj, bool fReplace = true);
     bool objectAdd(const string& sKey, const MfcJsonObj& json, bool fReplace = true);
-#ifndef _WIN32
+#ifdef __APPLE__     // time_t is int64_t on Linux
     bool objectAdd(const string& sKey, time_t   nVal, bool fReplace = true) { return objectAdd(sKey, (int64_t)nVal, fReplace); }
 #endif
     bool objectAdd(const string& sKey, int32_t  nVal, bool fReplace = true) { return objectAdd(sKey, (int64_t)nVal, fReplace); }
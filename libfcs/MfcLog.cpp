@@ -105,6 +105,7 @@
 #include <memory>
 #include <vector>
 #include <set>
+#include <mutex>
 
 #include <libPlugins/Portable.h>
 
@@ -120,6 +121,8 @@ char g_dummyCharVal = 'x';
 
 void MfcLog::Setup(const string& sLogDir)
 {
+    std::unique_lock< std::mutex > lk(m_ioMutex);
+
     m_Data.fTraceFunction       = true;
 
     for (size_t n = 0; n < ILog::MAX_LOGLEVEL; n++)
@@ -138,12 +141,14 @@ void MfcLog::Setup(const string& sLogDir)
         m_Data.tvLastOpen[n].tv_usec = 0;
     }
 
+    lk.unlock();
     SetLog(ILog::MAX_LOGCLASS, NULL, false);
 }
 
 
 void MfcLog::SetLog(LogClass nClass, const char* pszFile, bool fUnlink)
 {
+    std::lock_guard< std::mutex > lk(m_ioMutex);
     const char* pch;
 
     if (nClass < ILog::MAX_LOGCLASS)
@@ -311,55 +316,145 @@ void MfcLog::TraceMarker(const char* pszFile, const char* pszFunction, int nLine
 }
 
 
-void MfcLog::_Mesg(LogLevel nLevel, const char* pszMesg)
+MfcLog::~MfcLog()
 {
-    struct timeval tvNow;
-    char szTmp[512];
-    struct tm tmNow;
-    struct stat st;
-    char* pszFmt;
-    string sLog;
-    int n;
+    // Write out whatever is still queued before the fds go away
+    if (m_pWriter)
+    {
+        m_fAsync.store(false, std::memory_order_release);
+        m_pWriter->stop();
+    }
+}
 
-    gettimeofday(&tvNow, NULL);
 
-#ifdef _WIN32
-    _localtime32_s(&tmNow, (__time32_t*)&tvNow.tv_sec);
-
-    char szModuleName[MAX_PATH];
-    //GetModuleFileNameExA(GetCurrentProcess(), GetModuleHandle(NULL), szModuleName, sizeof(szModuleName));
-    HMODULE phModule = NULL;
-    if ( GetModuleHandleExA(GET_MODULE_HANDLE_EX_FLAG_FROM_ADDRESS | GET_MODULE_HANDLE_EX_FLAG_UNCHANGED_REFCOUNT,
-        (LPCSTR) &g_dummyCharVal,
-        &phModule) )
+void MfcLog::SetAsync(bool fAsync)
+{
+    if (fAsync)
     {
-        char szFile[MAX_PATH];
-        GetModuleFileNameA(phModule, szFile, sizeof(szFile));
-        char* pch = strrchr(szFile, '\\');
-        if (pch)
-            fcs_strlcpy(szModuleName, pch + 1, sizeof(szModuleName));
-        else fcs_strlcpy(szModuleName, szFile, sizeof(szModuleName));
+        {
+            std::lock_guard< std::mutex > lk(m_ioMutex);
+            if (!m_pWriter)
+                m_pWriter.reset(new MfcLogWriter(this));
+        }
+
+        m_pWriter->start();
+        m_fAsync.store(true, std::memory_order_release);
     }
-    else fcs_strlcpy(szModuleName, "error-getting-module-handle", sizeof(szModuleName));
-#else
-    struct tm* pCt = localtime(&tvNow.tv_sec);
-    if (pCt)
-        tmNow = *pCt;
     else
-        memset(&tmNow, 0, sizeof(tmNow));
+    {
+        // Callers already past the m_fAsync check still queue, stop() drains after
+        // the thread exits and Flush() or the destructor picks up any stragglers
+        m_fAsync.store(false, std::memory_order_release);
+        if (m_pWriter)
+            m_pWriter->stop();
+    }
+}
 
-    char szModuleName[256];
 
-    Dl_info dylib;
-    if (dladdr(&g_dummyCharVal, &dylib) != 0)
+bool MfcLog::GetAsyncStats(MfcLogWriter::Stats& stats) const
+{
+    if (!m_pWriter)
+        return false;
+
+    stats = m_pWriter->getStats();
+    return true;
+}
+
+
+// Module name is looked up once per module (libfcs is linked statically into each one)
+const char* MfcLog::ModuleName(void)
+{
+    static const string s_sModuleName = []()
     {
-        const char* pch = strrchr(dylib.dli_fname, '/');
-        if (pch)
-            fcs_strlcpy(szModuleName, pch + 1, sizeof(szModuleName));
-        else fcs_strlcpy(szModuleName, dylib.dli_fname, sizeof(szModuleName));
-    }
-    else fcs_strlcpy(szModuleName, "module-err", sizeof(szModuleName));
+#ifdef _WIN32
+        HMODULE phModule = NULL;
+        if ( GetModuleHandleExA(GET_MODULE_HANDLE_EX_FLAG_FROM_ADDRESS | GET_MODULE_HANDLE_EX_FLAG_UNCHANGED_REFCOUNT,
+            (LPCSTR) &g_dummyCharVal,
+            &phModule) )
+        {
+            char szFile[MAX_PATH];
+            GetModuleFileNameA(phModule, szFile, sizeof(szFile));
+            char* pch = strrchr(szFile, '\\');
+            return string(pch ? pch + 1 : szFile);
+        }
+        return string("error-getting-module-handle");
+#else
+        Dl_info dylib;
+        if (dladdr(&g_dummyCharVal, &dylib) != 0 && dylib.dli_fname)
+        {
+            const char* pch = strrchr(dylib.dli_fname, '/');
+            return string(pch ? pch + 1 : dylib.dli_fname);
+        }
+        return string("module-err");
+#endif
+    }();
+
+    return s_sModuleName.c_str();
+}
+
+
+size_t MfcLog::FormatStamp(const struct timeval& tvNow, char* pszBuf, size_t nSz)
+{
+    // The prefix only changes once a second (apart from the msec digits), so each
+    // thread keeps the last one it built and just patches in the milliseconds.
+    struct StampCache
+    {
+        time_t  tSec;
+        int     nMask;
+        size_t  nLen;
+        bool    fMsec;
+        char    szStamp[512];
+    };
+    static thread_local StampCache s_cache = { -1, -1, 0, false, "" };
+
+    if (s_cache.tSec != tvNow.tv_sec || s_cache.nMask != m_Data.nStampMask)
+    {
+        struct tm tmNow;
+        string sStamp;
+
+#ifdef _WIN32
+        _localtime32_s(&tmNow, (__time32_t*)&tvNow.tv_sec);
+#else
+        time_t tSec = tvNow.tv_sec;
+        if (!localtime_r(&tSec, &tmNow))
+            memset(&tmNow, 0, sizeof(tmNow));
 #endif
+        BuildStamp(tmNow, 0, sStamp);
+
+        s_cache.tSec = tvNow.tv_sec;
+        s_cache.nMask = m_Data.nStampMask;
+        s_cache.nLen = fcs_strlcpy(s_cache.szStamp, sStamp.c_str(), sizeof(s_cache.szStamp));
+        if (s_cache.nLen >= sizeof(s_cache.szStamp))
+            s_cache.nLen = sizeof(s_cache.szStamp) - 1;
+
+        // When msec are shown they are always the 4 digits right before the closing "] "
+        int nMsecMask = ILog::TS_HOURMIN | ILog::TS_SEC | ILog::TS_MSEC;
+        s_cache.fMsec = (m_Data.nStampMask & nMsecMask) == nMsecMask && s_cache.nLen >= 6;
+    }
+
+    size_t nLen = std::min(s_cache.nLen, nSz - 1);
+    memcpy(pszBuf, s_cache.szStamp, nLen);
+    pszBuf[nLen] = '\0';
+
+    if (s_cache.fMsec && nLen == s_cache.nLen)
+    {
+        int nMsec = (int)(tvNow.tv_usec / 1000);
+        char* pch = pszBuf + nLen - 6;
+        pch[0] = '0';
+        pch[1] = (char)('0' + nMsec / 100);
+        pch[2] = (char)('0' + (nMsec / 10) % 10);
+        pch[3] = (char)('0' + nMsec % 10);
+    }
+
+    return nLen;
+}
+
+
+void MfcLog::BuildStamp(const struct tm& tmNow, int nMsec, string& sLog)
+{
+    const char* szModuleName = ModuleName();
+    char szTmp[512];
+    char* pszFmt;
 
     // Hardcode the most common time formats as an optimization (less calls to snprintf)
     if (m_Data.nStampMask == (ILog::TS_YEAR | ILog::TS_MONTHDAY | ILog::TS_HOURMIN | ILog::TS_SEC))
@@ -377,7 +472,7 @@ void MfcLog::_Mesg(LogLevel nLevel, const char* pszMesg)
                     szModuleName,
                     tmNow.tm_mon + 1, tmNow.tm_mday,
                     tmNow.tm_hour, tmNow.tm_min, tmNow.tm_sec,
-                    tvNow.tv_usec / 1000);
+                    nMsec);
     }
     else if (m_Data.nStampMask == (ILog::TS_PID | ILog::TS_MONTHDAY | ILog::TS_HOURMIN | ILog::TS_SEC | ILog::TS_MSEC))
     {
@@ -391,7 +486,7 @@ void MfcLog::_Mesg(LogLevel nLevel, const char* pszMesg)
 #endif
                     tmNow.tm_mon + 1, tmNow.tm_mday,
                     tmNow.tm_hour, tmNow.tm_min, tmNow.tm_sec,
-                    tvNow.tv_usec / 1000);
+                    nMsec);
     }
     else if (m_Data.nStampMask == (ILog::TS_PROGNAME | ILog::TS_PID | ILog::TS_YEAR | ILog::TS_MONTHDAY | ILog::TS_HOURMIN | ILog::TS_SEC))
     {
@@ -462,7 +557,7 @@ void MfcLog::_Mesg(LogLevel nLevel, const char* pszMesg)
             }
             else pszFmt = (char*)"%02d:%02d";
 
-            snprintf(szTmp, sizeof(szTmp), pszFmt, tmNow.tm_hour, tmNow.tm_min, tmNow.tm_sec, tvNow.tv_usec / 1000);
+            snprintf(szTmp, sizeof(szTmp), pszFmt, tmNow.tm_hour, tmNow.tm_min, tmNow.tm_sec, nMsec);
             sLog += szTmp;
         }
 
@@ -471,7 +566,27 @@ void MfcLog::_Mesg(LogLevel nLevel, const char* pszMesg)
         else
             sLog.clear();
     }
+}
+
+
+void MfcLog::_Mesg(LogLevel nLevel, const char* pszMesg)
+{
+    struct timeval tvNow;
+    char szStamp[512];
+    string sLog;
 
+    gettimeofday(&tvNow, NULL);
+
+    size_t nStamp = FormatStamp(tvNow, szStamp, sizeof(szStamp));
+    int nOutputs = m_Data.nOutputMasks[nLevel];
+
+    if (m_fAsync.load(std::memory_order_acquire))
+    {
+        m_pWriter->push(nLevel, nOutputs, szStamp, nStamp, pszMesg, strlen(pszMesg));
+        return;
+    }
+
+    sLog.assign(szStamp, nStamp);
     sLog += pszMesg;
 
 /*  // Reimplement option to strip ansi colors from logs that don't go to stdout or stderr
@@ -494,13 +609,13 @@ void MfcLog::_Mesg(LogLevel nLevel, const char* pszMesg)
 
 #ifndef _WIN32
     // Output syslog prior to \n concat
-    if (m_Data.nOutputMasks[nLevel] & OF_SYSLOG)
+    if (nOutputs & OF_SYSLOG)
         syslog((int)nLevel, "%s", sLog.c_str());
 #else
-    //if (m_Data.nOutputMasks[nLevel] & OF_DEBUGGER)
+    //if (nOutputs & OF_DEBUGGER)
     //   OutputDebugStringA(stdprintf("%s\r\n", sLog.c_str()).c_str());
 
-    if (m_Data.nOutputMasks[nLevel] & OF_HWND)
+    if (nOutputs & OF_HWND)
     {
         //OutputConsoleString(stdprintf("%s\r\n", sLog.c_str()));
     }
@@ -508,102 +623,116 @@ void MfcLog::_Mesg(LogLevel nLevel, const char* pszMesg)
 
     sLog += "\n";
 
-    if (m_Data.nOutputMasks[nLevel] & OF_FILE)
+    if (nOutputs & OF_FILE)
     {
-        // If auto-rotate file is on and its been >5 seconds since we last checked,
-        // check each LogClass file to see if it needs to be deleted
-        if (m_Data.nAutoRotateSz > 0 && tvNow.tv_sec - m_Data.nAutoRotateTm > 5)
+        std::lock_guard< std::mutex > lk(m_ioMutex);
+        WriteFile(ClassOf(nLevel), sLog.c_str(), sLog.size());
+    }
+
+    if (nOutputs & OF_STDOUT)
+        fwrite(sLog.c_str(), sLog.length(), 1, stdout);
+#ifdef _WIN32
+    if (nOutputs & OF_STDERR)
+        fwrite(sLog.c_str(), sLog.length(), 1, stderr);
+#endif
+}
+
+
+void MfcLog::WriteFile(LogClass nClass, const char* pszData, size_t nLen)
+{
+    struct timeval tvNow;
+    char szTmp[512];
+    struct stat st;
+    int n;
+
+    gettimeofday(&tvNow, NULL);
+
+    // If auto-rotate file is on and its been >5 seconds since we last checked,
+    // check each LogClass file to see if it needs to be deleted
+    if (m_Data.nAutoRotateSz > 0 && tvNow.tv_sec - m_Data.nAutoRotateTm > 5)
+    {
+        for (size_t n = 0; n < ILog::MAX_LOGCLASS; n++)
         {
-            for (size_t n = 0; n < ILog::MAX_LOGCLASS; n++)
+            snprintf(szTmp, sizeof(szTmp), "%s/%s", m_Data.sLogDir.c_str(), m_Data.sLogFiles[n].c_str());
+            if (stat(szTmp, &st) == 0)
             {
-                snprintf(szTmp, sizeof(szTmp), "%s/%s", m_Data.sLogDir.c_str(), m_Data.sLogFiles[n].c_str());
-                if (stat(szTmp, &st) == 0)
+                if ((size_t)st.st_size > m_Data.nAutoRotateSz)
                 {
-                    if ((size_t)st.st_size > m_Data.nAutoRotateSz)
+                    // Close handle if its open before unlink
+                    if (m_Data.nLogFds[n] > -1)
                     {
-                        // Close handle if its open before unlink
-                        if (m_Data.nLogFds[n] > -1)
-                        {
 #ifdef _WIN32
-                            _close(m_Data.nLogFds[n]);
+                        _close(m_Data.nLogFds[n]);
 #else
-                            close(m_Data.nLogFds[n]);
+                        close(m_Data.nLogFds[n]);
 #endif
-                            m_Data.nLogFds[n] = -1;
-                            m_Data.tvLastOpen[n].tv_sec = 0;
-                            m_Data.tvLastOpen[n].tv_usec = 0;
-                        }
+                        m_Data.nLogFds[n] = -1;
+                        m_Data.tvLastOpen[n].tv_sec = 0;
+                        m_Data.tvLastOpen[n].tv_usec = 0;
+                    }
 #ifdef _WIN32
-                        _unlink(szTmp);
+                    _unlink(szTmp);
 #else
-                        unlink(szTmp);
+                    unlink(szTmp);
 #endif
-                    }
                 }
             }
-
-            m_Data.nAutoRotateTm = tvNow.tv_sec;
         }
 
-        // If we've been open for >3sec, close/reopen to make sure deleted log files get detected and re-opened correctly
-        if (MfcTimer::DiffTime(tvNow, m_Data.tvLastOpen[ClassOf(nLevel)]) >= 3.0)
+        m_Data.nAutoRotateTm = tvNow.tv_sec;
+    }
+
+    // If we've been open for >3sec, close/reopen to make sure deleted log files get detected and re-opened correctly
+    if (MfcTimer::DiffTime(tvNow, m_Data.tvLastOpen[nClass]) >= 3.0)
+    {
+        if (m_Data.nLogFds[nClass] > -1)
         {
-            if (m_Data.nLogFds[ClassOf(nLevel)] > -1)
-            {
 #ifdef _WIN32
-                _close(m_Data.nLogFds[ClassOf(nLevel)]);
+            _close(m_Data.nLogFds[nClass]);
 #else
-                close(m_Data.nLogFds[ClassOf(nLevel)]);
+            close(m_Data.nLogFds[nClass]);
 #endif
-                m_Data.nLogFds[ClassOf(nLevel)] = -1;
-                m_Data.tvLastOpen[ClassOf(nLevel)].tv_sec = 0;
-                m_Data.tvLastOpen[ClassOf(nLevel)].tv_usec = 0;
-            }
+            m_Data.nLogFds[nClass] = -1;
+            m_Data.tvLastOpen[nClass].tv_sec = 0;
+            m_Data.tvLastOpen[nClass].tv_usec = 0;
         }
+    }
 
-        // find file handle to write to
-        if (m_Data.nLogFds[ClassOf(nLevel)] == -1)
-            OpenLog(ClassOf(nLevel));
+    // find file handle to write to
+    if (m_Data.nLogFds[nClass] == -1)
+        OpenLog(nClass);
 
-        if (m_Data.nLogFds[ClassOf(nLevel)] > -1)
-        {
+    if (m_Data.nLogFds[nClass] > -1)
+    {
 #ifdef _WIN32
-            if ((n = _write(m_Data.nLogFds[ClassOf(nLevel)], sLog.c_str(), sLog.size())) != (int)sLog.size())
+        if ((n = _write(m_Data.nLogFds[nClass], pszData, (unsigned int)nLen)) != (int)nLen)
 #else
-            if ((n = write(m_Data.nLogFds[ClassOf(nLevel)], sLog.c_str(), sLog.size())) != (int)sLog.size())
+        if ((n = (int)write(m_Data.nLogFds[nClass], pszData, nLen)) != (int)nLen)
 #endif
+        {
+            // Error writing to file? try close/open the file
+            if (n == -1)
             {
-                // Error writing to file? try close/open the file
-                if (n == -1)
-                {
 #ifdef _WIN32
-                    _close(m_Data.nLogFds[ClassOf(nLevel)]);
+                _close(m_Data.nLogFds[nClass]);
 #else
-                    close(m_Data.nLogFds[ClassOf(nLevel)]);
+                close(m_Data.nLogFds[nClass]);
 #endif
-                    m_Data.nLogFds[ClassOf(nLevel)] = -1;
-                    m_Data.tvLastOpen[ClassOf(nLevel)].tv_sec = 0;
-                    m_Data.tvLastOpen[ClassOf(nLevel)].tv_usec = 0;
+                m_Data.nLogFds[nClass] = -1;
+                m_Data.tvLastOpen[nClass].tv_sec = 0;
+                m_Data.tvLastOpen[nClass].tv_usec = 0;
 
-                    OpenLog(ClassOf(nLevel));
+                OpenLog(nClass);
 
-                    if (m_Data.nLogFds[ClassOf(nLevel)] > -1)
+                if (m_Data.nLogFds[nClass] > -1)
 #ifdef _WIN32
-                        _write(m_Data.nLogFds[ClassOf(nLevel)], sLog.c_str(), sLog.size());
+                    _write(m_Data.nLogFds[nClass], pszData, (unsigned int)nLen);
 #else
-                        write(m_Data.nLogFds[ClassOf(nLevel)], sLog.c_str(), sLog.size());
+                    write(m_Data.nLogFds[nClass], pszData, nLen);
 #endif
-                }
             }
         }
     }
-
-    if (m_Data.nOutputMasks[nLevel] & OF_STDOUT)
-        fwrite(sLog.c_str(), sLog.length(), 1, stdout);
-#ifdef _WIN32
-    if (m_Data.nOutputMasks[nLevel] & OF_STDERR)
-        fwrite(sLog.c_str(), sLog.length(), 1, stderr);
-#endif
 }
 
 
@@ -656,6 +785,7 @@ void MfcLog::AddStampMask(int nValue)
 
 void MfcLog::SetAutoRotate(size_t nSz)
 {
+    std::lock_guard< std::mutex > lk(m_ioMutex);
     m_Data.nAutoRotateSz = nSz;
     m_Data.nAutoRotateTm = 0;
 }
@@ -696,6 +826,11 @@ int MfcLog::GetOutputMask(ILog::LogLevel nLevel)
 
 void MfcLog::Flush(void)
 {
+    if (m_pWriter)
+        m_pWriter->flush();
+
+    std::lock_guard< std::mutex > lk(m_ioMutex);
+
     for (int n = 0; n < ILog::MAX_LOGCLASS; n++)
     {
         if (m_Data.nLogFds[n] > -1)
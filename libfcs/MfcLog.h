@@ -26,13 +26,19 @@
 #endif
 #include <time.h>
 
+#include <atomic>
+#include <memory>
+#include <mutex>
+
 #include "ILog.h"
+#include "MfcBinLog.h"
+#include "MfcLogWriter.h"
 
 class MfcLog : public ILog
 {
 public:
-    MfcLog() { Setup("/tmp"); }
-    ~MfcLog() override = default;
+    MfcLog() : m_fAsync(false) { Setup("/tmp"); }
+    ~MfcLog() override;
 
     ILog* GetILog(void) { return (ILog*)this; }
 
@@ -50,6 +56,18 @@ public:
 
     struct ILog::LogData m_Data;
 
+    // In async mode _Mesg() only formats the line and queues it, a background
+    // MfcLogWriter does the file/stdout/syslog output. Flush() waits for it.
+    void SetAsync(bool fAsync);
+    bool IsAsync(void) const { return m_fAsync.load(std::memory_order_acquire); }
+    bool GetAsyncStats(MfcLogWriter::Stats& stats) const;
+
+    // Binary channel for _BTRACE/_BMESG call sites, closed unless opened with BinLog().Open()
+    MfcBinLog& BinLog(void) { return m_BinLog; }
+
+    // File name of the module libfcs is linked into, as shown in the log stamp
+    static const char* ModuleName(void);
+
     //-- [ ILog Interface Implementation ] --------------------------------
     //
     void Setup(const string& sLogDir) override;
@@ -84,14 +102,28 @@ public:
     // -------------------------------------------------------------------
 
 private:
+    friend class MfcLogWriter;
+
     bool OpenLog(LogClass nClass);
 
-    inline LogClass ClassOf(ILog::LogLevel nLevel)
+    // Writes pszData to nClass's file, rotating/reopening as needed. Caller holds m_ioMutex.
+    void WriteFile(LogClass nClass, const char* pszData, size_t nLen);
+
+    // Fills pszBuf with the "[module ...] " prefix for tvNow according to nStampMask
+    size_t FormatStamp(const struct timeval& tvNow, char* pszBuf, size_t nSz);
+    void BuildStamp(const struct tm& tmNow, int nMsec, string& sLog);
+
+    static inline LogClass ClassOf(ILog::LogLevel nLevel)
     {
         if (nLevel == DBG)      return ILog::LC_DEBUG;
         if (nLevel == TRACE)    return ILog::LC_TRACE;
         return ILog::LC_MAIN;
     }
+
+    std::mutex                      m_ioMutex;      // log fds and rotation state in m_Data
+    std::atomic< bool >             m_fAsync;
+    std::unique_ptr< MfcLogWriter > m_pWriter;      // created on first SetAsync(true), kept until destruction
+    MfcBinLog                       m_BinLog;
 };
 
 #endif // MFC_LOG_H
@@ -0,0 +1,377 @@
+/*
+ * Copyright (c) 2013-2021 MFCXY, Inc. <mfcxy@mfcxy.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef _WIN32
+#include <syslog.h>
+#endif
+
+#include <stdio.h>
+#include <string.h>
+
+#include <algorithm>
+
+#include "MfcLog.h"
+#include "MfcLogWriter.h"
+
+static_assert((MfcLogWriter::QUEUE_CELLS & (MfcLogWriter::QUEUE_CELLS - 1)) == 0,
+              "MfcLogWriter::QUEUE_CELLS must be a power of 2");
+static_assert(MfcLogWriter::MAX_LINE_CELLS <= MfcLogWriter::QUEUE_CELLS / 4,
+              "MfcLogWriter::MAX_LINE_CELLS must leave room for other lines in the ring");
+
+
+MfcLogWriter::MfcLogWriter(MfcLog* pLog)
+    : m_pLog(pLog)
+    , m_tail(0)
+    , m_head(0)
+    , m_wakePending(false)
+    , m_bRunning(false)
+    , m_nFlushReq(0)
+    , m_nFlushDone(0)
+    , m_bStop(false)
+    , m_nDroppedSeen(0)
+    , m_nQueued(0)
+    , m_nWritten(0)
+    , m_nDropped(0)
+    , m_nTruncated(0)
+    , m_nBatches(0)
+{
+    for (size_t n = 0; n < QUEUE_CELLS; n++)
+        m_cells[n].seq.store(n, std::memory_order_relaxed);
+}
+
+
+MfcLogWriter::~MfcLogWriter()
+{
+    stop();
+}
+
+
+bool MfcLogWriter::push(ILog::LogLevel nLevel, int nOutputs, const char* pszHead, size_t nHead, const char* pszBody, size_t nBody)
+{
+    size_t nTotal = nHead + nBody + 1;
+    size_t nCells = (nTotal + CELL_DATA - 1) / CELL_DATA;
+
+    if (nCells > MAX_LINE_CELLS)
+    {
+        nCells = MAX_LINE_CELLS;
+        nTotal = nCells * CELL_DATA;
+        if (nHead > nTotal - 1)
+            nHead = nTotal - 1;
+        nBody = nTotal - 1 - nHead;
+        m_nTruncated.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    // Claim nCells consecutive cells. The writer frees cells in order, so if the last
+    // one is free for this lap of the ring then all of the ones before it are too.
+    size_t nPos = m_tail.load(std::memory_order_relaxed);
+    int nFullRetries = 0;
+
+    while (true)
+    {
+        size_t nLast = nPos + nCells - 1;
+        size_t nSeq = m_cells[ nLast & (QUEUE_CELLS - 1) ].seq.load(std::memory_order_acquire);
+        intptr_t nDiff = (intptr_t)nSeq - (intptr_t)nLast;
+
+        if (nDiff == 0)
+        {
+            if (m_tail.compare_exchange_weak(nPos, nPos + nCells, std::memory_order_relaxed))
+                break;
+        }
+        else if (nDiff < 0)
+        {
+            // Writer hasn't caught up and the ring is full. Give it a moment to drain
+            // before we throw the line away, a burst shouldn't cost us log lines.
+            wake();
+            if (nFullRetries++ >= FULL_RETRIES)
+            {
+                m_nDropped.fetch_add(1, std::memory_order_relaxed);
+                return false;
+            }
+            std::this_thread::yield();
+            nPos = m_tail.load(std::memory_order_relaxed);
+        }
+        else nPos = m_tail.load(std::memory_order_relaxed);
+    }
+
+    // Copy head, body and the newline across the claimed cells
+    const char* pszSrc = pszHead;
+    size_t nSrcLeft = nHead;
+    bool inBody = false;
+
+    for (size_t n = 0; n < nCells; n++)
+    {
+        Cell& cell = m_cells[ (nPos + n) & (QUEUE_CELLS - 1) ];
+        size_t nUsed = 0;
+
+        while (nUsed < CELL_DATA)
+        {
+            if (nSrcLeft == 0)
+            {
+                if (!inBody)
+                {
+                    pszSrc = pszBody;
+                    nSrcLeft = nBody;
+                    inBody = true;
+                    continue;
+                }
+                if (pszSrc)
+                {
+                    cell.data[nUsed++] = '\n';
+                    pszSrc = nullptr;
+                }
+                break;
+            }
+
+            size_t nCopy = std::min(nSrcLeft, CELL_DATA - nUsed);
+            memcpy(cell.data + nUsed, pszSrc, nCopy);
+            nUsed += nCopy;
+            pszSrc += nCopy;
+            nSrcLeft -= nCopy;
+        }
+
+        cell.nLen = (uint16_t)nUsed;
+    }
+
+    Cell& first = m_cells[ nPos & (QUEUE_CELLS - 1) ];
+    first.nCells = (uint16_t)nCells;
+    first.nLevel = (uint8_t)nLevel;
+    first.nOutputs = (uint8_t)nOutputs;
+
+    // Publish the first cell last, the writer only looks at the others once it sees it
+    for (size_t n = nCells; n-- > 0; )
+        m_cells[ (nPos + n) & (QUEUE_CELLS - 1) ].seq.store(nPos + n + 1, std::memory_order_release);
+
+    m_nQueued.fetch_add(1, std::memory_order_relaxed);
+
+    // Only wake the writer early for bad news or when the ring is getting full,
+    // otherwise it picks the line up on its next FLUSH_INTERVAL_MS tick
+    if (nLevel <= ILog::ERR || nPos + nCells - m_head.load(std::memory_order_relaxed) > QUEUE_CELLS / 4)
+        wake();
+
+    return true;
+}
+
+
+void MfcLogWriter::wake(void)
+{
+    if (!m_wakePending.exchange(true, std::memory_order_acq_rel))
+    {
+        std::lock_guard< std::mutex > lk(m_mutex);
+        m_cv.notify_one();
+    }
+}
+
+
+void MfcLogWriter::start(void)
+{
+    std::lock_guard< std::mutex > lk(m_mutex);
+    if (m_bRunning.load(std::memory_order_relaxed))
+        return;
+
+    m_bStop = false;
+    m_bRunning.store(true, std::memory_order_release);
+    m_thread = std::thread(&MfcLogWriter::run, this);
+}
+
+
+void MfcLogWriter::stop(void)
+{
+    {
+        std::lock_guard< std::mutex > lk(m_mutex);
+        m_bStop = true;
+        m_cv.notify_one();
+    }
+
+    if (m_thread.joinable())
+        m_thread.join();
+
+    // Anything pushed while the thread was exiting is written from here
+    std::lock_guard< std::mutex > lk(m_drainMutex);
+    if (drain() > 0)
+        writeBatch();
+}
+
+
+void MfcLogWriter::flush(void)
+{
+    std::unique_lock< std::mutex > lk(m_mutex);
+    if (!m_bRunning.load(std::memory_order_relaxed))
+    {
+        lk.unlock();
+
+        std::lock_guard< std::mutex > lkDrain(m_drainMutex);
+        if (drain() > 0)
+            writeBatch();
+        return;
+    }
+
+    uint64_t nReq = ++m_nFlushReq;
+    m_cv.notify_one();
+    m_cvFlushed.wait(lk, [this, nReq]() { return m_nFlushDone >= nReq || !m_bRunning.load(std::memory_order_relaxed); });
+}
+
+
+MfcLogWriter::Stats MfcLogWriter::getStats(void) const
+{
+    Stats stats;
+    stats.queued    = m_nQueued.load(std::memory_order_relaxed);
+    stats.written   = m_nWritten.load(std::memory_order_relaxed);
+    stats.dropped   = m_nDropped.load(std::memory_order_relaxed);
+    stats.truncated = m_nTruncated.load(std::memory_order_relaxed);
+    stats.batches   = m_nBatches.load(std::memory_order_relaxed);
+    return stats;
+}
+
+
+void MfcLogWriter::run(void)
+{
+    std::unique_lock< std::mutex > lk(m_mutex);
+
+    while (true)
+    {
+        uint64_t nReq = m_nFlushReq;
+        bool bStop = m_bStop;
+        lk.unlock();
+
+        // Clear before reading so a push racing with us wakes us again
+        m_wakePending.store(false, std::memory_order_release);
+
+        {
+            std::lock_guard< std::mutex > lkDrain(m_drainMutex);
+            if (drain() > 0)
+                writeBatch();
+        }
+
+        lk.lock();
+        if (nReq > m_nFlushDone)
+        {
+            m_nFlushDone = nReq;
+            m_cvFlushed.notify_all();
+        }
+
+        if (bStop)
+            break;
+
+        if (m_nFlushReq == m_nFlushDone && !m_bStop && !m_wakePending.load(std::memory_order_acquire))
+            m_cv.wait_for(lk, std::chrono::milliseconds(FLUSH_INTERVAL_MS));
+    }
+
+    m_bRunning.store(false, std::memory_order_release);
+    m_cvFlushed.notify_all();
+}
+
+
+// Moves every complete line out of the ring into the batch buffers, returns the number of lines
+size_t MfcLogWriter::drain(void)
+{
+    size_t nHead = m_head.load(std::memory_order_relaxed);
+    size_t nLines = 0;
+
+    while (true)
+    {
+        Cell& first = m_cells[ nHead & (QUEUE_CELLS - 1) ];
+        if (first.seq.load(std::memory_order_acquire) != nHead + 1)
+            break;
+
+        ILog::LogLevel nLevel = (ILog::LogLevel)first.nLevel;
+        int nOutputs = first.nOutputs;
+        size_t nCells = first.nCells;
+        std::string* psFile = (nOutputs & ILog::OF_FILE) ? &m_sBatch[ MfcLog::ClassOf(nLevel) ] : nullptr;
+
+        for (size_t n = 0; n < nCells; n++)
+        {
+            Cell& cell = m_cells[ (nHead + n) & (QUEUE_CELLS - 1) ];
+
+            if (psFile)
+                psFile->append(cell.data, cell.nLen);
+            if (nOutputs & ILog::OF_STDOUT)
+                m_sStdout.append(cell.data, cell.nLen);
+#ifdef _WIN32
+            if (nOutputs & ILog::OF_STDERR)
+                m_sStderr.append(cell.data, cell.nLen);
+#endif
+        }
+
+#ifndef _WIN32
+        if (nOutputs & ILog::OF_SYSLOG)
+        {
+            std::string sLine;
+            for (size_t n = 0; n < nCells; n++)
+            {
+                Cell& cell = m_cells[ (nHead + n) & (QUEUE_CELLS - 1) ];
+                sLine.append(cell.data, cell.nLen);
+            }
+            if (!sLine.empty() && sLine.back() == '\n')
+                sLine.pop_back();
+            syslog((int)nLevel, "%s", sLine.c_str());
+        }
+#endif
+
+        for (size_t n = 0; n < nCells; n++)
+            m_cells[ (nHead + n) & (QUEUE_CELLS - 1) ].seq.store(nHead + n + QUEUE_CELLS, std::memory_order_release);
+
+        nHead += nCells;
+        m_head.store(nHead, std::memory_order_relaxed);
+        nLines++;
+
+        if (m_sStdout.size() >= BATCH_FLUSH_SZ || (psFile && psFile->size() >= BATCH_FLUSH_SZ))
+            writeBatch();
+    }
+
+    uint64_t nDropped = m_nDropped.load(std::memory_order_relaxed);
+    if (nDropped != m_nDroppedSeen)
+    {
+        char szLine[128];
+        int nLen = snprintf(szLine, sizeof(szLine), "[MfcLogWriter] log queue full, %llu lines dropped\n",
+                            (unsigned long long)(nDropped - m_nDroppedSeen));
+        m_sBatch[ ILog::LC_MAIN ].append(szLine, (size_t)nLen);
+        m_nDroppedSeen = nDropped;
+        nLines++;
+    }
+
+    m_nWritten.fetch_add(nLines, std::memory_order_relaxed);
+    return nLines;
+}
+
+
+void MfcLogWriter::writeBatch(void)
+{
+    std::lock_guard< std::mutex > lk(m_pLog->m_ioMutex);
+
+    for (size_t n = 0; n < ILog::MAX_LOGCLASS; n++)
+    {
+        if (!m_sBatch[n].empty())
+        {
+            m_pLog->WriteFile((ILog::LogClass)n, m_sBatch[n].data(), m_sBatch[n].size());
+            m_sBatch[n].clear();
+        }
+    }
+
+    if (!m_sStdout.empty())
+    {
+        fwrite(m_sStdout.data(), m_sStdout.size(), 1, stdout);
+        fflush(stdout);
+        m_sStdout.clear();
+    }
+
+    if (!m_sStderr.empty())
+    {
+        fwrite(m_sStderr.data(), m_sStderr.size(), 1, stderr);
+        m_sStderr.clear();
+    }
+
+    m_nBatches.fetch_add(1, std::memory_order_relaxed);
+}
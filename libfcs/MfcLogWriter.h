@@ -0,0 +1,134 @@
+/*
+ * Copyright (c) 2013-2021 MFCXY, Inc. <mfcxy@mfcxy.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#pragma once
+
+#ifndef MFC_LOG_WRITER_H
+#define MFC_LOG_WRITER_H
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include "ILog.h"
+
+class MfcLog;
+
+// Background writer for MfcLog's async mode.
+//
+// Producers copy each finished log line (stamp + message + "\n") into a bounded
+// lock-free multi-producer ring of fixed size cells; a line longer than one cell
+// claims several consecutive cells with a single CAS. Nothing on the producer side
+// takes a lock, allocates, or makes a syscall unless the ring is filling up or the
+// line is ERR or worse, in which case the writer is woken right away.
+//
+// The writer thread wakes at least every FLUSH_INTERVAL_MS, drains the ring into one
+// buffer per LogClass plus stdout, and hands each buffer to MfcLog as a single write
+// (rotation and reopen are handled there, the same as the synchronous path).
+// When the ring is full a producer yields for a while to let the writer catch up, and
+// only then drops the line and counts it; the writer logs how many were lost.
+//
+class MfcLogWriter
+{
+public:
+    static const size_t QUEUE_CELLS         = 4096;     // must be a power of 2
+    static const size_t CELL_DATA           = 240;      // line bytes per cell
+    static const size_t MAX_LINE_CELLS      = 128;      // longer lines are truncated (~30KB)
+    static const size_t BATCH_FLUSH_SZ      = 256 * 1024;
+    static const int    FLUSH_INTERVAL_MS   = 100;
+    static const int    FULL_RETRIES        = 1000;     // yields while the ring is full before dropping
+
+    struct Stats
+    {
+        uint64_t    queued;             // lines accepted by push()
+        uint64_t    written;            // lines handed to MfcLog by the writer
+        uint64_t    dropped;            // lines rejected because the ring was full
+        uint64_t    truncated;          // lines cut to MAX_LINE_CELLS
+        uint64_t    batches;            // write passes that had something to write
+    };
+
+    explicit MfcLogWriter(MfcLog* pLog);
+    ~MfcLogWriter();
+
+    // Producer side, safe from any thread. pszHead/pszBody are concatenated and a
+    // trailing "\n" is added. Returns false if the line was dropped.
+    bool push(ILog::LogLevel nLevel, int nOutputs, const char* pszHead, size_t nHead, const char* pszBody, size_t nBody);
+
+    // Starts the writer thread if it isn't running.
+    void start(void);
+
+    // Writes out everything queued so far and stops the writer thread.
+    void stop(void);
+
+    // Blocks until everything pushed before the call has been written.
+    void flush(void);
+
+    bool isRunning(void) const { return m_bRunning.load(std::memory_order_acquire); }
+
+    Stats getStats(void) const;
+
+private:
+    struct Cell
+    {
+        std::atomic< size_t >   seq;
+        uint16_t                nLen;           // bytes of data[] used
+        uint16_t                nCells;         // cells in this line, first cell only
+        uint8_t                 nLevel;         // first cell only
+        uint8_t                 nOutputs;       // first cell only
+        char                    data[ CELL_DATA ];
+    };
+
+    void run(void);
+    size_t drain(void);
+    void writeBatch(void);
+    void wake(void);
+
+    MfcLog*                             m_pLog;
+
+    Cell                                m_cells[ QUEUE_CELLS ];
+
+    alignas(64) std::atomic< size_t >   m_tail;         // next cell to claim, shared by producers
+    alignas(64) std::atomic< size_t >   m_head;         // next cell to read, only the writer stores it
+
+    std::atomic< bool >                 m_wakePending;
+    std::atomic< bool >                 m_bRunning;
+
+    std::mutex                          m_mutex;        // protects the flush/stop state below
+    std::condition_variable             m_cv;
+    std::condition_variable             m_cvFlushed;
+    uint64_t                            m_nFlushReq;
+    uint64_t                            m_nFlushDone;
+    bool                                m_bStop;
+    std::thread                         m_thread;
+
+    std::mutex                          m_drainMutex;   // one consumer at a time, held around drain()
+    std::string                         m_sBatch[ ILog::MAX_LOGCLASS ];
+    std::string                         m_sStdout;
+    std::string                         m_sStderr;
+    uint64_t                            m_nDroppedSeen;
+
+    std::atomic< uint64_t >             m_nQueued;
+    std::atomic< uint64_t >             m_nWritten;
+    std::atomic< uint64_t >             m_nDropped;
+    std::atomic< uint64_t >             m_nTruncated;
+    std::atomic< uint64_t >             m_nBatches;
+};
+
+#endif // MFC_LOG_WRITER_H
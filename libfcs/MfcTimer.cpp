@@ -0,0 +1,108 @@
+/*
+ * Copyright (c) 2013-2021 MFCXY, Inc. <mfcxy@mfcxy.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <time.h>
+
+#include "Compat.h"
+#include "MfcTimer.h"
+
+#if defined(MFC_TIMER_TSC) && !defined(_WIN32)
+#include <cpuid.h>
+#endif
+
+// How long the TSC is measured against MonoNs() on first use of FastNs()
+#define TSC_CALIBRATION_NS      (5 * 1000 * 1000)
+
+
+uint64_t MfcTimer::MonoNs(void)
+{
+#ifdef _WIN32
+    static const LONGLONG s_nFreq = []()
+    {
+        LARGE_INTEGER liFreq;
+        QueryPerformanceFrequency(&liFreq);
+        return liFreq.QuadPart;
+    }();
+    LARGE_INTEGER liNow;
+    QueryPerformanceCounter(&liNow);
+
+    // Split so the multiply can't overflow for counters running at 10MHz+
+    uint64_t nSec = (uint64_t)(liNow.QuadPart / s_nFreq);
+    uint64_t nRem = (uint64_t)(liNow.QuadPart % s_nFreq);
+    return nSec * 1000000000ULL + (nRem * 1000000000ULL) / (uint64_t)s_nFreq;
+#elif defined(__APPLE__)
+    return clock_gettime_nsec_np(CLOCK_MONOTONIC_RAW);
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+#endif
+}
+
+
+#ifdef MFC_TIMER_TSC
+// CPUID 0x80000007 EDX bit 8: the TSC ticks at a constant rate across P/C states and cores
+static bool hasInvariantTsc(void)
+{
+#ifdef _WIN32
+    int nRegs[4] = { 0 };
+    __cpuid(nRegs, 0x80000000);
+    if ((unsigned)nRegs[0] < 0x80000007)
+        return false;
+    __cpuid(nRegs, 0x80000007);
+    return (nRegs[3] & (1 << 8)) != 0;
+#else
+    unsigned int eax = 0, ebx = 0, ecx = 0, edx = 0;
+    if (__get_cpuid_max(0x80000000, nullptr) < 0x80000007)
+        return false;
+    __get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx);
+    return (edx & (1 << 8)) != 0;
+#endif
+}
+#endif
+
+
+const MfcTimer::TickCalibration& MfcTimer::Calibration(void)
+{
+    static const TickCalibration s_cal = []()
+    {
+        TickCalibration cal = { false, 0.0, 0, 0 };
+#ifdef MFC_TIMER_TSC
+        if (hasInvariantTsc())
+        {
+            uint64_t nStartNs = MonoNs(), nStartTicks = __rdtsc();
+            uint64_t nNowNs = nStartNs, nNowTicks = nStartTicks;
+
+            while (nNowNs - nStartNs < TSC_CALIBRATION_NS)
+            {
+                nNowNs = MonoNs();
+                nNowTicks = __rdtsc();
+            }
+
+            if (nNowTicks > nStartTicks)
+            {
+                cal.dNsPerTick = (double)(nNowNs - nStartNs) / (double)(nNowTicks - nStartTicks);
+                cal.nBaseTicks = nNowTicks;
+                cal.nBaseNs = nNowNs;
+                cal.fTsc = true;
+            }
+        }
+#endif
+        return cal;
+    }();
+
+    return s_cal;
+}
@@ -15,8 +15,12 @@
  */
 #pragma once
 
+#ifndef MFC_TIMER_H
+#define MFC_TIMER_H
+
 #include <string.h>
 #include <stdlib.h>
+#include <stdint.h>
 #include <time.h>
 
 #include <vector>
@@ -33,6 +37,22 @@ using namespace std;
 #include "UtilCommon.h"
 #endif
 
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#define MFC_TIMER_TSC 1
+#ifdef _WIN32
+#include <intrin.h>
+#else
+#include <x86intrin.h>
+#endif
+#endif
+
+// Elapsed time is measured on a monotonic clock (CLOCK_MONOTONIC_RAW, or QPC on windows)
+// so it never jumps when the wall clock is changed. FastNs() is a cheaper version for hot
+// loops: on x86 with an invariant TSC it's a single rdtsc scaled by a factor calibrated
+// once per process, elsewhere it is MonoNs().
+//
+// The wall clock helpers (Now, Date, Year ...) keep their results per thread, so the
+// accessors without arguments return what the last Now()/Date() call on the same thread saw.
 class MfcTimer
 {
 public:
@@ -40,15 +60,18 @@ public:
 	{
 		m_tvStart.tv_sec = 0, m_tvStart.tv_usec = 0;
 		m_tvStop = m_tvStart;
+		m_nStartNs = 0;
+		m_nStopNs = 0;
 		m_nDiff = 0;
 		m_dSeconds = 0;
-		//m_nObjectTm = time(NULL);
 	}
 
 	MfcTimer(bool fStart)
 	{
 		m_tvStart.tv_sec = 0, m_tvStart.tv_usec = 0;
 		m_tvStop = m_tvStart;
+		m_nStartNs = 0;
+		m_nStopNs = 0;
 		m_nDiff = 0;
 		m_dSeconds = 0;
 
@@ -60,59 +83,79 @@ public:
 	{
 	}
 
+    //
+    // Monotonic clock
+    //
 
-    static time_t Now(time_t* pNow)
+    // Nanoseconds since an arbitrary fixed point, never goes backwards
+    static uint64_t MonoNs(void);
+    static uint64_t MonoUs(void)        { return MonoNs() / 1000;           }
+    static uint64_t MonoMs(void)        { return MonoNs() / 1000000;        }
+
+    // Same timeline as MonoNs(), from the calibrated TSC when there is an invariant one
+    static uint64_t FastNs(void)
     {
-        gettimeofday(&sm_tvNow, NULL);
-#ifdef WIN32
-		localtime_s(&sm_ctNow, (const time_t*)&sm_tvNow.tv_sec);
-#else
-		sm_ctNow = *(localtime((const time_t*)&sm_tvNow.tv_sec));
+#ifdef MFC_TIMER_TSC
+        const TickCalibration& cal = Calibration();
+        if (cal.fTsc)
+        {
+            uint64_t nTicks = __rdtsc();
+            if (nTicks > cal.nBaseTicks)
+                return cal.nBaseNs + (uint64_t)((double)(nTicks - cal.nBaseTicks) * cal.dNsPerTick);
+            return cal.nBaseNs;
+        }
 #endif
-        *pNow = sm_tvNow.tv_sec;
-        return sm_tvNow.tv_sec;
+        return MonoNs();
+    }
+
+    // True if FastNs() is running off the TSC rather than calling MonoNs()
+    static bool HasFastClock(void)      { return Calibration().fTsc;        }
+
+    //
+    // Wall clock
+    //
+
+    static time_t Now(time_t* pNow)
+    {
+        TimeCache& tc = Cache();
+        tc.Update();
+        *pNow = tc.tvNow.tv_sec;
+        return tc.tvNow.tv_sec;
     }
     static struct timeval Now(struct timeval* pTmVal)
     {
-        gettimeofday(&sm_tvNow, NULL);
-#ifdef WIN32
-		localtime_s(&sm_ctNow, (const time_t*)&sm_tvNow.tv_sec);
-#else
-		sm_ctNow = *(localtime((const time_t*)&sm_tvNow.tv_sec));
-#endif
-        *pTmVal = sm_tvNow;
-        return sm_tvNow;
+        TimeCache& tc = Cache();
+        tc.Update();
+        *pTmVal = tc.tvNow;
+        return tc.tvNow;
     }
     static struct tm Date(void)
     {
-        gettimeofday(&sm_tvNow, NULL);
-#ifdef WIN32
-		localtime_s(&sm_ctNow, (const time_t*)&sm_tvNow.tv_sec);
-#else
-		sm_ctNow = *(localtime((const time_t*)&sm_tvNow.tv_sec));
-#endif
-        return sm_ctNow;
+        TimeCache& tc = Cache();
+        tc.Update();
+        return tc.ctNow;
     }
-    static time_t   Now(void)           { return sm_tvNow.tv_sec;           }
-    static int      Year(void)          { return sm_ctNow.tm_year + 1900;   }
-    static int      Month(void)         { return sm_ctNow.tm_mon + 1;       }
-    static int      Day(void)           { return sm_ctNow.tm_mday;          }
-    static int      Hour(void)          { return sm_ctNow.tm_hour;          }
-    static int      Min(void)           { return sm_ctNow.tm_min;           }
-    static int      Sec(void)           { return sm_ctNow.tm_sec;           }
+    static time_t   Now(void)           { return Cache().tvNow.tv_sec;          }
+    static int      Year(void)          { return Cache().ctNow.tm_year + 1900;  }
+    static int      Month(void)         { return Cache().ctNow.tm_mon + 1;      }
+    static int      Day(void)           { return Cache().ctNow.tm_mday;         }
+    static int      Hour(void)          { return Cache().ctNow.tm_hour;         }
+    static int      Min(void)           { return Cache().ctNow.tm_min;          }
+    static int      Sec(void)           { return Cache().ctNow.tm_sec;          }
 
 
 	void Start(void)
     {
-        MfcTimer::Now(&m_tvStart);
+        gettimeofday(&m_tvStart, NULL);
+        m_nStartNs = MonoNs();
     }
 
 	double Stop(void)
 	{
 		gettimeofday(&m_tvStop, NULL);
-        sm_tvNow = m_tvStart;
-        m_nDiff = DiffMicro(m_tvStop, m_tvStart);
-		return (m_dSeconds = (double)m_nDiff / (double)1000000);
+        m_nStopNs = MonoNs();
+        m_nDiff = (m_nStopNs - m_nStartNs) / 1000;
+		return (m_dSeconds = (double)(m_nStopNs - m_nStartNs) / 1000000000.0);
 	}
 
 	double Restart(void)
@@ -122,6 +165,15 @@ public:
 		return dRet;
 	}
 
+    // Time since Start() without stopping the timer
+    uint64_t ElapsedNs(void) const      { return MonoNs() - m_nStartNs;     }
+    uint64_t ElapsedUs(void) const      { return ElapsedNs() / 1000;        }
+    uint64_t ElapsedMs(void) const      { return ElapsedNs() / 1000000;     }
+
+    // Start() to Stop() interval
+    uint64_t Nanos(void) const          { return m_nStopNs - m_nStartNs;    }
+    uint64_t Micros(void) const         { return m_nDiff;                   }
+
     //
     // Static helper functions that can work from any two timevals to calculate elapsed time
     //
@@ -144,16 +196,55 @@ public:
         return (uint64_t)((tvStop.tv_sec - tvStart.tv_sec) * 1000000) + (tvStop.tv_usec - tvStart.tv_usec);
     }
 
+    // returns the number of nanoseconds between two MonoNs()/FastNs() readings, 0 if nStop is earlier
+    static uint64_t DiffNs(uint64_t nStop, uint64_t nStart)
+    {
+        return nStop > nStart ? nStop - nStart : 0;
+    }
+
 
 	double Seconds(void) { return m_dSeconds; }
 
-	struct timeval m_tvStart;
+	struct timeval m_tvStart;           // wall clock at Start()/Stop(), for display
 	struct timeval m_tvStop;
-	uint64_t m_nDiff;
+	uint64_t m_nStartNs;                // MonoNs() at Start()/Stop(), used for the elapsed time
+	uint64_t m_nStopNs;
+	uint64_t m_nDiff;                   // microseconds
 	double m_dSeconds;
 
-    static struct timeval sm_tvNow;
-    static struct tm sm_ctNow;
+private:
+    struct TickCalibration
+    {
+        bool        fTsc;               // invariant TSC found and calibrated
+        double      dNsPerTick;
+        uint64_t    nBaseTicks;
+        uint64_t    nBaseNs;            // MonoNs() when nBaseTicks was read
+    };
+
+    struct TimeCache
+    {
+        struct timeval  tvNow;
+        struct tm       ctNow;
+
+        void Update(void)
+        {
+            gettimeofday(&tvNow, NULL);
+            time_t nNow = (time_t)tvNow.tv_sec;
+#ifdef _WIN32
+            localtime_s(&ctNow, &nNow);
+#else
+            localtime_r(&nNow, &ctNow);
+#endif
+        }
+    };
+
+    static TimeCache& Cache(void)
+    {
+        static thread_local TimeCache s_cache;
+        return s_cache;
+    }
+
+    static const TickCalibration& Calibration(void);
 };
 
 /*
@@ -319,3 +410,5 @@ public:
 };
 
 */
+
+#endif  // MFC_TIMER_H
@@ -0,0 +1,274 @@
+/*
+ * Copyright (c) 2013-2021 MFCXY, Inc. <mfcxy@mfcxy.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef _WIN32
+#include <unistd.h>
+#else
+#include <process.h>
+#endif
+
+#include <stdio.h>
+#include <string.h>
+
+#include <algorithm>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "Compat.h"
+#include "MfcBinLog.h"
+#include "MfcTrace.h"
+
+using std::string;
+
+
+struct MfcTrace::ThreadRing
+{
+    Event                   events[ RING_EVENTS ];
+    std::atomic< uint64_t > nCount;             // events ever recorded, only the owning thread stores it
+    std::atomic< bool >     fOwned;             // a live thread records into this ring
+    uint64_t                nDumpFrom;          // Clear() mark, guarded by s_mutex
+
+    ThreadRing() : nCount(0), fOwned(true), nDumpFrom(0) {}
+};
+
+namespace
+{
+    // Registered rings are never freed. A thread that exits hands its ring back (its
+    // events stay dumpable) and the next new thread picks it up instead of allocating.
+    std::mutex                                          s_mutex;
+    std::vector< std::unique_ptr< MfcTrace::ThreadRing > >* s_pRings = nullptr;
+    std::map< uint32_t, string >*                       s_pNames = nullptr;
+
+    struct RingHolder
+    {
+        MfcTrace::ThreadRing* pRing = nullptr;
+
+        ~RingHolder()
+        {
+            if (pRing)
+                pRing->fOwned.store(false, std::memory_order_release);
+        }
+    };
+
+    thread_local RingHolder s_holder;
+
+    void jsonEscape(string& sOut, const char* psz)
+    {
+        for (; psz && *psz; psz++)
+        {
+            unsigned char ch = (unsigned char)*psz;
+            if (ch == '"' || ch == '\\')
+            {
+                sOut += '\\';
+                sOut += (char)ch;
+            }
+            else if (ch < 0x20)
+            {
+                char szEsc[8];
+                snprintf(szEsc, sizeof(szEsc), "\\u%04x", ch);
+                sOut += szEsc;
+            }
+            else sOut += (char)ch;
+        }
+    }
+}
+
+std::atomic< bool > MfcTrace::sm_fEnabled(false);
+
+
+void MfcTrace::Enable(bool fEnable)
+{
+    sm_fEnabled.store(fEnable, std::memory_order_relaxed);
+}
+
+
+void MfcTrace::Clear(void)
+{
+    std::lock_guard< std::mutex > lk(s_mutex);
+
+    if (s_pRings)
+        for (auto& pRing : *s_pRings)
+            pRing->nDumpFrom = pRing->nCount.load(std::memory_order_acquire);
+}
+
+
+void MfcTrace::SetThreadName(const char* pszName)
+{
+    std::lock_guard< std::mutex > lk(s_mutex);
+
+    if (!s_pNames)
+        s_pNames = new std::map< uint32_t, string >;
+    (*s_pNames)[ MfcBinLog::ThreadId() ] = pszName ? pszName : "";
+}
+
+
+MfcTrace::ThreadRing* MfcTrace::Ring(void)
+{
+    if (s_holder.pRing)
+        return s_holder.pRing;
+
+    std::lock_guard< std::mutex > lk(s_mutex);
+
+    if (!s_pRings)
+        s_pRings = new std::vector< std::unique_ptr< ThreadRing > >;
+
+    for (auto& pRing : *s_pRings)
+    {
+        bool fOwned = false;
+        if (pRing->fOwned.compare_exchange_strong(fOwned, true, std::memory_order_acquire))
+        {
+            s_holder.pRing = pRing.get();
+            return s_holder.pRing;
+        }
+    }
+
+    s_pRings->emplace_back(new ThreadRing);
+    s_holder.pRing = s_pRings->back().get();
+    return s_holder.pRing;
+}
+
+
+void MfcTrace::Record(char chPhase, const char* pszCat, const char* pszName, uint64_t nTsNs, uint64_t nDurNs,
+                      const char* pszArg, int64_t nArg)
+{
+    ThreadRing* pRing = Ring();
+    uint64_t nCount = pRing->nCount.load(std::memory_order_relaxed);
+    Event& ev = pRing->events[ nCount & (RING_EVENTS - 1) ];
+
+    ev.pszName  = pszName;
+    ev.pszCat   = pszCat;
+    ev.pszArg   = pszArg;
+    ev.nTsNs    = nTsNs;
+    ev.nDurNs   = nDurNs;
+    ev.nArg     = nArg;
+    ev.dwTid    = MfcBinLog::ThreadId();
+    ev.chPhase  = chPhase;
+
+    pRing->nCount.store(nCount + 1, std::memory_order_release);
+}
+
+
+size_t MfcTrace::Dump(string& sJson)
+{
+    std::vector< Event > vEvents;
+    std::map< uint32_t, string > names;
+
+    {
+        std::lock_guard< std::mutex > lk(s_mutex);
+
+        if (s_pNames)
+            names = *s_pNames;
+
+        for (size_t n = 0; s_pRings && n < s_pRings->size(); n++)
+        {
+            ThreadRing& ring = *(*s_pRings)[n];
+            uint64_t nEnd = ring.nCount.load(std::memory_order_acquire);
+            uint64_t nBegin = std::max(ring.nDumpFrom, nEnd > RING_EVENTS ? nEnd - RING_EVENTS : 0);
+            size_t nFirst = vEvents.size();
+
+            for (uint64_t i = nBegin; i < nEnd; i++)
+                vEvents.push_back(ring.events[ i & (RING_EVENTS - 1) ]);
+
+            // The owner may have lapped us while copying; anything it could have
+            // overwritten (including the slot it is writing now) is dropped rather
+            // than shown half written.
+            std::atomic_thread_fence(std::memory_order_acquire);
+            uint64_t nNow = ring.nCount.load(std::memory_order_relaxed);
+            if (nNow + 1 > nBegin + RING_EVENTS)
+            {
+                size_t nStale = (size_t)std::min(nEnd - nBegin, nNow + 1 - RING_EVENTS - nBegin);
+                vEvents.erase(vEvents.begin() + nFirst, vEvents.begin() + nFirst + nStale);
+            }
+        }
+    }
+
+    std::sort(vEvents.begin(), vEvents.end(), [](const Event& a, const Event& b) { return a.nTsNs < b.nTsNs; });
+
+#ifdef _WIN32
+    int nPid = _getpid();
+#else
+    int nPid = getpid();
+#endif
+    uint64_t nBaseNs = vEvents.empty() ? 0 : vEvents.front().nTsNs;
+    char szBuf[256];
+
+    sJson.clear();
+    sJson.reserve(vEvents.size() * 128 + 256);
+    sJson += "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+
+    bool fFirst = true;
+    for (const auto& name : names)
+    {
+        snprintf(szBuf, sizeof(szBuf), "%s\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%u,\"args\":{\"name\":\"",
+                 fFirst ? "" : ",", nPid, name.first);
+        sJson += szBuf;
+        jsonEscape(sJson, name.second.c_str());
+        sJson += "\"}}";
+        fFirst = false;
+    }
+
+    for (const Event& ev : vEvents)
+    {
+        sJson += fFirst ? "\n{\"name\":\"" : ",\n{\"name\":\"";
+        jsonEscape(sJson, ev.pszName);
+        sJson += "\",\"cat\":\"";
+        jsonEscape(sJson, ev.pszCat);
+
+        double dTsUs = (double)(ev.nTsNs - nBaseNs) / 1000.0;
+        if (ev.chPhase == 'X')
+            snprintf(szBuf, sizeof(szBuf), "\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":%d,\"tid\":%u",
+                     dTsUs, (double)ev.nDurNs / 1000.0, nPid, ev.dwTid);
+        else
+            snprintf(szBuf, sizeof(szBuf), "\",\"ph\":\"i\",\"s\":\"t\",\"ts\":%.3f,\"pid\":%d,\"tid\":%u",
+                     dTsUs, nPid, ev.dwTid);
+        sJson += szBuf;
+
+        if (ev.pszArg)
+        {
+            sJson += ",\"args\":{\"";
+            jsonEscape(sJson, ev.pszArg);
+            snprintf(szBuf, sizeof(szBuf), "\":%lld}", (long long)ev.nArg);
+            sJson += szBuf;
+        }
+        sJson += "}";
+        fFirst = false;
+    }
+
+    sJson += "\n]}\n";
+    return vEvents.size();
+}
+
+
+bool MfcTrace::Dump(const string& sFile, size_t* pnEvents)
+{
+    string sJson;
+    size_t nEvents = Dump(sJson);
+    bool retVal = false;
+
+    if (pnEvents)
+        *pnEvents = nEvents;
+
+    FILE* pFile = fopen(sFile.c_str(), "wb");
+    if (pFile)
+    {
+        retVal = (fwrite(sJson.data(), 1, sJson.size(), pFile) == sJson.size());
+        retVal = (fclose(pFile) == 0) && retVal;
+    }
+
+    return retVal;
+}
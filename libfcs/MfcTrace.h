@@ -0,0 +1,139 @@
+/*
+ * Copyright (c) 2013-2021 MFCXY, Inc. <mfcxy@mfcxy.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#pragma once
+
+#ifndef MFC_TRACE_H
+#define MFC_TRACE_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#include "MfcTimer.h"
+
+// Scoped spans and instant events for seeing where time goes across threads.
+//
+// Each thread records into its own fixed size ring of events, so recording is a few
+// plain stores and one release store of the ring's count: no locks, no allocation
+// after the thread's first event. Names, categories and arg names must be string
+// literals (only the pointers are kept). Dump() writes everything recorded so far as
+// Chrome Trace Event JSON, which chrome://tracing and ui.perfetto.dev open directly.
+//
+// Tracing is off until Enable(true); while off a span or instant costs one relaxed load.
+//
+//   void CHttpThread::Process()
+//   {
+//       MFC_TRACE_SCOPE("http", "heartbeat");
+//       ...
+//       MFC_TRACE_INSTANT_ARG("http", "wakeup", "cmd", dwCmd);
+//
+class MfcTrace
+{
+public:
+    static const size_t RING_EVENTS         = 4096;     // per thread, must be a power of 2
+
+    struct Event
+    {
+        const char*     pszName;
+        const char*     pszCat;
+        const char*     pszArg;         // arg name, nullptr if the event has no arg
+        uint64_t        nTsNs;          // MfcTimer::FastNs()
+        uint64_t        nDurNs;         // 'X' events only
+        int64_t         nArg;
+        uint32_t        dwTid;
+        char            chPhase;        // 'X' complete span, 'i' instant
+    };
+
+    static bool IsEnabled(void) { return sm_fEnabled.load(std::memory_order_relaxed); }
+
+    // Turning tracing on doesn't clear what was recorded before, use Clear() for that
+    static void Enable(bool fEnable);
+
+    // Drops everything recorded so far (buffers are kept for reuse)
+    static void Clear(void);
+
+    // Shown as the thread's name in the trace viewer
+    static void SetThreadName(const char* pszName);
+
+    static void Instant(const char* pszCat, const char* pszName, const char* pszArg = nullptr, int64_t nArg = 0)
+    {
+        if (IsEnabled())
+            Record('i', pszCat, pszName, MfcTimer::FastNs(), 0, pszArg, nArg);
+    }
+
+    static void Complete(const char* pszCat, const char* pszName, uint64_t nStartNs, uint64_t nEndNs,
+                         const char* pszArg = nullptr, int64_t nArg = 0)
+    {
+        Record('X', pszCat, pszName, nStartNs, MfcTimer::DiffNs(nEndNs, nStartNs), pszArg, nArg);
+    }
+
+    // Trace Event JSON of everything recorded since the last Clear(), returns events written
+    static size_t Dump(std::string& sJson);
+    static bool Dump(const std::string& sFile, size_t* pnEvents = nullptr);
+
+    struct ThreadRing;              // per thread event storage, opaque outside MfcTrace.cpp
+
+private:
+    static void Record(char chPhase, const char* pszCat, const char* pszName, uint64_t nTsNs, uint64_t nDurNs,
+                       const char* pszArg, int64_t nArg);
+    static ThreadRing* Ring(void);
+
+    static std::atomic< bool > sm_fEnabled;
+};
+
+
+// RAII span: records a complete ('X') event from construction to destruction.
+// The decision to record is made once at construction, so a span that started
+// while tracing was on is still recorded if tracing is turned off meanwhile.
+class MfcTraceSpan
+{
+public:
+    MfcTraceSpan(const char* pszCat, const char* pszName)
+        : m_pszCat(pszCat), m_pszName(pszName), m_pszArg(nullptr), m_nArg(0)
+        , m_nStartNs(MfcTrace::IsEnabled() ? MfcTimer::FastNs() : 0)
+    {}
+
+    ~MfcTraceSpan()
+    {
+        if (m_nStartNs)
+            MfcTrace::Complete(m_pszCat, m_pszName, m_nStartNs, MfcTimer::FastNs(), m_pszArg, m_nArg);
+    }
+
+    // Attaches one named value to the span, e.g. the result of the traced call
+    void SetArg(const char* pszArg, int64_t nArg) { m_pszArg = pszArg; m_nArg = nArg; }
+
+    MfcTraceSpan(const MfcTraceSpan&) = delete;
+    MfcTraceSpan& operator=(const MfcTraceSpan&) = delete;
+
+private:
+    const char*     m_pszCat;
+    const char*     m_pszName;
+    const char*     m_pszArg;
+    int64_t         m_nArg;
+    uint64_t        m_nStartNs;
+};
+
+#define MFC_TRACE_CONCAT2(a, b)                         a##b
+#define MFC_TRACE_CONCAT(a, b)                          MFC_TRACE_CONCAT2(a, b)
+
+#define MFC_TRACE_SCOPE(pszCat, pszName)                MfcTraceSpan MFC_TRACE_CONCAT(_mfcTraceSpan, __LINE__)(pszCat, pszName)
+#define MFC_TRACE_SPAN(var, pszCat, pszName)            MfcTraceSpan var(pszCat, pszName)
+#define MFC_TRACE_INSTANT(pszCat, pszName)              MfcTrace::Instant(pszCat, pszName)
+#define MFC_TRACE_INSTANT_ARG(pszCat, pszName, pszArg, nArg) \
+    do { if (MfcTrace::IsEnabled()) MfcTrace::Instant(pszCat, pszName, pszArg, (int64_t)(nArg)); } while (0)
+
+#endif // MFC_TRACE_H
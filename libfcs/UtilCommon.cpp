@@ -38,9 +38,6 @@
 #include "MfcTimer.h"
 #include "Log.h"
 
-// The initialization/definition of static shared global timeval cache
-struct timeval      MfcTimer::sm_tvNow;
-struct tm           MfcTimer::sm_ctNow;
 /*set< ProfTimer* >   ProfTimer::sm_stActiveObjs;
 size_t              ProfTimer::sm_nUnalignedOverlaps = 0;
 size_t              ProfTimer::sm_nOverlaps = 0;*/
@@ -0,0 +1,38 @@
+/*
+ * Copyright (c) 2013-2021 MFCXY, Inc. <mfcxy@mfcxy.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+// The _TRACE loop of logbench -filter built with trace sites compiled out, the way a
+// target built with MFC_LOG_COMPILED_LEVEL=5 has them.
+
+#define MFC_LOG_COMPILED_LEVEL      5
+
+#include <string>
+
+#include <libfcs/Log.h>
+
+extern volatile int g_nSink;
+
+
+void traceCompiledOut(int nIters, const char* pszArg)
+{
+    (void)pszArg;   // only used by the compiled out site
+
+    for (int n = 0; n < nIters; n++)
+    {
+        g_nSink = n;
+        _TRACE("site %d %s", n, std::string(pszArg).c_str());
+    }
+}
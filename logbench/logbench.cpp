@@ -0,0 +1,341 @@
+/*
+ * Copyright (c) 2013-2021 MFCXY, Inc. <mfcxy@mfcxy.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+// logbench: what a log call costs the thread making it, with MfcLog writing on the
+// caller's thread (sync) and through the MfcLogWriter ring (async).
+//
+//   logbench [-n calls] [-t threads] [-s bytes] [-gap us] [-d dir]
+//   logbench -filter [-n calls]
+//
+//   -n calls   _TRACE calls per thread and run, after WARMUP untimed ones (default 100000,
+//              FILTER_CALLS with -filter)
+//   -t threads producer threads of the second run of each mode, 1 for a single run (default 4)
+//   -s bytes   payload per line, on top of the stamp and marker (default 60)
+//   -gap us    pause between calls, 0 for a saturating burst (default 0)
+//   -d dir     where the trace log goes (default the system temp dir), removed afterwards
+//
+// Output is the trace log file only, no stdout, the way the plugin logs. Every call is
+// timed on its own with MfcTimer::FastNs(), the table shows the distribution over all
+// threads. Async runs end with Flush() (not timed) and show what the writer queued,
+// wrote and dropped during the run, warmup calls included.
+//
+// -filter times sites that don't log instead: a loop of _TRACE calls whose argument
+// builds a FILTER_ARG_BYTES std::string, with the module's level below TRACE, with
+// _BTRACE, with TRACE enabled but no outputs set, and built with the sites compiled
+// out (compiledout.cpp). An empty loop is the baseline. The string is only built when
+// the level check lets the call through.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <libfcs/Log.h>
+#include <libfcs/MfcTimer.h>
+
+#ifdef _WIN32
+char* __progname = "logbench";
+#else
+const char* __progname = "logbench";
+#endif
+
+static const char*  PROGNAME        = "logbench";
+static const int    WARMUP          = 1000;
+static const int    FILTER_CALLS    = 50000000;
+static const size_t FILTER_ARG_BYTES = 100;
+
+volatile int        g_nSink         = 0;
+
+void traceCompiledOut(int nIters, const char* pszArg);
+
+
+struct RunResult
+{
+    std::vector< int64_t >  vNs;            // every timed call, all threads
+    double                  dWallMs;
+    MfcLogWriter::Stats     writer;         // deltas over the run, async only
+};
+
+
+static int usage(void)
+{
+    fprintf(stderr, "usage: %s [-n calls] [-t threads] [-s bytes] [-gap us] [-d dir]\n"
+                    "       %s -filter [-n calls]\n", PROGNAME, PROGNAME);
+    return 2;
+}
+
+
+static MfcLogWriter::Stats writerStats(void)
+{
+    MfcLogWriter::Stats stats;
+    if (!Log::GetAsyncStats(stats))
+        memset(&stats, 0, sizeof(stats));
+    return stats;
+}
+
+
+static RunResult runCalls(int nThreads, int nCalls, int nGapUs, const std::string& sPayload)
+{
+    RunResult res;
+    std::vector< std::vector< int64_t > > vThreadNs(nThreads);
+    std::vector< std::thread > vThreads;
+    std::atomic< int > nReady(0);
+    std::atomic< bool > fGo(false);
+
+    MfcLogWriter::Stats before = writerStats();
+
+    for (int t = 0; t < nThreads; t++)
+    {
+        vThreads.emplace_back([&, t]()
+        {
+            std::vector< int64_t >& vNs = vThreadNs[t];
+            vNs.reserve(nCalls);
+
+            for (int n = 0; n < WARMUP; n++)
+                _TRACE("warmup %d %s", n, sPayload.c_str());
+
+            nReady++;
+            while (!fGo.load(std::memory_order_acquire))
+                std::this_thread::yield();
+
+            for (int n = 0; n < nCalls; n++)
+            {
+                uint64_t qwStart = MfcTimer::FastNs();
+                _TRACE("call %d %s", n, sPayload.c_str());
+                vNs.push_back((int64_t)(MfcTimer::FastNs() - qwStart));
+
+                if (nGapUs > 0)
+                    std::this_thread::sleep_for(std::chrono::microseconds(nGapUs));
+            }
+        });
+    }
+
+    while (nReady.load() < nThreads)
+        std::this_thread::yield();
+
+    uint64_t qwStart = MfcTimer::MonoNs();
+    fGo.store(true, std::memory_order_release);
+    for (std::thread& thread : vThreads)
+        thread.join();
+    res.dWallMs = (double)(MfcTimer::MonoNs() - qwStart) / 1e6;
+
+    Log::Flush();
+
+    MfcLogWriter::Stats after = writerStats();
+    res.writer.queued       = after.queued - before.queued;
+    res.writer.written      = after.written - before.written;
+    res.writer.dropped      = after.dropped - before.dropped;
+    res.writer.truncated    = after.truncated - before.truncated;
+    res.writer.batches      = after.batches - before.batches;
+
+    for (std::vector< int64_t >& vNs : vThreadNs)
+        res.vNs.insert(res.vNs.end(), vNs.begin(), vNs.end());
+    std::sort(res.vNs.begin(), res.vNs.end());
+    return res;
+}
+
+
+static int64_t pct(const std::vector< int64_t >& v, double d)
+{
+    return v.empty() ? 0 : v[std::min(v.size() - 1, (size_t)(d * (double)v.size()))];
+}
+
+
+static void printRow(const char* pszMode, int nThreads, const RunResult& res, bool fAsync)
+{
+    int64_t nSum = 0;
+    for (int64_t n : res.vNs)
+        nSum += n;
+
+    printf("%-6s %7d %9lld %8lld %8lld %9lld %9.1f",
+           pszMode, nThreads,
+           (long long)(res.vNs.empty() ? 0 : nSum / (int64_t)res.vNs.size()),
+           (long long)pct(res.vNs, 0.50), (long long)pct(res.vNs, 0.99),
+           (long long)(res.vNs.empty() ? 0 : res.vNs.back()), res.dWallMs);
+
+    if (fAsync)
+        printf("   queued %llu written %llu dropped %llu batches %llu",
+               (unsigned long long)res.writer.queued, (unsigned long long)res.writer.written,
+               (unsigned long long)res.writer.dropped, (unsigned long long)res.writer.batches);
+    printf("\n");
+}
+
+
+enum FilterCase
+{
+    FC_EMPTY        = 0,
+    FC_TRACE,
+    FC_BTRACE,
+    FC_TRACE_NOOUT,
+    FC_COMPILED_OUT,
+    MAX_FILTERCASE
+};
+
+
+static void filterLoop(FilterCase nCase, int nIters, const char* pszArg)
+{
+    switch (nCase)
+    {
+        case FC_EMPTY:
+            for (int n = 0; n < nIters; n++)
+                g_nSink = n;
+            break;
+
+        case FC_TRACE:
+        case FC_TRACE_NOOUT:
+            for (int n = 0; n < nIters; n++)
+            {
+                g_nSink = n;
+                _TRACE("site %d %s", n, std::string(pszArg).c_str());
+            }
+            break;
+
+        case FC_BTRACE:
+            for (int n = 0; n < nIters; n++)
+            {
+                g_nSink = n;
+                _BTRACE("site %d %s", n, std::string(pszArg).c_str());
+            }
+            break;
+
+        case FC_COMPILED_OUT:
+            traceCompiledOut(nIters, pszArg);
+            break;
+
+        default:
+            break;
+    }
+}
+
+
+static int runFilter(int nIters)
+{
+    static const char* s_pszCases[ MAX_FILTERCASE ] =
+    {
+        "empty loop",
+        "_TRACE, level NOTICE",
+        "_BTRACE, level NOTICE",
+        "_TRACE, no outputs",
+        "_TRACE, compiled out",
+    };
+    std::string sArg(FILTER_ARG_BYTES, 'x');
+
+    Log::Setup("");
+    for (int n = 0; n < ILog::MAX_LOGLEVEL; n++)
+        Log::SetOutputMask((ILog::LogLevel)n, ILog::OF_NONE);
+
+    printf("%d calls, %d byte argument\n\n", nIters, (int)FILTER_ARG_BYTES);
+    printf("%-24s %10s\n", "site", "ns/call");
+
+    for (int nCase = 0; nCase < MAX_FILTERCASE; nCase++)
+    {
+        Log::SetTagLevel(Log::LT_DEFAULT, nCase == FC_TRACE_NOOUT ? ILog::TRACE : ILog::NOTICE);
+
+        // the no outputs case goes all the way through TraceMarker(), a tenth is plenty
+        int nCaseIters = nCase == FC_TRACE_NOOUT ? std::max(nIters / 10, 1) : nIters;
+
+        uint64_t qwStart = MfcTimer::MonoNs();
+        filterLoop((FilterCase)nCase, nCaseIters, sArg.c_str());
+        double dNs = (double)(MfcTimer::MonoNs() - qwStart) / (double)nCaseIters;
+
+        printf("%-24s %10.2f\n", s_pszCases[nCase], dNs);
+    }
+
+    Log::SetTagLevel(Log::LT_DEFAULT, ILog::TRACE);
+    return 0;
+}
+
+
+int main(int argc, char* argv[])
+{
+    int nCalls = 0, nThreads = 4, nBytes = 60, nGapUs = 0;
+    bool fFilter = false;
+    std::string sDir;
+
+    for (int n = 1; n < argc; n++)
+    {
+        const char* psz = argv[n];
+        const char* pszVal = n + 1 < argc ? argv[n + 1] : nullptr;
+
+        if (strcmp(psz, "-filter") == 0)
+            fFilter = true;
+        else if (!pszVal)
+            return usage();
+        else if (strcmp(psz, "-n") == 0)
+            nCalls = atoi(argv[++n]);
+        else if (strcmp(psz, "-t") == 0)
+            nThreads = atoi(argv[++n]);
+        else if (strcmp(psz, "-s") == 0)
+            nBytes = atoi(argv[++n]);
+        else if (strcmp(psz, "-gap") == 0)
+            nGapUs = atoi(argv[++n]);
+        else if (strcmp(psz, "-d") == 0)
+            sDir = argv[++n];
+        else
+            return usage();
+    }
+
+    if (nCalls == 0)
+        nCalls = fFilter ? FILTER_CALLS : 100000;
+
+    if (nCalls < 1 || nThreads < 1 || nBytes < 0 || nGapUs < 0)
+        return usage();
+
+    if (fFilter)
+        return runFilter(nCalls);
+
+    if (sDir.empty())
+    {
+#ifdef _WIN32
+        const char* pszTmp = getenv("TEMP");
+#else
+        const char* pszTmp = getenv("TMPDIR");
+#endif
+        sDir = pszTmp && *pszTmp ? pszTmp : "/tmp";
+    }
+
+    Log::Setup(sDir);
+    Log::SetLog(ILog::LC_TRACE, "trace_logbench.log", true);
+    for (int n = 0; n < ILog::MAX_LOGLEVEL; n++)
+        Log::SetOutputMask((ILog::LogLevel)n, ILog::OF_FILE);
+
+    std::string sPayload((size_t)nBytes, 'x');
+    std::vector< int > vThreadCounts = { 1 };
+    if (nThreads > 1)
+        vThreadCounts.push_back(nThreads);
+
+    printf("%d calls per thread, %d byte payload, gap %d us, %s clock\n\n",
+           nCalls, nBytes, nGapUs, MfcTimer::HasFastClock() ? "TSC" : "monotonic");
+    printf("mode   threads    avg ns   p50 ns   p99 ns    max ns   wall ms\n");
+
+    for (int nAsync = 0; nAsync < 2; nAsync++)
+    {
+        Log::SetAsync(nAsync != 0);
+        for (int nCount : vThreadCounts)
+            printRow(nAsync ? "async" : "sync", nCount, runCalls(nCount, nCalls, nGapUs, sPayload), nAsync != 0);
+    }
+
+    Log::SetAsync(false);
+    Log::Flush();
+    Log::SetLog(ILog::LC_TRACE, "trace_logbench.log", true);
+    return 0;
+}